@@ -25,16 +25,55 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <getopt.h>
 
 #include "common.h"
 #include "version.h"
 
-int debug_level;
+enum {
+	OPT_METRICS_SHM = 0x100,
+	OPT_METRICS_SOCKET,
+	OPT_CAPS_CACHE,
+	OPT_SINK,
+	OPT_ROTATOR_BENCH,
+	OPT_ROTATOR,
+	OPT_ROTATOR_DEPTH,
+	OPT_ROTATOR_CROP,
+	OPT_ROTATOR_SIZE,
+	OPT_ROTATOR_FORMAT,
+	OPT_UBWC_THREADS,
+	OPT_UBWC_VERIFY,
+	OPT_VERIFY,
+	OPT_VERIFY_REFERENCE,
+	OPT_DECIMATE,
+};
+
+static const struct option long_options[] = {
+	{ "metrics-shm",	required_argument, NULL, OPT_METRICS_SHM },
+	{ "metrics-socket",	required_argument, NULL, OPT_METRICS_SOCKET },
+	{ "caps-cache",		required_argument, NULL, OPT_CAPS_CACHE },
+	{ "sink",		required_argument, NULL, OPT_SINK },
+	{ "rotator",		required_argument, NULL, OPT_ROTATOR },
+	{ "rotator-depth",	required_argument, NULL, OPT_ROTATOR_DEPTH },
+	{ "rotator-bench",	required_argument, NULL, OPT_ROTATOR_BENCH },
+	{ "rotator-crop",	required_argument, NULL, OPT_ROTATOR_CROP },
+	{ "rotator-size",	required_argument, NULL, OPT_ROTATOR_SIZE },
+	{ "rotator-format",	required_argument, NULL, OPT_ROTATOR_FORMAT },
+	{ "ubwc-threads",	required_argument, NULL, OPT_UBWC_THREADS },
+	{ "ubwc-verify",	no_argument,	   NULL, OPT_UBWC_VERIFY },
+	{ "verify",		required_argument, NULL, OPT_VERIFY },
+	{ "verify-reference",	required_argument, NULL, OPT_VERIFY_REFERENCE },
+	{ "decimate",		required_argument, NULL, OPT_DECIMATE },
+	{ "help",		no_argument,	   NULL, 'h' },
+	{ NULL, 0, NULL, 0 }
+};
 
 void print_usage(char *name)
 {
 	fprintf(stderr, "v4l2_decode version " VERSION " date " DATE "\n\n");
-	fprintf(stderr, "usage: %s [OPTS] <URL>\n", name);
+	fprintf(stderr, "usage: %s [OPTS] <URL>...\n", name);
+	fprintf(stderr, "Several URLs are decoded at once, in sessions of "
+		"their own (see wayland:mosaic)\n");
 	fprintf(stderr, "Where OPTS is a combination of:\n"
 	        "  -m <device>     video device (default /dev/video32)\n"
 	        "  -c              set \"continue data transfer\" flag\n"
@@ -45,6 +84,61 @@ void print_usage(char *name)
 	        "  -s              secure mode\n"
 	        "  -v              increase debug verbosity\n"
 	        "  -q              remove all debug output\n"
+	        "  --metrics-shm=<name>\n"
+	        "                  publish metrics in shared memory <name>\n"
+	        "                  (e.g. /v4l2_decode, see metrics.h)\n"
+	        "  --metrics-socket=<path>\n"
+	        "                  serve metrics as text on unix socket <path>\n"
+	        "  --decimate=<key[:<n>]|ref>\n"
+	        "                  only submit the key frames, every n-th\n"
+	        "                  of them, or the reference frames\n"
+	        "  --sink=<sink>[,<sink>...]\n"
+	        "                  where decoded frames go, several at once\n"
+	        "                  (default null): null, file:<path>,\n"
+	        "                  dump:<path>[:direct][:buffers=<n>][:resume],\n"
+	        "                  shm:<socket>[:<slots>] (see client/)\n"
+	        "                  or wayland[:mailbox][:mosaic], mosaic\n"
+	        "                  shows every session in a pane of one\n"
+	        "                  window\n"
+	        "  --rotator=<device|sw|none>\n"
+	        "                  rotator device (default /dev/video2, sw\n"
+	        "                  when it is missing), sw for the CPU,\n"
+	        "                  which crops and scales the linear NV12\n"
+	        "                  the decoder then gives, none\n"
+	        "                  hands the UBWC frames of the decoder to\n"
+	        "                  the sinks\n"
+	        "                  (default when they all take them, as\n"
+	        "                  wayland does if the compositor has the\n"
+	        "                  UBWC modifier)\n"
+	        "  --rotator-depth=<n>\n"
+	        "                  frames in flight in the rotator\n"
+	        "  --rotator-bench=<n>\n"
+	        "                  convert the first frame n times with a\n"
+	        "                  one-shot and with the persistent rotator\n"
+	        "                  session and compare the latencies\n"
+	        "  --rotator-crop=<w>x<h>[+<x>+<y>]\n"
+	        "                  only convert this part of the frames\n"
+	        "                  (default the decoder crop)\n"
+	        "  --rotator-size=<w>x<h>\n"
+	        "                  scale the converted frames to this size\n"
+	        "  --rotator-format=<nv12|grey>\n"
+	        "                  converted frames format, grey is luma only\n"
+	        "  --ubwc-threads=<n>\n"
+	        "                  threads of the CPU UBWC detiler of\n"
+	        "                  --ubwc-verify (default one per CPU)\n"
+	        "  --ubwc-verify\n"
+	        "                  compare each rotator frame with the CPU\n"
+	        "                  detiler and report the differences\n"
+	        "  --verify=<list>\n"
+	        "                  hash every frame and compare with the\n"
+	        "                  reference list, report the first frame\n"
+	        "                  that differs; not with --rotator=none\n"
+	        "  --verify-reference=<list>\n"
+	        "                  decode the stream with libavcodec and\n"
+	        "                  write the reference list for --verify\n"
+	        "  --caps-cache=<file|none>\n"
+	        "                  device capability cache (default in\n"
+	        "                  $XDG_CACHE_HOME/v4l2_decode)\n"
 		"\n");
 }
 
@@ -58,7 +152,8 @@ int parse_args(struct instance *i, int argc, char **argv)
 
 	debug_level = 2;
 
-	while ((c = getopt(argc, argv, "cdfhim:o:pqsv")) != -1) {
+	while ((c = getopt_long(argc, argv, "cdfhim:o:pqsv",
+				long_options, NULL)) != -1) {
 		switch (c) {
 		case 'c':
 			i->continue_data_transfer = 1;
@@ -87,6 +182,73 @@ int parse_args(struct instance *i, int argc, char **argv)
 		case 'v':
 			debug_level++;
 			break;
+		case OPT_METRICS_SHM:
+			i->metrics_shm = optarg;
+			break;
+		case OPT_METRICS_SOCKET:
+			i->metrics_sock = optarg;
+			break;
+		case OPT_CAPS_CACHE:
+			i->caps_path = optarg;
+			break;
+		case OPT_ROTATOR:
+			i->rotator_name = optarg;
+			break;
+		case OPT_ROTATOR_DEPTH:
+			i->rotator_depth = atoi(optarg);
+			break;
+		case OPT_ROTATOR_BENCH:
+			i->rotator_bench = atoi(optarg);
+			break;
+		case OPT_ROTATOR_CROP: {
+			struct v4l2_rect *c = &i->rotator_crop;
+
+			c->left = c->top = 0;
+			if (sscanf(optarg, "%ux%u+%d+%d", &c->width, &c->height,
+				   &c->left, &c->top) < 2 ||
+			    !c->width || !c->height) {
+				err("invalid crop %s", optarg);
+				return -1;
+			}
+			break;
+		}
+		case OPT_ROTATOR_SIZE:
+			if (sscanf(optarg, "%dx%d", &i->rotator_width,
+				   &i->rotator_height) != 2 ||
+			    i->rotator_width <= 0 || i->rotator_height <= 0) {
+				err("invalid size %s", optarg);
+				return -1;
+			}
+			break;
+		case OPT_ROTATOR_FORMAT:
+			if (!strcmp(optarg, "nv12")) {
+				i->rotator_fourcc = V4L2_PIX_FMT_NV12;
+			} else if (!strcmp(optarg, "grey")) {
+				i->rotator_fourcc = V4L2_PIX_FMT_GREY;
+			} else {
+				err("unknown format %s", optarg);
+				return -1;
+			}
+			break;
+		case OPT_UBWC_THREADS:
+			i->ubwc_threads = atoi(optarg);
+			break;
+		case OPT_UBWC_VERIFY:
+			i->ubwc_verify = 1;
+			break;
+		case OPT_SINK:
+			i->sink_list = optarg;
+			break;
+		case OPT_VERIFY:
+			i->verify_path = optarg;
+			break;
+		case OPT_VERIFY_REFERENCE:
+			i->verify_reference = optarg;
+			break;
+		case OPT_DECIMATE:
+			if (decimate_parse(&i->decimate, optarg))
+				return -1;
+			break;
 		default:
 			err("bad argument\n");
 		case 'h':
@@ -99,7 +261,21 @@ int parse_args(struct instance *i, int argc, char **argv)
 		return -1;
 	}
 
+	/* one reference list, for one stream */
+	if ((i->verify_path || i->verify_reference) && argc - optind > 1) {
+		err("--verify and --verify-reference take a single url\n");
+		return -1;
+	}
+
+	/* the reference has every frame in display order */
+	if (i->verify_path && (i->decode_order || i->skip_frames)) {
+		err("--verify needs every frame, without -d or -i\n");
+		return -1;
+	}
+
 	i->url = argv[optind];
+	i->urls = &argv[optind];
+	i->n_urls = argc - optind;
 
 	return 0;
 }
@@ -0,0 +1,316 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Device capability cache
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#include "common.h"
+
+#define DBG_TAG "  caps"
+
+static void
+caps_sanitize(char *dst, size_t size, const uint8_t *src)
+{
+	size_t n;
+
+	for (n = 0; n < size - 1 && src[n]; n++)
+		dst[n] = isalnum(src[n]) ? src[n] : '_';
+
+	dst[n] = '\0';
+}
+
+char *
+caps_default_path(const struct v4l2_capability *cap)
+{
+	const char *base = getenv("XDG_CACHE_HOME");
+	char driver[sizeof (cap->driver) + 1];
+	char card[sizeof (cap->card) + 1];
+	char dir[256];
+	char *path;
+	size_t size;
+
+	if (base && *base) {
+		snprintf(dir, sizeof (dir), "%s/v4l2_decode", base);
+	} else {
+		base = getenv("HOME");
+		if (!base || !*base)
+			base = "/tmp";
+		snprintf(dir, sizeof (dir), "%s/.cache/v4l2_decode", base);
+	}
+
+	/* create both levels, failures show up when saving */
+	*strrchr(dir, '/') = '\0';
+	mkdir(dir, 0755);
+	dir[strlen(dir)] = '/';
+	mkdir(dir, 0755);
+
+	caps_sanitize(driver, sizeof (driver), cap->driver);
+	caps_sanitize(card, sizeof (card), cap->card);
+
+	size = strlen(dir) + strlen(driver) + strlen(card) + 32;
+	path = malloc(size);
+	if (!path)
+		return NULL;
+
+	snprintf(path, size, "%s/%s-%s-%u.caps", dir, driver, card,
+		 cap->version);
+
+	return path;
+}
+
+int
+caps_load(struct video_caps *caps, const char *path,
+	  const struct v4l2_capability *cap)
+{
+	char line[256];
+	int version = 0;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+
+	memset(caps, 0, sizeof (*caps));
+	caps->ext_ctrls = -1;
+
+	while (fgets(line, sizeof (line), f)) {
+		struct video_fmt_caps *fmt;
+		char *value;
+
+		line[strcspn(line, "\n")] = '\0';
+
+		if (line[0] == '#' || !line[0])
+			continue;
+
+		value = strchr(line, ' ');
+		if (!value)
+			goto invalid;
+		*value++ = '\0';
+
+		if (!strcmp(line, "version")) {
+			version = atoi(value);
+		} else if (!strcmp(line, "driver")) {
+			snprintf(caps->driver, sizeof (caps->driver), "%s",
+				 value);
+		} else if (!strcmp(line, "card")) {
+			snprintf(caps->card, sizeof (caps->card), "%s", value);
+		} else if (!strcmp(line, "kernel")) {
+			caps->version = strtoul(value, NULL, 0);
+		} else if (!strcmp(line, "capabilities")) {
+			caps->capabilities = strtoul(value, NULL, 0);
+		} else if (!strcmp(line, "ext_ctrls")) {
+			caps->ext_ctrls = atoi(value);
+		} else if (!strcmp(line, "fmt")) {
+			if (caps->nfmts == CAPS_MAX_FMTS)
+				goto invalid;
+
+			fmt = &caps->fmt[caps->nfmts++];
+			if (sscanf(value, "%u %x %u %u %u %u %u %u %u",
+				   &fmt->type, &fmt->pixelformat,
+				   &fmt->frmsize_type,
+				   &fmt->min_width, &fmt->min_height,
+				   &fmt->max_width, &fmt->max_height,
+				   &fmt->step_width, &fmt->step_height) != 9)
+				goto invalid;
+		}
+	}
+
+	fclose(f);
+
+	if (version != CAPS_VERSION ||
+	    strncmp(caps->driver, (char *)cap->driver, sizeof (caps->driver)) ||
+	    strncmp(caps->card, (char *)cap->card, sizeof (caps->card)) ||
+	    caps->version != cap->version ||
+	    caps->capabilities != cap->capabilities ||
+	    !caps->nfmts) {
+		dbg("cache %s is stale", path);
+		return -1;
+	}
+
+	return 0;
+
+invalid:
+	fclose(f);
+	err("invalid capability cache %s", path);
+	return -1;
+}
+
+int
+caps_save(struct video_caps *caps, const char *path)
+{
+	char tmp[PATH_MAX];
+	FILE *f;
+
+	if (!caps->dirty)
+		return 0;
+
+	snprintf(tmp, sizeof (tmp), "%s.%d", path, getpid());
+
+	f = fopen(tmp, "w");
+	if (!f) {
+		dbg("cannot write %s: %m", tmp);
+		return -1;
+	}
+
+	fprintf(f, "# v4l2_decode capability cache\n"
+		"version %d\n"
+		"driver %s\n"
+		"card %s\n"
+		"kernel %u\n"
+		"capabilities 0x%08x\n"
+		"ext_ctrls %d\n",
+		CAPS_VERSION, caps->driver, caps->card, caps->version,
+		caps->capabilities, caps->ext_ctrls);
+
+	for (int n = 0; n < caps->nfmts; n++) {
+		const struct video_fmt_caps *fmt = &caps->fmt[n];
+
+		fprintf(f, "fmt %u %08x %u %u %u %u %u %u %u\n",
+			fmt->type, fmt->pixelformat, fmt->frmsize_type,
+			fmt->min_width, fmt->min_height,
+			fmt->max_width, fmt->max_height,
+			fmt->step_width, fmt->step_height);
+	}
+
+	/* replace atomically so a concurrent start never reads half */
+	if (fclose(f) || rename(tmp, path) < 0) {
+		dbg("cannot write %s: %m", path);
+		unlink(tmp);
+		return -1;
+	}
+
+	caps->dirty = 0;
+
+	dbg("capabilities cached in %s", path);
+
+	return 0;
+}
+
+static void
+caps_probe_type(struct video_caps *caps, int fd, enum v4l2_buf_type type)
+{
+	struct v4l2_fmtdesc fdesc;
+	struct v4l2_frmsizeenum frmsize;
+
+	memzero(fdesc);
+	fdesc.type = type;
+
+	while (caps->nfmts < CAPS_MAX_FMTS &&
+	       !ioctl(fd, VIDIOC_ENUM_FMT, &fdesc)) {
+		struct video_fmt_caps *fmt = &caps->fmt[caps->nfmts++];
+
+		memset(fmt, 0, sizeof (*fmt));
+		fmt->type = type;
+		fmt->pixelformat = fdesc.pixelformat;
+
+		memzero(frmsize);
+		frmsize.pixel_format = fdesc.pixelformat;
+
+		while (!ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &frmsize)) {
+			if (frmsize.type != V4L2_FRMSIZE_TYPE_DISCRETE) {
+				fmt->frmsize_type = frmsize.type;
+				fmt->min_width = frmsize.stepwise.min_width;
+				fmt->min_height = frmsize.stepwise.min_height;
+				fmt->max_width = frmsize.stepwise.max_width;
+				fmt->max_height = frmsize.stepwise.max_height;
+				fmt->step_width = frmsize.stepwise.step_width;
+				fmt->step_height = frmsize.stepwise.step_height;
+				break;
+			}
+
+			/* keep the bounding range of discrete sizes */
+			if (!fmt->frmsize_type ||
+			    frmsize.discrete.width < fmt->min_width)
+				fmt->min_width = frmsize.discrete.width;
+			if (!fmt->frmsize_type ||
+			    frmsize.discrete.height < fmt->min_height)
+				fmt->min_height = frmsize.discrete.height;
+			fmt->max_width = MAX(fmt->max_width,
+					     frmsize.discrete.width);
+			fmt->max_height = MAX(fmt->max_height,
+					      frmsize.discrete.height);
+			fmt->frmsize_type = V4L2_FRMSIZE_TYPE_DISCRETE;
+
+			frmsize.index++;
+		}
+
+		fdesc.index++;
+	}
+}
+
+int
+caps_probe(struct video_caps *caps, int fd, const struct v4l2_capability *cap)
+{
+	memset(caps, 0, sizeof (*caps));
+
+	snprintf(caps->driver, sizeof (caps->driver), "%s", (char *)cap->driver);
+	snprintf(caps->card, sizeof (caps->card), "%s", (char *)cap->card);
+	caps->version = cap->version;
+	caps->capabilities = cap->capabilities;
+	caps->ext_ctrls = -1;
+
+	caps_probe_type(caps, fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE);
+	caps_probe_type(caps, fd, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
+
+	caps->dirty = 1;
+
+	return caps->nfmts ? 0 : -1;
+}
+
+void
+caps_dump(const struct video_caps *caps)
+{
+	uint32_t type = 0;
+
+	for (int n = 0; n < caps->nfmts; n++) {
+		const struct video_fmt_caps *fmt = &caps->fmt[n];
+		uint32_t f = fmt->pixelformat;
+
+		if (fmt->type != type) {
+			type = fmt->type;
+			dbg("%s formats:", V4L2_TYPE_IS_OUTPUT(type) ?
+			    "OUTPUT" : "CAPTURE");
+		}
+
+		dbg("  %c%c%c%c  %ux%u to %ux%u, step %+d%+d",
+		    f & 0xff, (f >> 8) & 0xff, (f >> 16) & 0xff, f >> 24,
+		    fmt->min_width, fmt->min_height,
+		    fmt->max_width, fmt->max_height,
+		    fmt->step_width, fmt->step_height);
+	}
+}
+
+const struct video_fmt_caps *
+caps_find(const struct video_caps *caps, enum v4l2_buf_type type,
+	  uint32_t pixelformat)
+{
+	for (int n = 0; n < caps->nfmts; n++) {
+		if (caps->fmt[n].type == type &&
+		    caps->fmt[n].pixelformat == pixelformat)
+			return &caps->fmt[n];
+	}
+
+	return NULL;
+}
@@ -0,0 +1,85 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Device capability cache header file
+ *
+ * Enumerating the formats and frame sizes of the decoder costs a few
+ * dozen ioctls at every start.  The result only changes with the
+ * driver, so it is kept in a small text file keyed by the driver, card
+ * and version reported by VIDIOC_QUERYCAP, together with what we
+ * learned about the driver at runtime (e.g. whether S_EXT_CTRLS works).
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef INCLUDE_CAPS_H
+#define INCLUDE_CAPS_H
+
+#include <stdint.h>
+#include <linux/videodev2.h>
+
+#define CAPS_VERSION		1
+
+/* Maximum number of formats remembered for both queues */
+#define CAPS_MAX_FMTS		48
+
+struct video_fmt_caps {
+	uint32_t type;			/* enum v4l2_buf_type */
+	uint32_t pixelformat;
+	uint32_t frmsize_type;		/* 0 when no frame sizes reported */
+	uint32_t min_width;
+	uint32_t min_height;
+	uint32_t max_width;
+	uint32_t max_height;
+	uint32_t step_width;
+	uint32_t step_height;
+};
+
+struct video_caps {
+	char driver[16];
+	char card[32];
+	uint32_t version;
+	uint32_t capabilities;
+
+	/* 1 if batched S_EXT_CTRLS works, 0 if not, -1 if not known yet */
+	int ext_ctrls;
+
+	int nfmts;
+	struct video_fmt_caps fmt[CAPS_MAX_FMTS];
+
+	/* needs to be written back */
+	int dirty;
+};
+
+/* Default cache file for the device, caller frees the string */
+char *caps_default_path(const struct v4l2_capability *cap);
+
+/* Load the cache, fails if missing, corrupted or for another driver */
+int caps_load(struct video_caps *caps, const char *path,
+	      const struct v4l2_capability *cap);
+
+/* Write the cache, if it was modified */
+int caps_save(struct video_caps *caps, const char *path);
+
+/* Enumerate formats and frame sizes of both queues */
+int caps_probe(struct video_caps *caps, int fd,
+	       const struct v4l2_capability *cap);
+
+void caps_dump(const struct video_caps *caps);
+
+const struct video_fmt_caps *caps_find(const struct video_caps *caps,
+				       enum v4l2_buf_type type,
+				       uint32_t pixelformat);
+
+#endif /* INCLUDE_CAPS_H */
@@ -0,0 +1,218 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Frame archive random access benchmark
+ *
+ * Reads frames of a v4l2_decode --sink=dump:<path> file in random order
+ * and reports the latency of getting a frame in memory and the
+ * bandwidth:
+ *
+ *	dump_bench [-n <frames>] [-c] [-v] <path>
+ *
+ * -c drops the file from the page cache first and reads every frame at
+ * most once, the latency is then the one of the storage.  -v also
+ * verifies the check of every frame read.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dump_file.h"
+
+/* keeps the reads of the frames */
+static volatile uint64_t sink;
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Touch every page of the planes, what a consumer reading them costs */
+static uint64_t read_frame(const struct dump_view *v)
+{
+	uint64_t sum = 0;
+
+	for (unsigned int p = 0; p < v->info->n_planes; p++) {
+		size_t size = (size_t)v->info->plane_width[p] *
+			v->info->plane_height[p];
+
+		for (size_t n = 0; n < size; n += 4096)
+			sum += v->plane[p][n];
+	}
+
+	return sum;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int drop_cache(const char *path)
+{
+	int fd, ret;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	ret = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+
+	return ret ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t *latency, sum = 0, bytes = 0, start, elapsed;
+	size_t frames, count = 1000, *order, n;
+	int cold = 0, verify = 0, bad = 0, c;
+	struct dump_file *d;
+	struct dump_view v;
+
+	while ((c = getopt(argc, argv, "n:cv")) != -1) {
+		switch (c) {
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			cold = 1;
+			break;
+		case 'v':
+			verify = 1;
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (optind != argc - 1 || !count)
+		goto usage;
+
+	if (cold && drop_cache(argv[optind]))
+		perror("dropping the page cache");
+
+	start = now_us();
+	d = dump_file_open(argv[optind]);
+	if (!d) {
+		perror(argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	frames = dump_file_frames(d);
+	printf("%s: %zu frames, opened in %llu us%s\n", argv[optind], frames,
+	       (unsigned long long)(now_us() - start),
+	       dump_file_recovered(d) ? ", index rebuilt" : "");
+
+	if (!frames) {
+		dump_file_close(d);
+		return EXIT_FAILURE;
+	}
+
+	/* a cold run reads a frame once, a shuffle of the frames */
+	if (cold && count > frames)
+		count = frames;
+
+	order = malloc(count * sizeof (*order));
+	latency = malloc(count * sizeof (*latency));
+	if (!order || !latency) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+
+	srand(time(NULL));
+
+	if (cold) {
+		size_t *all = malloc(frames * sizeof (*all));
+
+		if (!all) {
+			perror("malloc");
+			return EXIT_FAILURE;
+		}
+
+		for (n = 0; n < frames; n++)
+			all[n] = n;
+
+		for (n = frames - 1; n > 0; n--) {
+			size_t k = rand() % (n + 1), t = all[n];
+
+			all[n] = all[k];
+			all[k] = t;
+		}
+
+		for (n = 0; n < count; n++)
+			order[n] = all[n];
+
+		free(all);
+	} else {
+		for (n = 0; n < count; n++)
+			order[n] = rand() % frames;
+	}
+
+	start = now_us();
+
+	for (n = 0; n < count; n++) {
+		uint64_t t = now_us();
+
+		dump_file_frame(d, order[n], &v);
+		sink += read_frame(&v);
+
+		latency[n] = now_us() - t;
+		sum += latency[n];
+		bytes += v.info->size;
+
+		if (verify && !dump_file_verify(d, order[n])) {
+			fprintf(stderr, "frame %llu: bad check\n",
+				(unsigned long long)v.info->seq);
+			bad++;
+		}
+	}
+
+	elapsed = now_us() - start;
+
+	qsort(latency, count, sizeof (*latency), cmp_u64);
+
+	printf("%s: %zu frames, latency mean %llu us p50 %llu us "
+	       "p99 %llu us max %llu us, %.1f MB/s\n",
+	       cold ? "cold" : "warm", count,
+	       (unsigned long long)(sum / count),
+	       (unsigned long long)latency[count / 2],
+	       (unsigned long long)latency[count * 99 / 100],
+	       (unsigned long long)latency[count - 1],
+	       elapsed ? bytes / (double)elapsed : 0.0);
+
+	if (verify)
+		printf("%d bad frames\n", bad);
+
+	free(latency);
+	free(order);
+	dump_file_close(d);
+
+	return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+
+usage:
+	fprintf(stderr, "usage: %s [-n <frames>] [-c] [-v] <path>\n", argv[0]);
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,208 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Frame archive reader library
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dump_file.h"
+
+struct dump_file {
+	const uint8_t *base;
+	size_t size;
+
+	const struct dump_index_entry *index;
+	size_t frames;
+	struct dump_index_entry *rebuilt;	/* index of an unclosed file */
+};
+
+/* Frame headers up to the first damaged frame, like the writer does
+ * when it resumes */
+static int dump_file_rebuild(struct dump_file *d)
+{
+	size_t alloc = 0;
+	uint64_t off;
+
+	for (off = DUMP_BLOCK; off + DUMP_BLOCK <= d->size; ) {
+		const struct dump_frame_header *fh =
+			(const struct dump_frame_header *)(d->base + off);
+
+		if (fh->magic != DUMP_FRAME_MAGIC ||
+		    fh->header_size != DUMP_BLOCK ||
+		    fh->record_size != DUMP_BLOCK + DUMP_ALIGN(fh->info.size) ||
+		    off + fh->record_size > d->size ||
+		    dump_check(d->base + off + DUMP_BLOCK, fh->info.size) !=
+		    fh->info.check)
+			break;
+
+		if (d->frames == alloc) {
+			struct dump_index_entry *e;
+
+			alloc = alloc ? 2 * alloc : 1024;
+			e = realloc(d->rebuilt, alloc * sizeof (*e));
+			if (!e)
+				return -1;
+			d->rebuilt = e;
+		}
+
+		d->rebuilt[d->frames].offset = off;
+		d->rebuilt[d->frames].info = fh->info;
+		d->frames++;
+
+		off += fh->record_size;
+	}
+
+	d->index = d->rebuilt;
+
+	return 0;
+}
+
+struct dump_file *dump_file_open(const char *path)
+{
+	const struct dump_file_header *hdr;
+	struct dump_file *d;
+	struct stat st;
+	void *base;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return NULL;
+	}
+
+	if (st.st_size < DUMP_BLOCK) {
+		close(fd);
+		errno = EPROTO;
+		return NULL;
+	}
+
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return NULL;
+
+	/* frames are read one by one, not the whole file ahead */
+	madvise(base, st.st_size, MADV_RANDOM);
+
+	d = calloc(1, sizeof (*d));
+	if (!d) {
+		munmap(base, st.st_size);
+		return NULL;
+	}
+
+	d->base = base;
+	d->size = st.st_size;
+
+	hdr = base;
+	if (hdr->magic != DUMP_MAGIC || hdr->version != DUMP_VERSION ||
+	    hdr->block_size != DUMP_BLOCK) {
+		dump_file_close(d);
+		errno = EPROTO;
+		return NULL;
+	}
+
+	if (hdr->index_offset &&
+	    hdr->index_offset + hdr->index_size <= d->size &&
+	    hdr->index_size == hdr->frames * sizeof (*d->index)) {
+		d->index = (const struct dump_index_entry *)(d->base +
+							     hdr->index_offset);
+		d->frames = hdr->frames;
+	} else if (dump_file_rebuild(d)) {
+		dump_file_close(d);
+		return NULL;
+	}
+
+	return d;
+}
+
+void dump_file_close(struct dump_file *d)
+{
+	munmap((void *)d->base, d->size);
+	free(d->rebuilt);
+	free(d);
+}
+
+size_t dump_file_frames(struct dump_file *d)
+{
+	return d->frames;
+}
+
+int dump_file_recovered(struct dump_file *d)
+{
+	return d->rebuilt != NULL;
+}
+
+int dump_file_frame(struct dump_file *d, size_t n, struct dump_view *v)
+{
+	const struct dump_index_entry *e;
+	const uint8_t *payload;
+
+	if (n >= d->frames)
+		return -1;
+
+	e = &d->index[n];
+	payload = d->base + e->offset + DUMP_BLOCK;
+
+	/* the payload is DUMP_BLOCK aligned, hence page aligned */
+	madvise((void *)payload, DUMP_ALIGN(e->info.size), MADV_WILLNEED);
+
+	v->info = &e->info;
+	for (unsigned int p = 0; p < 2; p++)
+		v->plane[p] = p < e->info.n_planes ?
+			payload + e->info.plane_offset[p] : NULL;
+
+	return 0;
+}
+
+long dump_file_find(struct dump_file *d, uint64_t seq)
+{
+	size_t lo = 0, hi = d->frames;
+
+	/* frame numbers only grow in a file */
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (d->index[mid].info.seq < seq)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo < d->frames && d->index[lo].info.seq == seq ? (long)lo : -1;
+}
+
+int dump_file_verify(struct dump_file *d, size_t n)
+{
+	const struct dump_index_entry *e;
+
+	if (n >= d->frames)
+		return 0;
+
+	e = &d->index[n];
+
+	return dump_check(d->base + e->offset + DUMP_BLOCK, e->info.size) ==
+		e->info.check;
+}
@@ -0,0 +1,67 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Frame archive reader library header file
+ *
+ * Reads the files of the dump sink (v4l2_decode --sink=dump:<path>),
+ * see ../dump.h for the format.  The whole file is mapped read-only
+ * once, any frame is then at hand in O(1) without decoding:
+ *
+ *	d = dump_file_open(path);
+ *	for (n = 0; n < dump_file_frames(d); n++) {
+ *		dump_file_frame(d, n, &v);
+ *		use v.plane[0], v.info->plane_width[0]...;
+ *	}
+ *
+ * A file that was not closed, e.g. after a crash, gets its index
+ * rebuilt from the frame headers up to the first damaged frame.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef INCLUDE_DUMP_FILE_H
+#define INCLUDE_DUMP_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../dump.h"
+
+struct dump_file;
+
+struct dump_view {
+	const struct dump_frame_info *info;
+	const uint8_t *plane[2];	/* info->plane_width[p] per line */
+};
+
+/* NULL and errno set on failure */
+struct dump_file *dump_file_open(const char *path);
+void dump_file_close(struct dump_file *d);
+
+size_t dump_file_frames(struct dump_file *d);
+
+/* Whether the index was rebuilt, the file was not closed */
+int dump_file_recovered(struct dump_file *d);
+
+/* Frame n in file order, the pages are read ahead in the background.
+ * -1 when n is out of range */
+int dump_file_frame(struct dump_file *d, size_t n, struct dump_view *v);
+
+/* Frame n of the file order with this frame number, -1 if none */
+long dump_file_find(struct dump_file *d, uint64_t seq);
+
+/* Whether the payload of frame n matches its check */
+int dump_file_verify(struct dump_file *d, size_t n);
+
+#endif /* INCLUDE_DUMP_FILE_H */
@@ -0,0 +1,333 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Frame ring reader library
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "frame_ring.h"
+
+#ifndef F_GET_SEALS
+#define F_GET_SEALS	1034
+#define F_SEAL_SHRINK	0x0002
+#endif
+
+struct frame_ring {
+	int sock;
+	int event_fd;
+
+	/* current ring, NULL until the first frame */
+	int fd;
+	const struct sink_shm_header *hdr;
+	size_t size;
+	unsigned int ring;
+
+	uint64_t cursor;	/* next frame to read */
+	uint64_t lost;
+};
+
+static const struct sink_shm_slot *ring_slot(struct frame_ring *r,
+					     uint64_t index)
+{
+	return (const struct sink_shm_slot *)((const uint8_t *)r->hdr +
+		r->hdr->data_offset +
+		(size_t)(index % r->hdr->slots) * r->hdr->slot_size);
+}
+
+static void ring_unmap(struct frame_ring *r)
+{
+	if (r->hdr)
+		munmap((void *)r->hdr, r->size);
+	if (r->fd >= 0)
+		close(r->fd);
+	if (r->event_fd >= 0)
+		close(r->event_fd);
+
+	r->hdr = NULL;
+	r->fd = -1;
+	r->event_fd = -1;
+}
+
+static int ring_map(struct frame_ring *r, const struct sink_shm_hello *hello,
+		    int fd)
+{
+	const struct sink_shm_header *hdr;
+	struct stat st;
+
+	/* the decoder sealed the size, it cannot be cut under us */
+	if (hello->magic != SINK_SHM_MAGIC ||
+	    hello->version != SINK_SHM_VERSION ||
+	    fstat(fd, &st) < 0 || (uint64_t)st.st_size != hello->size ||
+	    !(fcntl(fd, F_GET_SEALS) & F_SEAL_SHRINK)) {
+		errno = EPROTO;
+		return -1;
+	}
+
+	hdr = mmap(NULL, hello->size, PROT_READ, MAP_SHARED, fd, 0);
+	if (hdr == MAP_FAILED)
+		return -1;
+
+	if (hdr->magic != SINK_SHM_MAGIC || !hdr->slots ||
+	    hdr->slot_size <= sizeof (struct sink_shm_slot) ||
+	    hdr->data_offset + (uint64_t)hdr->slots * hdr->slot_size >
+	    hello->size) {
+		munmap((void *)hdr, hello->size);
+		errno = EPROTO;
+		return -1;
+	}
+
+	r->hdr = hdr;
+	r->size = hello->size;
+	r->fd = fd;
+	r->cursor = 0;
+	r->ring++;
+
+	return 0;
+}
+
+/* 1 with a new ring, 0 when none is waiting, -1 when the decoder left */
+static int ring_receive(struct frame_ring *r)
+{
+	struct sink_shm_hello hello;
+	char control[CMSG_SPACE(2 * sizeof (int))];
+	struct iovec iov = {
+		.iov_base = &hello,
+		.iov_len = sizeof (hello),
+	};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control,
+		.msg_controllen = sizeof (control),
+	};
+	struct cmsghdr *cmsg;
+	int fds[2];
+	ssize_t ret;
+
+	ret = recvmsg(r->sock, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+	if (ret < 0)
+		return errno == EAGAIN || errno == EINTR ? 0 : -1;
+
+	if (ret == 0) {
+		errno = EPIPE;
+		return -1;
+	}
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (ret != sizeof (hello) || !cmsg ||
+	    cmsg->cmsg_type != SCM_RIGHTS ||
+	    cmsg->cmsg_len != CMSG_LEN(sizeof (fds))) {
+		errno = EPROTO;
+		return -1;
+	}
+
+	memcpy(fds, CMSG_DATA(cmsg), sizeof (fds));
+
+	ring_unmap(r);
+	r->event_fd = fds[1];
+
+	if (ring_map(r, &hello, fds[0])) {
+		close(fds[0]);
+		return -1;
+	}
+
+	return 1;
+}
+
+struct frame_ring *frame_ring_connect(const char *path)
+{
+	struct sockaddr_un addr;
+	struct frame_ring *r;
+
+	if (strlen(path) >= sizeof (addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+
+	r = calloc(1, sizeof (*r));
+	if (!r)
+		return NULL;
+
+	r->fd = -1;
+	r->event_fd = -1;
+
+	r->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (r->sock < 0) {
+		free(r);
+		return NULL;
+	}
+
+	memset(&addr, 0, sizeof (addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	if (connect(r->sock, (struct sockaddr *)&addr, sizeof (addr)) < 0) {
+		frame_ring_close(r);
+		return NULL;
+	}
+
+	return r;
+}
+
+void frame_ring_close(struct frame_ring *r)
+{
+	ring_unmap(r);
+	close(r->sock);
+	free(r);
+}
+
+int frame_ring_get_fd(struct frame_ring *r)
+{
+	return r->event_fd;
+}
+
+int frame_ring_get_sock(struct frame_ring *r)
+{
+	return r->sock;
+}
+
+int frame_ring_wait(struct frame_ring *r, int timeout_ms)
+{
+	struct pollfd pfd[2] = {
+		{ .fd = r->event_fd, .events = POLLIN },
+		{ .fd = r->sock, .events = POLLIN },
+	};
+	uint64_t count;
+	int ret;
+
+	do {
+		ret = poll(pfd, 2, timeout_ms);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret <= 0)
+		return ret;
+
+	if (pfd[0].revents & POLLIN)
+		(void)!read(r->event_fd, &count, sizeof (count));
+
+	/* a new ring, or the decoder is gone */
+	if (pfd[1].revents && ring_receive(r) < 0)
+		return -1;
+
+	return 1;
+}
+
+int frame_ring_next(struct frame_ring *r, struct frame_ring_frame *f)
+{
+	const struct sink_shm_slot *slot;
+	uint64_t head, slots;
+	unsigned int seq, expected;
+	int ret;
+
+	while (!r->hdr ||
+	       atomic_load_explicit(&r->hdr->state, memory_order_acquire) ==
+	       SINK_SHM_RETIRED) {
+		ret = ring_receive(r);
+		if (ret <= 0)
+			return ret;
+	}
+
+	slots = r->hdr->slots;
+	head = atomic_load_explicit(&r->hdr->head, memory_order_acquire);
+
+	for (; r->cursor < head; r->cursor++) {
+		/* the writer is already past the oldest ones */
+		if (head - r->cursor > slots) {
+			r->lost += head - r->cursor - slots;
+			r->cursor = head - slots;
+		}
+
+		/* slot n % slots holds frame n after its (n / slots + 1)th
+		 * write, any other sequence is another frame */
+		slot = ring_slot(r, r->cursor);
+		expected = 2 * (r->cursor / slots + 1);
+
+		seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		if (seq != expected) {
+			r->lost++;
+			continue;
+		}
+
+		f->info = slot->frame;
+		atomic_thread_fence(memory_order_acquire);
+
+		if (atomic_load_explicit(&slot->seq, memory_order_relaxed) !=
+		    seq || f->info.size > r->hdr->slot_size - sizeof (*slot)) {
+			r->lost++;
+			continue;
+		}
+
+		f->data = (const uint8_t *)(slot + 1);
+		f->index = r->cursor++;
+		f->lost = r->lost;
+		f->seq = seq;
+		f->ring = r->ring;
+		r->lost = 0;
+
+		return 1;
+	}
+
+	return 0;
+}
+
+int frame_ring_valid(struct frame_ring *r, const struct frame_ring_frame *f)
+{
+	const struct sink_shm_slot *slot;
+
+	if (!r->hdr || f->ring != r->ring)
+		return 0;
+
+	slot = ring_slot(r, f->index);
+	atomic_thread_fence(memory_order_acquire);
+
+	return atomic_load_explicit(&slot->seq, memory_order_relaxed) ==
+		f->seq;
+}
+
+int frame_ring_read(struct frame_ring *r, struct frame_ring_frame *f,
+		    void *buf, size_t size)
+{
+	int ret;
+
+	while ((ret = frame_ring_next(r, f)) > 0) {
+		/* f->info.size tells how much, read it again next time */
+		if (f->info.size > size) {
+			r->cursor = f->index;
+			errno = ENOSPC;
+			return -1;
+		}
+
+		memcpy(buf, f->data, f->info.size);
+
+		if (frame_ring_valid(r, f))
+			return 1;
+
+		r->lost++;
+	}
+
+	return ret;
+}
@@ -0,0 +1,83 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Frame ring reader library header file
+ *
+ * Reads the frames published by the shm sink (v4l2_decode
+ * --sink=shm:<path>) from another process, see ../sink_shm.h for the
+ * protocol.  The ring is mapped read-only and frames can be read in
+ * place:
+ *
+ *	r = frame_ring_connect(path);
+ *	while (frame_ring_wait(r, -1) >= 0) {
+ *		while (frame_ring_next(r, &f) > 0) {
+ *			process(f.data, f.info.size);
+ *			if (!frame_ring_valid(r, &f))
+ *				the decoder overwrote it meanwhile;
+ *		}
+ *	}
+ *
+ * or copied with frame_ring_read(), which retries overwritten frames.
+ * The decoder never waits for readers: a reader more than a ring behind
+ * skips to the oldest frame still there, f.lost counts the frames it
+ * missed.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef INCLUDE_FRAME_RING_H
+#define INCLUDE_FRAME_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../sink_shm.h"
+
+struct frame_ring;
+
+struct frame_ring_frame {
+	struct sink_shm_frame info;
+	const uint8_t *data;	/* in the ring, info.size bytes */
+	uint64_t index;		/* position in the ring */
+	uint64_t lost;		/* frames skipped since the previous one */
+	unsigned int seq;	/* slot sequence when it was read */
+	unsigned int ring;	/* rings the reader got so far */
+};
+
+/* NULL and errno set on failure */
+struct frame_ring *frame_ring_connect(const char *path);
+void frame_ring_close(struct frame_ring *r);
+
+/* eventfd signalled on every frame, and the connection to the decoder
+ * which gets readable when the ring is replaced or the decoder exits:
+ * poll both and call frame_ring_next() when either is readable */
+int frame_ring_get_fd(struct frame_ring *r);
+int frame_ring_get_sock(struct frame_ring *r);
+
+/* 1 when woken up, 0 on timeout (ms, -1 waits forever), -1 on error */
+int frame_ring_wait(struct frame_ring *r, int timeout_ms);
+
+/* 1 and the next frame, 0 when there is none yet, -1 when the decoder
+ * is gone.  Frames of a replaced ring are not valid anymore */
+int frame_ring_next(struct frame_ring *r, struct frame_ring_frame *f);
+
+/* Whether f was not overwritten since frame_ring_next() returned it */
+int frame_ring_valid(struct frame_ring *r, const struct frame_ring_frame *f);
+
+/* frame_ring_next() and a consistent copy of the data to buf, -1 and
+ * ENOSPC when it needs f->info.size bytes */
+int frame_ring_read(struct frame_ring *r, struct frame_ring_frame *f,
+		    void *buf, size_t size);
+
+#endif /* INCLUDE_FRAME_RING_H */
@@ -0,0 +1,190 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Frame ring reader benchmark
+ *
+ * Reads the frames of v4l2_decode --sink=shm:<path> for a while and
+ * reports the frame rate, bandwidth, latency from publication and the
+ * frames lost:
+ *
+ *	ring_bench [-t <seconds>] [-z] [-d <ms>] <path>
+ *
+ * -z reads the frames in place instead of copying them, -d sleeps after
+ * every frame to play a slow reader, the decoder frame rate must not
+ * change.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "frame_ring.h"
+
+static struct {
+	uint64_t frames;
+	uint64_t bytes;
+	uint64_t lost;
+	uint64_t torn;		/* overwritten while being read in place */
+	uint64_t latency_sum;
+	uint64_t latency_max;
+	uint64_t first_us;
+	uint64_t last_us;
+	uint64_t sink;		/* keeps the in place reads */
+} bench;
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Touch every cache line, what a consumer reading in place costs */
+static uint64_t read_in_place(const uint8_t *data, size_t size)
+{
+	uint64_t sum = 0;
+
+	for (size_t n = 0; n < size; n += 64)
+		sum += data[n];
+
+	return sum;
+}
+
+static void account(const struct frame_ring_frame *f)
+{
+	uint64_t now = now_us();
+	uint64_t latency = now - f->info.published_us;
+
+	if (!bench.frames)
+		bench.first_us = now;
+	bench.last_us = now;
+
+	bench.frames++;
+	bench.bytes += f->info.size;
+	bench.lost += f->lost;
+	bench.latency_sum += latency;
+	if (latency > bench.latency_max)
+		bench.latency_max = latency;
+}
+
+int main(int argc, char **argv)
+{
+	struct frame_ring_frame f;
+	struct frame_ring *r;
+	int seconds = 10, in_place = 0, delay_ms = 0;
+	uint64_t end, elapsed;
+	size_t size = 0;
+	void *buf = NULL;
+	int c, ret = 0;
+
+	while ((c = getopt(argc, argv, "t:zd:")) != -1) {
+		switch (c) {
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'z':
+			in_place = 1;
+			break;
+		case 'd':
+			delay_ms = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (optind != argc - 1 || seconds <= 0)
+		goto usage;
+
+	r = frame_ring_connect(argv[optind]);
+	if (!r) {
+		perror(argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	end = now_us() + seconds * 1000000ULL;
+
+	while (ret >= 0 && now_us() < end) {
+		ret = frame_ring_wait(r, 100);
+		if (ret < 0)
+			break;
+
+		for (;;) {
+			if (in_place) {
+				ret = frame_ring_next(r, &f);
+				if (ret <= 0)
+					break;
+
+				bench.sink += read_in_place(f.data,
+							    f.info.size);
+				if (!frame_ring_valid(r, &f)) {
+					bench.torn++;
+					continue;
+				}
+			} else {
+				ret = frame_ring_read(r, &f, buf, size);
+				if (ret < 0 && errno == ENOSPC) {
+					size = f.info.size;
+					free(buf);
+					buf = malloc(size);
+					if (!buf)
+						break;
+					continue;
+				}
+
+				if (ret <= 0)
+					break;
+			}
+
+			account(&f);
+
+			if (delay_ms)
+				usleep(delay_ms * 1000);
+		}
+	}
+
+	if (ret < 0 && errno != EPIPE)
+		perror("frame ring");
+
+	elapsed = bench.last_us - bench.first_us;
+
+	printf("%s: %llu frames, %.1f frames/s, %.1f MB/s, "
+	       "latency mean %llu us max %llu us, %llu lost, %llu torn\n",
+	       in_place ? "in place" : "copy",
+	       (unsigned long long)bench.frames,
+	       elapsed ? (bench.frames - 1) * 1e6 / elapsed : 0.0,
+	       elapsed ? bench.bytes / (double)elapsed : 0.0,
+	       (unsigned long long)(bench.frames ?
+				    bench.latency_sum / bench.frames : 0),
+	       (unsigned long long)bench.latency_max,
+	       (unsigned long long)bench.lost,
+	       (unsigned long long)bench.torn);
+
+	frame_ring_close(r);
+	free(buf);
+
+	return bench.frames ? EXIT_SUCCESS : EXIT_FAILURE;
+
+usage:
+	fprintf(stderr, "usage: %s [-t <seconds>] [-z] [-d <ms>] <path>\n",
+		argv[0]);
+	return EXIT_FAILURE;
+}
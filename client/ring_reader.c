@@ -0,0 +1,144 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Frame ring reader example
+ *
+ * Prints the frames published by v4l2_decode --sink=shm:<path> and
+ * optionally appends them to a file:
+ *
+ *	ring_reader [-o <file>] [-n <frames>] <path>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "frame_ring.h"
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int main(int argc, char **argv)
+{
+	struct frame_ring_frame f;
+	struct frame_ring *r;
+	FILE *out = NULL;
+	long frames = -1, n = 0;
+	uint64_t lost = 0;
+	size_t size = 0;
+	void *buf = NULL;
+	int c, ret = 0;
+
+	while ((c = getopt(argc, argv, "o:n:")) != -1) {
+		switch (c) {
+		case 'o':
+			out = fopen(optarg, "wb");
+			if (!out) {
+				perror(optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'n':
+			frames = atol(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (optind != argc - 1)
+		goto usage;
+
+	r = frame_ring_connect(argv[optind]);
+	if (!r) {
+		perror(argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	while (frames < 0 || n < frames) {
+		ret = frame_ring_wait(r, 1000);
+		if (ret < 0)
+			break;
+
+		for (;;) {
+			ret = frame_ring_read(r, &f, buf, size);
+			if (ret < 0 && errno == ENOSPC) {
+				/* the first frame, or a bigger one */
+				size = f.info.size;
+				free(buf);
+				buf = malloc(size);
+				if (!buf)
+					break;
+				continue;
+			}
+
+			if (ret <= 0)
+				break;
+
+			lost += f.lost;
+			n++;
+
+			printf("frame %llu pts %llu %c%c%c%c %ux%u %u bytes, "
+			       "latency %llu us, %llu lost\n",
+			       (unsigned long long)f.info.seq,
+			       (unsigned long long)f.info.pts,
+			       f.info.fourcc & 0xff, (f.info.fourcc >> 8) & 0xff,
+			       (f.info.fourcc >> 16) & 0xff, f.info.fourcc >> 24,
+			       f.info.width, f.info.height, f.info.size,
+			       (unsigned long long)(now_us() -
+						    f.info.published_us),
+			       (unsigned long long)f.lost);
+
+			if (out && fwrite(buf, f.info.size, 1, out) != 1) {
+				perror("write");
+				ret = -1;
+				break;
+			}
+
+			if (frames >= 0 && n == frames)
+				break;
+		}
+
+		if (ret < 0)
+			break;
+	}
+
+	if (ret < 0 && errno != EPIPE)
+		perror("frame ring");
+
+	printf("%ld frames read, %llu lost\n", n, (unsigned long long)lost);
+
+	frame_ring_close(r);
+	free(buf);
+	if (out)
+		fclose(out);
+
+	return ret < 0 && errno != EPIPE ? EXIT_FAILURE : EXIT_SUCCESS;
+
+usage:
+	fprintf(stderr, "usage: %s [-o <file>] [-n <frames>] <path>\n",
+		argv[0]);
+	return EXIT_FAILURE;
+}
@@ -26,6 +26,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdatomic.h>
 #include <pthread.h>
 #include <termios.h>
 
@@ -34,6 +35,12 @@
 
 #include "display.h"
 #include "list.h"
+#include "caps.h"
+#include "decimate.h"
+#include "log.h"
+#include "metrics.h"
+#include "sink.h"
+#include "ubwc.h"
 
 extern int debug_level;
 
@@ -41,7 +48,7 @@ extern int debug_level;
 
 #define print(l, msg, ...)						\
 	do {								\
-		if (debug_level >= l)					\
+		if (l <= LOG_LEVEL_MAX && debug_level >= l)		\
 			fprintf(stderr, msg, ##__VA_ARGS__);		\
 	} while (0)
 
@@ -55,6 +62,7 @@ extern int debug_level;
     print(3, "\033[35m" DBG_TAG ": " msg "\033[0m\n", ##__VA_ARGS__)
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
 
 #define memzero(x)	memset(&(x), 0, sizeof (x));
 
@@ -78,6 +86,10 @@ struct video {
 	char *name;
 	int fd;
 
+	/* Device capabilities, possibly from the on-disk cache */
+	struct video_caps caps;
+	char *caps_path;
+
 	/* Output queue related */
 	int out_buf_cnt;
 	int out_buf_size;
@@ -96,6 +108,8 @@ struct video {
 	int cap_planes_count;
 	int cap_plane_off[CAP_PLANES];
 	int cap_plane_stride[CAP_PLANES];
+	int cap_scanlines;
+	struct v4l2_rect cap_crop;	/* visible part of the frame */
 	int cap_buf_flag[MAX_CAP_BUF];
 	int cap_buf_size;
 	int cap_buf_fd[MAX_CAP_BUF];
@@ -114,20 +128,132 @@ struct video {
 	int extradata_off[MAX_CAP_BUF];
 	void *extradata_addr[MAX_CAP_BUF];
 
+	/* V4L2_CID_MPEG_VIDC_VIDEO_OPERATING_RATE, fps in Q16 */
+	int operating_rate;
+
 	/* Metrics */
-	unsigned long total_captured;
+	atomic_ulong total_captured;
+	atomic_ulong out_queued_total;
+	atomic_ulong out_dequeued_total;
+	atomic_ulong cap_queued_total;
+	atomic_ulong cap_dequeued_total;
 };
 
+/* Number of linear buffers in the rotator pool */
+#define MAX_ROT_BUF		8
+
+/* Planes of the rotator OUTPUT queue with the mplane API */
+#define ROT_OUT_PLANES		4
+
+/* Rotator buffer states */
+#define ROT_BUF_FREE		0
+#define ROT_BUF_QUEUED		1
+#define ROT_BUF_HELD		2
+
+/* Default number of frames in flight in the rotator */
+#define ROT_DEPTH		4
+
+/* A frame going through the rotator, one per pool buffer */
+struct rotator_job {
+	int dec_index;		/* decoder CAPTURE buffer being read */
+	int src_fd;
+	void *src;
+	int src_size;
+	int consumed;		/* decoder buffer handed back */
+	int failed;		/* not converted, the frame is dropped */
+	int unverified;		/* no CPU reference, see verify */
+	uint64_t pts;
+	uint64_t submitted;
+};
+
+struct rotator_cb;
+struct rotator_sw;
+struct scaler;
+
+/* SDE rotator session, UBWC frames in and linear NV12 out */
 struct rotator {
+	char *name;
 	int fd;
+	int event_fd;
+	int active;
+	int depth;
+	int fourcc;			/* of the CAPTURE queue */
+	int secure;
+	int mplane;			/* DMABUF planes, else fd as userptr */
+
+	/* frames from the decoder, UBWC unless it was asked for linear
+	 * NV12, and the part of them converted */
+	int src_linear;
 	int width;
 	int height;
-	int fourcc;
-	int secure;
+	int stride;
+	int scanlines;
+	struct v4l2_rect crop;
+	int crop_changed;		/* reopen with the new one when idle */
+
+	/* linear frames produced, same stride for the UV plane */
+	int cap_w;
+	int cap_h;
+	int cap_stride;
+	int cap_scanlines;
+
+	/* frames handed to the consumer, made on the CPU from the CAPTURE
+	 * buffers (post) when the rotator cannot produce them directly */
+	uint32_t dst_fourcc;		/* V4L2_PIX_FMT_NV12 or GREY */
+	int dst_w;
+	int dst_h;
+	int dst_stride;
+	int dst_scanlines;
+	int dst_size;
+	int post;
+	void *dst_addr[MAX_ROT_BUF];
+	void *dst_uv_addr[MAX_ROT_BUF];
+	struct scaler *scale_y;		/* for the crop, set up at open */
+	struct scaler *scale_uv;
+
+	/* OUTPUT queue, fed with decoder capture buffers */
 	int out_buf_size;
 	int out_buf_cnt;
-	unsigned long out_buf_fd[MAX_OUT_BUF];
-	void *out_buf_addr[MAX_OUT_BUF];
+	int out_planes;			/* 1, or Y, Ymeta, UV, UVmeta */
+	int out_plane_off[ROT_OUT_PLANES];
+	int out_plane_size[ROT_OUT_PLANES];
+
+	/* CAPTURE queue, our pool of linear buffers; with two planes the
+	 * UV plane has a buffer of its own */
+	int cap_buf_size;
+	int cap_buf_cnt;
+	int cap_buf_fd[MAX_ROT_BUF];
+	void *cap_buf_addr[MAX_ROT_BUF];
+	int cap_buf_flag[MAX_ROT_BUF];
+	int cap_planes;
+	int cap_uv_size;
+	int cap_uv_fd[MAX_ROT_BUF];
+	void *cap_uv_addr[MAX_ROT_BUF];
+
+	/* Frames in flight and completion callbacks */
+	const struct rotator_cb *cb;
+	struct rotator_job job[MAX_ROT_BUF];
+	int in_flight;
+
+	/* Decoder buffers waiting for a free pool buffer */
+	int wait_dec[MAX_CAP_BUF];
+	uint64_t wait_pts[MAX_CAP_BUF];
+	int wait_head;
+	int wait_count;
+
+	/* Software backend and the frames it could not convert */
+	struct rotator_sw *sw;
+	int sw_failed;
+
+	/* CPU detiler, for the software backend and --ubwc-verify */
+	struct ubwc *ubwc;
+	struct ubwc_layout layout;
+	int verify;
+	uint8_t *verify_buf[MAX_ROT_BUF];
+	int verify_frames;
+	int verify_bad;
+	int verify_skipped;	/* tile metadata set, no reference */
+	double verify_psnr;	/* worst frame */
 };
 
 struct instance {
@@ -140,16 +266,47 @@ struct instance {
 	int interlaced;
 	int decode_order;
 	int skip_frames;
+	struct decimate decimate;
 	int insert_sc;
 	int need_header;
 	int secure;
 	int continue_data_transfer;
 	char *url;
+	char **urls;		/* every url given, a session each */
+	int n_urls;
+	char *caps_path;
 
 	/* video decoder related parameters */
 	struct video	video;
 	struct rotator	rotator;
 
+	int rotator_bench;
+	char *rotator_name;
+	int capture_linear;	/* no rotator, NV12 from the decoder */
+	int rotator_depth;
+	struct v4l2_rect rotator_crop;
+	int rotator_width;
+	int rotator_height;
+	uint32_t rotator_fourcc;
+	int ubwc_threads;
+	int ubwc_verify;
+
+	/* Frame sinks, --sink */
+	char *sink_list;
+	struct sink *sinks[SINK_MAX];
+	int n_sinks;
+	uint64_t frame_seq;
+
+	/* Decoded frame checks, see verify.h */
+	char *verify_path;
+	char *verify_reference;
+	int verify_failed;
+
+	/* Runtime metrics export */
+	struct metrics	metrics;
+	char *metrics_shm;
+	char *metrics_sock;
+
 	pthread_mutex_t lock;
 	pthread_cond_t cond;
 
@@ -170,6 +327,10 @@ struct instance {
 	int stdin_valid;
 	struct termios stdin_termios;
 
+	/* hex dump of the packets, debug level 4 */
+	char *pkt_dump;
+	size_t pkt_dump_size;
+
 	AVFormatContext *avctx;
 	AVStream *stream;
 	AVBSFContext *bsf;
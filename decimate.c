@@ -0,0 +1,145 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Access unit decimation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "decimate.h"
+
+#define DBG_TAG "decim"
+
+/* HEVC nal_unit_type */
+#define HEVC_NAL_RSV_VCL_N14	14
+#define HEVC_NAL_BLA_W_LP	16
+#define HEVC_NAL_RSV_IRAP_23	23
+#define HEVC_NAL_VCL_MAX	31
+
+/* H.264 nal_unit_type */
+#define H264_NAL_SLICE		1
+#define H264_NAL_IDR		5
+
+int decimate_parse(struct decimate *d, const char *arg)
+{
+	memset(d, 0, sizeof (*d));
+	d->every = 1;
+
+	if (!strcmp(arg, "ref")) {
+		d->mode = DECIMATE_REF;
+		return 0;
+	}
+
+	if (!strncmp(arg, "key", 3) && (!arg[3] || arg[3] == ':')) {
+		d->mode = DECIMATE_KEY;
+		if (arg[3])
+			d->every = atoi(arg + 4);
+		if (d->every > 0)
+			return 0;
+	}
+
+	err("invalid decimation %s, key[:<n>] or ref", arg);
+
+	return -1;
+}
+
+/* Header byte of the first slice NAL unit, -1 if there is none */
+static int first_slice(enum AVCodecID codec, const uint8_t *data, int size)
+{
+	int annexb = size >= 3 && !data[0] && !data[1] &&
+		(data[2] == 1 || (size >= 4 && !data[2] && data[3] == 1));
+	int pos = 0;
+
+	while (pos < size) {
+		int start, len, type;
+
+		if (annexb) {
+			/* next start code */
+			while (pos + 3 <= size &&
+			       (data[pos] || data[pos + 1] || data[pos + 2] != 1))
+				pos++;
+			if (pos + 3 > size)
+				return -1;
+			start = pos + 3;
+			len = 1;
+		} else {
+			if (pos + 4 > size)
+				return -1;
+			len = (data[pos] << 24) | (data[pos + 1] << 16) |
+				(data[pos + 2] << 8) | data[pos + 3];
+			start = pos + 4;
+			if (len <= 0 || len > size - start)
+				return -1;
+		}
+
+		if (start >= size)
+			return -1;
+
+		if (codec == AV_CODEC_ID_HEVC) {
+			type = (data[start] >> 1) & 0x3f;
+			if (type <= HEVC_NAL_VCL_MAX)
+				return data[start];
+		} else {
+			type = data[start] & 0x1f;
+			if (type >= H264_NAL_SLICE && type <= H264_NAL_IDR)
+				return data[start];
+		}
+
+		pos = start + len;
+	}
+
+	return -1;
+}
+
+int decimate_keep(struct decimate *d, enum AVCodecID codec,
+		  const uint8_t *data, int size)
+{
+	int nal, type, key, ref;
+
+	if (d->mode == DECIMATE_NONE)
+		return 1;
+
+	/* parameter sets or SEI on their own */
+	nal = first_slice(codec, data, size);
+	if (nal < 0)
+		return 1;
+
+	switch (codec) {
+	case AV_CODEC_ID_HEVC:
+		type = (nal >> 1) & 0x3f;
+		key = type >= HEVC_NAL_BLA_W_LP &&
+			type <= HEVC_NAL_RSV_IRAP_23;
+		/* even types below 16 are sub-layer non-reference */
+		ref = type > HEVC_NAL_RSV_VCL_N14 || (type & 1);
+		break;
+	case AV_CODEC_ID_H264:
+		key = (nal & 0x1f) == H264_NAL_IDR;
+		ref = (nal >> 5) & 3;
+		break;
+	default:
+		return 1;
+	}
+
+	if (d->mode == DECIMATE_REF)
+		return ref;
+
+	if (!key)
+		return 0;
+
+	return d->keys++ % d->every == 0;
+}
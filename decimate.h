@@ -0,0 +1,57 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Access unit decimation header file
+ *
+ * --decimate drops access units before they are submitted, from the
+ * type of their first slice NAL unit, so the decoder only spends time
+ * on the pictures that are shown:
+ *
+ *	key[:<n>]	IRAP (HEVC) or IDR (H.264) pictures only, every
+ *			n-th of them; the decoder is also switched to its
+ *			picture type mode (as with -i)
+ *	ref		no sub-layer non-reference (HEVC) or nal_ref_idc 0
+ *			(H.264) pictures, nothing refers to them
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef INCLUDE_DECIMATE_H
+#define INCLUDE_DECIMATE_H
+
+#include <stdint.h>
+
+#include <libavcodec/avcodec.h>
+
+enum decimate_mode {
+	DECIMATE_NONE,
+	DECIMATE_KEY,
+	DECIMATE_REF,
+};
+
+struct decimate {
+	enum decimate_mode mode;
+	int every;		/* key mode, keep one key picture in every */
+	uint64_t keys;		/* key pictures seen */
+};
+
+/* "key[:<n>]" or "ref" */
+int decimate_parse(struct decimate *d, const char *arg);
+
+/* Whether the access unit goes to the decoder, in Annex B or with
+ * 4 bytes NAL unit lengths as demuxed from MP4 */
+int decimate_keep(struct decimate *d, enum AVCodecID codec,
+		  const uint8_t *data, int size);
+
+#endif /* INCLUDE_DECIMATE_H */
@@ -2,7 +2,13 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
-#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/memfd.h>
 
 #include <wayland-client.h>
 
@@ -18,10 +24,19 @@
 
 #define DBG_TAG "  disp"
 
+/* A mosaic the compositor leaves the size of */
+#define MOSAIC_WIDTH	1920
+#define MOSAIC_HEIGHT	1080
+
+/* Format and modifier pairs the compositor takes */
+#define MAX_DRM_FORMATS	128
+
 struct display {
 	struct wl_display *display;
 	struct wl_registry *registry;
 	struct wl_compositor *compositor;
+	struct wl_subcompositor *subcompositor;
+	struct wl_shm *shm;
 	struct wl_seat *seat;
 	struct wl_keyboard *keyboard;
 	struct wl_shell *wl_shell;
@@ -29,16 +44,30 @@ struct display {
 	struct wl_scaler *scaler;
 	struct wp_viewporter *viewporter;
 	struct wp_presentation *presentation;
+	int64_t presentation_offset_us;	/* clock of the feedback to ours */
 	struct zlinux_dmabuf *dmabuf_legacy;
 	struct zwp_linux_dmabuf_v1 *dmabuf;
-	uint32_t drm_formats[32];
+	struct {
+		uint32_t format;
+		uint64_t modifier;	/* DRM_FORMAT_MOD_INVALID if implicit */
+	} drm_formats[MAX_DRM_FORMATS];
 	int compositor_version;
+	int dmabuf_version;
 	int seat_version;
 	int drm_format_count;
 	int running;
 
 	struct window *keyboard_focus;
 	struct wl_list window_list;
+
+	/* Mosaic panes are fed from several threads: display_start_thread()
+	 * reads the connection, and the lock (recursive, listeners call
+	 * back into the window functions) covers the windows and the
+	 * dispatching of the events */
+	pthread_mutex_t lock;
+	pthread_t thread;
+	bool thread_started;
+	int stop_fd;
 };
 
 struct window {
@@ -61,15 +90,53 @@ struct window {
 	bool fullscreen;
 
 	window_key_cb_t key_cb;
+	window_present_cb_t present_cb;
+	window_frame_cb_t frame_cb;
+	struct wl_callback *frame;
 	void *user_data;
+
+	/* surface state the compositor keeps, only sent when it changes */
+	int surface_w, surface_h;
+	int opaque_w, opaque_h;
+	int view_src[4];
+	int view_dst[2];
+	bool view_set;
+
+	struct window_stats stats;
+
+	/* Requests go through these, the display ones or, for a pane,
+	 * wrappers on its own queue */
+	struct wl_compositor *compositor;
+	struct wp_presentation *presentation;
+	struct zwp_linux_dmabuf_v1 *dmabuf;
+
+	/* Mosaic: a parent with a black background and the panes, its
+	 * subsurfaces in a grid, each with its own event queue */
+	struct window *parent;
+	struct wl_list panes;
+	struct wl_list pane_link;
+	int n_panes;
+	struct wl_buffer *background;
+	bool background_attached;
+	bool dirty;		/* a pane committed after the last parent one */
+
+	struct wl_subsurface *subsurface;
+	struct wl_event_queue *queue;
+	int wake_fd;		/* signalled when events may be queued */
+	int cell_x, cell_y;
+	int pos_x, pos_y;
+	bool pos_set;
 };
 
 void
 fb_destroy(struct fb *fb)
 {
 	list_del(&fb->link);
-	if (fb->sync_callback)
-		wl_callback_destroy(fb->sync_callback);
+	/* the reply is dropped with the request */
+	if (fb->params)
+		zwp_linux_buffer_params_v1_destroy(fb->params);
+	if (fb->params_legacy)
+		zlinux_buffer_params_destroy(fb->params_legacy);
 	if (fb->presentation_feedback)
 		wp_presentation_feedback_destroy(fb->presentation_feedback);
 	if (fb->buffer)
@@ -122,6 +189,55 @@ window_set_key_callback(struct window *w, window_key_cb_t callback)
 	w->key_cb = callback;
 }
 
+void
+window_set_present_callback(struct window *w, window_present_cb_t callback)
+{
+	w->present_cb = callback;
+}
+
+void
+window_set_frame_callback(struct window *w, window_frame_cb_t callback)
+{
+	w->frame_cb = callback;
+}
+
+int
+window_frame_pending(struct window *w)
+{
+	return w->frame != NULL;
+}
+
+void
+window_get_stats(struct window *w, struct window_stats *st)
+{
+	*st = w->stats;
+}
+
+static uint64_t
+clock_us(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void
+handle_presentation_clock_id(void *data, struct wp_presentation *presentation,
+			     uint32_t clk_id)
+{
+	struct display *d = data;
+
+	/* usually CLOCK_MONOTONIC already, a fixed offset otherwise */
+	d->presentation_offset_us = clk_id == CLOCK_MONOTONIC ? 0 :
+		(int64_t)(clock_us(clk_id) - clock_us(CLOCK_MONOTONIC));
+}
+
+static const struct wp_presentation_listener presentation_listener = {
+	handle_presentation_clock_id,
+};
+
 static void
 handle_sync_output(void *data, struct wp_presentation_feedback *feedback,
 		   struct wl_output *output)
@@ -135,7 +251,16 @@ handle_presented(void *data, struct wp_presentation_feedback *feedback,
 		 uint32_t flags)
 {
 	struct fb *fb = data;
+	struct window *w = fb->window;
 	uint64_t tv_sec = (uint64_t)tv_sec_hi << 32 | tv_sec_lo;
+	struct fb_presentation p = {
+		.presented = 1,
+		.time_us = tv_sec * 1000000 + tv_nsec / 1000 -
+			w->display->presentation_offset_us,
+		.refresh_ns = refresh,
+		.msc = (uint64_t)seq_hi << 32 | seq_lo,
+		.flags = flags,
+	};
 
 	dbg("buffer %d displayed at %lu.%04u, %u.%04us till next refresh",
 	    fb->index, tv_sec, tv_nsec / 1000000, refresh / 1000000000,
@@ -143,17 +268,25 @@ handle_presented(void *data, struct wp_presentation_feedback *feedback,
 
 	wp_presentation_feedback_destroy(feedback);
 	fb->presentation_feedback = NULL;
+
+	if (w->present_cb)
+		w->present_cb(w, fb, &p);
 }
 
 static void
 handle_discarded(void *data, struct wp_presentation_feedback *feedback)
 {
 	struct fb *fb = data;
+	struct window *w = fb->window;
+	struct fb_presentation p = { .presented = 0 };
 
 	dbg("buffer %d discarded", fb->index);
 
 	wp_presentation_feedback_destroy(feedback);
 	fb->presentation_feedback = NULL;
+
+	if (w->present_cb)
+		w->present_cb(w, fb, &p);
 }
 
 static const struct wp_presentation_feedback_listener presentation_feedback_listener = {
@@ -162,57 +295,144 @@ static const struct wp_presentation_feedback_listener presentation_feedback_list
 	handle_discarded,
 };
 
+static void window_commit_parent(struct window *w);
+
 static void
-sync_callback(void * data, struct wl_callback * callback, uint32_t time)
+frame_done(void *data, struct wl_callback *callback, uint32_t time)
 {
-	struct fb *fb = data;
+	struct window *w = data;
 
 	wl_callback_destroy(callback);
-	if (fb)
-		fb->sync_callback = NULL;
+	w->frame = NULL;
+
+	/* what the panes committed since waited for this refresh */
+	if (w->dirty)
+		window_commit_parent(w);
+
+	if (w->frame_cb)
+		w->frame_cb(w);
 }
 
-static const struct wl_callback_listener sync_listener = {
-	sync_callback
+static const struct wl_callback_listener frame_listener = {
+	frame_done
 };
 
+/*
+ * A frame is attach, damage and commit, plus the presentation feedback
+ * and frame callback when somebody listens.  The opaque region only goes
+ * out when the surface size changed: the compositor keeps it.
+ */
 static void
-window_commit(struct window *w)
+window_commit_surface(struct window *w)
 {
 	struct display *display = w->display;
 	struct fb *fb = w->buffer;
-	struct wl_region *region;
+	int requests = 1;
+
+	/* without a viewport, the surface is the size of the buffer */
+	if (fb && !w->viewport && !w->legacy_viewport) {
+		w->surface_w = fb->width;
+		w->surface_h = fb->height;
+	}
+
+	if ((fb || w->background) && (w->surface_w != w->opaque_w ||
+				      w->surface_h != w->opaque_h)) {
+		struct wl_region *region;
 
-	region = wl_compositor_create_region(display->compositor);
-	wl_region_add(region, 0, 0, INT_MAX, INT_MAX);
-	wl_surface_set_opaque_region(w->surface, region);
-	wl_region_destroy(region);
+		region = wl_compositor_create_region(w->compositor);
+		wl_region_add(region, 0, 0, w->surface_w, w->surface_h);
+		wl_surface_set_opaque_region(w->surface, region);
+		wl_region_destroy(region);
+		requests += 4;
 
-	wl_surface_attach(w->surface, fb ? fb->buffer : NULL, 0, 0);
-	wl_surface_damage(w->surface, 0, 0, INT_MAX, INT_MAX);
+		w->opaque_w = w->surface_w;
+		w->opaque_h = w->surface_h;
+	}
+
+	if (w->background) {
+		/* one black pixel, stretched over the window */
+		if (!w->background_attached) {
+			wl_surface_attach(w->surface, w->background, 0, 0);
+			wl_surface_damage(w->surface, 0, 0, INT_MAX, INT_MAX);
+			w->background_attached = true;
+			requests += 2;
+		}
 
-	if (fb && display->presentation) {
+		if (w->view_dst[0] != w->surface_w ||
+		    w->view_dst[1] != w->surface_h) {
+			wp_viewport_set_destination(w->viewport, w->surface_w,
+						    w->surface_h);
+			w->view_dst[0] = w->surface_w;
+			w->view_dst[1] = w->surface_h;
+			requests++;
+		}
+	} else {
+		wl_surface_attach(w->surface, fb ? fb->buffer : NULL, 0, 0);
+		requests++;
+	}
+
+	if (fb) {
+		/* buffer coordinates, nothing to transform for the viewport */
+		if (display->compositor_version >= 4)
+			wl_surface_damage_buffer(w->surface, 0, 0, fb->width,
+						 fb->height);
+		else
+			wl_surface_damage(w->surface, 0, 0, INT_MAX, INT_MAX);
+		requests++;
+	}
+
+	if (fb && w->presentation && w->present_cb) {
 		if (fb->presentation_feedback)
 			wp_presentation_feedback_destroy(fb->presentation_feedback);
 
 		fb->presentation_feedback =
-			wp_presentation_feedback(display->presentation,
-						 w->surface);
+			wp_presentation_feedback(w->presentation, w->surface);
 
 		wp_presentation_feedback_add_listener(
 			fb->presentation_feedback,
 			&presentation_feedback_listener, fb);
-	} else if (fb) {
-		if (fb->sync_callback)
-			wl_callback_destroy(fb->sync_callback);
-		fb->sync_callback = wl_display_sync(display->display);
-		wl_callback_add_listener(fb->sync_callback, &sync_listener, fb);
+		requests++;
 	}
 
 	if (fb)
 		fb->busy = 1;
 
+	if ((w->frame_cb || w->n_panes) && !w->frame) {
+		w->frame = wl_surface_frame(w->surface);
+		wl_callback_add_listener(w->frame, &frame_listener, w);
+		requests++;
+	}
+
 	wl_surface_commit(w->surface);
+
+	w->stats.commits++;
+	w->stats.requests += requests;
+}
+
+/*
+ * Panes are synchronized subsurfaces: what they commit is applied with
+ * the next commit of the parent, all of them at once.  The parent
+ * commits at most once a refresh, when its frame callback came back.
+ */
+static void
+window_commit_parent(struct window *w)
+{
+	if (!w->configured || w->frame) {
+		w->dirty = true;
+		return;
+	}
+
+	w->dirty = false;
+	window_commit_surface(w);
+}
+
+static void
+window_commit(struct window *w)
+{
+	window_commit_surface(w);
+
+	if (w->parent)
+		window_commit_parent(w->parent);
 }
 
 static int
@@ -261,6 +481,37 @@ window_recenter(struct window *w)
 		output_h = w->height;
 	}
 
+	w->surface_w = output_w;
+	w->surface_h = output_h;
+
+	/* centered in its cell of the mosaic */
+	if (w->subsurface) {
+		int x = w->cell_x + (w->width - output_w) / 2;
+		int y = w->cell_y + (w->height - output_h) / 2;
+
+		if (!w->pos_set || w->pos_x != x || w->pos_y != y) {
+			wl_subsurface_set_position(w->subsurface, x, y);
+			w->pos_set = true;
+			w->pos_x = x;
+			w->pos_y = y;
+			w->stats.requests++;
+		}
+	}
+
+	if (w->view_set &&
+	    w->view_src[0] == src_x && w->view_src[1] == src_y &&
+	    w->view_src[2] == src_w && w->view_src[3] == src_h &&
+	    w->view_dst[0] == output_w && w->view_dst[1] == output_h)
+		return 1;
+
+	w->view_set = true;
+	w->view_src[0] = src_x;
+	w->view_src[1] = src_y;
+	w->view_src[2] = src_w;
+	w->view_src[3] = src_h;
+	w->view_dst[0] = output_w;
+	w->view_dst[1] = output_h;
+
 	dbg("fb %dx%d ar %d:%d src %dx%d%+d%+d dst %dx%d",
 	    fb->width, fb->height, ar_x, ar_y,
 	    (int)src_w, (int)src_h, (int)src_x, (int)src_y,
@@ -273,6 +524,7 @@ window_recenter(struct window *w)
 				       wl_fixed_from_int(src_y),
 				       wl_fixed_from_int(src_w),
 				       wl_fixed_from_int(src_h));
+		w->stats.requests += 2;
 	} else {
 		wl_viewport_set(w->legacy_viewport,
 				wl_fixed_from_int(src_x),
@@ -280,6 +532,7 @@ window_recenter(struct window *w)
 				wl_fixed_from_int(src_w),
 				wl_fixed_from_int(src_h),
 				output_w, output_h);
+		w->stats.requests++;
 	}
 
 	return 1;
@@ -291,6 +544,8 @@ window_set_aspect_ratio(struct window *w, int ar_x, int ar_y)
 	if (ar_x == 0 || ar_y == 0)
 		return;
 
+	pthread_mutex_lock(&w->display->lock);
+
 	w->ar_x = ar_x;
 	w->ar_y = ar_y;
 
@@ -298,11 +553,15 @@ window_set_aspect_ratio(struct window *w, int ar_x, int ar_y)
 		window_recenter(w);
 		window_commit(w);
 	}
+
+	pthread_mutex_unlock(&w->display->lock);
 }
 
 void
 window_toggle_fullscreen(struct window *w)
 {
+	pthread_mutex_lock(&w->display->lock);
+
 	if (w->xdg_toplevel) {
 		if (w->fullscreen)
 			zxdg_toplevel_v6_unset_fullscreen(w->xdg_toplevel);
@@ -316,6 +575,43 @@ window_toggle_fullscreen(struct window *w)
 							WL_SHELL_SURFACE_FULLSCREEN_METHOD_SCALE,
 							0, NULL);
 	}
+
+	pthread_mutex_unlock(&w->display->lock);
+}
+
+/* As many columns as rows or one more, in the order panes were made */
+static void
+window_layout(struct window *w)
+{
+	int width = w->size_set ? w->width : MOSAIC_WIDTH;
+	int height = w->size_set ? w->height : MOSAIC_HEIGHT;
+	struct window *pane;
+	int cols = 1, rows, k = 0;
+
+	if (!w->n_panes)
+		return;
+
+	while (cols * cols < w->n_panes)
+		cols++;
+	rows = (w->n_panes + cols - 1) / cols;
+
+	w->surface_w = width;
+	w->surface_h = height;
+
+	wl_list_for_each(pane, &w->panes, pane_link) {
+		pane->cell_x = k % cols * width / cols;
+		pane->cell_y = k / cols * height / rows;
+		pane->width = width / cols;
+		pane->height = height / rows;
+		pane->size_set = true;
+		pane->configured = w->configured;
+		k++;
+
+		if (pane->configured && window_recenter(pane))
+			window_commit_surface(pane);
+	}
+
+	window_commit_parent(w);
 }
 
 static void
@@ -385,6 +681,7 @@ xdg_surface_handle_configure(void *data, struct zxdg_surface_v6 *xdg_surface,
 	w->configured = true;
 	if (window_recenter(w))
 		window_commit(w);
+	window_layout(w);
 }
 
 static const struct zxdg_surface_v6_listener xdg_surface_listener = {
@@ -415,6 +712,7 @@ shell_surface_handle_configure(void *data, struct wl_shell_surface *shell_surfac
 
 	if (window_recenter(w))
 		window_commit(w);
+	window_layout(w);
 }
 
 static void
@@ -438,9 +736,14 @@ display_create_window(struct display *display)
 		return NULL;
 
 	window->display = display;
+	window->compositor = display->compositor;
+	window->presentation = display->presentation;
+	window->dmabuf = display->dmabuf;
 	window->surface = wl_compositor_create_surface(display->compositor);
 	window->ar_x = 1;
 	window->ar_y = 1;
+	window->wake_fd = -1;
+	wl_list_init(&window->panes);
 
 	if (display->xdg_shell) {
 		window->xdg_surface =
@@ -482,11 +785,133 @@ display_create_window(struct display *display)
 					       window->surface);
 	}
 
+	pthread_mutex_lock(&display->lock);
 	wl_list_insert(&display->window_list, &window->link);
+	pthread_mutex_unlock(&display->lock);
 
 	return window;
 }
 
+/* 1x1 black XRGB8888, a new memfd reads as zeroes */
+static struct wl_buffer *
+display_create_background(struct display *display)
+{
+	struct wl_shm_pool *pool;
+	struct wl_buffer *buffer;
+	int fd;
+
+	fd = syscall(SYS_memfd_create, "v4l2dec-background", MFD_CLOEXEC);
+	if (fd < 0 || ftruncate(fd, 4)) {
+		err("failed to create the mosaic background: %m");
+		if (fd >= 0)
+			close(fd);
+		return NULL;
+	}
+
+	pool = wl_shm_create_pool(display->shm, fd, 4);
+	buffer = wl_shm_pool_create_buffer(pool, 0, 1, 1, 4,
+					   WL_SHM_FORMAT_XRGB8888);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+
+	return buffer;
+}
+
+static void
+window_free_pane(struct window *w)
+{
+	if (w->wake_fd >= 0)
+		close(w->wake_fd);
+	if (w->compositor)
+		wl_proxy_wrapper_destroy(w->compositor);
+	if (w->presentation)
+		wl_proxy_wrapper_destroy(w->presentation);
+	if (w->dmabuf)
+		wl_proxy_wrapper_destroy(w->dmabuf);
+	if (w->queue)
+		wl_event_queue_destroy(w->queue);
+	free(w);
+}
+
+/*
+ * Everything of a pane, its surface, buffers, feedback and frame
+ * callbacks, is created through wrappers of the globals on its queue:
+ * its events are only dispatched by window_dispatch(), on the thread
+ * feeding it.
+ */
+struct window *
+window_create_pane(struct window *parent)
+{
+	struct display *display = parent->display;
+	struct window *w;
+
+	if (!display->subcompositor || !display->shm || !display->viewporter ||
+	    !display->dmabuf || !parent->viewport) {
+		err("mosaic needs wl_subcompositor, wl_shm, wp_viewporter "
+		    "and zwp_linux_dmabuf_v1");
+		return NULL;
+	}
+
+	w = calloc(1, sizeof *w);
+	if (!w)
+		return NULL;
+
+	w->display = display;
+	w->parent = parent;
+	w->ar_x = 1;
+	w->ar_y = 1;
+	wl_list_init(&w->panes);
+
+	w->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	w->queue = wl_display_create_queue(display->display);
+	w->compositor = wl_proxy_create_wrapper(display->compositor);
+	w->dmabuf = wl_proxy_create_wrapper(display->dmabuf);
+	if (display->presentation)
+		w->presentation = wl_proxy_create_wrapper(display->presentation);
+
+	if (w->wake_fd < 0 || !w->queue || !w->compositor || !w->dmabuf ||
+	    (display->presentation && !w->presentation)) {
+		err("failed to create a mosaic pane");
+		window_free_pane(w);
+		return NULL;
+	}
+
+	wl_proxy_set_queue((struct wl_proxy *)w->compositor, w->queue);
+	wl_proxy_set_queue((struct wl_proxy *)w->dmabuf, w->queue);
+	if (w->presentation)
+		wl_proxy_set_queue((struct wl_proxy *)w->presentation,
+				   w->queue);
+
+	pthread_mutex_lock(&display->lock);
+
+	if (!parent->background) {
+		parent->background = display_create_background(display);
+		if (!parent->background) {
+			pthread_mutex_unlock(&display->lock);
+			window_free_pane(w);
+			return NULL;
+		}
+	}
+
+	/* synchronized, the default: shown with the parent commit */
+	w->surface = wl_compositor_create_surface(w->compositor);
+	w->subsurface = wl_subcompositor_get_subsurface(display->subcompositor,
+							w->surface,
+							parent->surface);
+	w->viewport = wp_viewporter_get_viewport(display->viewporter,
+						 w->surface);
+
+	wl_list_insert(parent->panes.prev, &w->pane_link);
+	parent->n_panes++;
+	wl_list_insert(&display->window_list, &w->link);
+
+	window_layout(parent);
+
+	pthread_mutex_unlock(&display->lock);
+
+	return w;
+}
+
 static struct window *
 display_find_window_by_surface(struct display *display,
 			       struct wl_surface *surface)
@@ -504,8 +929,18 @@ display_find_window_by_surface(struct display *display,
 void
 window_destroy(struct window *window)
 {
+	struct display *display = window->display;
+	struct window *parent = window->parent;
+
+	pthread_mutex_lock(&display->lock);
+
 	wl_list_remove(&window->link);
 
+	if (display->keyboard_focus == window)
+		display->keyboard_focus = NULL;
+
+	if (window->frame)
+		wl_callback_destroy(window->frame);
 	if (window->xdg_toplevel)
 		zxdg_toplevel_v6_destroy(window->xdg_toplevel);
 	if (window->xdg_surface)
@@ -516,10 +951,24 @@ window_destroy(struct window *window)
 		wp_viewport_destroy(window->viewport);
 	if (window->legacy_viewport)
 		wl_viewport_destroy(window->legacy_viewport);
+	if (window->subsurface)
+		wl_subsurface_destroy(window->subsurface);
+	if (window->background)
+		wl_buffer_destroy(window->background);
 
 	wl_surface_destroy(window->surface);
 
-	free(window);
+	/* the others fill the room it leaves */
+	if (parent) {
+		wl_list_remove(&window->pane_link);
+		parent->n_panes--;
+		window_layout(parent);
+		window_free_pane(window);
+	} else {
+		free(window);
+	}
+
+	pthread_mutex_unlock(&display->lock);
 }
 
 static void
@@ -550,6 +999,7 @@ create_succeeded(void *data,
 	wl_buffer_add_listener(fb->buffer, &buffer_listener, fb);
 
 	zwp_linux_buffer_params_v1_destroy(params);
+	fb->params = NULL;
 }
 
 static void
@@ -557,9 +1007,13 @@ create_failed(void *data, struct zwp_linux_buffer_params_v1 *params)
 {
 	struct fb *fb = data;
 
+	/* create_immed made one already, unusable */
+	if (fb->buffer)
+		wl_buffer_destroy(fb->buffer);
 	fb->buffer = NULL;
 
 	zwp_linux_buffer_params_v1_destroy(params);
+	fb->params = NULL;
 
 	err("zwp_linux_buffer_params.create failed");
 
@@ -582,6 +1036,7 @@ dmabuf_legacy_create_succeeded(void *data,
 	wl_buffer_add_listener(fb->buffer, &buffer_listener, fb);
 
 	zlinux_buffer_params_destroy(params);
+	fb->params_legacy = NULL;
 }
 
 static void
@@ -592,6 +1047,7 @@ dmabuf_legacy_create_failed(void *data, struct zlinux_buffer_params *params)
 	fb->buffer = NULL;
 
 	zlinux_buffer_params_destroy(params);
+	fb->params_legacy = NULL;
 
 	err("zlinux_buffer_params.create failed");
 
@@ -604,32 +1060,65 @@ static const struct zlinux_buffer_params_listener dmabuf_legacy_params_listener
 };
 
 static int
-format_is_supported(struct display *display, uint32_t format)
+format_find(struct display *display, uint32_t format, uint64_t modifier)
 {
 	int i;
 
 	for (i = 0; i < display->drm_format_count; i++) {
-		if (display->drm_formats[i] == format)
-			return 1;
+		if (display->drm_formats[i].format == format &&
+		    display->drm_formats[i].modifier == modifier)
+			return i;
 	}
 
-	return 0;
+	return -1;
+}
+
+/*
+ * Without modifier events (zwp_linux_dmabuf_v1 before version 3) a
+ * format is only known to be taken with its implicit layout, which is
+ * assumed to be the linear one.
+ */
+int
+display_supports(struct display *display, uint32_t format, uint64_t modifier)
+{
+	if (format_find(display, format, modifier) >= 0)
+		return 1;
+
+	return modifier == DRM_FORMAT_MOD_LINEAR &&
+	       format_find(display, format, DRM_FORMAT_MOD_INVALID) >= 0;
+}
+
+static void
+format_add(struct display *d, uint32_t format, uint64_t modifier)
+{
+	if (format_find(d, format, modifier) >= 0)
+		return;
+
+	if (d->drm_format_count == MAX_DRM_FORMATS) {
+		dbg("format %.4s modifier %llx ignored, too many",
+		    (char *)&format, (unsigned long long)modifier);
+		return;
+	}
+
+	d->drm_formats[d->drm_format_count].format = format;
+	d->drm_formats[d->drm_format_count].modifier = modifier;
+	d->drm_format_count++;
 }
 
 struct fb *
 window_create_buffer(struct window *window, int group, int index, int fd,
-		     uint32_t format, int width, int height, int n_planes,
-		     const int *plane_offsets, const int *plane_strides)
+		     uint32_t format, uint64_t modifier, int width, int height,
+		     int n_planes, const int *plane_offsets,
+		     const int *plane_strides)
 {
 	struct display *display = window->display;
 	struct fb *fb;
 
-#if 0
-	if (!format_is_supported(display, format)) {
-		err("unsupported display format");
+	if (!display_supports(display, format, modifier)) {
+		err("display format %.4s modifier %llx not supported",
+		    (char *)&format, (unsigned long long)modifier);
 		return NULL;
 	}
-#endif
 
 	if (n_planes <= 0 || n_planes > FB_MAX_PLANES) {
 		err("invalid number of planes");
@@ -641,6 +1130,7 @@ window_create_buffer(struct window *window, int group, int index, int fd,
 	fb->index = index;
 	fb->fd = fd;
 	fb->format = format;
+	fb->modifier = modifier;
 	fb->width = width;
 	fb->height = height;
 	fb->window = window;
@@ -653,19 +1143,35 @@ window_create_buffer(struct window *window, int group, int index, int fd,
 
 	INIT_LIST_HEAD(&fb->link);
 
+	/*
+	 * No roundtrip here: the params stay around for the reply, or for
+	 * the failed event of create_immed, and are destroyed with the fb.
+	 */
 	if (display->dmabuf) {
 		struct zwp_linux_buffer_params_v1 *params =
-			zwp_linux_dmabuf_v1_create_params(display->dmabuf);
+			zwp_linux_dmabuf_v1_create_params(window->dmabuf);
 
 		for (int i = 0; i < fb->n_planes; i++) {
 			zwp_linux_buffer_params_v1_add(params, fb->fd, i,
 						       fb->offsets[i],
-						       fb->strides[i], 0, 0);
+						       fb->strides[i],
+						       fb->modifier >> 32,
+						       fb->modifier & 0xffffffff);
 		}
 
+		fb->params = params;
 		zwp_linux_buffer_params_v1_add_listener(params, &params_listener, fb);
-		zwp_linux_buffer_params_v1_create(params, fb->width, fb->height,
-						  fb->format, 0);
+
+		if (display->dmabuf_version >= 2) {
+			fb->buffer = zwp_linux_buffer_params_v1_create_immed(
+				params, fb->width, fb->height, fb->format, 0);
+			wl_buffer_add_listener(fb->buffer, &buffer_listener,
+					       fb);
+		} else {
+			zwp_linux_buffer_params_v1_create(params, fb->width,
+							  fb->height,
+							  fb->format, 0);
+		}
 	} else {
 		struct zlinux_buffer_params *params =
 			zlinux_dmabuf_create_params(display->dmabuf_legacy);
@@ -673,21 +1179,17 @@ window_create_buffer(struct window *window, int group, int index, int fd,
 		for (int i = 0; i < fb->n_planes; i++) {
 			zlinux_buffer_params_add(params, fb->fd, i,
 						 fb->offsets[i],
-						 fb->strides[i], 0, 0);
+						 fb->strides[i],
+						 fb->modifier >> 32,
+						 fb->modifier & 0xffffffff);
 		}
 
+		fb->params_legacy = params;
 		zlinux_buffer_params_add_listener(params, &dmabuf_legacy_params_listener, fb);
 		zlinux_buffer_params_create(params, fb->width, fb->height,
 					    fb->format, 0);
 	}
 
-	wl_display_roundtrip(display->display);
-
-	if (!fb->buffer) {
-		fb_destroy(fb);
-		return NULL;
-	}
-
 	return fb;
 }
 
@@ -700,36 +1202,86 @@ window_show_buffer(struct window *window, struct fb *fb,
 
 	dbg("present buffer %d", fb->index);
 
+	pthread_mutex_lock(&window->display->lock);
+
 	window->buffer = fb;
 
 	if (window->configured) {
 		window_recenter(window);
 		window_commit(window);
 	}
+
+	pthread_mutex_unlock(&window->display->lock);
+}
+
+int
+window_get_fd(struct window *w)
+{
+	return w->wake_fd;
+}
+
+int
+window_dispatch(struct window *w)
+{
+	struct display *display = w->display;
+	eventfd_t n;
+	int ret;
+
+	eventfd_read(w->wake_fd, &n);
+
+	pthread_mutex_lock(&display->lock);
+	ret = wl_display_dispatch_queue_pending(display->display, w->queue);
+	pthread_mutex_unlock(&display->lock);
+
+	if (ret < 0 ||
+	    (wl_display_flush(display->display) < 0 && errno != EAGAIN))
+		return -1;
+
+	return 0;
+}
+
+int
+window_roundtrip(struct window *w)
+{
+	struct display *display = w->display;
+	int ret;
+
+	if (!w->queue)
+		return wl_display_roundtrip(display->display);
+
+	pthread_mutex_lock(&display->lock);
+	ret = wl_display_roundtrip_queue(display->display, w->queue);
+	pthread_mutex_unlock(&display->lock);
+
+	return ret;
 }
 
 static void
 dmabuf_format(void *data, struct zwp_linux_dmabuf_v1 *zwp_linux_dmabuf,
 	      uint32_t format)
 {
-	struct display *d = data;
+	format_add(data, format, DRM_FORMAT_MOD_INVALID);
+}
 
-	assert(d->drm_format_count <= 32);
-	d->drm_formats[d->drm_format_count++] = format;
+/* Version 3, sent along with the format events */
+static void
+dmabuf_modifier(void *data, struct zwp_linux_dmabuf_v1 *zwp_linux_dmabuf,
+		uint32_t format, uint32_t modifier_hi, uint32_t modifier_lo)
+{
+	format_add(data, format,
+		   ((uint64_t)modifier_hi << 32) | modifier_lo);
 }
 
 static const struct zwp_linux_dmabuf_v1_listener dmabuf_listener = {
-	dmabuf_format
+	dmabuf_format,
+	dmabuf_modifier
 };
 
 static void
 dmabuf_legacy_format(void *data, struct zlinux_dmabuf *zlinux_dmabuf,
 		     uint32_t format)
 {
-	struct display *d = data;
-
-	assert(d->drm_format_count <= 32);
-	d->drm_formats[d->drm_format_count++] = format;
+	format_add(data, format, DRM_FORMAT_MOD_INVALID);
 }
 
 static const struct zlinux_dmabuf_listener dmabuf_legacy_listener = {
@@ -852,6 +1404,12 @@ registry_handle_global(void *data, struct wl_registry *registry,
 		d->compositor = wl_registry_bind(registry, id,
 						 &wl_compositor_interface,
 						 d->compositor_version);
+	} else if (!strcmp(interface, "wl_subcompositor")) {
+		d->subcompositor = wl_registry_bind(registry, id,
+						    &wl_subcompositor_interface,
+						    1);
+	} else if (!strcmp(interface, "wl_shm")) {
+		d->shm = wl_registry_bind(registry, id, &wl_shm_interface, 1);
 	} else if (!strcmp(interface, "wp_viewporter")) {
 		d->viewporter = wl_registry_bind(registry, id,
 						 &wp_viewporter_interface, 1);
@@ -862,6 +1420,8 @@ registry_handle_global(void *data, struct wl_registry *registry,
 		d->presentation = wl_registry_bind(registry, id,
 						   &wp_presentation_interface,
 						   1);
+		wp_presentation_add_listener(d->presentation,
+					     &presentation_listener, d);
 	} else if (!strcmp(interface, "zxdg_shell_v6")) {
 		d->xdg_shell = wl_registry_bind(registry, id,
 						&zxdg_shell_v6_interface, 1);
@@ -871,8 +1431,11 @@ registry_handle_global(void *data, struct wl_registry *registry,
 		d->wl_shell = wl_registry_bind(registry, id,
 					       &wl_shell_interface, 1);
 	} else if (!strcmp(interface, "zwp_linux_dmabuf_v1")) {
+		/* version 2 has create_immed, 3 the modifiers */
+		d->dmabuf_version = MIN(version, 3);
 		d->dmabuf = wl_registry_bind(registry, id,
-					     &zwp_linux_dmabuf_v1_interface, 1);
+					     &zwp_linux_dmabuf_v1_interface,
+					     d->dmabuf_version);
 		zwp_linux_dmabuf_v1_add_listener(d->dmabuf, &dmabuf_listener,
 						 d);
 	} else if (!strcmp(interface, "zlinux_dmabuf")) {
@@ -902,6 +1465,13 @@ static const struct wl_registry_listener registry_listener = {
 void
 display_destroy(struct display *display)
 {
+	if (display->thread_started) {
+		eventfd_write(display->stop_fd, 1);
+		pthread_join(display->thread, NULL);
+	}
+	if (display->stop_fd >= 0)
+		close(display->stop_fd);
+
 	if (display->seat) {
 		seat_handle_capabilities(display, display->seat, 0);
 		wl_seat_destroy(display->seat);
@@ -915,6 +1485,10 @@ display_destroy(struct display *display)
 		wp_presentation_destroy(display->presentation);
 	if (display->compositor)
 		wl_compositor_destroy(display->compositor);
+	if (display->subcompositor)
+		wl_subcompositor_destroy(display->subcompositor);
+	if (display->shm)
+		wl_shm_destroy(display->shm);
 	if (display->xdg_shell)
 		zxdg_shell_v6_destroy(display->xdg_shell);
 	if (display->wl_shell)
@@ -927,6 +1501,7 @@ display_destroy(struct display *display)
 		wl_registry_destroy(display->registry);
 	if (display->display)
 		wl_display_disconnect(display->display);
+	pthread_mutex_destroy(&display->lock);
 	free(display);
 }
 
@@ -934,11 +1509,20 @@ struct display *
 display_create(void)
 {
 	struct display *display;
+	pthread_mutexattr_t attr;
 
 	display = calloc(1, sizeof *display);
 	if (!display)
 		return NULL;
 
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&display->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	display->stop_fd = -1;
+	wl_list_init(&display->window_list);
+
 	display->display = wl_display_connect(NULL);
 	if (!display->display) {
 		err("failed to connect to wayland display: %m");
@@ -949,6 +1533,8 @@ display_create(void)
 	wl_registry_add_listener(display->registry, &registry_listener,
 				 display);
 
+	/* the globals, then what they sent once bound: formats, clock */
+	wl_display_roundtrip(display->display);
 	wl_display_roundtrip(display->display);
 
 	if (!display->xdg_shell && !display->wl_shell) {
@@ -961,8 +1547,6 @@ display_create(void)
 		goto fail;
 	}
 
-	wl_list_init(&display->window_list);
-
 	display->running = 1;
 
 	return display;
@@ -978,6 +1562,104 @@ display_is_running(struct display *display)
 	return display->running;
 }
 
+void
+display_exit(struct display *display)
+{
+	display->running = 0;
+}
+
+static void
+display_wake_panes(struct display *display)
+{
+	struct window *w;
+
+	wl_list_for_each(w, &display->window_list, link) {
+		if (w->wake_fd >= 0)
+			eventfd_write(w->wake_fd, 1);
+	}
+}
+
+/* Reads for every thread, dispatches the default queue, wakes the panes
+ * up to dispatch theirs */
+static void *
+display_thread(void *data)
+{
+	struct display *display = data;
+	struct pollfd pfd[2] = {
+		{ .fd = wl_display_get_fd(display->display), .events = POLLIN },
+		{ .fd = display->stop_fd, .events = POLLIN },
+	};
+
+	while (display->running) {
+		pthread_mutex_lock(&display->lock);
+		while (wl_display_prepare_read(display->display))
+			wl_display_dispatch_pending(display->display);
+		pthread_mutex_unlock(&display->lock);
+
+		pfd[0].events = POLLIN;
+		if (wl_display_flush(display->display) < 0) {
+			if (errno != EAGAIN) {
+				wl_display_cancel_read(display->display);
+				break;
+			}
+			pfd[0].events |= POLLOUT;
+		}
+
+		if (poll(pfd, 2, -1) < 0 && errno != EINTR) {
+			wl_display_cancel_read(display->display);
+			break;
+		}
+
+		if (pfd[1].revents) {
+			wl_display_cancel_read(display->display);
+			return NULL;
+		}
+
+		if (!(pfd[0].revents & (POLLIN | POLLERR | POLLHUP))) {
+			wl_display_cancel_read(display->display);
+			continue;
+		}
+
+		if (wl_display_read_events(display->display) < 0)
+			break;
+
+		pthread_mutex_lock(&display->lock);
+		wl_display_dispatch_pending(display->display);
+		display_wake_panes(display);
+		pthread_mutex_unlock(&display->lock);
+	}
+
+	/* a break, not display_exit() */
+	if (display->running)
+		err("wayland connection failed: %m");
+
+	/* the panes find out on their next dispatch */
+	pthread_mutex_lock(&display->lock);
+	display->running = 0;
+	display_wake_panes(display);
+	pthread_mutex_unlock(&display->lock);
+
+	return NULL;
+}
+
+int
+display_start_thread(struct display *display)
+{
+	display->stop_fd = eventfd(0, EFD_CLOEXEC);
+	if (display->stop_fd < 0)
+		return -1;
+
+	if (pthread_create(&display->thread, NULL, display_thread, display)) {
+		close(display->stop_fd);
+		display->stop_fd = -1;
+		return -1;
+	}
+
+	display->thread_started = true;
+
+	return 0;
+}
+
 struct wl_display *
 display_get_wl_display(struct display *display)
 {
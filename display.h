@@ -16,8 +16,40 @@ typedef void (*fb_release_cb_t)(struct fb *fb, void *data);
 typedef void (*window_key_cb_t)(struct window *w, uint32_t time, uint32_t key,
 				enum wl_keyboard_key_state state);
 
+/* wp_presentation feedback of a shown buffer */
+struct fb_presentation {
+	int presented;		/* 0 if discarded, nothing else is set */
+	uint64_t time_us;	/* CLOCK_MONOTONIC, on the glass */
+	uint32_t refresh_ns;	/* 0 if not known */
+	uint64_t msc;		/* vertical retrace counter, 0 if none */
+	uint32_t flags;		/* WP_PRESENTATION_FEEDBACK_KIND_* */
+};
+
+typedef void (*window_present_cb_t)(struct window *w, struct fb *fb,
+				    const struct fb_presentation *p);
+
+/* The compositor is ready for a new frame */
+typedef void (*window_frame_cb_t)(struct window *w);
+
+/* Surface commits and the requests they took, viewport ones included */
+struct window_stats {
+	uint64_t commits;
+	uint64_t requests;
+};
+
 #define FB_MAX_PLANES 3
 
+/* Layout modifiers, as in drm_fourcc.h */
+#ifndef DRM_FORMAT_MOD_LINEAR
+#define DRM_FORMAT_MOD_LINEAR		0ULL
+#endif
+#ifndef DRM_FORMAT_MOD_INVALID
+#define DRM_FORMAT_MOD_INVALID		0x00ffffffffffffffULL
+#endif
+#ifndef DRM_FORMAT_MOD_QCOM_COMPRESSED
+#define DRM_FORMAT_MOD_QCOM_COMPRESSED	((0x05ULL << 56) | 1)
+#endif
+
 struct fb {
 	struct window *window;
 	int group;
@@ -32,9 +64,11 @@ struct fb {
 	int ar_x, ar_y;
 	int crop_x, crop_y, crop_w, crop_h;
 	uint32_t format;
+	uint64_t modifier;
 	struct list_head link;
-	struct wl_buffer *buffer;
-	struct wl_callback *sync_callback;
+	struct wl_buffer *buffer;	/* NULL until the compositor made it */
+	struct zwp_linux_buffer_params_v1 *params;
+	struct zlinux_buffer_params *params_legacy;
 	struct wp_presentation_feedback *presentation_feedback;
 	fb_release_cb_t release_cb;
 	void *cb_data;
@@ -44,20 +78,57 @@ struct wl_display *display_get_wl_display(struct display *display);
 
 struct display *display_create(void);
 int display_is_running(struct display *display);
+/* display_is_running() is 0 from now on */
+void display_exit(struct display *display);
 struct window *display_create_window(struct display *display);
 void display_destroy(struct display *display);
 
+/* The compositor takes dmabufs of this DRM format and layout modifier */
+int display_supports(struct display *display, uint32_t format,
+		     uint64_t modifier);
+
+/*
+ * Mosaic: panes are subsurfaces of a window, laid out in a grid and each
+ * scaled to its cell by its own viewport.  They are synchronized, so the
+ * frames of every pane reach the screen together, with the commit of
+ * the window done at most once a refresh.
+ *
+ * Each pane can be fed from its own thread: once display_start_thread()
+ * reads the connection, the events of a pane are only dispatched by
+ * window_dispatch() when window_get_fd() is readable.
+ */
+struct window *window_create_pane(struct window *parent);
+int display_start_thread(struct display *display);
+int window_get_fd(struct window *w);
+int window_dispatch(struct window *w);
+
+/* Waits for the replies to what was sent so far, on the window queue */
+int window_roundtrip(struct window *w);
+
 void window_set_user_data(struct window *w, void *data);
 void *window_get_user_data(struct window *w);
 void window_set_key_callback(struct window *w, window_key_cb_t handler);
+/* Needs wp_presentation, fb->cb_data is still the one given to show;
+ * without one no feedback is asked for */
+void window_set_present_callback(struct window *w, window_present_cb_t handler);
+/* Commits then ask for a wl_surface frame callback */
+void window_set_frame_callback(struct window *w, window_frame_cb_t handler);
+/* The last commit was not drawn yet */
+int window_frame_pending(struct window *w);
+void window_get_stats(struct window *w, struct window_stats *st);
 void window_set_aspect_ratio(struct window *w, int ar_x, int ar_y);
 void window_toggle_fullscreen(struct window *w);
 
 void window_show_buffer(struct window *window, struct fb *fb,
 			fb_release_cb_t release_cb, void *cb_data);
+
+/* Does not wait for the compositor: with zwp_linux_dmabuf_v1 version 2
+ * fb->buffer is there right away, else it comes with the reply and one
+ * wl_display_roundtrip() waits for all the buffers asked for */
 struct fb *window_create_buffer(struct window *window, int group, int index,
-				int fd, uint32_t format, int width, int height,
-				int n_planes, const int *plane_offsets,
+				int fd, uint32_t format, uint64_t modifier,
+				int width, int height, int n_planes,
+				const int *plane_offsets,
 				const int *plane_strides);
 void window_destroy(struct window *window);
 
@@ -0,0 +1,116 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Frame archive file format header file
+ *
+ * Written by the dump sink (--sink=dump:<path>), every part is aligned
+ * to DUMP_BLOCK bytes so it can be written with O_DIRECT and any frame
+ * used in place from a mapping of the file:
+ *
+ *	struct dump_file_header, padded to DUMP_BLOCK
+ *	for every frame:
+ *		struct dump_frame_header, padded to DUMP_BLOCK
+ *		the planes packed one after the other, padded to DUMP_BLOCK
+ *	struct dump_index_entry for every frame
+ *
+ * The index and the frame count of the file header are written when
+ * the sink is closed, index_offset is 0 until then.  Frame headers are
+ * enough to rebuild the index of a file that was not closed: records
+ * are taken up to the first one with a bad header or check.
+ *
+ * client/dump_file.h reads these files.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef INCLUDE_DUMP_H
+#define INCLUDE_DUMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define DUMP_MAGIC		0x504d5544	/* "DUMP" */
+#define DUMP_FRAME_MAGIC	0x4d415246	/* "FRAM" */
+#define DUMP_VERSION		2
+
+#define DUMP_BLOCK		4096
+#define DUMP_ALIGN(x)		(((x) + DUMP_BLOCK - 1) & \
+				 ~(uint64_t)(DUMP_BLOCK - 1))
+
+struct dump_file_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t block_size;		/* DUMP_BLOCK */
+	uint32_t reserved;
+	uint64_t frames;
+	uint64_t index_offset;		/* 0 while being written */
+	uint64_t index_size;		/* bytes */
+};
+
+struct dump_frame_info {
+	uint64_t seq;			/* frame number */
+	uint64_t pts;
+	uint32_t fourcc;
+	uint32_t width;
+	uint32_t height;
+	uint32_t n_planes;
+	uint32_t plane_offset[2];	/* in the payload */
+	uint32_t plane_width[2];	/* bytes of a line, also the stride */
+	uint32_t plane_height[2];
+	uint32_t crop_left;		/* visible part, pixels */
+	uint32_t crop_top;
+	uint32_t crop_width;
+	uint32_t crop_height;
+	uint32_t size;			/* payload */
+	uint32_t reserved;
+	uint64_t check;			/* dump_check() of the payload */
+};
+
+struct dump_frame_header {
+	uint32_t magic;
+	uint32_t header_size;		/* payload follows at this offset */
+	uint32_t record_size;		/* header and padded payload */
+	uint32_t reserved;
+	struct dump_frame_info info;
+};
+
+struct dump_index_entry {
+	uint64_t offset;		/* of the frame header */
+	struct dump_frame_info info;
+};
+
+/* Position dependent sums of 64-bit words, catches the torn or never
+ * written pages of a crash at memory speed */
+static inline uint64_t dump_check(const void *data, size_t size)
+{
+	const uint8_t *p = data;
+	uint64_t a = 0, b = 0, w;
+	size_t n;
+
+	for (n = 0; n + 8 <= size; n += 8) {
+		memcpy(&w, p + n, 8);
+		a += w;
+		b += a;
+	}
+
+	for (; n < size; n++) {
+		a += p[n];
+		b += a;
+	}
+
+	return a ^ (b * 0x9e3779b97f4a7c15ULL);
+}
+
+#endif /* INCLUDE_DUMP_H */
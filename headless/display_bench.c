@@ -0,0 +1,603 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Display path benchmark
+ *
+ * Feeds NV12 frames at a given rate through the wayland sink, the same
+ * display.c and sink_wayland.c code v4l2_decode runs, into wl_headless
+ * (spawned on a private socket) or any compositor already running.  No
+ * decoder is involved, so what is measured is the display path alone:
+ *
+ *  - the cost of a wl_display_roundtrip() on the connection
+ *  - how long announcing the buffer pool takes
+ *  - how long the compositor keeps each buffer, and how often the
+ *    producer waits for one to come back
+ *  - presentation: frames shown and discarded, vsyncs missed, and the
+ *    decode to present, refresh interval and jitter histograms
+ *
+ * With -u the frames are laid out as the decoder UBWC ones, a single
+ * opaque plane, and shown with the compressed modifier.
+ *
+ *	display_bench [-n <frames>] [-b <buffers>] [-s <w>x<h>] [-f <fps>]
+ *		      [-m] [-i] [-u] [-c <compositor>] [-r <Hz>] [-S <n>]
+ *		      [-V <v>] [-k] [-v]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <wayland-client.h>
+
+#include "common.h"
+#include "ubwc.h"
+#include "video.h"
+
+#define DBG_TAG "  bench"
+
+/* Roundtrips timed on a connection of its own */
+#define BENCH_ROUNDTRIPS	200
+
+/* How long the compositor gets to come up, and the last frames to show */
+#define BENCH_CONNECT_US	(2 * 1000 * 1000)
+#define BENCH_DRAIN_US		(200 * 1000)
+
+extern char **environ;
+
+struct bench_buf {
+	int fd;
+	void *addr;
+	int busy;
+};
+
+struct bench {
+	struct instance i;
+
+	int frames;
+	int n_bufs;
+	int width;
+	int height;
+	int stride;
+	size_t size;
+	int fps;
+	int ion;
+	int ubwc;
+	struct ubwc_layout layout;
+
+	struct bench_buf buf[MAX_CAP_BUF];
+	int busy;
+
+	uint64_t waits;
+	uint64_t wait_start_us;
+	struct metrics_hist wait;	/* frame due to a buffer coming back */
+	struct metrics_hist roundtrip;
+	uint64_t pool_us;
+
+	pid_t compositor;
+	char runtime_dir[64];
+};
+
+static struct bench bench;
+
+static int bench_free_buf(struct bench *b)
+{
+	for (int n = 0; n < b->n_bufs; n++) {
+		if (!b->buf[n].busy)
+			return n;
+	}
+
+	return -1;
+}
+
+static void bench_release(struct instance *i, struct sink_frame *f)
+{
+	struct bench *b = &bench;
+
+	b->buf[f->index].busy = 0;
+	b->busy--;
+
+	if (b->wait_start_us) {
+		metrics_hist_add(&b->wait, metrics_now_us() - b->wait_start_us);
+		b->wait_start_us = 0;
+	}
+
+	free(f);
+}
+
+static void bench_describe(struct bench *b, int n, struct sink_frame *f)
+{
+	size_t luma = (size_t)b->stride * b->height;
+
+	memset(f, 0, sizeof (*f));
+
+	if (b->ubwc) {
+		f->fourcc = V4L2_PIX_FMT_NV12_UBWC;
+		f->n_planes = 1;
+		f->plane[0] = (struct sink_plane) {
+			.addr = b->buf[n].addr, .fd = b->buf[n].fd,
+			.stride = b->layout.y_stride, .width = b->size,
+			.height = 1,
+		};
+	} else {
+		f->fourcc = V4L2_PIX_FMT_NV12;
+		f->n_planes = 2;
+		f->plane[0] = (struct sink_plane) {
+			.addr = b->buf[n].addr, .fd = b->buf[n].fd,
+			.offset = 0, .stride = b->stride, .width = b->width,
+			.height = b->height,
+		};
+		f->plane[1] = (struct sink_plane) {
+			.addr = (uint8_t *)b->buf[n].addr + luma,
+			.fd = b->buf[n].fd, .offset = luma,
+			.stride = b->stride, .width = b->width,
+			.height = b->height / 2,
+		};
+	}
+
+	f->width = b->width;
+	f->height = b->height;
+	f->crop.width = b->width;
+	f->crop.height = b->height;
+	f->group = 0;
+	f->index = n;
+}
+
+static int bench_alloc(struct bench *b)
+{
+	b->stride = (b->width + 127) & ~127;
+	b->size = (size_t)b->stride * b->height * 3 / 2;
+
+	if (b->ubwc) {
+		ubwc_layout_nv12(&b->layout, b->width, b->height);
+		b->size = b->layout.size;
+	}
+
+	for (int n = 0; n < b->n_bufs; n++) {
+		struct bench_buf *buf = &b->buf[n];
+
+		if (b->ion) {
+			buf->fd = alloc_ion_buffer(b->size, 0);
+		} else {
+			buf->fd = memfd_create("display_bench", MFD_CLOEXEC);
+			if (buf->fd >= 0 && ftruncate(buf->fd, b->size)) {
+				close(buf->fd);
+				buf->fd = -1;
+			}
+		}
+
+		if (buf->fd < 0) {
+			err("cannot allocate buffer %d of %zu bytes", n,
+			    b->size);
+			return -1;
+		}
+
+		buf->addr = mmap(NULL, b->size, PROT_READ | PROT_WRITE,
+				 MAP_SHARED, buf->fd, 0);
+		if (buf->addr == MAP_FAILED) {
+			err("cannot map buffer %d: %m", n);
+			buf->addr = NULL;
+			return -1;
+		}
+
+		/* black, and every page faulted in before timing starts;
+		 * UBWC ones only need the pages, nobody looks at them */
+		if (b->ubwc) {
+			memset(buf->addr, 0, b->size);
+			continue;
+		}
+
+		memset(buf->addr, 16, (size_t)b->stride * b->height);
+		memset((uint8_t *)buf->addr + (size_t)b->stride * b->height,
+		       128, b->size - (size_t)b->stride * b->height);
+	}
+
+	return 0;
+}
+
+static void bench_free(struct bench *b)
+{
+	for (int n = 0; n < b->n_bufs; n++) {
+		if (b->buf[n].addr)
+			munmap(b->buf[n].addr, b->size);
+		if (b->buf[n].fd >= 0)
+			close(b->buf[n].fd);
+	}
+}
+
+static int bench_spawn(struct bench *b, const char *path, char **extra)
+{
+	char socket_name[32];
+	char *argv[16];
+	int argc = 0;
+
+	/* libwayland wants one, a box without a session may not have it */
+	if (!getenv("XDG_RUNTIME_DIR")) {
+		snprintf(b->runtime_dir, sizeof (b->runtime_dir),
+			 "/tmp/display_bench.XXXXXX");
+		if (!mkdtemp(b->runtime_dir)) {
+			err("cannot create a runtime directory: %m");
+			b->runtime_dir[0] = '\0';
+			return -1;
+		}
+		setenv("XDG_RUNTIME_DIR", b->runtime_dir, 1);
+	}
+
+	snprintf(socket_name, sizeof (socket_name), "display-bench-%d",
+		 (int)getpid());
+	setenv("WAYLAND_DISPLAY", socket_name, 1);
+
+	argv[argc++] = (char *)path;
+	argv[argc++] = "-s";
+	argv[argc++] = socket_name;
+	while (*extra && argc < (int)ARRAY_LENGTH(argv) - 1)
+		argv[argc++] = *extra++;
+	argv[argc] = NULL;
+
+	errno = posix_spawn(&b->compositor, path, NULL, NULL, argv, environ);
+	if (errno) {
+		err("cannot run %s: %m", path);
+		b->compositor = 0;
+		return -1;
+	}
+
+	info("compositor %s on %s, pid %d", path, socket_name,
+	     (int)b->compositor);
+
+	return 0;
+}
+
+static void bench_stop(struct bench *b)
+{
+	if (b->compositor) {
+		/* it prints what it saw on its way out */
+		kill(b->compositor, SIGTERM);
+		waitpid(b->compositor, NULL, 0);
+		b->compositor = 0;
+	}
+
+	if (b->runtime_dir[0])
+		rmdir(b->runtime_dir);
+}
+
+/* Waits for the compositor to listen, then times bare roundtrips */
+static int bench_roundtrips(struct bench *b)
+{
+	uint64_t deadline = metrics_now_us() + BENCH_CONNECT_US;
+	struct wl_display *display;
+
+	while (!(display = wl_display_connect(NULL))) {
+		if (metrics_now_us() > deadline) {
+			err("cannot connect to %s", getenv("WAYLAND_DISPLAY"));
+			return -1;
+		}
+		usleep(10 * 1000);
+	}
+
+	for (int n = 0; n < BENCH_ROUNDTRIPS; n++) {
+		uint64_t start = metrics_now_us();
+
+		if (wl_display_roundtrip(display) < 0) {
+			err("roundtrip failed");
+			wl_display_disconnect(display);
+			return -1;
+		}
+
+		metrics_hist_add(&b->roundtrip, metrics_now_us() - start);
+	}
+
+	wl_display_disconnect(display);
+
+	return 0;
+}
+
+static int bench_run(struct bench *b)
+{
+	struct instance *i = &b->i;
+	uint64_t period = b->fps ? 1000000 / b->fps : 0;
+	uint64_t next_us, start, drain_us = 0;
+	struct sink_frame pool[MAX_CAP_BUF];
+	int produced = 0;
+
+	for (int n = 0; n < b->n_bufs; n++)
+		bench_describe(b, n, &pool[n]);
+
+	start = metrics_now_us();
+	sinks_pool(i, pool, b->n_bufs);
+	b->pool_us = metrics_now_us() - start;
+
+	next_us = metrics_now_us();
+
+	for (;;) {
+		struct pollfd pfd[SINK_MAX];
+		struct timespec ts, *timeout = NULL;
+		uint64_t now = metrics_now_us();
+		int n, nfds;
+
+		if (produced == b->frames) {
+			if (!drain_us)
+				drain_us = now + BENCH_DRAIN_US;
+			if (now >= drain_us)
+				break;
+		}
+
+		if (produced < b->frames && now >= next_us) {
+			n = bench_free_buf(b);
+			if (n >= 0) {
+				struct sink_frame *f = malloc(sizeof (*f));
+
+				if (!f)
+					return -1;
+
+				bench_describe(b, n, f);
+				f->seq = produced++;
+				f->pts = f->seq * period;
+				f->decoded = now;
+				f->release = bench_release;
+
+				b->buf[n].busy = 1;
+				b->busy++;
+
+				metrics_frame_decoded(&i->metrics, 0);
+				sinks_deliver(i, f);
+
+				next_us = period ? next_us + period : now;
+				/* a late producer does not catch up in a burst */
+				if (next_us < now)
+					next_us = now;
+				continue;
+			}
+
+			if (!b->wait_start_us) {
+				b->wait_start_us = now;
+				b->waits++;
+			}
+		}
+
+		/* woken by the buffer release otherwise */
+		if (produced < b->frames && b->busy < b->n_bufs) {
+			uint64_t left = next_us > now ? next_us - now : 0;
+
+			ts.tv_sec = left / 1000000;
+			ts.tv_nsec = (left % 1000000) * 1000;
+			timeout = &ts;
+		} else if (drain_us) {
+			uint64_t left = drain_us > now ? drain_us - now : 0;
+
+			ts.tv_sec = left / 1000000;
+			ts.tv_nsec = (left % 1000000) * 1000;
+			timeout = &ts;
+		}
+
+		if (sinks_prepare(i))
+			return -1;
+
+		nfds = sinks_get_fds(i, pfd);
+
+		if (ppoll(pfd, nfds, timeout, NULL) < 0 && errno != EINTR) {
+			err("poll failed: %m");
+			return -1;
+		}
+
+		if (sinks_dispatch(i, pfd, nfds))
+			return -1;
+
+		metrics_update(i, 0);
+	}
+
+	metrics_update(i, 1);
+
+	return 0;
+}
+
+static void bench_report(struct bench *b)
+{
+	const struct metrics_data *d = &b->i.metrics.cur;
+
+	info("%d frames of %dx%d NV12 in %d %s buffers at %d fps",
+	     b->frames, b->width, b->height, b->n_bufs,
+	     b->ion ? "ION" : "memfd", b->fps);
+
+	metrics_report_hist("roundtrip", &b->roundtrip);
+
+	info("pool of %d buffers announced in %llu us", b->n_bufs,
+	     (unsigned long long)b->pool_us);
+
+	info("waited %llu times for a buffer to come back",
+	     (unsigned long long)b->waits);
+	metrics_report_hist("buffer wait", &b->wait);
+
+	info("presented %llu frames, %llu discarded, %llu vsyncs missed",
+	     (unsigned long long)d->frames_presented,
+	     (unsigned long long)d->frames_discarded,
+	     (unsigned long long)d->vsync_misses);
+
+	metrics_report_hist("decode to present", &d->present_latency);
+	metrics_report_hist("refresh interval", &d->refresh_interval);
+	metrics_report_hist("present jitter", &d->present_jitter);
+
+	if (d->display_commits)
+		info("%llu surface commits, %.2f requests each",
+		     (unsigned long long)d->display_commits,
+		     (double)d->display_requests / d->display_commits);
+
+	sinks_report(&b->i);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-n <frames>] [-b <buffers>] [-s <w>x<h>] "
+		"[-f <fps>] [-m] [-i] [-u]\n"
+		"       [-c <compositor>] [-r <Hz>] [-S <n>] [-V <v>] [-k] "
+		"[-v]\n"
+		"  -n  frames to show (600)\n"
+		"  -b  producer buffers (4)\n"
+		"  -s  frame size (1920x1080)\n"
+		"  -f  frame rate, 0 for as fast as buffers come back "
+		"(refresh rate)\n"
+		"  -m  mailbox mode, wayland:mailbox\n"
+		"  -i  ION buffers instead of memfds\n"
+		"  -u  UBWC frames, the compositor needs the modifier\n"
+		"  -c  compositor to run (wl_headless next to this binary)\n"
+		"  -r, -S, -V  passed to the compositor\n"
+		"  -k  use the compositor at $WAYLAND_DISPLAY, run none\n"
+		"  -v  more output\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench *b = &bench;
+	char *extra[8], rate[16] = "60";
+	char *compositor = NULL;
+	int n_extra = 0, mailbox = 0, keep = 0, opt, ret = 1;
+
+	b->frames = 600;
+	b->n_bufs = 4;
+	b->width = 1920;
+	b->height = 1080;
+	b->fps = -1;
+	debug_level = 2;
+
+	for (int n = 0; n < MAX_CAP_BUF; n++)
+		b->buf[n].fd = -1;
+
+	while ((opt = getopt(argc, argv, "n:b:s:f:miuc:r:S:V:kvh")) != -1) {
+		switch (opt) {
+		case 'n':
+			b->frames = atoi(optarg);
+			break;
+		case 'b':
+			b->n_bufs = atoi(optarg);
+			break;
+		case 's':
+			if (sscanf(optarg, "%dx%d", &b->width,
+				   &b->height) != 2) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'f':
+			b->fps = atoi(optarg);
+			break;
+		case 'm':
+			mailbox = 1;
+			break;
+		case 'i':
+			b->ion = 1;
+			break;
+		case 'u':
+			b->ubwc = 1;
+			break;
+		case 'c':
+			compositor = optarg;
+			break;
+		case 'r':
+			snprintf(rate, sizeof (rate), "%s", optarg);
+			/* fall through */
+		case 'S':
+		case 'V':
+			extra[n_extra++] = opt == 'r' ? "-r" :
+					   opt == 'S' ? "-S" : "-V";
+			extra[n_extra++] = optarg;
+			break;
+		case 'k':
+			keep = 1;
+			break;
+		case 'v':
+			debug_level++;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	extra[n_extra] = NULL;
+
+	if (optind != argc || b->frames <= 0 || b->n_bufs <= 0 ||
+	    b->n_bufs > MAX_CAP_BUF || b->width <= 0 || b->height <= 0 ||
+	    (b->width | b->height) & 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* the compositor refresh rate, what a player would feed */
+	if (b->fps < 0)
+		b->fps = atoi(rate);
+
+	if (!keep) {
+		if (!compositor) {
+			const char *slash = strrchr(argv[0], '/');
+			int len = slash ? (int)(slash - argv[0]) + 1 : 0;
+
+			compositor = malloc(len + sizeof ("wl_headless"));
+			if (!compositor)
+				return 1;
+			sprintf(compositor, "%.*swl_headless", len, argv[0]);
+		}
+
+		if (bench_spawn(b, compositor, extra))
+			goto out;
+	}
+
+	if (bench_roundtrips(b))
+		goto out;
+
+	if (metrics_init(&b->i.metrics, NULL, NULL))
+		goto out;
+
+	b->i.width = b->width;
+	b->i.height = b->height;
+	b->i.fps_n = b->fps;
+	b->i.fps_d = 1;
+	metrics_update(&b->i, 1);
+
+	if (bench_alloc(b))
+		goto out_metrics;
+
+	if (sinks_open(&b->i, mailbox ? "wayland:mailbox" : "wayland"))
+		goto out_free;
+
+	if (b->ubwc && !sinks_accept(&b->i, V4L2_PIX_FMT_NV12_UBWC)) {
+		err("the compositor has no UBWC modifier for NV12");
+		sinks_close(&b->i);
+		goto out_free;
+	}
+
+	if (!bench_run(b)) {
+		bench_report(b);
+		ret = 0;
+	}
+
+	sinks_close(&b->i);
+out_free:
+	bench_free(b);
+out_metrics:
+	metrics_close(&b->i.metrics);
+out:
+	bench_stop(b);
+
+	return ret;
+}
@@ -0,0 +1,1359 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Headless compositor stand-in
+ *
+ * Just enough of a Wayland compositor for the display path of
+ * v4l2_decode (display.c) to run unchanged on any Linux box, to test and
+ * benchmark it: wl_compositor, wl_subcompositor, wl_shm, xdg-shell v6,
+ * linux-dmabuf v1 (version 1 to 3), viewporter and presentation-time.
+ * Nothing is drawn.  Buffers are dmabufs or memfds, only checked to be
+ * large enough for the planes they are said to have; wl_shm ones are
+ * never released.  Synchronized subsurfaces cache their commits until
+ * their parent commits, as a mosaic of panes expects.  Version 3 of
+ * linux-dmabuf advertises the linear layout of every format and the
+ * Qualcomm compressed one (UBWC) of NV12, as an MSM compositor would.
+ *
+ * A virtual vsync latches the last buffer committed on every surface,
+ * sends its presentation feedback and frame callbacks, and releases the
+ * buffer it replaces.  A buffer replaced before a vsync is released at
+ * once and its feedback discarded.  -S makes the compositor slow, only
+ * every n-th vsync is drawn.
+ *
+ *	wl_headless [-s <socket>] [-r <Hz>] [-S <n>] [-V <1|2>] [-o <w>x<h>]
+ *
+ * runs until SIGINT or SIGTERM, then prints what it saw.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include <wayland-server.h>
+
+#include "viewporter-server-protocol.h"
+#include "presentation-time-server-protocol.h"
+#include "xdg-shell-unstable-v6-server-protocol.h"
+#include "linux-dmabuf-unstable-v1-server-protocol.h"
+
+#define HL_MAX_PLANES		4
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+#define HL_FOURCC(a, b, c, d)	((uint32_t)(a) | ((uint32_t)(b) << 8) | \
+				 ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+/* Layout modifiers, as in drm_fourcc.h */
+#define HL_MOD_LINEAR		0ULL
+#define HL_MOD_QCOM_COMPRESSED	((0x05ULL << 56) | 1)
+
+static const uint32_t hl_formats[] = {
+	HL_FOURCC('N', 'V', '1', '2'),
+	HL_FOURCC('R', '8', ' ', ' '),
+	HL_FOURCC('X', 'R', '2', '4'),
+	HL_FOURCC('A', 'R', '2', '4'),
+};
+
+struct hl_stats {
+	unsigned long commits;
+	unsigned long requests;		/* of every kind, from all clients */
+	unsigned long vsyncs;
+	unsigned long repaints;
+	unsigned long presented;
+	unsigned long discarded;
+	unsigned long released;
+	unsigned long created;		/* wl_buffers, create */
+	unsigned long created_immed;	/* wl_buffers, create_immed */
+	unsigned long compressed;	/* wl_buffers, UBWC */
+	unsigned long failed;
+	int buffers;
+	int buffers_max;
+};
+
+struct hl_compositor {
+	struct wl_display *display;
+	struct wl_list surfaces;
+
+	int dmabuf_version;
+	int output_width;
+	int output_height;
+
+	/* virtual vsync */
+	int timer_fd;
+	uint64_t refresh_ns;
+	uint64_t start_ns;
+	uint64_t msc;
+	int repaint_every;
+
+	struct hl_stats stats;
+};
+
+struct hl_buffer {
+	struct wl_resource *resource;
+	struct hl_compositor *c;
+	int fd[HL_MAX_PLANES];
+	int n_planes;
+	int width;
+	int height;
+	uint32_t format;
+};
+
+/* The state a commit moves from one stage to the next */
+struct hl_state {
+	int attached;
+	struct hl_buffer *buffer;
+	struct wl_list frames;		/* wl_callback */
+	struct wl_list feedbacks;	/* wp_presentation_feedback */
+};
+
+struct hl_surface {
+	struct wl_resource *resource;
+	struct hl_compositor *c;
+	struct wl_list link;
+
+	struct hl_state pending;	/* not committed yet */
+	struct hl_state cached;		/* synchronized, until the parent commits */
+	struct hl_state queued;		/* committed, for the next repaint */
+	struct hl_buffer *current;	/* on the virtual screen */
+
+	/* subsurfaces */
+	struct wl_resource *subsurface;
+	struct hl_surface *parent;
+	struct wl_list children;
+	struct wl_list child_link;
+	int sync;
+
+	struct wl_resource *toplevel;
+	struct wl_resource *xdg_surface;
+	uint32_t serial;
+};
+
+struct hl_params {
+	struct wl_resource *resource;
+	struct hl_compositor *c;
+	int fd[HL_MAX_PLANES];
+	uint32_t offset[HL_MAX_PLANES];
+	uint32_t stride[HL_MAX_PLANES];
+	uint64_t modifier[HL_MAX_PLANES];
+	int used;
+};
+
+static uint64_t hl_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void hl_unlink_resource(struct wl_resource *resource)
+{
+	wl_list_remove(wl_resource_get_link(resource));
+}
+
+static void hl_destroy_resource(struct wl_client *client,
+				struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void hl_not_supported(struct wl_resource *resource)
+{
+	wl_resource_post_error(resource, WL_DISPLAY_ERROR_INVALID_METHOD,
+			       "not supported by wl_headless");
+}
+
+static void hl_state_init(struct hl_state *st)
+{
+	st->attached = 0;
+	st->buffer = NULL;
+	wl_list_init(&st->frames);
+	wl_list_init(&st->feedbacks);
+}
+
+/* Hand over the callbacks of src, they are not discarded */
+static void hl_state_move(struct hl_state *dst, struct hl_state *src)
+{
+	wl_list_insert_list(dst->frames.prev, &src->frames);
+	wl_list_insert_list(dst->feedbacks.prev, &src->feedbacks);
+	wl_list_init(&src->frames);
+	wl_list_init(&src->feedbacks);
+
+	if (src->attached) {
+		dst->attached = 1;
+		dst->buffer = src->buffer;
+	}
+
+	src->attached = 0;
+	src->buffer = NULL;
+}
+
+static void hl_discard_feedbacks(struct hl_compositor *c, struct wl_list *list)
+{
+	struct wl_resource *fb, *next;
+
+	wl_resource_for_each_safe(fb, next, list) {
+		wp_presentation_feedback_send_discarded(fb);
+		wl_resource_destroy(fb);
+		c->stats.discarded++;
+	}
+}
+
+/* Released once neither on screen nor waiting for a repaint */
+static void hl_surface_release(struct hl_surface *s, struct hl_buffer *b)
+{
+	if (!b || b == s->current || b == s->queued.buffer ||
+	    b == s->cached.buffer)
+		return;
+
+	wl_buffer_send_release(b->resource);
+	s->c->stats.released++;
+}
+
+/* Buffers */
+
+static void hl_buffer_destroy(struct wl_resource *resource)
+{
+	struct hl_buffer *b = wl_resource_get_user_data(resource);
+	struct hl_surface *s;
+
+	wl_list_for_each(s, &b->c->surfaces, link) {
+		if (s->pending.buffer == b)
+			s->pending.buffer = NULL;
+		if (s->cached.buffer == b)
+			s->cached.buffer = NULL;
+		if (s->queued.buffer == b)
+			s->queued.buffer = NULL;
+		if (s->current == b)
+			s->current = NULL;
+	}
+
+	for (int p = 0; p < HL_MAX_PLANES; p++) {
+		if (b->fd[p] >= 0)
+			close(b->fd[p]);
+	}
+
+	b->c->stats.buffers--;
+	free(b);
+}
+
+static const struct wl_buffer_interface hl_buffer_impl = {
+	.destroy = hl_destroy_resource,
+};
+
+/* Regions, nothing to keep */
+
+static void hl_region_add(struct wl_client *client,
+			  struct wl_resource *resource,
+			  int32_t x, int32_t y, int32_t width, int32_t height)
+{
+}
+
+static const struct wl_region_interface hl_region_impl = {
+	.destroy = hl_destroy_resource,
+	.add = hl_region_add,
+	.subtract = hl_region_add,
+};
+
+/* Surfaces */
+
+static void hl_surface_attach(struct wl_client *client,
+			      struct wl_resource *resource,
+			      struct wl_resource *buffer, int32_t x, int32_t y)
+{
+	struct hl_surface *s = wl_resource_get_user_data(resource);
+
+	s->pending.attached = 1;
+	s->pending.buffer = NULL;
+
+	/* wl_shm ones, a background, are shown but not tracked */
+	if (buffer && !wl_shm_buffer_get(buffer))
+		s->pending.buffer = wl_resource_get_user_data(buffer);
+}
+
+static void hl_surface_damage(struct wl_client *client,
+			      struct wl_resource *resource,
+			      int32_t x, int32_t y, int32_t width, int32_t height)
+{
+}
+
+static void hl_surface_frame(struct wl_client *client,
+			     struct wl_resource *resource, uint32_t id)
+{
+	struct hl_surface *s = wl_resource_get_user_data(resource);
+	struct wl_resource *cb;
+
+	cb = wl_resource_create(client, &wl_callback_interface, 1, id);
+	if (!cb) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(cb, NULL, NULL, hl_unlink_resource);
+	wl_list_insert(s->pending.frames.prev, wl_resource_get_link(cb));
+}
+
+static void hl_surface_set_region(struct wl_client *client,
+				  struct wl_resource *resource,
+				  struct wl_resource *region)
+{
+}
+
+/* st replaces what dst has, a buffer not shown goes back at once */
+static void hl_state_replace(struct hl_surface *s, struct hl_state *dst,
+			     struct hl_state *st)
+{
+	struct hl_buffer *replaced = dst->buffer;
+
+	/* a newer buffer before the repaint, the older one is not shown */
+	if (st->attached && dst->attached) {
+		hl_discard_feedbacks(s->c, &dst->feedbacks);
+		dst->buffer = NULL;
+	}
+
+	hl_state_move(dst, st);
+
+	if (replaced != dst->buffer)
+		hl_surface_release(s, replaced);
+}
+
+/* What synchronized subsurfaces cached goes with their parent */
+static void hl_surface_apply(struct hl_surface *s, struct hl_state *st)
+{
+	struct hl_surface *child;
+
+	hl_state_replace(s, &s->queued, st);
+
+	wl_list_for_each(child, &s->children, child_link) {
+		if (child->sync)
+			hl_surface_apply(child, &child->cached);
+	}
+}
+
+static void hl_surface_commit(struct wl_client *client,
+			      struct wl_resource *resource)
+{
+	struct hl_surface *s = wl_resource_get_user_data(resource);
+
+	s->c->stats.commits++;
+
+	if (s->parent && s->sync)
+		hl_state_replace(s, &s->cached, &s->pending);
+	else
+		hl_surface_apply(s, &s->pending);
+}
+
+static void hl_surface_set_int(struct wl_client *client,
+			       struct wl_resource *resource, int32_t value)
+{
+}
+
+static const struct wl_surface_interface hl_surface_impl = {
+	.destroy = hl_destroy_resource,
+	.attach = hl_surface_attach,
+	.damage = hl_surface_damage,
+	.frame = hl_surface_frame,
+	.set_opaque_region = hl_surface_set_region,
+	.set_input_region = hl_surface_set_region,
+	.commit = hl_surface_commit,
+	.set_buffer_transform = hl_surface_set_int,
+	.set_buffer_scale = hl_surface_set_int,
+	.damage_buffer = hl_surface_damage,
+};
+
+static void hl_state_free(struct hl_state *st)
+{
+	struct wl_resource *r, *next;
+
+	wl_resource_for_each_safe(r, next, &st->frames)
+		wl_resource_destroy(r);
+	wl_resource_for_each_safe(r, next, &st->feedbacks)
+		wl_resource_destroy(r);
+}
+
+static void hl_surface_destroy(struct wl_resource *resource)
+{
+	struct hl_surface *s = wl_resource_get_user_data(resource);
+
+	/* the client may go with its toplevel still there */
+	if (s->toplevel)
+		wl_resource_set_user_data(s->toplevel, NULL);
+	if (s->xdg_surface)
+		wl_resource_set_user_data(s->xdg_surface, NULL);
+	if (s->subsurface)
+		wl_resource_set_user_data(s->subsurface, NULL);
+
+	if (s->parent)
+		wl_list_remove(&s->child_link);
+	while (!wl_list_empty(&s->children)) {
+		struct hl_surface *child;
+
+		child = wl_container_of(s->children.next, child, child_link);
+		wl_list_remove(&child->child_link);
+		child->parent = NULL;
+	}
+
+	hl_state_free(&s->pending);
+	hl_state_free(&s->cached);
+	hl_state_free(&s->queued);
+	wl_list_remove(&s->link);
+	free(s);
+}
+
+/* Compositor */
+
+static void hl_create_surface(struct wl_client *client,
+			      struct wl_resource *resource, uint32_t id)
+{
+	struct hl_compositor *c = wl_resource_get_user_data(resource);
+	struct hl_surface *s;
+
+	s = calloc(1, sizeof (*s));
+	if (!s)
+		goto nomem;
+
+	s->resource = wl_resource_create(client, &wl_surface_interface,
+					 wl_resource_get_version(resource), id);
+	if (!s->resource) {
+		free(s);
+		goto nomem;
+	}
+
+	s->c = c;
+	hl_state_init(&s->pending);
+	hl_state_init(&s->cached);
+	hl_state_init(&s->queued);
+	wl_list_init(&s->children);
+	wl_list_insert(&c->surfaces, &s->link);
+
+	wl_resource_set_implementation(s->resource, &hl_surface_impl, s,
+				       hl_surface_destroy);
+	return;
+
+nomem:
+	wl_client_post_no_memory(client);
+}
+
+static void hl_create_region(struct wl_client *client,
+			     struct wl_resource *resource, uint32_t id)
+{
+	struct wl_resource *region;
+
+	region = wl_resource_create(client, &wl_region_interface, 1, id);
+	if (!region) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(region, &hl_region_impl, NULL, NULL);
+}
+
+static const struct wl_compositor_interface hl_compositor_impl = {
+	.create_surface = hl_create_surface,
+	.create_region = hl_create_region,
+};
+
+/* Subsurfaces, where they are does not matter here */
+
+static void hl_subsurface_set_position(struct wl_client *client,
+				       struct wl_resource *resource,
+				       int32_t x, int32_t y)
+{
+}
+
+static void hl_subsurface_place(struct wl_client *client,
+				struct wl_resource *resource,
+				struct wl_resource *sibling)
+{
+}
+
+static void hl_subsurface_set_sync(struct wl_client *client,
+				   struct wl_resource *resource)
+{
+	struct hl_surface *s = wl_resource_get_user_data(resource);
+
+	if (s)
+		s->sync = 1;
+}
+
+/* What was cached goes as if committed now */
+static void hl_subsurface_set_desync(struct wl_client *client,
+				     struct wl_resource *resource)
+{
+	struct hl_surface *s = wl_resource_get_user_data(resource);
+
+	if (!s || !s->sync)
+		return;
+
+	s->sync = 0;
+	hl_surface_apply(s, &s->cached);
+}
+
+static const struct wl_subsurface_interface hl_subsurface_impl = {
+	.destroy = hl_destroy_resource,
+	.set_position = hl_subsurface_set_position,
+	.place_above = hl_subsurface_place,
+	.place_below = hl_subsurface_place,
+	.set_sync = hl_subsurface_set_sync,
+	.set_desync = hl_subsurface_set_desync,
+};
+
+/* The surface stays, unmapped until it is a subsurface again */
+static void hl_subsurface_destroy(struct wl_resource *resource)
+{
+	struct hl_surface *s = wl_resource_get_user_data(resource);
+
+	if (!s)
+		return;
+
+	if (s->parent)
+		wl_list_remove(&s->child_link);
+	s->parent = NULL;
+	s->subsurface = NULL;
+}
+
+static void hl_subcompositor_get_subsurface(struct wl_client *client,
+					    struct wl_resource *resource,
+					    uint32_t id,
+					    struct wl_resource *surface,
+					    struct wl_resource *parent)
+{
+	struct hl_surface *s = wl_resource_get_user_data(surface);
+	struct hl_surface *p = wl_resource_get_user_data(parent);
+
+	if (s->subsurface || s == p) {
+		wl_resource_post_error(resource,
+				       WL_SUBCOMPOSITOR_ERROR_BAD_SURFACE,
+				       "surface is a subsurface already");
+		return;
+	}
+
+	s->subsurface = wl_resource_create(client, &wl_subsurface_interface,
+					   1, id);
+	if (!s->subsurface) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(s->subsurface, &hl_subsurface_impl, s,
+				       hl_subsurface_destroy);
+
+	/* synchronized, the default */
+	s->parent = p;
+	s->sync = 1;
+	wl_list_insert(p->children.prev, &s->child_link);
+}
+
+static const struct wl_subcompositor_interface hl_subcompositor_impl = {
+	.destroy = hl_destroy_resource,
+	.get_subsurface = hl_subcompositor_get_subsurface,
+};
+
+/* xdg-shell v6, one toplevel per surface, configured at once */
+
+static void hl_toplevel_configure(struct hl_surface *s, int fullscreen)
+{
+	struct hl_compositor *c;
+	struct wl_array states;
+
+	if (!s || !s->toplevel || !s->xdg_surface)
+		return;
+
+	c = s->c;
+	wl_array_init(&states);
+
+	if (fullscreen) {
+		uint32_t *state = wl_array_add(&states, sizeof (*state));
+
+		if (state)
+			*state = ZXDG_TOPLEVEL_V6_STATE_FULLSCREEN;
+	}
+
+	zxdg_toplevel_v6_send_configure(s->toplevel,
+					fullscreen ? c->output_width : 0,
+					fullscreen ? c->output_height : 0,
+					&states);
+	zxdg_surface_v6_send_configure(s->xdg_surface, ++s->serial);
+
+	wl_array_release(&states);
+}
+
+static void hl_toplevel_set_fullscreen(struct wl_client *client,
+				       struct wl_resource *resource,
+				       struct wl_resource *output)
+{
+	hl_toplevel_configure(wl_resource_get_user_data(resource), 1);
+}
+
+static void hl_toplevel_unset_fullscreen(struct wl_client *client,
+					 struct wl_resource *resource)
+{
+	hl_toplevel_configure(wl_resource_get_user_data(resource), 0);
+}
+
+static void hl_toplevel_set_parent(struct wl_client *client,
+				   struct wl_resource *resource,
+				   struct wl_resource *parent)
+{
+}
+
+static void hl_toplevel_set_string(struct wl_client *client,
+				   struct wl_resource *resource,
+				   const char *string)
+{
+}
+
+static void hl_toplevel_show_window_menu(struct wl_client *client,
+					 struct wl_resource *resource,
+					 struct wl_resource *seat,
+					 uint32_t serial, int32_t x, int32_t y)
+{
+}
+
+static void hl_toplevel_move(struct wl_client *client,
+			     struct wl_resource *resource,
+			     struct wl_resource *seat, uint32_t serial)
+{
+}
+
+static void hl_toplevel_resize(struct wl_client *client,
+			       struct wl_resource *resource,
+			       struct wl_resource *seat, uint32_t serial,
+			       uint32_t edges)
+{
+}
+
+static void hl_toplevel_set_size(struct wl_client *client,
+				 struct wl_resource *resource,
+				 int32_t width, int32_t height)
+{
+}
+
+static void hl_toplevel_set_state(struct wl_client *client,
+				  struct wl_resource *resource)
+{
+}
+
+static const struct zxdg_toplevel_v6_interface hl_toplevel_impl = {
+	.destroy = hl_destroy_resource,
+	.set_parent = hl_toplevel_set_parent,
+	.set_title = hl_toplevel_set_string,
+	.set_app_id = hl_toplevel_set_string,
+	.show_window_menu = hl_toplevel_show_window_menu,
+	.move = hl_toplevel_move,
+	.resize = hl_toplevel_resize,
+	.set_max_size = hl_toplevel_set_size,
+	.set_min_size = hl_toplevel_set_size,
+	.set_maximized = hl_toplevel_set_state,
+	.unset_maximized = hl_toplevel_set_state,
+	.set_fullscreen = hl_toplevel_set_fullscreen,
+	.unset_fullscreen = hl_toplevel_unset_fullscreen,
+	.set_minimized = hl_toplevel_set_state,
+};
+
+static void hl_toplevel_destroy(struct wl_resource *resource)
+{
+	struct hl_surface *s = wl_resource_get_user_data(resource);
+
+	if (s)
+		s->toplevel = NULL;
+}
+
+static void hl_xdg_surface_destroy(struct wl_resource *resource)
+{
+	struct hl_surface *s = wl_resource_get_user_data(resource);
+
+	if (s)
+		s->xdg_surface = NULL;
+}
+
+static void hl_xdg_surface_get_toplevel(struct wl_client *client,
+					struct wl_resource *resource,
+					uint32_t id)
+{
+	struct hl_surface *s = wl_resource_get_user_data(resource);
+
+	s->toplevel = wl_resource_create(client, &zxdg_toplevel_v6_interface,
+					 1, id);
+	if (!s->toplevel) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(s->toplevel, &hl_toplevel_impl, s,
+				       hl_toplevel_destroy);
+
+	hl_toplevel_configure(s, 0);
+}
+
+static void hl_xdg_surface_get_popup(struct wl_client *client,
+				     struct wl_resource *resource,
+				     uint32_t id, struct wl_resource *parent,
+				     struct wl_resource *positioner)
+{
+	hl_not_supported(resource);
+}
+
+static void hl_xdg_surface_set_window_geometry(struct wl_client *client,
+					       struct wl_resource *resource,
+					       int32_t x, int32_t y,
+					       int32_t width, int32_t height)
+{
+}
+
+static void hl_xdg_surface_ack_configure(struct wl_client *client,
+					 struct wl_resource *resource,
+					 uint32_t serial)
+{
+}
+
+static const struct zxdg_surface_v6_interface hl_xdg_surface_impl = {
+	.destroy = hl_destroy_resource,
+	.get_toplevel = hl_xdg_surface_get_toplevel,
+	.get_popup = hl_xdg_surface_get_popup,
+	.set_window_geometry = hl_xdg_surface_set_window_geometry,
+	.ack_configure = hl_xdg_surface_ack_configure,
+};
+
+static void hl_xdg_shell_create_positioner(struct wl_client *client,
+					   struct wl_resource *resource,
+					   uint32_t id)
+{
+	hl_not_supported(resource);
+}
+
+static void hl_xdg_shell_get_xdg_surface(struct wl_client *client,
+					 struct wl_resource *resource,
+					 uint32_t id,
+					 struct wl_resource *surface)
+{
+	struct hl_surface *s = wl_resource_get_user_data(surface);
+
+	s->xdg_surface = wl_resource_create(client, &zxdg_surface_v6_interface,
+					    1, id);
+	if (!s->xdg_surface) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(s->xdg_surface, &hl_xdg_surface_impl,
+				       s, hl_xdg_surface_destroy);
+}
+
+static void hl_xdg_shell_pong(struct wl_client *client,
+			      struct wl_resource *resource, uint32_t serial)
+{
+}
+
+static const struct zxdg_shell_v6_interface hl_xdg_shell_impl = {
+	.destroy = hl_destroy_resource,
+	.create_positioner = hl_xdg_shell_create_positioner,
+	.get_xdg_surface = hl_xdg_shell_get_xdg_surface,
+	.pong = hl_xdg_shell_pong,
+};
+
+/* linux-dmabuf */
+
+static void hl_params_add(struct wl_client *client,
+			  struct wl_resource *resource, int32_t fd,
+			  uint32_t plane_idx, uint32_t offset,
+			  uint32_t stride, uint32_t modifier_hi,
+			  uint32_t modifier_lo)
+{
+	struct hl_params *p = wl_resource_get_user_data(resource);
+
+	if (plane_idx >= HL_MAX_PLANES) {
+		wl_resource_post_error(resource,
+				       ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_PLANE_IDX,
+				       "plane %u", plane_idx);
+		close(fd);
+		return;
+	}
+
+	if (p->fd[plane_idx] >= 0) {
+		wl_resource_post_error(resource,
+				       ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_PLANE_SET,
+				       "plane %u set twice", plane_idx);
+		close(fd);
+		return;
+	}
+
+	p->fd[plane_idx] = fd;
+	p->offset[plane_idx] = offset;
+	p->stride[plane_idx] = stride;
+	p->modifier[plane_idx] = ((uint64_t)modifier_hi << 32) | modifier_lo;
+}
+
+static int hl_format_supported(uint32_t format, uint64_t modifier)
+{
+	if (modifier == HL_MOD_QCOM_COMPRESSED)
+		return format == HL_FOURCC('N', 'V', '1', '2');
+
+	if (modifier != HL_MOD_LINEAR)
+		return 0;
+
+	for (size_t n = 0; n < sizeof (hl_formats) / sizeof (hl_formats[0]); n++) {
+		if (hl_formats[n] == format)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* The planes have to fit in their fd, a dmabuf or memfd alike */
+static int hl_params_check(struct hl_params *p, int width, int height,
+			   uint32_t format, int *n_planes)
+{
+	int n = 0;
+
+	while (n < HL_MAX_PLANES && p->fd[n] >= 0)
+		n++;
+
+	for (int k = n; k < HL_MAX_PLANES; k++) {
+		if (p->fd[k] >= 0)
+			return ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INCOMPLETE;
+	}
+
+	if (!n)
+		return ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INCOMPLETE;
+
+	/* one layout for all the planes */
+	for (int k = 1; k < n; k++) {
+		if (p->modifier[k] != p->modifier[0])
+			return ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_FORMAT;
+	}
+
+	if (!hl_format_supported(format, p->modifier[0]))
+		return ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_FORMAT;
+
+	if (width <= 0 || height <= 0)
+		return ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_DIMENSIONS;
+
+	for (int k = 0; k < n; k++) {
+		/* chroma planes have half the lines */
+		uint64_t lines = k ? (height + 1) / 2 : height;
+		off_t size = lseek(p->fd[k], 0, SEEK_END);
+
+		if (size >= 0 &&
+		    p->offset[k] + (uint64_t)p->stride[k] * lines > (uint64_t)size)
+			return ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_OUT_OF_BOUNDS;
+	}
+
+	*n_planes = n;
+
+	return -1;
+}
+
+static void hl_params_import(struct wl_client *client, struct hl_params *p,
+			     uint32_t id, int32_t width, int32_t height,
+			     uint32_t format)
+{
+	struct hl_compositor *c = p->c;
+	struct hl_buffer *b;
+	int error, n_planes = 0;
+
+	if (p->used) {
+		wl_resource_post_error(p->resource,
+				       ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_ALREADY_USED,
+				       "params used already");
+		return;
+	}
+	p->used = 1;
+
+	error = hl_params_check(p, width, height, format, &n_planes);
+	if (error >= 0) {
+		c->stats.failed++;
+		/* create_immed: failed as well, the wl_buffer is unusable */
+		zwp_linux_buffer_params_v1_send_failed(p->resource);
+		if (!id)
+			return;
+	}
+
+	b = calloc(1, sizeof (*b));
+	if (!b) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	b->resource = wl_resource_create(client, &wl_buffer_interface, 1, id);
+	if (!b->resource) {
+		free(b);
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	b->c = c;
+	b->width = width;
+	b->height = height;
+	b->format = format;
+	b->n_planes = n_planes;
+
+	/* the fds go with the buffer */
+	for (int k = 0; k < HL_MAX_PLANES; k++) {
+		b->fd[k] = p->fd[k];
+		p->fd[k] = -1;
+	}
+
+	wl_resource_set_implementation(b->resource, &hl_buffer_impl, b,
+				       hl_buffer_destroy);
+
+	c->stats.buffers++;
+	if (c->stats.buffers > c->stats.buffers_max)
+		c->stats.buffers_max = c->stats.buffers;
+
+	if (p->modifier[0] == HL_MOD_QCOM_COMPRESSED)
+		c->stats.compressed++;
+
+	if (id) {
+		c->stats.created_immed++;
+	} else {
+		c->stats.created++;
+		zwp_linux_buffer_params_v1_send_created(p->resource,
+							b->resource);
+	}
+}
+
+static void hl_params_create(struct wl_client *client,
+			     struct wl_resource *resource, int32_t width,
+			     int32_t height, uint32_t format, uint32_t flags)
+{
+	hl_params_import(client, wl_resource_get_user_data(resource), 0,
+			 width, height, format);
+}
+
+static void hl_params_create_immed(struct wl_client *client,
+				   struct wl_resource *resource,
+				   uint32_t buffer_id, int32_t width,
+				   int32_t height, uint32_t format,
+				   uint32_t flags)
+{
+	hl_params_import(client, wl_resource_get_user_data(resource),
+			 buffer_id, width, height, format);
+}
+
+static const struct zwp_linux_buffer_params_v1_interface hl_params_impl = {
+	.destroy = hl_destroy_resource,
+	.add = hl_params_add,
+	.create = hl_params_create,
+	.create_immed = hl_params_create_immed,
+};
+
+static void hl_params_destroy(struct wl_resource *resource)
+{
+	struct hl_params *p = wl_resource_get_user_data(resource);
+
+	for (int k = 0; k < HL_MAX_PLANES; k++) {
+		if (p->fd[k] >= 0)
+			close(p->fd[k]);
+	}
+
+	free(p);
+}
+
+static void hl_dmabuf_create_params(struct wl_client *client,
+				    struct wl_resource *resource, uint32_t id)
+{
+	struct hl_params *p;
+
+	p = calloc(1, sizeof (*p));
+	if (!p)
+		goto nomem;
+
+	p->resource = wl_resource_create(client,
+					 &zwp_linux_buffer_params_v1_interface,
+					 wl_resource_get_version(resource), id);
+	if (!p->resource) {
+		free(p);
+		goto nomem;
+	}
+
+	p->c = wl_resource_get_user_data(resource);
+	for (int k = 0; k < HL_MAX_PLANES; k++)
+		p->fd[k] = -1;
+
+	wl_resource_set_implementation(p->resource, &hl_params_impl, p,
+				       hl_params_destroy);
+	return;
+
+nomem:
+	wl_client_post_no_memory(client);
+}
+
+static const struct zwp_linux_dmabuf_v1_interface hl_dmabuf_impl = {
+	.destroy = hl_destroy_resource,
+	.create_params = hl_dmabuf_create_params,
+};
+
+/* viewporter, the crop and scale do not matter here */
+
+static void hl_viewport_set_source(struct wl_client *client,
+				   struct wl_resource *resource,
+				   wl_fixed_t x, wl_fixed_t y,
+				   wl_fixed_t width, wl_fixed_t height)
+{
+}
+
+static void hl_viewport_set_destination(struct wl_client *client,
+					struct wl_resource *resource,
+					int32_t width, int32_t height)
+{
+}
+
+static const struct wp_viewport_interface hl_viewport_impl = {
+	.destroy = hl_destroy_resource,
+	.set_source = hl_viewport_set_source,
+	.set_destination = hl_viewport_set_destination,
+};
+
+static void hl_viewporter_get_viewport(struct wl_client *client,
+				       struct wl_resource *resource,
+				       uint32_t id,
+				       struct wl_resource *surface)
+{
+	struct wl_resource *viewport;
+
+	viewport = wl_resource_create(client, &wp_viewport_interface, 1, id);
+	if (!viewport) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(viewport, &hl_viewport_impl, NULL,
+				       NULL);
+}
+
+static const struct wp_viewporter_interface hl_viewporter_impl = {
+	.destroy = hl_destroy_resource,
+	.get_viewport = hl_viewporter_get_viewport,
+};
+
+/* presentation-time */
+
+static void hl_presentation_feedback(struct wl_client *client,
+				     struct wl_resource *resource,
+				     struct wl_resource *surface,
+				     uint32_t callback)
+{
+	struct hl_surface *s = wl_resource_get_user_data(surface);
+	struct wl_resource *fb;
+
+	fb = wl_resource_create(client, &wp_presentation_feedback_interface,
+				1, callback);
+	if (!fb) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(fb, NULL, NULL, hl_unlink_resource);
+	wl_list_insert(s->pending.feedbacks.prev, wl_resource_get_link(fb));
+}
+
+static const struct wp_presentation_interface hl_presentation_impl = {
+	.destroy = hl_destroy_resource,
+	.feedback = hl_presentation_feedback,
+};
+
+/* Globals */
+
+#define HL_BIND(name, interface, impl, version_max, extra)		\
+static void hl_bind_##name(struct wl_client *client, void *data,	\
+			   uint32_t version, uint32_t id)		\
+{									\
+	struct hl_compositor *c = data;					\
+	struct wl_resource *resource;					\
+									\
+	resource = wl_resource_create(client, &interface,		\
+				      MIN(version, version_max), id);	\
+	if (!resource) {						\
+		wl_client_post_no_memory(client);			\
+		return;							\
+	}								\
+									\
+	wl_resource_set_implementation(resource, &impl, c, NULL);	\
+	extra;								\
+}
+
+static void hl_send_modifier(struct wl_resource *resource, uint32_t format,
+			     uint64_t modifier)
+{
+	zwp_linux_dmabuf_v1_send_modifier(resource, format, modifier >> 32,
+					  modifier & 0xffffffff);
+}
+
+static void hl_send_formats(struct wl_resource *resource)
+{
+	int modifiers = wl_resource_get_version(resource) >= 3;
+
+	for (size_t n = 0; n < sizeof (hl_formats) / sizeof (hl_formats[0]); n++) {
+		zwp_linux_dmabuf_v1_send_format(resource, hl_formats[n]);
+		if (modifiers)
+			hl_send_modifier(resource, hl_formats[n],
+					 HL_MOD_LINEAR);
+	}
+
+	if (modifiers)
+		hl_send_modifier(resource, HL_FOURCC('N', 'V', '1', '2'),
+				 HL_MOD_QCOM_COMPRESSED);
+}
+
+HL_BIND(compositor, wl_compositor_interface, hl_compositor_impl, 4, )
+HL_BIND(subcompositor, wl_subcompositor_interface, hl_subcompositor_impl, 1, )
+HL_BIND(xdg_shell, zxdg_shell_v6_interface, hl_xdg_shell_impl, 1, )
+HL_BIND(dmabuf, zwp_linux_dmabuf_v1_interface, hl_dmabuf_impl,
+	(uint32_t)c->dmabuf_version, hl_send_formats(resource))
+HL_BIND(viewporter, wp_viewporter_interface, hl_viewporter_impl, 1, )
+HL_BIND(presentation, wp_presentation_interface, hl_presentation_impl, 1,
+	wp_presentation_send_clock_id(resource, CLOCK_MONOTONIC))
+
+/* Virtual vsync */
+
+static void hl_repaint(struct hl_compositor *c, struct hl_surface *s,
+		       uint64_t time_ns)
+{
+	struct hl_buffer *old = s->current;
+	struct wl_resource *r, *next;
+	uint64_t sec = time_ns / 1000000000;
+	int latched = s->queued.attached;
+
+	if (latched) {
+		s->current = s->queued.buffer;
+		s->queued.attached = 0;
+		s->queued.buffer = NULL;
+		if (old != s->current)
+			hl_surface_release(s, old);
+	}
+
+	wl_resource_for_each_safe(r, next, &s->queued.feedbacks) {
+		wp_presentation_feedback_send_presented(r, sec >> 32, sec,
+			time_ns % 1000000000, c->refresh_ns, c->msc >> 32,
+			c->msc, WP_PRESENTATION_FEEDBACK_KIND_VSYNC);
+		wl_resource_destroy(r);
+		c->stats.presented++;
+	}
+
+	wl_resource_for_each_safe(r, next, &s->queued.frames) {
+		wl_callback_send_done(r, time_ns / 1000000);
+		wl_resource_destroy(r);
+	}
+}
+
+static int hl_vsync(int fd, uint32_t mask, void *data)
+{
+	struct hl_compositor *c = data;
+	struct hl_surface *s, *next;
+	uint64_t expirations, time_ns;
+
+	if (read(fd, &expirations, sizeof (expirations)) !=
+	    sizeof (expirations))
+		return 0;
+
+	c->msc += expirations;
+	c->stats.vsyncs += expirations;
+
+	if (c->msc % c->repaint_every)
+		return 0;
+
+	c->stats.repaints++;
+	time_ns = c->start_ns + c->msc * c->refresh_ns;
+
+	wl_list_for_each_safe(s, next, &c->surfaces, link)
+		hl_repaint(c, s, time_ns);
+
+	return 0;
+}
+
+static int hl_vsync_start(struct hl_compositor *c, struct wl_event_loop *loop)
+{
+	struct itimerspec its;
+
+	c->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+				     TFD_NONBLOCK | TFD_CLOEXEC);
+	if (c->timer_fd < 0) {
+		fprintf(stderr, "timerfd_create: %m\n");
+		return -1;
+	}
+
+	c->start_ns = hl_now_ns();
+
+	its.it_interval.tv_sec = c->refresh_ns / 1000000000;
+	its.it_interval.tv_nsec = c->refresh_ns % 1000000000;
+	its.it_value.tv_sec = (c->start_ns + c->refresh_ns) / 1000000000;
+	its.it_value.tv_nsec = (c->start_ns + c->refresh_ns) % 1000000000;
+
+	if (timerfd_settime(c->timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+		fprintf(stderr, "timerfd_settime: %m\n");
+		return -1;
+	}
+
+	if (!wl_event_loop_add_fd(loop, c->timer_fd, WL_EVENT_READABLE,
+				  hl_vsync, c))
+		return -1;
+
+	return 0;
+}
+
+static int hl_signal(int signal_number, void *data)
+{
+	struct hl_compositor *c = data;
+
+	wl_display_terminate(c->display);
+
+	return 0;
+}
+
+static void hl_log(void *data, enum wl_protocol_logger_type type,
+		   const struct wl_protocol_logger_message *message)
+{
+	struct hl_compositor *c = data;
+
+	if (type == WL_PROTOCOL_LOGGER_REQUEST)
+		c->stats.requests++;
+}
+
+static void hl_report(const struct hl_compositor *c)
+{
+	const struct hl_stats *st = &c->stats;
+
+	fprintf(stderr, "wl_headless: %lu vsyncs, %lu repaints, %lu commits\n"
+		"wl_headless: %lu requests, %.2f per commit\n"
+		"wl_headless: %lu presented, %lu discarded, %lu released\n"
+		"wl_headless: %lu wl_buffers created, %lu with create_immed, "
+		"%lu failed, up to %d at once, %lu UBWC\n",
+		st->vsyncs, st->repaints, st->commits,
+		st->requests, st->commits ?
+		(double)st->requests / st->commits : 0.0,
+		st->presented, st->discarded, st->released,
+		st->created, st->created_immed, st->failed, st->buffers_max,
+		st->compressed);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-s <socket>] [-r <Hz>] [-S <n>] [-V <1-3>] "
+		"[-o <w>x<h>]\n"
+		"  -s  socket name in $XDG_RUNTIME_DIR (wayland-headless)\n"
+		"  -r  refresh rate of the virtual output (60)\n"
+		"  -S  only draw every n-th vsync, a slow compositor (1)\n"
+		"  -V  zwp_linux_dmabuf_v1 version, 2 has create_immed, 3 the\n"
+		"      modifiers (3)\n"
+		"  -o  fullscreen size (1920x1080)\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	struct hl_compositor c = {
+		.dmabuf_version = 3,
+		.output_width = 1920,
+		.output_height = 1080,
+		.repaint_every = 1,
+		.timer_fd = -1,
+	};
+	const char *socket_name = "wayland-headless";
+	struct wl_event_loop *loop;
+	double refresh = 60;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:r:S:V:o:h")) != -1) {
+		switch (opt) {
+		case 's':
+			socket_name = optarg;
+			break;
+		case 'r':
+			refresh = strtod(optarg, NULL);
+			break;
+		case 'S':
+			c.repaint_every = atoi(optarg);
+			break;
+		case 'V':
+			c.dmabuf_version = atoi(optarg);
+			break;
+		case 'o':
+			if (sscanf(optarg, "%dx%d", &c.output_width,
+				   &c.output_height) != 2) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (refresh <= 0 || c.repaint_every < 1 ||
+	    c.dmabuf_version < 1 || c.dmabuf_version > 3) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	c.refresh_ns = 1e9 / refresh;
+	wl_list_init(&c.surfaces);
+
+	c.display = wl_display_create();
+	if (!c.display)
+		return 1;
+
+	if (wl_display_add_socket(c.display, socket_name) < 0) {
+		fprintf(stderr, "cannot listen on %s: %m\n", socket_name);
+		return 1;
+	}
+
+	if (wl_display_init_shm(c.display) ||
+	    !wl_global_create(c.display, &wl_compositor_interface, 4, &c,
+			      hl_bind_compositor) ||
+	    !wl_global_create(c.display, &wl_subcompositor_interface, 1, &c,
+			      hl_bind_subcompositor) ||
+	    !wl_global_create(c.display, &zxdg_shell_v6_interface, 1, &c,
+			      hl_bind_xdg_shell) ||
+	    !wl_global_create(c.display, &zwp_linux_dmabuf_v1_interface,
+			      c.dmabuf_version, &c, hl_bind_dmabuf) ||
+	    !wl_global_create(c.display, &wp_viewporter_interface, 1, &c,
+			      hl_bind_viewporter) ||
+	    !wl_global_create(c.display, &wp_presentation_interface, 1, &c,
+			      hl_bind_presentation))
+		return 1;
+
+	/* counts what clients send, to check how lean a frame is */
+	wl_display_add_protocol_logger(c.display, hl_log, &c);
+
+	loop = wl_display_get_event_loop(c.display);
+
+	if (hl_vsync_start(&c, loop))
+		return 1;
+
+	wl_event_loop_add_signal(loop, SIGINT, hl_signal, &c);
+	wl_event_loop_add_signal(loop, SIGTERM, hl_signal, &c);
+
+	fprintf(stderr, "wl_headless: %s, %.2f Hz, dmabuf version %d\n",
+		socket_name, refresh, c.dmabuf_version);
+
+	wl_display_run(c.display);
+
+	hl_report(&c);
+
+	wl_display_destroy_clients(c.display);
+	wl_display_destroy(c.display);
+	close(c.timer_fd);
+
+	return 0;
+}
@@ -3,166 +3,1677 @@
 #include <sys/ioctl.h>  
 #include <linux/videodev2.h>  
 #include <sys/mman.h>  
+#include <sys/eventfd.h>
 #include <errno.h>  
 #include <string.h>  
 #include <stdlib.h> 
 #include <assert.h>
 #include <poll.h>
+#include <math.h>
 #include "common.h"
 #include "video.h"
+#include "hw_rot.h"
+#include "scale.h"
 
 
 #define DBG_TAG "rot_test"
-  
-int convert_ubwc_to_linear(unsigned long out_buf_fd, 
-                          int width, int height,  
-                          unsigned char **linear_data, size_t *linear_size)  
-{  
-    static int rotator_fd = -1;  
-    static int cap_ion_fd = -1;
-    int ret = -1;  
-    static struct v4l2_format fmt_cap = {0}, fmt_out = {0};  
-    struct v4l2_requestbuffers req_in = {0}, req_out = {0};  
-    struct v4l2_buffer buf_in = {0}, buf_out = {0};  
-    void *mapped_in = NULL, *mapped_out = NULL;  
-      
-    // Open SDE rotator device  
-    rotator_fd = open("/dev/video2", O_RDWR);  
-    if (rotator_fd < 0) {  
-        err("Failed to open rotator device");  
-        return -1;  
-    }
-    // VIDIOC_QUERYCAP to check capabilities
-    struct v4l2_capability cap;
-    memzero(cap);
-    if (ioctl(rotator_fd, VIDIOC_QUERYCAP, &cap) < 0) {
-        err("Failed to verify capabilities: %m");
-        return -1;
-    }
-    dbg("caps (/dev/video2): driver=\"%s\" bus_info=\"%s\" card=\"%s\" "
-        "version=%u.%u.%u",  cap.driver, cap.bus_info, cap.card,
-        (cap.version >> 16) & 0xff,
-        (cap.version >> 8) & 0xff,
-        cap.version & 0xff);
-    
-    fmt_out.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-    fmt_out.fmt.pix.width       = 1952;      // e.g. 1952
-    fmt_out.fmt.pix.height      = 1216;      // e.g. 1216
-    fmt_out.fmt.pix.pixelformat = V4L2_PIX_FMT_NV12_UBWC;  // the UBWC fourcc
-    fmt_out.fmt.pix.field       = V4L2_FIELD_NONE;
-    ioctl(rotator_fd, VIDIOC_S_FMT, &fmt_out);
-    fmt_cap.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    fmt_cap.fmt.pix.width       = 1952;
-    fmt_cap.fmt.pix.height      = 1216;
-    fmt_cap.fmt.pix.pixelformat = V4L2_PIX_FMT_NV12;      // plain NV12
-    fmt_cap.fmt.pix.field       = V4L2_FIELD_NONE;
-    ioctl(rotator_fd, VIDIOC_S_FMT, &fmt_cap);
-    
-    struct v4l2_requestbuffers req = {0};
-    req.count  = 1;
-    req.type   = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-    req.memory = V4L2_MEMORY_USERPTR;
-    ioctl(rotator_fd, VIDIOC_REQBUFS, &req);
-    // allocate capture ion buffer
-    cap_ion_fd = alloc_ion_buffer(fmt_cap.fmt.pix.sizeimage, 0);
-    if (cap_ion_fd < 0) {
-        err("Failed to allocate ION buffer for capture");
-        return -1;
-    }
-
-
-    struct v4l2_buffer buf = {0};
-    info("ion buffer fd: %i", out_buf_fd);
-    int sizeimage = fmt_out.fmt.pix.sizeimage;  // size of the output buffer
-    buf.type      = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-    buf.memory    = V4L2_MEMORY_USERPTR;
-    buf.index     = 0;
-    buf.m.userptr = (unsigned long)out_buf_fd;
-    buf.length    = sizeimage;               // use fmt_out.fmt.pix.sizeimage
-    ioctl(rotator_fd, VIDIOC_QBUF, &buf);
-
-
-    struct v4l2_requestbuffers req_cap = {0};
-    req_cap.count  = 1;
-    req_cap.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    req_cap.memory = V4L2_MEMORY_USERPTR;
-    ioctl(rotator_fd, VIDIOC_REQBUFS, &req_cap);
-
-    struct v4l2_buffer cap_buf = {0};
-    cap_buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    cap_buf.memory = V4L2_MEMORY_USERPTR;
-    cap_buf.index  = 0;
-    cap_buf.m.userptr = (unsigned long)cap_ion_fd;  // use the ION fd
-    ioctl(rotator_fd, VIDIOC_QUERYBUF, &cap_buf);
-    cap_buf.m.userptr = (unsigned long)cap_ion_fd;  // use the ION fd 
-    ioctl(rotator_fd, VIDIOC_QBUF, &cap_buf);
-
-    enum v4l2_buf_type t = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-    ioctl(rotator_fd, VIDIOC_STREAMON, &t); 
-    t = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    ioctl(rotator_fd, VIDIOC_STREAMON, &t);
-
-    struct pollfd pfd = {
-        .fd = rotator_fd,
-        .events = POLLIN | POLLRDNORM,
-    };
-    ret = poll(&pfd, 1, 2000);
-
-    if (ret <= 0) {
-        err("poll() timed out or error");
-    }
-
-
-    struct v4l2_buffer dq = {
-    .type   = V4L2_BUF_TYPE_VIDEO_CAPTURE,
-    .memory = V4L2_MEMORY_USERPTR
-    };
-    if (ioctl(rotator_fd, VIDIOC_DQBUF, &dq) < 0) {
-        err("CAP DQBUF");
-
-    }
-
-    struct v4l2_buffer dqout = {
-        .type   = V4L2_BUF_TYPE_VIDEO_OUTPUT,
-        .memory = V4L2_MEMORY_USERPTR,
-    };
-    ioctl(rotator_fd, VIDIOC_DQBUF, &dqout);
-
-    void *linear_ptr = mmap(NULL, dq.length,
-                        PROT_READ|PROT_WRITE,
-                        MAP_SHARED,
-                        cap_ion_fd, 0);
-
-    if (linear_ptr == MAP_FAILED) {
-        err("mmap CAP");
-        return -1;
-    }
-    // // linear_ptr[0..dq.length-1] is NV12 frame
-    // *linear_data = (unsigned char *)linear_ptr;  // set the output pointer
-    // *linear_size = dq.length;                    // set the output size
-    // // Save the NV12 frame to a file for veiwing
-    // FILE *f = fopen("frame_nv12.yuv", "wb");
-    // if (!f) {
-    //     err("Failed to open output file");
-    //     return -1;
-    // }
-
-    // size_t written = fwrite(*linear_data, 1, *linear_size, f);
-    // if (written != *linear_size) {
-    //     err("Partial write occurred");
-    //     fclose(f);
-    //     return -1;
-    // }
-
-    // fclose(f);
-
-    // Clean up resources assuming everything worked
-    
-    
-    munmap(linear_ptr, dq.length);
-    close(cap_ion_fd);
-    close(rotator_fd);
-    info("UBWC to linear conversion successful");
-    return 0;
-   
-}
\ No newline at end of file
+
+/* Longest time a single synchronous conversion may take */
+#define ROT_TIMEOUT_MS		2000
+
+/* Queue types and memory of the API picked at open time */
+#define ROT_OUT(rot)	((rot)->mplane ? V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE : \
+			 V4L2_BUF_TYPE_VIDEO_OUTPUT)
+#define ROT_CAP(rot)	((rot)->mplane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE : \
+			 V4L2_BUF_TYPE_VIDEO_CAPTURE)
+#define ROT_MEMORY(rot)	((rot)->mplane ? V4L2_MEMORY_DMABUF : \
+			 V4L2_MEMORY_USERPTR)
+
+/* NV12 lines are even, the UV ones are as long as the Y ones */
+#define NV12_STRIDE(w)	(((w) + 1) & ~1)
+
+/* Format returned by the driver, the same for both APIs */
+struct rotator_fmt {
+	uint32_t fourcc;
+	int width;
+	int height;
+	int planes;
+	int stride[VIDEO_MAX_PLANES];
+	int size[VIDEO_MAX_PLANES];
+};
+
+/*
+ * Software backend, for machines without /dev/video2: a worker thread
+ * makes the pool frame on the CPU and signals completion through an
+ * eventfd, so the rest of the pipeline behaves as with the hardware.
+ * There the decoder gives linear NV12, which is cropped and scaled.
+ * A UBWC frame can only be detiled when no tile has metadata (see
+ * ubwc.h), the others are dropped.
+ */
+struct rotator_sw {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int stop;
+
+	/* slot indices, submitted and completed */
+	int queue[MAX_ROT_BUF];
+	int queue_head, queue_count;
+	int done[MAX_ROT_BUF];
+	int done_head, done_count;
+
+	/* whole frame, when it has to be cropped or scaled afterwards */
+	uint8_t *scratch;
+};
+
+static int rotator_stream(struct rotator *rot, enum v4l2_buf_type type,
+			  int status)
+{
+	if (ioctl(rot->fd, status, &type) < 0) {
+		err("rotator: failed to stream %s %s queue: %m",
+		    status == VIDIOC_STREAMON ? "on" : "off",
+		    V4L2_TYPE_IS_OUTPUT(type) ? "OUTPUT" : "CAPTURE");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void rotator_fill_format(struct rotator *rot, struct v4l2_format *fmt,
+				enum v4l2_buf_type type, uint32_t fourcc,
+				int width, int height)
+{
+	memset(fmt, 0, sizeof (*fmt));
+	fmt->type = type;
+
+	if (rot->mplane) {
+		fmt->fmt.pix_mp.width = width;
+		fmt->fmt.pix_mp.height = height;
+		fmt->fmt.pix_mp.pixelformat = fourcc;
+		fmt->fmt.pix_mp.field = V4L2_FIELD_NONE;
+	} else {
+		fmt->fmt.pix.width = width;
+		fmt->fmt.pix.height = height;
+		fmt->fmt.pix.pixelformat = fourcc;
+		fmt->fmt.pix.field = V4L2_FIELD_NONE;
+	}
+}
+
+static void rotator_get_format(struct rotator *rot,
+			       const struct v4l2_format *fmt,
+			       struct rotator_fmt *rf)
+{
+	memset(rf, 0, sizeof (*rf));
+
+	if (rot->mplane) {
+		const struct v4l2_pix_format_mplane *pix = &fmt->fmt.pix_mp;
+
+		rf->fourcc = pix->pixelformat;
+		rf->width = pix->width;
+		rf->height = pix->height;
+		rf->planes = MIN(pix->num_planes, VIDEO_MAX_PLANES);
+
+		for (int n = 0; n < rf->planes; n++) {
+			rf->stride[n] = pix->plane_fmt[n].bytesperline;
+			rf->size[n] = pix->plane_fmt[n].sizeimage;
+		}
+	} else {
+		const struct v4l2_pix_format *pix = &fmt->fmt.pix;
+
+		rf->fourcc = pix->pixelformat;
+		rf->width = pix->width;
+		rf->height = pix->height;
+		rf->planes = 1;
+		rf->stride[0] = pix->bytesperline;
+		rf->size[0] = pix->sizeimage;
+	}
+}
+
+static int rotator_set_format(struct rotator *rot, enum v4l2_buf_type type,
+			      uint32_t fourcc, int width, int height,
+			      struct rotator_fmt *rf)
+{
+	struct v4l2_format fmt;
+
+	rotator_fill_format(rot, &fmt, type, fourcc, width, height);
+
+	if (ioctl(rot->fd, VIDIOC_S_FMT, &fmt) < 0) {
+		err("rotator: failed to set %dx%d format: %m", width, height);
+		return -1;
+	}
+
+	rotator_get_format(rot, &fmt, rf);
+
+	return 0;
+}
+
+/* Whether the rotator can produce exactly this format */
+static int rotator_try_format(struct rotator *rot, enum v4l2_buf_type type,
+			      uint32_t fourcc, int width, int height)
+{
+	struct v4l2_format fmt;
+	struct rotator_fmt rf;
+
+	rotator_fill_format(rot, &fmt, type, fourcc, width, height);
+
+	if (ioctl(rot->fd, VIDIOC_TRY_FMT, &fmt) < 0)
+		return -1;
+
+	rotator_get_format(rot, &fmt, &rf);
+
+	if (rf.fourcc != fourcc || rf.width != width || rf.height != height)
+		return -1;
+
+	return 0;
+}
+
+/* Only read the visible part of the decoded frames */
+static int rotator_set_crop(struct rotator *rot)
+{
+	struct v4l2_crop crop;
+
+	if (rot->crop.left == 0 && rot->crop.top == 0 &&
+	    (int)rot->crop.width == rot->width &&
+	    (int)rot->crop.height == rot->height)
+		return 0;
+
+	memzero(crop);
+	crop.type = ROT_OUT(rot);
+	crop.c = rot->crop;
+
+	if (ioctl(rot->fd, VIDIOC_S_CROP, &crop) < 0) {
+		err("rotator: failed to crop to %ux%u at %d,%d: %m",
+		    rot->crop.width, rot->crop.height, rot->crop.left,
+		    rot->crop.top);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int rotator_reqbufs(struct rotator *rot, enum v4l2_buf_type type,
+			   int count)
+{
+	struct v4l2_requestbuffers reqbuf;
+
+	memzero(reqbuf);
+	reqbuf.count = count;
+	reqbuf.type = type;
+	reqbuf.memory = ROT_MEMORY(rot);
+
+	if (ioctl(rot->fd, VIDIOC_REQBUFS, &reqbuf) < 0) {
+		err("rotator: failed to request %d buffers: %m", count);
+		return -1;
+	}
+
+	return reqbuf.count;
+}
+
+/* Bytes of a NV12 frame with a UV plane right after height lines */
+static size_t nv12_size(int stride, int height)
+{
+	return (size_t)stride * height + (size_t)stride * ((height + 1) / 2);
+}
+
+/* Scalers from a width x height rectangle to the consumer frame */
+static int rotator_scale_open(struct rotator *rot, int width, int height)
+{
+	rot->scale_y = scale_new(width, height, rot->dst_w, rot->dst_h, 1);
+	if (!rot->scale_y)
+		return -1;
+
+	if (rot->dst_fourcc == V4L2_PIX_FMT_GREY)
+		return 0;
+
+	rot->scale_uv = scale_new((width + 1) / 2, (height + 1) / 2,
+				  (rot->dst_w + 1) / 2, (rot->dst_h + 1) / 2,
+				  2);
+
+	return rot->scale_uv ? 0 : -1;
+}
+
+/* Make the consumer frame from the rectangle r of a NV12 frame, of the
+ * size given to rotator_scale_open() */
+static void rotator_crop_scale(struct rotator *rot, const uint8_t *src,
+			       const uint8_t *src_uv, int stride,
+			       const struct v4l2_rect *r, uint8_t *dst,
+			       uint8_t *dst_uv)
+{
+	scale_box(rot->scale_y, src + (size_t)r->top * stride + r->left,
+		  stride, dst, rot->dst_stride);
+
+	if (rot->dst_fourcc == V4L2_PIX_FMT_GREY)
+		return;
+
+	scale_box(rot->scale_uv, src_uv + (size_t)(r->top / 2) * stride +
+		  (r->left & ~1), stride, dst_uv, rot->dst_stride);
+}
+
+static int rotator_sw_convert(struct rotator *rot, struct rotator_job *job,
+			      int n)
+{
+	struct rotator_sw *sw = rot->sw;
+	const uint8_t *src = job->src;
+	size_t uv_off;
+
+	if (rot->src_linear) {
+		uv_off = (size_t)rot->stride * rot->scanlines;
+		if (job->src_size < uv_off + (size_t)rot->stride *
+		    ((rot->height + 1) / 2))
+			return -1;
+
+		rotator_crop_scale(rot, src, src + uv_off, rot->stride,
+				   &rot->crop, rot->cap_buf_addr[n],
+				   rot->cap_uv_addr[n]);
+		return 0;
+	}
+
+	if (!sw->scratch)
+		return ubwc_to_nv12(rot->ubwc, &rot->layout, job->src,
+				    job->src_size, rot->cap_w, rot->cap_h,
+				    rot->cap_buf_addr[n], rot->cap_stride,
+				    rot->cap_scanlines);
+
+	if (ubwc_to_nv12(rot->ubwc, &rot->layout, job->src, job->src_size,
+			 rot->crop.left + rot->crop.width,
+			 rot->crop.top + rot->crop.height,
+			 sw->scratch, NV12_STRIDE(rot->width), rot->height))
+		return -1;
+
+	rotator_crop_scale(rot, sw->scratch, sw->scratch +
+			   (size_t)NV12_STRIDE(rot->width) * rot->height,
+			   NV12_STRIDE(rot->width), &rot->crop,
+			   rot->cap_buf_addr[n], rot->cap_uv_addr[n]);
+
+	return 0;
+}
+
+static void *rotator_sw_thread(void *arg)
+{
+	struct instance *i = arg;
+	struct rotator *rot = &i->rotator;
+	struct rotator_sw *sw = rot->sw;
+	uint64_t one = 1;
+
+	pthread_mutex_lock(&sw->lock);
+
+	while (!sw->stop) {
+		struct rotator_job *job;
+		int n;
+
+		if (!sw->queue_count) {
+			pthread_cond_wait(&sw->cond, &sw->lock);
+			continue;
+		}
+
+		n = sw->queue[sw->queue_head];
+		sw->queue_head = (sw->queue_head + 1) % MAX_ROT_BUF;
+		sw->queue_count--;
+		job = &rot->job[n];
+
+		pthread_mutex_unlock(&sw->lock);
+
+		if (job->src)
+			job->failed = rotator_sw_convert(rot, job, n) < 0;
+
+		pthread_mutex_lock(&sw->lock);
+
+		sw->done[(sw->done_head + sw->done_count) % MAX_ROT_BUF] = n;
+		sw->done_count++;
+
+		if (write(rot->event_fd, &one, sizeof (one)) < 0)
+			err("rotator: eventfd write failed: %m");
+	}
+
+	pthread_mutex_unlock(&sw->lock);
+
+	return NULL;
+}
+
+static int rotator_sw_open(struct instance *i)
+{
+	struct rotator *rot = &i->rotator;
+	struct rotator_sw *sw;
+
+	sw = calloc(1, sizeof (*sw));
+	if (!sw)
+		return -1;
+
+	/* the pool holds the consumer frames directly */
+	rot->fourcc = rot->dst_fourcc;
+	rot->cap_w = rot->dst_w;
+	rot->cap_h = rot->dst_h;
+	rot->cap_stride = rot->dst_stride;
+	rot->cap_scanlines = rot->dst_scanlines;
+	rot->cap_buf_size = rot->dst_size;
+	rot->cap_planes = 1;
+
+	/* the detiler alone only drops the right and bottom padding */
+	if (!rot->src_linear && (rot->crop.left || rot->crop.top ||
+	    rot->dst_w != (int)rot->crop.width ||
+	    rot->dst_h != (int)rot->crop.height ||
+	    rot->dst_fourcc != V4L2_PIX_FMT_NV12)) {
+		sw->scratch = malloc(nv12_size(NV12_STRIDE(rot->width),
+					       rot->height));
+		if (!sw->scratch)
+			goto fail;
+	}
+
+	for (int n = 0; n < rot->cap_buf_cnt; n++) {
+		if (posix_memalign(&rot->cap_buf_addr[n], 4096,
+				   rot->cap_buf_size)) {
+			rot->cap_buf_addr[n] = NULL;
+			goto fail;
+		}
+
+		if (rot->fourcc == V4L2_PIX_FMT_NV12)
+			rot->cap_uv_addr[n] = (uint8_t *)rot->cap_buf_addr[n] +
+				(size_t)rot->cap_stride * rot->cap_scanlines;
+	}
+
+	rot->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (rot->event_fd < 0) {
+		err("rotator: failed to create eventfd: %m");
+		goto fail;
+	}
+
+	pthread_mutex_init(&sw->lock, NULL);
+	pthread_cond_init(&sw->cond, NULL);
+
+	rot->sw = sw;
+
+	if (pthread_create(&sw->thread, NULL, rotator_sw_thread, i)) {
+		err("rotator: failed to start the software backend");
+		pthread_mutex_destroy(&sw->lock);
+		pthread_cond_destroy(&sw->cond);
+		rot->sw = NULL;
+		goto fail;
+	}
+
+	if (rot->src_linear)
+		info("rotator: no hardware rotator, converting linear frames "
+		     "with the CPU");
+	else
+		info("rotator: no hardware rotator, detiling with the CPU "
+		     "(%s)", ubwc_kernel());
+
+	return 0;
+
+fail:
+	/* rotator_close() would munmap() them */
+	for (int n = 0; n < MAX_ROT_BUF; n++) {
+		free(rot->cap_buf_addr[n]);
+		rot->cap_buf_addr[n] = NULL;
+		rot->cap_uv_addr[n] = NULL;
+	}
+	free(sw->scratch);
+	free(sw);
+	return -1;
+}
+
+static void rotator_sw_close(struct rotator *rot)
+{
+	struct rotator_sw *sw = rot->sw;
+
+	pthread_mutex_lock(&sw->lock);
+	sw->stop = 1;
+	pthread_cond_signal(&sw->cond);
+	pthread_mutex_unlock(&sw->lock);
+
+	pthread_join(sw->thread, NULL);
+	pthread_mutex_destroy(&sw->lock);
+	pthread_cond_destroy(&sw->cond);
+
+	for (int n = 0; n < MAX_ROT_BUF; n++) {
+		free(rot->cap_buf_addr[n]);
+		rot->cap_buf_addr[n] = NULL;
+		rot->cap_uv_addr[n] = NULL;
+	}
+
+	free(sw->scratch);
+	free(sw);
+	rot->sw = NULL;
+}
+
+/* The decoder buffer holds the four UBWC planes, the mplane API gets
+ * each of them as an offset in the same dmabuf */
+static int rotator_setup_output(struct instance *i)
+{
+	struct rotator *rot = &i->rotator;
+	const struct ubwc_layout *l = &rot->layout;
+	struct rotator_fmt rf;
+
+	if (rotator_set_format(rot, ROT_OUT(rot), V4L2_PIX_FMT_NV12_UBWC,
+			       rot->width, rot->height, &rf))
+		return -1;
+
+	rot->out_planes = rf.planes;
+
+	if (rf.planes == 1) {
+		rot->out_plane_off[0] = 0;
+		rot->out_plane_size[0] = rf.size[0];
+		rot->out_buf_size = rf.size[0];
+	} else if (rf.planes == ROT_OUT_PLANES) {
+		/* in the order of the driver, not the one in memory */
+		const size_t off[ROT_OUT_PLANES] = {
+			l->y_off, l->y_meta_off, l->uv_off, l->uv_meta_off,
+		};
+		const size_t room[ROT_OUT_PLANES] = {
+			l->uv_meta_off - l->y_off, l->y_off - l->y_meta_off,
+			l->size - l->uv_off, l->uv_off - l->uv_meta_off,
+		};
+
+		rot->out_buf_size = 0;
+
+		for (int n = 0; n < ROT_OUT_PLANES; n++) {
+			if ((size_t)rf.size[n] > room[n]) {
+				err("rotator: plane %d needs %d bytes, the "
+				    "decoder layout has %zu", n, rf.size[n],
+				    room[n]);
+				return -1;
+			}
+
+			rot->out_plane_off[n] = off[n];
+			rot->out_plane_size[n] = rf.size[n];
+			rot->out_buf_size = MAX(rot->out_buf_size,
+						(int)off[n] + rf.size[n]);
+		}
+	} else {
+		err("rotator: unexpected %d planes UBWC format", rf.planes);
+		return -1;
+	}
+
+	/* the rotator computes the UBWC layout on its own */
+	if (rot->out_buf_size > i->video.cap_buf_size) {
+		err("rotator: expects %d bytes per frame, decoder buffers "
+		    "have %d", rot->out_buf_size, i->video.cap_buf_size);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int rotator_setup_capture(struct rotator *rot)
+{
+	struct rotator_fmt rf;
+
+	/* ask for the consumer frame, or for the cropped NV12 frame which
+	 * is then scaled on the CPU */
+	if (!rotator_try_format(rot, ROT_CAP(rot), rot->dst_fourcc,
+				rot->dst_w, rot->dst_h)) {
+		rot->fourcc = rot->dst_fourcc;
+		rot->cap_w = rot->dst_w;
+		rot->cap_h = rot->dst_h;
+	} else {
+		rot->fourcc = V4L2_PIX_FMT_NV12;
+		rot->cap_w = rot->crop.width;
+		rot->cap_h = rot->crop.height;
+		rot->post = 1;
+
+		info("rotator: cannot output %c%c%c%c %dx%d, scaling on "
+		     "the CPU", rot->dst_fourcc & 0xff,
+		     (rot->dst_fourcc >> 8) & 0xff,
+		     (rot->dst_fourcc >> 16) & 0xff, rot->dst_fourcc >> 24,
+		     rot->dst_w, rot->dst_h);
+	}
+
+	if (rotator_set_format(rot, ROT_CAP(rot), rot->fourcc, rot->cap_w,
+			       rot->cap_h, &rf))
+		return -1;
+
+	if (rf.planes > 2 ||
+	    (rf.planes == 2 && rf.stride[1] && rf.stride[1] != rf.stride[0])) {
+		err("rotator: unsupported %d planes linear format", rf.planes);
+		return -1;
+	}
+
+	rot->cap_planes = rf.planes;
+	rot->cap_buf_size = rf.size[0];
+	rot->cap_uv_size = rf.planes > 1 ? rf.size[1] : 0;
+	rot->cap_w = rf.width;
+	rot->cap_h = rf.height;
+	rot->cap_stride = rf.stride[0] ? rf.stride[0] : rot->cap_w;
+	rot->cap_scanlines = rot->cap_h;
+
+	return 0;
+}
+
+static void *rotator_map(int fd, int size)
+{
+	void *addr;
+
+	addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+		err("rotator: failed to map buffer: %m");
+		return NULL;
+	}
+
+	return addr;
+}
+
+/* One ION buffer per CAPTURE plane */
+static int rotator_alloc(struct rotator *rot, int n)
+{
+	int fd;
+
+	fd = alloc_ion_buffer(rot->cap_buf_size, 0);
+	if (fd < 0)
+		return -1;
+
+	rot->cap_buf_fd[n] = fd;
+	rot->cap_buf_addr[n] = rotator_map(fd, rot->cap_buf_size);
+	if (!rot->cap_buf_addr[n])
+		return -1;
+
+	if (rot->cap_planes > 1) {
+		fd = alloc_ion_buffer(rot->cap_uv_size, 0);
+		if (fd < 0)
+			return -1;
+
+		rot->cap_uv_fd[n] = fd;
+		rot->cap_uv_addr[n] = rotator_map(fd, rot->cap_uv_size);
+		if (!rot->cap_uv_addr[n])
+			return -1;
+	} else if (rot->fourcc == V4L2_PIX_FMT_NV12) {
+		rot->cap_uv_addr[n] = (uint8_t *)rot->cap_buf_addr[n] +
+			(size_t)rot->cap_stride * rot->cap_scanlines;
+	}
+
+	return 0;
+}
+
+static int rotator_hw_open(struct instance *i, int fd)
+{
+	struct rotator *rot = &i->rotator;
+	struct v4l2_capability cap;
+	uint32_t caps;
+	int n, count;
+
+	rot->fd = fd;
+
+	memzero(cap);
+	if (ioctl(rot->fd, VIDIOC_QUERYCAP, &cap) < 0) {
+		err("Failed to verify capabilities: %m");
+		return -1;
+	}
+
+	caps = cap.capabilities & V4L2_CAP_DEVICE_CAPS ? cap.device_caps :
+		cap.capabilities;
+
+	/* older rotator drivers only have the single plane API, where the
+	 * ion fd is passed as the user pointer */
+	rot->mplane = !!(caps & V4L2_CAP_VIDEO_M2M_MPLANE);
+
+	dbg("caps (%s): driver=\"%s\" card=\"%s\" %s", rot->name, cap.driver,
+	    cap.card, rot->mplane ? "mplane dmabuf" : "userptr");
+
+	if (rotator_setup_output(i) || rotator_set_crop(rot) ||
+	    rotator_setup_capture(rot))
+		return -1;
+
+	count = rotator_reqbufs(rot, ROT_OUT(rot), rot->cap_buf_cnt);
+	if (count < 0)
+		return -1;
+	rot->out_buf_cnt = count;
+
+	count = rotator_reqbufs(rot, ROT_CAP(rot), rot->cap_buf_cnt);
+	if (count < 0)
+		return -1;
+
+	/* OUTPUT and CAPTURE buffers are used in pairs */
+	rot->cap_buf_cnt = MIN(MIN(count, rot->out_buf_cnt), MAX_ROT_BUF);
+
+	for (n = 0; n < rot->cap_buf_cnt; n++) {
+		if (rotator_alloc(rot, n))
+			return -1;
+	}
+
+	if (rotator_stream(rot, ROT_OUT(rot), VIDIOC_STREAMON) ||
+	    rotator_stream(rot, ROT_CAP(rot), VIDIOC_STREAMON))
+		return -1;
+
+	return 0;
+}
+
+/* Clip the rectangle asked by the user to the decoded frame */
+static int rotator_user_crop(struct rotator *rot, const struct v4l2_rect *r)
+{
+	struct v4l2_rect c;
+
+	c.left = MIN(MAX(r->left, 0), rot->width);
+	c.top = MIN(MAX(r->top, 0), rot->height);
+	c.width = MIN((int)r->width, rot->width - c.left);
+	c.height = MIN((int)r->height, rot->height - c.top);
+
+	if (!c.width || !c.height) {
+		err("rotator: crop %ux%u at %d,%d is outside of the %dx%d "
+		    "frame", r->width, r->height, r->left, r->top,
+		    rot->width, rot->height);
+		return -1;
+	}
+
+	rot->crop = c;
+
+	return 0;
+}
+
+int rotator_present(const char *name)
+{
+	int fd;
+
+	if (!strcmp(name, "sw") || !strcmp(name, "none"))
+		return 0;
+
+	fd = open(name, O_RDWR | O_NONBLOCK);
+	if (fd < 0)
+		return errno != ENOENT && errno != ENODEV;
+
+	close(fd);
+
+	return 1;
+}
+
+int rotator_open(struct instance *i, const char *name, int depth,
+		 const struct rotator_cb *cb)
+{
+	struct rotator *rot = &i->rotator;
+	struct video *vid = &i->video;
+	int fd = -1;
+	int n, ret;
+
+	memset(rot, 0, sizeof (*rot));
+	rot->fd = -1;
+	rot->event_fd = -1;
+	for (n = 0; n < MAX_ROT_BUF; n++) {
+		rot->cap_buf_fd[n] = -1;
+		rot->cap_uv_fd[n] = -1;
+	}
+
+	rot->name = strdup(name);
+	rot->cb = cb;
+	rot->depth = depth;
+	rot->cap_buf_cnt = depth > 0 ? MIN(depth, MAX_ROT_BUF) : ROT_DEPTH;
+
+	if (!vid->cap_w || !vid->cap_h) {
+		err("rotator: decoder capture format not set");
+		goto fail;
+	}
+
+	/* same geometry as the decoder capture queue, the padding is
+	 * cropped away */
+	rot->width = vid->cap_w;
+	rot->height = vid->cap_h;
+	rot->stride = vid->cap_plane_stride[0];
+	rot->scanlines = vid->cap_scanlines;
+	rot->crop = vid->cap_crop;
+	rot->src_linear = vid->cap_buf_format == V4L2_PIX_FMT_NV12;
+
+	if (i->rotator_crop.width && i->rotator_crop.height &&
+	    rotator_user_crop(rot, &i->rotator_crop))
+		goto fail;
+
+	rot->dst_fourcc = i->rotator_fourcc ? i->rotator_fourcc :
+		V4L2_PIX_FMT_NV12;
+	rot->dst_w = i->rotator_width ? i->rotator_width : rot->crop.width;
+	rot->dst_h = i->rotator_height ? i->rotator_height : rot->crop.height;
+	rot->dst_scanlines = rot->dst_h;
+	if (rot->dst_fourcc == V4L2_PIX_FMT_NV12) {
+		rot->dst_stride = NV12_STRIDE(rot->dst_w);
+		rot->dst_size = nv12_size(rot->dst_stride, rot->dst_h);
+	} else {
+		rot->dst_stride = rot->dst_w;
+		rot->dst_size = rot->dst_stride * rot->dst_scanlines;
+	}
+
+	/* the plane offsets are computed, they have to agree with what
+	 * the decoder says of its buffers */
+	ubwc_layout_nv12(&rot->layout, rot->width, rot->height);
+
+	if (!rot->src_linear &&
+	    ubwc_layout_match(&rot->layout, rot->stride, rot->scanlines,
+			      vid->cap_buf_size))
+		goto fail;
+
+	/* without the default device the CPU stands in, see the drop
+	 * count of the report for what its rate is worth */
+	if (strcmp(name, "sw")) {
+		fd = open(name, O_RDWR | O_NONBLOCK);
+		if (fd < 0 && (errno == ENOENT || errno == ENODEV) &&
+		    !strcmp(name, ROTATOR_DEVICE)) {
+			info("rotator: no %s, using the software stand-in",
+			     name);
+		} else if (fd < 0) {
+			err("Failed to open rotator device %s: %m", name);
+			goto fail;
+		}
+	}
+
+	if (fd >= 0)
+		ret = rotator_hw_open(i, fd);
+	else
+		ret = rotator_sw_open(i);
+
+	if (ret)
+		goto fail;
+
+	/* the consumer frame is made on the CPU, from the whole CAPTURE
+	 * frame or from the crop of the linear or detiled one */
+	if (rot->post &&
+	    rotator_scale_open(rot, rot->cap_w, rot->cap_h))
+		goto fail;
+	if (rot->sw && (rot->src_linear || rot->sw->scratch) &&
+	    rotator_scale_open(rot, rot->crop.width, rot->crop.height))
+		goto fail;
+
+	for (n = 0; n < rot->cap_buf_cnt; n++) {
+		if (!rot->post) {
+			rot->dst_addr[n] = rot->cap_buf_addr[n];
+			rot->dst_uv_addr[n] = rot->cap_uv_addr[n];
+			continue;
+		}
+
+		rot->dst_addr[n] = malloc(rot->dst_size);
+		if (!rot->dst_addr[n])
+			goto fail;
+
+		if (rot->dst_fourcc == V4L2_PIX_FMT_NV12)
+			rot->dst_uv_addr[n] = (uint8_t *)rot->dst_addr[n] +
+				(size_t)rot->dst_stride * rot->dst_scanlines;
+	}
+
+	/* compare every hardware frame with the CPU detiler, which only
+	 * drops the right and bottom padding */
+	if (i->ubwc_verify && !rot->sw && !i->secure &&
+	    (rot->fourcc != V4L2_PIX_FMT_NV12 || rot->crop.left ||
+	     rot->crop.top || rot->cap_w != (int)rot->crop.width ||
+	     rot->cap_h != (int)rot->crop.height)) {
+		info("rotator: cannot verify scaled frames");
+	} else if (i->ubwc_verify && !rot->sw && !i->secure) {
+		rot->verify = 1;
+		rot->verify_psnr = INFINITY;
+
+		for (n = 0; n < rot->cap_buf_cnt; n++) {
+			rot->verify_buf[n] = malloc(nv12_size(rot->cap_stride,
+							      rot->cap_scanlines));
+			if (!rot->verify_buf[n])
+				goto fail;
+		}
+	}
+
+	if ((rot->sw && !rot->src_linear) || rot->verify) {
+		rot->ubwc = ubwc_new(i->ubwc_threads);
+		if (!rot->ubwc)
+			goto fail;
+	}
+
+	for (n = 0; n < rot->cap_buf_cnt; n++)
+		rot->cap_buf_flag[n] = ROT_BUF_FREE;
+
+	rot->active = 1;
+
+	info("rotator: %dx%d to %dx%d session with %d buffers of %d bytes",
+	     rot->width, rot->height, rot->dst_w, rot->dst_h,
+	     rot->cap_buf_cnt, rot->dst_size);
+
+	if (cb->pool)
+		cb->pool(i);
+
+	return 0;
+
+fail:
+	rotator_close(i);
+	return -1;
+}
+
+void rotator_close(struct instance *i)
+{
+	struct rotator *rot = &i->rotator;
+
+	if (rot->sw)
+		rotator_sw_close(rot);
+
+	if (rot->verify)
+		info("rotator: %d frames verified, %d differ from the CPU "
+		     "detiler, worst PSNR %.2f dB, %d with tile metadata not "
+		     "checked",
+		     rot->verify_frames, rot->verify_bad, rot->verify_psnr,
+		     rot->verify_skipped);
+
+	if (rot->sw_failed)
+		info("rotator: %d frames the software backend could not "
+		     "convert dropped", rot->sw_failed);
+
+	ubwc_free(rot->ubwc);
+	rot->ubwc = NULL;
+
+	scale_free(rot->scale_y);
+	scale_free(rot->scale_uv);
+	rot->scale_y = NULL;
+	rot->scale_uv = NULL;
+
+	for (int n = 0; n < MAX_ROT_BUF; n++) {
+		free(rot->verify_buf[n]);
+		rot->verify_buf[n] = NULL;
+
+		if (rot->post)
+			free(rot->dst_addr[n]);
+		rot->dst_addr[n] = NULL;
+		rot->dst_uv_addr[n] = NULL;
+	}
+	rot->verify = 0;
+	rot->post = 0;
+	rot->crop_changed = 0;
+
+	if (rot->fd >= 0) {
+		/* STREAMOFF returns all queued buffers */
+		rotator_stream(rot, ROT_OUT(rot), VIDIOC_STREAMOFF);
+		rotator_stream(rot, ROT_CAP(rot), VIDIOC_STREAMOFF);
+
+		rotator_reqbufs(rot, ROT_OUT(rot), 0);
+		rotator_reqbufs(rot, ROT_CAP(rot), 0);
+
+		close(rot->fd);
+		rot->fd = -1;
+	}
+
+	for (int n = 0; n < MAX_ROT_BUF; n++) {
+		if (rot->cap_buf_addr[n])
+			munmap(rot->cap_buf_addr[n], rot->cap_buf_size);
+		if (rot->cap_buf_fd[n] >= 0)
+			close(rot->cap_buf_fd[n]);
+
+		/* otherwise it points into the buffer above */
+		if (rot->cap_uv_fd[n] >= 0) {
+			if (rot->cap_uv_addr[n])
+				munmap(rot->cap_uv_addr[n], rot->cap_uv_size);
+			close(rot->cap_uv_fd[n]);
+		}
+
+		rot->cap_buf_addr[n] = NULL;
+		rot->cap_buf_fd[n] = -1;
+		rot->cap_uv_addr[n] = NULL;
+		rot->cap_uv_fd[n] = -1;
+		rot->cap_buf_flag[n] = ROT_BUF_FREE;
+	}
+
+	if (rot->event_fd >= 0)
+		close(rot->event_fd);
+	rot->event_fd = -1;
+
+	/* decoder buffers still in flight are requeued by the caller
+	 * when it restarts the capture queue */
+	rot->in_flight = 0;
+	rot->wait_count = 0;
+	rot->cap_buf_cnt = 0;
+	rot->out_buf_cnt = 0;
+	rot->mplane = 0;
+	rot->active = 0;
+
+	free(rot->name);
+	rot->name = NULL;
+}
+
+int rotator_get_fd(struct instance *i)
+{
+	struct rotator *rot = &i->rotator;
+
+	return rot->sw ? rot->event_fd : rot->fd;
+}
+
+int rotator_busy(struct instance *i)
+{
+	return i->rotator.in_flight > 0;
+}
+
+static void rotator_consumed(struct instance *i, int n)
+{
+	struct rotator *rot = &i->rotator;
+	struct rotator_job *job = &rot->job[n];
+
+	if (job->consumed)
+		return;
+
+	job->consumed = 1;
+
+	if (rot->cb && rot->cb->consumed)
+		rot->cb->consumed(i, job->dec_index);
+}
+
+/*
+ * An OUTPUT QBUF failed with CAPTURE buffer n queued already, which only
+ * a STREAMOFF gives back: the frames in flight are lost, their decoder
+ * buffers and the ones waiting go back to the decoder.
+ */
+static void rotator_abort(struct instance *i, int n)
+{
+	struct rotator *rot = &i->rotator;
+
+	rotator_stream(rot, ROT_OUT(rot), VIDIOC_STREAMOFF);
+	rotator_stream(rot, ROT_CAP(rot), VIDIOC_STREAMOFF);
+
+	for (int k = 0; k < rot->cap_buf_cnt; k++) {
+		if (k == n || rot->cap_buf_flag[k] != ROT_BUF_QUEUED)
+			continue;
+
+		rotator_consumed(i, k);
+		rot->cap_buf_flag[k] = ROT_BUF_FREE;
+		rot->in_flight--;
+	}
+
+	while (rot->wait_count) {
+		if (rot->cb && rot->cb->consumed)
+			rot->cb->consumed(i, rot->wait_dec[rot->wait_head]);
+		rot->wait_head = (rot->wait_head + 1) % MAX_CAP_BUF;
+		rot->wait_count--;
+	}
+
+	rotator_stream(rot, ROT_OUT(rot), VIDIOC_STREAMON);
+	rotator_stream(rot, ROT_CAP(rot), VIDIOC_STREAMON);
+}
+
+static int rotator_queue_mplane(struct instance *i, int n)
+{
+	struct rotator *rot = &i->rotator;
+	struct rotator_job *job = &rot->job[n];
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
+	struct v4l2_buffer buf;
+
+	memzero(buf);
+	memset(planes, 0, sizeof (planes));
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	buf.memory = V4L2_MEMORY_DMABUF;
+	buf.index = n;
+	buf.m.planes = planes;
+	buf.length = rot->cap_planes;
+
+	planes[0].m.fd = rot->cap_buf_fd[n];
+	planes[0].length = rot->cap_buf_size;
+	if (rot->cap_planes > 1) {
+		planes[1].m.fd = rot->cap_uv_fd[n];
+		planes[1].length = rot->cap_uv_size;
+	}
+
+	if (ioctl(rot->fd, VIDIOC_QBUF, &buf) < 0) {
+		err("rotator: failed to queue CAPTURE buffer %d: %m", n);
+		return -1;
+	}
+
+	/* all planes are in the decoder buffer, bytesused counts from
+	 * its start like for the decoder */
+	memzero(buf);
+	memset(planes, 0, sizeof (planes));
+	buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+	buf.memory = V4L2_MEMORY_DMABUF;
+	buf.index = n;
+	buf.m.planes = planes;
+	buf.length = rot->out_planes;
+
+	for (int p = 0; p < rot->out_planes; p++) {
+		planes[p].m.fd = job->src_fd;
+		planes[p].length = job->src_size;
+		planes[p].data_offset = rot->out_plane_off[p];
+		planes[p].bytesused = rot->out_plane_off[p] +
+			rot->out_plane_size[p];
+	}
+
+	if (ioctl(rot->fd, VIDIOC_QBUF, &buf) < 0) {
+		err("rotator: failed to queue OUTPUT buffer %d: %m", n);
+		rotator_abort(i, n);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int rotator_queue(struct instance *i, int n)
+{
+	struct rotator *rot = &i->rotator;
+	struct rotator_job *job = &rot->job[n];
+	struct v4l2_buffer buf;
+
+	if (rot->sw) {
+		struct rotator_sw *sw = rot->sw;
+
+		pthread_mutex_lock(&sw->lock);
+		sw->queue[(sw->queue_head + sw->queue_count) % MAX_ROT_BUF] = n;
+		sw->queue_count++;
+		pthread_cond_signal(&sw->cond);
+		pthread_mutex_unlock(&sw->lock);
+
+		return 0;
+	}
+
+	if (rot->mplane)
+		return rotator_queue_mplane(i, n);
+
+	memzero(buf);
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf.memory = V4L2_MEMORY_USERPTR;
+	buf.index = n;
+	buf.m.userptr = (unsigned long)rot->cap_buf_fd[n];
+	buf.length = rot->cap_buf_size;
+
+	if (ioctl(rot->fd, VIDIOC_QBUF, &buf) < 0) {
+		err("rotator: failed to queue CAPTURE buffer %d: %m", n);
+		return -1;
+	}
+
+	memzero(buf);
+	buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	buf.memory = V4L2_MEMORY_USERPTR;
+	buf.index = n;
+	buf.m.userptr = (unsigned long)job->src_fd;
+	buf.length = rot->out_buf_size;
+	buf.bytesused = rot->out_buf_size;
+
+	if (ioctl(rot->fd, VIDIOC_QBUF, &buf) < 0) {
+		err("rotator: failed to queue OUTPUT buffer %d: %m", n);
+		rotator_abort(i, n);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Get back all queued buffers after an error */
+static void rotator_reset(struct rotator *rot)
+{
+	rotator_stream(rot, ROT_OUT(rot), VIDIOC_STREAMOFF);
+	rotator_stream(rot, ROT_CAP(rot), VIDIOC_STREAMOFF);
+
+	for (int n = 0; n < rot->cap_buf_cnt; n++) {
+		if (rot->cap_buf_flag[n] == ROT_BUF_QUEUED)
+			rot->cap_buf_flag[n] = ROT_BUF_FREE;
+	}
+
+	rotator_stream(rot, ROT_OUT(rot), VIDIOC_STREAMON);
+	rotator_stream(rot, ROT_CAP(rot), VIDIOC_STREAMON);
+}
+
+static int rotator_start(struct instance *i, int dec_index, uint64_t pts)
+{
+	struct rotator *rot = &i->rotator;
+	struct video *vid = &i->video;
+	struct rotator_job *job;
+	int n;
+
+	for (n = 0; n < rot->cap_buf_cnt; n++) {
+		if (rot->cap_buf_flag[n] == ROT_BUF_FREE)
+			break;
+	}
+
+	if (n == rot->cap_buf_cnt)
+		return -EBUSY;
+
+	job = &rot->job[n];
+	job->dec_index = dec_index;
+	job->pts = pts;
+	job->src_fd = vid->cap_buf_fd[dec_index];
+	job->src = vid->cap_buf_addr[dec_index];
+	job->src_size = vid->cap_buf_size;
+	job->consumed = 0;
+	job->failed = 0;
+	job->submitted = metrics_now_us();
+
+	/* the decoder may reuse its buffer before the rotator is done,
+	 * so the reference is computed right away */
+	job->unverified = rot->verify && (!job->src ||
+		ubwc_to_nv12(rot->ubwc, &rot->layout, job->src,
+			     job->src_size, rot->cap_w, rot->cap_h,
+			     rot->verify_buf[n], rot->cap_stride,
+			     rot->cap_scanlines));
+
+	rot->cap_buf_flag[n] = ROT_BUF_QUEUED;
+	rot->in_flight++;
+
+	if (rotator_queue(i, n)) {
+		rot->cap_buf_flag[n] = ROT_BUF_FREE;
+		rot->in_flight--;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int rotator_idle(struct rotator *rot)
+{
+	if (rot->in_flight || rot->wait_count)
+		return 0;
+
+	for (int n = 0; n < rot->cap_buf_cnt; n++) {
+		if (rot->cap_buf_flag[n] != ROT_BUF_FREE)
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Same session with the current decoder crop */
+static int rotator_reopen(struct instance *i)
+{
+	struct rotator *rot = &i->rotator;
+	const struct rotator_cb *cb = rot->cb;
+	int depth = rot->depth;
+	char *name = rot->name;
+	int ret;
+
+	rot->name = NULL;
+	rotator_close(i);
+
+	ret = rotator_open(i, name, depth, cb);
+	free(name);
+
+	return ret;
+}
+
+void rotator_update_crop(struct instance *i)
+{
+	struct rotator *rot = &i->rotator;
+	const struct v4l2_rect *c = &i->video.cap_crop;
+
+	/* the crop asked by the user wins */
+	if (!rot->active || (i->rotator_crop.width && i->rotator_crop.height))
+		return;
+
+	rot->crop_changed = c->left != rot->crop.left ||
+			    c->top != rot->crop.top ||
+			    c->width != rot->crop.width ||
+			    c->height != rot->crop.height;
+}
+
+int rotator_submit(struct instance *i, int dec_index, uint64_t pts)
+{
+	struct rotator *rot = &i->rotator;
+	int ret, w;
+
+	if (rot->crop_changed && rotator_idle(rot)) {
+		info("rotator: crop changed to %ux%u at %d,%d",
+		     i->video.cap_crop.width, i->video.cap_crop.height,
+		     i->video.cap_crop.left, i->video.cap_crop.top);
+
+		if (rotator_reopen(i))
+			return -1;
+	}
+
+	if (!rot->wait_count) {
+		ret = rotator_start(i, dec_index, pts);
+		if (ret != -EBUSY)
+			return ret;
+	}
+
+	/* all slots busy, hold on to the decoder buffer until one is
+	 * released, this is what throttles the decoder */
+	if (rot->wait_count == MAX_CAP_BUF)
+		return -1;
+
+	w = (rot->wait_head + rot->wait_count) % MAX_CAP_BUF;
+
+	rot->wait_dec[w] = dec_index;
+	rot->wait_pts[w] = pts;
+	rot->wait_count++;
+
+	return 0;
+}
+
+static void rotator_verify(struct instance *i, int n)
+{
+	struct rotator *rot = &i->rotator;
+	double psnr;
+	int row;
+
+	psnr = ubwc_compare_nv12(rot->cap_buf_addr[n], rot->cap_uv_addr[n],
+				 rot->verify_buf[n], rot->verify_buf[n] +
+				 (size_t)rot->cap_stride * rot->cap_scanlines,
+				 rot->cap_w, rot->cap_h, rot->cap_stride, &row);
+
+	rot->verify_frames++;
+	if (isinf(psnr))
+		return;
+
+	/* only the first one, the layout is the same for all frames */
+	if (!rot->verify_bad++)
+		err("rotator: frame %llu differs from the CPU detiler from "
+		    "line %d, PSNR %.2f dB",
+		    (unsigned long long)rot->job[n].pts, row, psnr);
+
+	rot->verify_psnr = MIN(rot->verify_psnr, psnr);
+}
+
+static void rotator_complete(struct instance *i, int n)
+{
+	struct rotator *rot = &i->rotator;
+	struct rotator_job *job = &rot->job[n];
+
+	rotator_consumed(i, n);
+
+	rot->cap_buf_flag[n] = ROT_BUF_HELD;
+	rot->in_flight--;
+
+	if (job->failed) {
+		metrics_inc(&i->metrics, frames_rot_dropped, 1);
+		if (!rot->sw_failed++)
+			err("rotator: the software backend cannot convert "
+			    "frame %llu, dropped",
+			    (unsigned long long)job->pts);
+		rotator_release(i, n);
+		return;
+	}
+
+	metrics_hist_add(&i->metrics.cur.rotator_latency,
+			 metrics_now_us() - job->submitted);
+	metrics_inc(&i->metrics, frames_rotated, 1);
+
+	if (rot->post) {
+		struct v4l2_rect all = { 0, 0, rot->cap_w, rot->cap_h };
+
+		rotator_crop_scale(rot, rot->cap_buf_addr[n],
+				   rot->cap_uv_addr[n], rot->cap_stride, &all,
+				   rot->dst_addr[n], rot->dst_uv_addr[n]);
+	}
+
+	if (rot->verify && job->unverified)
+		rot->verify_skipped++;
+	else if (rot->verify)
+		rotator_verify(i, n);
+
+	if (rot->cb && rot->cb->done)
+		rot->cb->done(i, n, job->pts);
+	else
+		rotator_release(i, n);
+}
+
+static int rotator_sw_dispatch(struct instance *i)
+{
+	struct rotator *rot = &i->rotator;
+	struct rotator_sw *sw = rot->sw;
+	int done[MAX_ROT_BUF];
+	uint64_t count;
+	int ndone = 0;
+
+	if (read(rot->event_fd, &count, sizeof (count)) < 0 &&
+	    errno != EAGAIN)
+		return -1;
+
+	pthread_mutex_lock(&sw->lock);
+	while (sw->done_count) {
+		done[ndone++] = sw->done[sw->done_head];
+		sw->done_head = (sw->done_head + 1) % MAX_ROT_BUF;
+		sw->done_count--;
+	}
+	pthread_mutex_unlock(&sw->lock);
+
+	for (int k = 0; k < ndone; k++)
+		rotator_complete(i, done[k]);
+
+	return 0;
+}
+
+static int rotator_dqbuf(struct rotator *rot, enum v4l2_buf_type type,
+			 int *index)
+{
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
+	struct v4l2_buffer buf;
+
+	memzero(buf);
+	buf.type = type;
+	buf.memory = ROT_MEMORY(rot);
+
+	if (rot->mplane) {
+		memset(planes, 0, sizeof (planes));
+		buf.m.planes = planes;
+		buf.length = VIDEO_MAX_PLANES;
+	}
+
+	if (ioctl(rot->fd, VIDIOC_DQBUF, &buf) < 0)
+		return -1;
+
+	*index = buf.index;
+
+	return 0;
+}
+
+int rotator_dispatch(struct instance *i)
+{
+	struct rotator *rot = &i->rotator;
+	int n;
+
+	if (rot->sw)
+		return rotator_sw_dispatch(i);
+
+	/* input consumed, the decoder can have its buffer back */
+	while (!rotator_dqbuf(rot, ROT_OUT(rot), &n)) {
+		if (n >= 0 && n < rot->cap_buf_cnt)
+			rotator_consumed(i, n);
+	}
+
+	while (!rotator_dqbuf(rot, ROT_CAP(rot), &n)) {
+		if (n >= 0 && n < rot->cap_buf_cnt &&
+		    rot->cap_buf_flag[n] == ROT_BUF_QUEUED)
+			rotator_complete(i, n);
+	}
+
+	if (errno != EAGAIN) {
+		err("rotator: failed to dequeue: %m");
+		return -1;
+	}
+
+	return 0;
+}
+
+void rotator_release(struct instance *i, int index)
+{
+	struct rotator *rot = &i->rotator;
+
+	if (index < 0 || index >= rot->cap_buf_cnt)
+		return;
+
+	rot->cap_buf_flag[index] = ROT_BUF_FREE;
+
+	/* feed the oldest waiting decoder buffer into the free slot,
+	 * taken off the queue first as a failure empties it */
+	while (rot->wait_count) {
+		int w = rot->wait_head;
+		int ret;
+
+		rot->wait_head = (w + 1) % MAX_CAP_BUF;
+		rot->wait_count--;
+
+		ret = rotator_start(i, rot->wait_dec[w], rot->wait_pts[w]);
+		if (ret == -EBUSY) {
+			rot->wait_head = w;
+			rot->wait_count++;
+			break;
+		}
+
+		if (ret && rot->cb && rot->cb->consumed)
+			rot->cb->consumed(i, rot->wait_dec[w]);
+	}
+}
+
+int rotator_convert(struct instance *i, int ion_fd, int *index)
+{
+	struct rotator *rot = &i->rotator;
+	struct pollfd pfd;
+	int n, ret;
+
+	/* the synchronous path is only for the hardware when idle */
+	if (rot->fd < 0 || rot->in_flight)
+		return -1;
+
+	for (n = 0; n < rot->cap_buf_cnt; n++) {
+		if (rot->cap_buf_flag[n] == ROT_BUF_FREE)
+			break;
+	}
+
+	if (n == rot->cap_buf_cnt) {
+		err("rotator: no free buffer");
+		return -1;
+	}
+
+	rot->job[n].src_fd = ion_fd;
+	rot->job[n].src_size = rot->out_buf_size;
+	rot->cap_buf_flag[n] = ROT_BUF_QUEUED;
+
+	if (rotator_queue(i, n))
+		goto reset;
+
+	pfd.fd = rot->fd;
+	pfd.events = POLLIN | POLLRDNORM;
+
+	ret = poll(&pfd, 1, ROT_TIMEOUT_MS);
+	if (ret <= 0) {
+		err("rotator: conversion %s", ret ? "failed" : "timed out");
+		goto reset;
+	}
+
+	if (rotator_dqbuf(rot, ROT_CAP(rot), index)) {
+		err("rotator: failed to dequeue CAPTURE buffer: %m");
+		goto reset;
+	}
+
+	rot->cap_buf_flag[*index] = ROT_BUF_HELD;
+
+	if (rotator_dqbuf(rot, ROT_OUT(rot), &n))
+		dbg("rotator: OUTPUT buffer not dequeued: %m");
+
+	return 0;
+
+reset:
+	rotator_reset(rot);
+	return -1;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void rotator_bench_report(const char *what, uint64_t *us, int n,
+				 int failed)
+{
+	uint64_t sum = 0;
+
+	if (!n) {
+		info("rotator bench %-10s: %d frames failed", what, failed);
+		return;
+	}
+
+	qsort(us, n, sizeof (*us), cmp_u64);
+
+	for (int k = 0; k < n; k++)
+		sum += us[k];
+
+	info("rotator bench %-10s: %d frames, %d failed, mean %llu us, "
+	     "min %llu p50 %llu p99 %llu max %llu", what, n, failed,
+	     (unsigned long long)(sum / n), (unsigned long long)us[0],
+	     (unsigned long long)us[n / 2],
+	     (unsigned long long)us[MIN(n * 99 / 100, n - 1)],
+	     (unsigned long long)us[n - 1]);
+}
+
+int rotator_bench(struct instance *i, int ion_fd, int iterations)
+{
+	uint64_t *us;
+	int n, done, failed;
+
+	if (i->rotator.fd < 0) {
+		err("rotator bench needs the hardware rotator");
+		return -1;
+	}
+
+	us = calloc(iterations, sizeof (*us));
+	if (!us)
+		return -1;
+
+	/* only the conversions that worked are timed, a failed one may
+	 * have waited for the whole timeout */
+	for (n = 0, done = 0, failed = 0; n < iterations; n++) {
+		unsigned char *data = NULL;
+		size_t size = 0;
+		uint64_t start = metrics_now_us();
+
+		if (convert_ubwc_to_linear(ion_fd, i->rotator.width,
+					   i->rotator.height, &data, &size)) {
+			failed++;
+			continue;
+		}
+
+		us[done++] = metrics_now_us() - start;
+	}
+
+	rotator_bench_report("per-frame", us, done, failed);
+
+	for (n = 0, done = 0, failed = 0; n < iterations; n++) {
+		uint64_t start = metrics_now_us();
+		int index;
+
+		if (rotator_convert(i, ion_fd, &index)) {
+			failed++;
+			continue;
+		}
+
+		us[done++] = metrics_now_us() - start;
+		rotator_release(i, index);
+	}
+
+	rotator_bench_report("persistent", us, done, failed);
+
+	free(us);
+
+	return 0;
+}
+
+int convert_ubwc_to_linear(unsigned long out_buf_fd, int width, int height,
+			   unsigned char **linear_data, size_t *linear_size)
+{
+	struct v4l2_capability cap;
+	struct v4l2_format fmt_out, fmt_cap;
+	struct v4l2_requestbuffers req;
+	struct v4l2_buffer buf;
+	struct pollfd pfd;
+	enum v4l2_buf_type type;
+	void *linear_ptr = MAP_FAILED;
+	int rotator_fd, cap_ion_fd = -1;
+	int ret = -1;
+
+	rotator_fd = open(ROTATOR_DEVICE, O_RDWR);
+	if (rotator_fd < 0) {
+		err("Failed to open rotator device %s: %m", ROTATOR_DEVICE);
+		return -1;
+	}
+
+	memzero(cap);
+	if (ioctl(rotator_fd, VIDIOC_QUERYCAP, &cap) < 0) {
+		err("Failed to verify capabilities: %m");
+		goto out;
+	}
+
+	dbg("caps (%s): driver=\"%s\" bus_info=\"%s\" card=\"%s\" "
+	    "version=%u.%u.%u", ROTATOR_DEVICE, cap.driver, cap.bus_info,
+	    cap.card, (cap.version >> 16) & 0xff, (cap.version >> 8) & 0xff,
+	    cap.version & 0xff);
+
+	memzero(fmt_out);
+	fmt_out.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	fmt_out.fmt.pix.width = width;
+	fmt_out.fmt.pix.height = height;
+	fmt_out.fmt.pix.pixelformat = V4L2_PIX_FMT_NV12_UBWC;
+	fmt_out.fmt.pix.field = V4L2_FIELD_NONE;
+	if (ioctl(rotator_fd, VIDIOC_S_FMT, &fmt_out) < 0) {
+		err("rotator: failed to set OUTPUT format: %m");
+		goto out;
+	}
+
+	memzero(fmt_cap);
+	fmt_cap.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	fmt_cap.fmt.pix.width = width;
+	fmt_cap.fmt.pix.height = height;
+	fmt_cap.fmt.pix.pixelformat = V4L2_PIX_FMT_NV12;
+	fmt_cap.fmt.pix.field = V4L2_FIELD_NONE;
+	if (ioctl(rotator_fd, VIDIOC_S_FMT, &fmt_cap) < 0) {
+		err("rotator: failed to set CAPTURE format: %m");
+		goto out;
+	}
+
+	memzero(req);
+	req.count = 1;
+	req.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	req.memory = V4L2_MEMORY_USERPTR;
+	if (ioctl(rotator_fd, VIDIOC_REQBUFS, &req) < 0) {
+		err("rotator: failed to request OUTPUT buffers: %m");
+		goto out;
+	}
+
+	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (ioctl(rotator_fd, VIDIOC_REQBUFS, &req) < 0) {
+		err("rotator: failed to request CAPTURE buffers: %m");
+		goto out;
+	}
+
+	cap_ion_fd = alloc_ion_buffer(fmt_cap.fmt.pix.sizeimage, 0);
+	if (cap_ion_fd < 0) {
+		err("Failed to allocate ION buffer for capture");
+		goto out;
+	}
+
+	/* this driver API takes the ion fds as user pointers */
+	memzero(buf);
+	buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	buf.memory = V4L2_MEMORY_USERPTR;
+	buf.m.userptr = out_buf_fd;
+	buf.length = fmt_out.fmt.pix.sizeimage;
+	if (ioctl(rotator_fd, VIDIOC_QBUF, &buf) < 0) {
+		err("rotator: failed to queue OUTPUT buffer: %m");
+		goto out;
+	}
+
+	memzero(buf);
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf.memory = V4L2_MEMORY_USERPTR;
+	buf.m.userptr = (unsigned long)cap_ion_fd;
+	buf.length = fmt_cap.fmt.pix.sizeimage;
+	if (ioctl(rotator_fd, VIDIOC_QBUF, &buf) < 0) {
+		err("rotator: failed to queue CAPTURE buffer: %m");
+		goto out;
+	}
+
+	type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	if (ioctl(rotator_fd, VIDIOC_STREAMON, &type) < 0) {
+		err("rotator: failed to start OUTPUT streaming: %m");
+		goto out;
+	}
+
+	type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (ioctl(rotator_fd, VIDIOC_STREAMON, &type) < 0) {
+		err("rotator: failed to start CAPTURE streaming: %m");
+		goto out;
+	}
+
+	pfd.fd = rotator_fd;
+	pfd.events = POLLIN | POLLRDNORM;
+	ret = poll(&pfd, 1, ROT_TIMEOUT_MS);
+	if (ret <= 0) {
+		if (!ret)
+			err("rotator: conversion timed out");
+		else
+			err("rotator: poll failed: %m");
+		ret = -1;
+		goto out;
+	}
+	ret = -1;
+
+	memzero(buf);
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf.memory = V4L2_MEMORY_USERPTR;
+	if (ioctl(rotator_fd, VIDIOC_DQBUF, &buf) < 0) {
+		err("rotator: failed to dequeue CAPTURE buffer: %m");
+		goto out;
+	}
+
+	/* the frame is only checked for being readable, the session
+	 * and its buffer go away on return */
+	linear_ptr = mmap(NULL, buf.length, PROT_READ, MAP_SHARED,
+			  cap_ion_fd, 0);
+	if (linear_ptr == MAP_FAILED) {
+		err("rotator: failed to map CAPTURE buffer: %m");
+		goto out;
+	}
+
+	munmap(linear_ptr, buf.length);
+
+	*linear_data = NULL;
+	*linear_size = buf.bytesused;
+
+	dbg("UBWC to linear conversion successful");
+	ret = 0;
+
+out:
+	/* closing the device stops streaming and frees its buffers */
+	if (cap_ion_fd >= 0)
+		close(cap_ion_fd);
+	close(rotator_fd);
+
+	return ret;
+}
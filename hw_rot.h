@@ -0,0 +1,97 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * SDE rotator header file
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef INCLUDE_HW_ROT_H
+#define INCLUDE_HW_ROT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Default rotator, the SDE rotator of the display subsystem */
+#define ROTATOR_DEVICE		"/dev/video2"
+
+struct instance;
+
+struct rotator_cb {
+	/* The decoder CAPTURE buffer has been read and can be queued
+	 * again */
+	void (*consumed)(struct instance *i, int dec_index);
+
+	/* A linear frame is ready in pool buffer index (at
+	 * rotator.dst_addr[index]), hand it back with rotator_release()
+	 * once done with it */
+	void (*done)(struct instance *i, int index, uint64_t pts);
+
+	/* The pool buffers were set up, frames of an older pool were all
+	 * released */
+	void (*pool)(struct instance *i);
+};
+
+/* Whether name is a rotator device that exists; one that cannot be
+ * opened for another reason counts, so rotator_open() reports it */
+int rotator_present(const char *name);
+
+/* Open a rotator session with depth frames in flight and set up its
+ * buffer pool, streaming starts right away so converting a frame is
+ * only QBUF/DQBUF. With name "sw", or when ROTATOR_DEVICE does not
+ * exist, the CPU does it: linear frames are cropped and scaled, UBWC
+ * ones only detiled when no tile has metadata (see ubwc.h) and
+ * dropped otherwise. */
+int rotator_open(struct instance *i, const char *name, int depth,
+		 const struct rotator_cb *cb);
+
+/* Stop streaming and release the session and its buffers */
+void rotator_close(struct instance *i);
+
+/* The decoder crop changed, the session follows once idle */
+void rotator_update_crop(struct instance *i);
+
+/* Fd to poll for completions, only while rotator_busy() */
+int rotator_get_fd(struct instance *i);
+int rotator_busy(struct instance *i);
+
+/* Start converting decoder CAPTURE buffer dec_index; when all pool
+ * buffers are busy the buffer waits for one to be released */
+int rotator_submit(struct instance *i, int dec_index, uint64_t pts);
+
+/* Collect finished frames and run the callbacks */
+int rotator_dispatch(struct instance *i);
+
+/* Give a pool buffer back to the rotator */
+void rotator_release(struct instance *i, int index);
+
+/* Synchronous conversion of the UBWC frame in ion_fd on an idle
+ * hardware session, *index is the pool buffer holding the frame */
+int rotator_convert(struct instance *i, int ion_fd, int *index);
+
+/* Per-frame latency of a one-shot session vs the persistent one, over
+ * the conversions that worked; the failures are counted apart */
+int rotator_bench(struct instance *i, int ion_fd, int iterations);
+
+/* One-shot conversion on ROTATOR_DEVICE, sets up and tears down a
+ * session every call. There is no CPU fallback, the detiler cannot
+ * read decoded frames; without the device the decoder is asked for
+ * linear NV12 (see video_setup_capture()) and nothing is converted. Returns -1 on any error or after 2 s
+ * without a frame. The frame is not kept: *linear_data is set to NULL
+ * and *linear_size to the bytes the rotator wrote. */
+int convert_ubwc_to_linear(unsigned long out_buf_fd,
+			   int width, int height,
+			   unsigned char **linear_data, size_t *linear_size);
+
+#endif /* INCLUDE_HW_ROT_H */
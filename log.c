@@ -0,0 +1,292 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Hot path logger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+
+#define DBG_TAG "   log"
+
+/* Number of records per thread, must be a power of two */
+#define LOG_RING_SIZE		1024
+
+/* How long the formatting thread sleeps when all rings are empty */
+#define LOG_IDLE_NS		(2 * 1000 * 1000)
+
+/* info() and up, parse_args() changes it for the tools */
+int debug_level = 2;
+
+struct log_record {
+	const char *fmt;
+	const char *tag;
+	int level;
+	int nargs;
+	long args[LOG_MAX_ARGS];
+};
+
+/* Single producer (the owning thread), single consumer (log thread) */
+struct log_ring {
+	atomic_uint head;
+	char pad0[60];
+	atomic_uint tail;
+	char pad1[60];
+	atomic_ulong dropped;
+	struct log_ring *next;
+	struct log_record rec[LOG_RING_SIZE];
+};
+
+static _Atomic(struct log_ring *) log_rings;
+static __thread struct log_ring *log_ring;
+static atomic_bool log_running;
+static atomic_bool log_stop;
+static pthread_t log_thread;
+
+/*
+ * printf() the record, one conversion at a time, so every argument is
+ * passed with the type its conversion expects.
+ */
+static int
+log_format(char *buf, size_t size, const struct log_record *r)
+{
+	const char *p = r->fmt;
+	size_t n = 0;
+	int arg = 0;
+
+	while (*p && n < size - 1) {
+		char spec[32];
+		size_t len;
+		int is_long = 0;
+		long v;
+
+		if (*p != '%') {
+			buf[n++] = *p++;
+			continue;
+		}
+
+		if (p[1] == '%') {
+			buf[n++] = '%';
+			p += 2;
+			continue;
+		}
+
+		len = 1 + strspn(p + 1, "-+ #0123456789.");
+		while (p[len] && strchr("hlqjzt", p[len])) {
+			if (p[len] != 'h')
+				is_long = 1;
+			len++;
+		}
+
+		/* conversion character */
+		len++;
+		if (len >= sizeof (spec) || !p[len - 1])
+			break;
+
+		memcpy(spec, p, len);
+		spec[len] = '\0';
+		p += len;
+
+		v = arg < r->nargs ? r->args[arg] : 0;
+		arg++;
+
+		switch (spec[len - 1]) {
+		case 'd': case 'i': case 'u': case 'x': case 'X':
+		case 'o': case 'c':
+			if (is_long)
+				n += snprintf(buf + n, size - n, spec, v);
+			else
+				n += snprintf(buf + n, size - n, spec, (int)v);
+			break;
+		case 'p':
+			n += snprintf(buf + n, size - n, spec, (void *)v);
+			break;
+		default:
+			/* strings and floats cannot be deferred */
+			n += snprintf(buf + n, size - n, "<?>");
+			break;
+		}
+	}
+
+	n = MIN(n, size - 1);
+	buf[n] = '\0';
+
+	return n;
+}
+
+static void
+log_emit(const struct log_record *r)
+{
+	char msg[256];
+
+	log_format(msg, sizeof (msg), r);
+
+	switch (r->level) {
+	case 1:
+		fprintf(stderr, "\033[31merror: %s\033[0m\n", msg);
+		break;
+	case 2:
+		fprintf(stderr, "\033[34minfo: %s\033[0m\n", msg);
+		break;
+	default:
+		fprintf(stderr, "\033[35m%s: %s\033[0m\n",
+			r->tag ? r->tag : "", msg);
+		break;
+	}
+}
+
+static struct log_ring *
+log_ring_get(void)
+{
+	struct log_ring *ring = log_ring;
+
+	if (ring)
+		return ring;
+
+	ring = calloc(1, sizeof (*ring));
+	if (!ring)
+		return NULL;
+
+	/* rings live as long as the process, so a plain push is enough */
+	ring->next = atomic_load(&log_rings);
+	while (!atomic_compare_exchange_weak(&log_rings, &ring->next, ring))
+		;
+
+	log_ring = ring;
+
+	return ring;
+}
+
+void
+log_write(int level, const char *tag, const char *fmt, int nargs,
+	  const long *args)
+{
+	struct log_ring *ring;
+	struct log_record *r;
+	unsigned int head, tail;
+
+	if (!atomic_load_explicit(&log_running, memory_order_acquire) ||
+	    !(ring = log_ring_get())) {
+		struct log_record tmp = {
+			.fmt = fmt, .tag = tag, .level = level,
+			.nargs = MIN(nargs, LOG_MAX_ARGS),
+		};
+
+		memcpy(tmp.args, args, tmp.nargs * sizeof (long));
+		log_emit(&tmp);
+		return;
+	}
+
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+	if (head - tail >= LOG_RING_SIZE) {
+		atomic_fetch_add_explicit(&ring->dropped, 1,
+					  memory_order_relaxed);
+		return;
+	}
+
+	r = &ring->rec[head & (LOG_RING_SIZE - 1)];
+	r->fmt = fmt;
+	r->tag = tag;
+	r->level = level;
+	r->nargs = MIN(nargs, LOG_MAX_ARGS);
+	memcpy(r->args, args, r->nargs * sizeof (long));
+
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+static int
+log_drain(void)
+{
+	struct log_ring *ring;
+	int count = 0;
+
+	for (ring = atomic_load(&log_rings); ring; ring = ring->next) {
+		unsigned int head, tail;
+
+		head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+		while (tail != head) {
+			log_emit(&ring->rec[tail & (LOG_RING_SIZE - 1)]);
+			tail++;
+			count++;
+		}
+
+		atomic_store_explicit(&ring->tail, tail, memory_order_release);
+	}
+
+	return count;
+}
+
+static void *
+log_thread_func(void *args)
+{
+	const struct timespec idle = { 0, LOG_IDLE_NS };
+
+	while (!atomic_load(&log_stop)) {
+		if (!log_drain())
+			nanosleep(&idle, NULL);
+	}
+
+	log_drain();
+
+	return NULL;
+}
+
+int
+log_init(void)
+{
+	if (atomic_load(&log_running))
+		return 0;
+
+	atomic_store(&log_stop, false);
+
+	if (pthread_create(&log_thread, NULL, log_thread_func, NULL)) {
+		err("failed to start log thread");
+		return -1;
+	}
+
+	atomic_store_explicit(&log_running, true, memory_order_release);
+
+	return 0;
+}
+
+void
+log_shutdown(void)
+{
+	struct log_ring *ring;
+	unsigned long dropped = 0;
+
+	if (!atomic_load(&log_running))
+		return;
+
+	atomic_store(&log_running, false);
+	atomic_store(&log_stop, true);
+	pthread_join(log_thread, NULL);
+
+	for (ring = atomic_load(&log_rings); ring; ring = ring->next)
+		dropped += atomic_exchange(&ring->dropped, 0);
+
+	if (dropped)
+		dbg("%lu log records dropped", dropped);
+}
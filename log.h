@@ -0,0 +1,71 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Hot path logger header file
+ *
+ * Per-frame messages are not formatted by the thread that emits them.
+ * Instead a fixed size binary record (level, tag, format string and up
+ * to LOG_MAX_ARGS integer arguments) is pushed into a lock-free ring
+ * owned by the calling thread, and a background thread formats and
+ * prints the records.  Only integer conversions are supported for
+ * these messages since the arguments are stored as long.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef INCLUDE_LOG_H
+#define INCLUDE_LOG_H
+
+/* Messages above this level are compiled out (1=err, 2=info, 3=dbg) */
+#ifndef LOG_LEVEL_MAX
+#define LOG_LEVEL_MAX		3
+#endif
+
+/* Maximum number of arguments of a binary log record */
+#define LOG_MAX_ARGS		6
+
+/* Start the formatting thread; until then records are printed inline */
+int log_init(void);
+
+/* Flush all pending records and stop the formatting thread */
+void log_shutdown(void);
+
+void log_write(int level, const char *tag, const char *fmt,
+	       int nargs, const long *args);
+
+static inline void __attribute__((format(printf, 1, 2)))
+log_check_format(const char *fmt, ...)
+{
+}
+
+#define log_print(l, tag, msg, ...)					\
+	do {								\
+		if (l <= LOG_LEVEL_MAX && debug_level >= l) {		\
+			const long __args[] = { 0, ##__VA_ARGS__ };	\
+			_Static_assert(ARRAY_LENGTH(__args) - 1 <=	\
+				       LOG_MAX_ARGS, "too many args");	\
+			if (0)					\
+				log_check_format(msg, ##__VA_ARGS__);	\
+			log_write(l, tag, msg,				\
+				  ARRAY_LENGTH(__args) - 1, __args + 1);\
+		}							\
+	} while (0)
+
+#define log_info(msg, ...) \
+	log_print(2, NULL, msg, ##__VA_ARGS__)
+
+#define log_dbg(msg, ...) \
+	log_print(3, DBG_TAG, msg, ##__VA_ARGS__)
+
+#endif /* INCLUDE_LOG_H */
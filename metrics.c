@@ -0,0 +1,607 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Runtime metrics
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "common.h"
+
+#define DBG_TAG "metric"
+
+uint64_t
+metrics_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void
+metrics_hist_add(struct metrics_hist *h, uint64_t us)
+{
+	int n = 0;
+
+	if (us)
+		n = MIN(64 - __builtin_clzll(us), METRICS_HIST_BUCKETS - 1);
+
+	__atomic_fetch_add(&h->bucket[n], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum_us, us, __ATOMIC_RELAXED);
+
+	if (us > __atomic_load_n(&h->max_us, __ATOMIC_RELAXED))
+		__atomic_store_n(&h->max_us, us, __ATOMIC_RELAXED);
+}
+
+void
+metrics_frame_decoded(struct metrics *m, uint64_t submitted)
+{
+	uint64_t now = metrics_now_us();
+	uint64_t latency;
+
+	if (!m->first_decode_us)
+		m->first_decode_us = now;
+	m->last_decode_us = now;
+
+	metrics_inc(m, frames_decoded, 1);
+
+	if (!submitted)
+		return;
+
+	latency = now - submitted;
+
+	metrics_hist_add(&m->cur.decode_latency, latency);
+
+	if (m->cur.frame_period_us && latency > m->cur.frame_period_us)
+		metrics_inc(m, frames_late, 1);
+
+	if (!m->keep_samples)
+		return;
+
+	if (m->nsamples == m->samples_size) {
+		size_t size = m->samples_size ? m->samples_size * 2 : 4096;
+		uint32_t *samples;
+
+		samples = realloc(m->samples, size * sizeof (*samples));
+		if (!samples) {
+			m->keep_samples = 0;
+			return;
+		}
+
+		m->samples = samples;
+		m->samples_size = size;
+	}
+
+	m->samples[m->nsamples++] = MIN(latency, UINT32_MAX);
+}
+
+void
+metrics_frame_presented(struct metrics *m, uint64_t decoded,
+			uint64_t present_us, uint32_t refresh_ns, uint64_t msc)
+{
+	uint64_t period = m->cur.frame_period_us;
+	uint64_t refresh = refresh_ns / 1000;
+
+	metrics_inc(m, frames_presented, 1);
+
+	if (decoded && present_us > decoded)
+		metrics_hist_add(&m->cur.present_latency, present_us - decoded);
+
+	if (refresh)
+		metrics_hist_add(&m->cur.refresh_interval, refresh);
+
+	if (m->last_present_us && present_us > m->last_present_us && period) {
+		uint64_t shown = present_us - m->last_present_us;
+
+		metrics_hist_add(&m->cur.present_jitter, shown > period ?
+				 shown - period : period - shown);
+	}
+
+	/* the previous frame should have been replaced after the nearest
+	 * whole number of refreshes, 2 and 3 alternate for 24 fps at 60 Hz */
+	if (m->last_msc && msc > m->last_msc && period && refresh) {
+		uint64_t expected = MAX((period + refresh / 2) / refresh, 1);
+
+		if (msc - m->last_msc > expected)
+			metrics_inc(m, vsync_misses,
+				    msc - m->last_msc - expected);
+	}
+
+	m->last_present_us = present_us;
+	m->last_msc = msc;
+}
+
+static int
+metrics_shm_open(struct metrics *m, const char *name)
+{
+	struct metrics_page *page;
+	int fd;
+
+	fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+	if (fd < 0) {
+		err("failed to create metrics page %s: %m", name);
+		return -1;
+	}
+
+	if (ftruncate(fd, sizeof (*page)) < 0) {
+		err("failed to size metrics page: %m");
+		goto fail;
+	}
+
+	page = mmap(NULL, sizeof (*page), PROT_READ | PROT_WRITE,
+		    MAP_SHARED, fd, 0);
+	if (page == MAP_FAILED) {
+		err("failed to map metrics page: %m");
+		goto fail;
+	}
+
+	close(fd);
+
+	page->version = METRICS_VERSION;
+	page->size = sizeof (*page);
+	page->pid = getpid();
+	atomic_store(&page->seq, 0);
+
+	/* readers check the magic last */
+	atomic_thread_fence(memory_order_release);
+	page->magic = METRICS_MAGIC;
+
+	m->page = page;
+	m->shm_name = strdup(name);
+
+	info("metrics exported in shared memory %s", name);
+
+	return 0;
+
+fail:
+	close(fd);
+	shm_unlink(name);
+	return -1;
+}
+
+static int
+metrics_sock_open(struct metrics *m, const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(path) >= sizeof (addr.sun_path)) {
+		err("metrics socket path too long");
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		err("failed to create metrics socket: %m");
+		return -1;
+	}
+
+	memzero(addr);
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	unlink(path);
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof (addr)) < 0 ||
+	    listen(fd, 4) < 0) {
+		err("failed to listen on %s: %m", path);
+		close(fd);
+		return -1;
+	}
+
+	m->sock_fd = fd;
+	m->sock_path = strdup(path);
+
+	info("metrics served on %s", path);
+
+	return 0;
+}
+
+int
+metrics_init(struct metrics *m, const char *shm_name, const char *sock_path)
+{
+	memset(m, 0, sizeof (*m));
+
+	m->sock_fd = -1;
+	m->cur.start_us = metrics_now_us();
+	m->fps_start_us = m->cur.start_us;
+
+	if (shm_name && metrics_shm_open(m, shm_name))
+		goto fail;
+
+	if (sock_path && metrics_sock_open(m, sock_path))
+		goto fail;
+
+	return 0;
+
+fail:
+	metrics_close(m);
+	return -1;
+}
+
+void
+metrics_close(struct metrics *m)
+{
+	if (m->page) {
+		munmap(m->page, sizeof (*m->page));
+		shm_unlink(m->shm_name);
+		m->page = NULL;
+	}
+
+	if (m->sock_fd >= 0) {
+		close(m->sock_fd);
+		unlink(m->sock_path);
+		m->sock_fd = -1;
+	}
+
+	free(m->shm_name);
+	free(m->sock_path);
+	free(m->samples);
+	m->shm_name = NULL;
+	m->sock_path = NULL;
+	m->samples = NULL;
+}
+
+int
+metrics_get_fd(struct metrics *m)
+{
+	return m->sock_fd;
+}
+
+static void
+metrics_publish(struct metrics *m)
+{
+	struct metrics_page *page = m->page;
+	unsigned int seq;
+
+	seq = atomic_load_explicit(&page->seq, memory_order_relaxed);
+
+	atomic_store_explicit(&page->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	memcpy(&page->data, &m->cur, sizeof (page->data));
+
+	atomic_store_explicit(&page->seq, seq + 2, memory_order_release);
+}
+
+int
+metrics_page_read(const struct metrics_page *page, struct metrics_data *data)
+{
+	struct metrics_page *p = (struct metrics_page *)page;
+	unsigned int seq;
+
+	if (page->magic != METRICS_MAGIC ||
+	    page->version != METRICS_VERSION)
+		return -1;
+
+	do {
+		seq = atomic_load_explicit(&p->seq, memory_order_acquire);
+		memcpy(data, &page->data, sizeof (*data));
+		atomic_thread_fence(memory_order_acquire);
+	} while ((seq & 1) ||
+		 seq != atomic_load_explicit(&p->seq, memory_order_relaxed));
+
+	return 0;
+}
+
+void
+metrics_update(struct instance *i, int force)
+{
+	struct metrics *m = &i->metrics;
+	struct video *vid = &i->video;
+	uint64_t now = metrics_now_us();
+	uint64_t frames;
+	uint32_t out_queued = 0, cap_queued = 0;
+
+	if (!force && now - m->last_publish_us < METRICS_PUBLISH_US)
+		return;
+
+	m->last_publish_us = now;
+	m->cur.timestamp_us = now;
+
+	/* fps over windows of at least one second */
+	frames = m->cur.frames_decoded;
+	if (now - m->fps_start_us >= 1000000) {
+		m->cur.fps_milli = (frames - m->fps_start_frames) *
+				   1000000000ULL / (now - m->fps_start_us);
+		m->fps_start_us = now;
+		m->fps_start_frames = frames;
+	}
+
+	if (i->fps_n > 0 && i->fps_d > 0)
+		m->cur.frame_period_us = 1000000ULL * i->fps_d / i->fps_n;
+
+	for (int n = 0; n < vid->out_buf_cnt; n++)
+		out_queued += !!vid->out_buf_flag[n];
+
+	for (int n = 0; n < vid->cap_buf_cnt; n++)
+		cap_queued += !!vid->cap_buf_flag[n];
+
+	m->cur.out_queued = out_queued;
+	m->cur.out_count = vid->out_buf_cnt;
+	m->cur.cap_queued = cap_queued;
+	m->cur.cap_count = vid->cap_buf_cnt;
+
+	if (m->page)
+		metrics_publish(m);
+}
+
+static int
+metrics_format_hist(char *buf, size_t size, const char *name,
+		    const struct metrics_hist *h)
+{
+	uint64_t cumulative = 0;
+	size_t n = 0;
+
+	/* Prometheus style cumulative buckets */
+	for (int b = 0; b < METRICS_HIST_BUCKETS - 1 && n < size; b++) {
+		cumulative += h->bucket[b];
+		n += snprintf(buf + n, size - n,
+			      "%s_bucket{le=\"%llu\"} %llu\n", name,
+			      (1ULL << b) - 1, (unsigned long long)cumulative);
+	}
+
+	if (n < size)
+		n += snprintf(buf + n, size - n,
+			      "%s_bucket{le=\"+Inf\"} %llu\n"
+			      "%s_sum %llu\n"
+			      "%s_count %llu\n"
+			      "%s_max %llu\n",
+			      name, (unsigned long long)h->count,
+			      name, (unsigned long long)h->sum_us,
+			      name, (unsigned long long)h->count,
+			      name, (unsigned long long)h->max_us);
+
+	return MIN(n, size);
+}
+
+int
+metrics_format(struct instance *i, char *buf, size_t size)
+{
+	const struct metrics_data *d = &i->metrics.cur;
+	size_t n;
+
+	n = snprintf(buf, size,
+		     "v4l2dec_uptime_us %llu\n"
+		     "v4l2dec_startup_us %llu\n"
+		     "v4l2dec_frames_submitted %llu\n"
+		     "v4l2dec_bytes_submitted %llu\n"
+		     "v4l2dec_frames_skipped %llu\n"
+		     "v4l2dec_frames_decoded %llu\n"
+		     "v4l2dec_frames_dropped %llu\n"
+		     "v4l2dec_frames_late %llu\n"
+		     "v4l2dec_frames_rotated %llu\n"
+		     "v4l2dec_frames_rot_dropped %llu\n"
+		     "v4l2dec_reconfigures %llu\n"
+		     "v4l2dec_hw_overloads %llu\n"
+		     "v4l2dec_frames_presented %llu\n"
+		     "v4l2dec_frames_discarded %llu\n"
+		     "v4l2dec_vsync_misses %llu\n"
+		     "v4l2dec_decode_fps %u.%03u\n"
+		     "v4l2dec_frame_period_us %u\n"
+		     "v4l2dec_queue_depth{port=\"output\"} %u\n"
+		     "v4l2dec_queue_size{port=\"output\"} %u\n"
+		     "v4l2dec_queue_depth{port=\"capture\"} %u\n"
+		     "v4l2dec_queue_size{port=\"capture\"} %u\n",
+		     (unsigned long long)(d->timestamp_us - d->start_us),
+		     (unsigned long long)d->startup_us,
+		     (unsigned long long)d->frames_submitted,
+		     (unsigned long long)d->bytes_submitted,
+		     (unsigned long long)d->frames_skipped,
+		     (unsigned long long)d->frames_decoded,
+		     (unsigned long long)d->frames_dropped,
+		     (unsigned long long)d->frames_late,
+		     (unsigned long long)d->frames_rotated,
+		     (unsigned long long)d->frames_rot_dropped,
+		     (unsigned long long)d->reconfigures,
+		     (unsigned long long)d->hw_overloads,
+		     (unsigned long long)d->frames_presented,
+		     (unsigned long long)d->frames_discarded,
+		     (unsigned long long)d->vsync_misses,
+		     d->fps_milli / 1000, d->fps_milli % 1000,
+		     d->frame_period_us,
+		     d->out_queued, d->out_count,
+		     d->cap_queued, d->cap_count);
+	n = MIN(n, size);
+
+	n += metrics_format_hist(buf + n, size - n,
+				 "v4l2dec_decode_latency_us",
+				 &d->decode_latency);
+	n += metrics_format_hist(buf + n, size - n,
+				 "v4l2dec_rotator_latency_us",
+				 &d->rotator_latency);
+	n += metrics_format_hist(buf + n, size - n,
+				 "v4l2dec_present_latency_us",
+				 &d->present_latency);
+	n += metrics_format_hist(buf + n, size - n,
+				 "v4l2dec_refresh_interval_us",
+				 &d->refresh_interval);
+	n += metrics_format_hist(buf + n, size - n,
+				 "v4l2dec_present_jitter_us",
+				 &d->present_jitter);
+	n += sinks_format(i, buf + n, size - n);
+
+	return n;
+}
+
+int
+metrics_handle_client(struct instance *i)
+{
+	struct metrics *m = &i->metrics;
+	char buf[16384];
+	int fd, len;
+
+	fd = accept(m->sock_fd, NULL, NULL);
+	if (fd < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			err("metrics accept failed: %m");
+		return -1;
+	}
+
+	metrics_update(i, 1);
+	len = metrics_format(i, buf, sizeof (buf));
+
+	/* one short reply per connection, never block the decoder */
+	if (send(fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL) != len)
+		dbg("short metrics reply");
+
+	close(fd);
+
+	return 0;
+}
+
+static int
+metrics_cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint32_t
+metrics_percentile(const uint32_t *samples, size_t n, int permille)
+{
+	return samples[MIN(n * permille / 1000, n - 1)];
+}
+
+/* Upper bound of the bucket holding the permille-th sample */
+static uint64_t
+metrics_hist_percentile(const struct metrics_hist *h, int permille)
+{
+	uint64_t rank = h->count * permille / 1000, seen = 0;
+
+	for (int b = 0; b < METRICS_HIST_BUCKETS - 1; b++) {
+		seen += h->bucket[b];
+		if (seen > rank)
+			return MIN((1ULL << b) - 1, h->max_us);
+	}
+
+	return h->max_us;
+}
+
+void
+metrics_report_hist(const char *name, const struct metrics_hist *h)
+{
+	if (!h->count)
+		return;
+
+	info("%s us: mean %llu p50 <%llu p90 <%llu p99 <%llu max %llu",
+	     name, (unsigned long long)(h->sum_us / h->count),
+	     (unsigned long long)metrics_hist_percentile(h, 500),
+	     (unsigned long long)metrics_hist_percentile(h, 900),
+	     (unsigned long long)metrics_hist_percentile(h, 990),
+	     (unsigned long long)h->max_us);
+}
+
+/* Decode rate lines of metrics_report() */
+static void
+metrics_report_rate(struct instance *i, uint64_t elapsed)
+{
+	const struct metrics_data *d = &i->metrics.cur;
+	int rate = i->video.operating_rate;
+
+	if (rate == INT_MAX)
+		info("operating rate: max");
+	else
+		info("operating rate: %d fps", rate >> 16);
+
+	/* first to last frame, so startup does not count */
+	info("sustained %.2f fps, bitstream %.2f MB/s over %.3f s",
+	     (d->frames_decoded - 1) * 1e6 / elapsed,
+	     d->bytes_submitted / (double)elapsed,
+	     elapsed / 1e6);
+
+	/* stream time over wall time, what --decimate buys */
+	if (d->frame_period_us)
+		info("%.1fx real time, %llu of %llu access units submitted",
+		     (double)(d->frames_submitted + d->frames_skipped) *
+		     d->frame_period_us / elapsed,
+		     (unsigned long long)d->frames_submitted,
+		     (unsigned long long)(d->frames_submitted +
+					  d->frames_skipped));
+}
+
+void
+metrics_report(struct instance *i)
+{
+	struct metrics *m = &i->metrics;
+	const struct metrics_data *d = &m->cur;
+	uint64_t elapsed = m->last_decode_us - m->first_decode_us;
+
+	info("decoded %llu frames, %llu dropped, %llu late",
+	     (unsigned long long)d->frames_decoded,
+	     (unsigned long long)d->frames_dropped,
+	     (unsigned long long)d->frames_late);
+
+	/* rates need two frames, the other sections are reported anyway */
+	if (d->frames_decoded >= 2 && elapsed)
+		metrics_report_rate(i, elapsed);
+
+	/* a rate without the drops would flatter the software backend */
+	if (d->rotator_latency.count)
+		info("rotated %llu frames at %.2f fps, %llu dropped, mean "
+		     "rotator latency %llu us",
+		     (unsigned long long)d->frames_rotated,
+		     elapsed ? d->frames_rotated * 1e6 / elapsed : 0.0,
+		     (unsigned long long)d->frames_rot_dropped,
+		     (unsigned long long)(d->rotator_latency.sum_us /
+					  d->rotator_latency.count));
+	else if (d->frames_rot_dropped)
+		info("rotated no frames, %llu dropped",
+		     (unsigned long long)d->frames_rot_dropped);
+
+	if (d->frames_presented || d->frames_discarded)
+		info("presented %llu frames, %llu discarded, %llu vsyncs "
+		     "missed", (unsigned long long)d->frames_presented,
+		     (unsigned long long)d->frames_discarded,
+		     (unsigned long long)d->vsync_misses);
+
+	metrics_report_hist("decode to present", &d->present_latency);
+	metrics_report_hist("refresh interval", &d->refresh_interval);
+	metrics_report_hist("present jitter", &d->present_jitter);
+
+	if (d->display_commits)
+		info("%llu surface commits, %.2f requests each",
+		     (unsigned long long)d->display_commits,
+		     (double)d->display_requests / d->display_commits);
+
+	if (!m->nsamples)
+		return;
+
+	qsort(m->samples, m->nsamples, sizeof (*m->samples),
+	      metrics_cmp_u32);
+
+	info("decode latency us: min %u p50 %u p90 %u p99 %u p99.9 %u max %u",
+	     m->samples[0],
+	     metrics_percentile(m->samples, m->nsamples, 500),
+	     metrics_percentile(m->samples, m->nsamples, 900),
+	     metrics_percentile(m->samples, m->nsamples, 990),
+	     metrics_percentile(m->samples, m->nsamples, 999),
+	     m->samples[m->nsamples - 1]);
+}
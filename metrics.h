@@ -0,0 +1,173 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Runtime metrics header file
+ *
+ * The decoder keeps its counters in a struct metrics_data owned by the
+ * decoding thread.  A copy is periodically published to a shared memory
+ * page protected by a sequence lock, so external tools can read it
+ * without any cooperation from the decoder, and optionally served as
+ * text on a Unix socket.
+ *
+ * Reading the shared memory page:
+ *
+ *	do {
+ *		seq = load_acquire(&page->seq);
+ *		copy page->data;
+ *		fence_acquire();
+ *	} while ((seq & 1) || seq != load(&page->seq));
+ *
+ * metrics_page_read() implements exactly that.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef INCLUDE_METRICS_H
+#define INCLUDE_METRICS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define METRICS_MAGIC		0x4d44344c	/* "L4DM" */
+#define METRICS_VERSION		7
+
+/* Bucket n counts samples in [2^(n-1), 2^n) us, bucket 0 is < 1us */
+#define METRICS_HIST_BUCKETS	24
+
+/* How often the shared memory page is refreshed */
+#define METRICS_PUBLISH_US	(100 * 1000)
+
+struct metrics_hist {
+	uint64_t count;
+	uint64_t sum_us;
+	uint64_t max_us;
+	uint64_t bucket[METRICS_HIST_BUCKETS];
+};
+
+struct metrics_data {
+	uint64_t timestamp_us;		/* CLOCK_MONOTONIC of last update */
+	uint64_t start_us;
+	uint64_t startup_us;		/* start to first OUTPUT QBUF */
+
+	uint64_t frames_submitted;
+	uint64_t bytes_submitted;
+	uint64_t frames_skipped;	/* access units left out, --decimate */
+	uint64_t frames_decoded;
+	uint64_t frames_dropped;	/* empty or corrupted capture buffers */
+	uint64_t frames_late;		/* decode latency above frame period */
+	uint64_t frames_rotated;
+	uint64_t frames_rot_dropped;	/* the rotator could not convert */
+	uint64_t reconfigures;
+	uint64_t hw_overloads;
+	uint64_t frames_presented;	/* on the glass, wp_presentation */
+	uint64_t frames_discarded;	/* replaced before they were shown */
+	uint64_t vsync_misses;		/* refreshes frames stayed too long */
+	uint64_t display_commits;	/* wl_surface commits */
+	uint64_t display_requests;	/* Wayland requests they took */
+
+	uint32_t fps_milli;		/* decoded fps * 1000, last window */
+	uint32_t frame_period_us;
+
+	uint32_t out_queued;		/* buffers owned by the driver */
+	uint32_t out_count;
+	uint32_t cap_queued;
+	uint32_t cap_count;
+
+	struct metrics_hist decode_latency;	/* submit to capture dequeue */
+	struct metrics_hist rotator_latency;	/* rotator submit to done */
+	struct metrics_hist present_latency;	/* decoded to on the glass */
+	struct metrics_hist refresh_interval;
+	struct metrics_hist present_jitter;	/* time shown off frame period */
+};
+
+/* Layout of the shared memory page, read-only for everybody else */
+struct metrics_page {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	uint32_t pid;
+	atomic_uint seq;
+	uint32_t reserved;
+	struct metrics_data data;
+};
+
+struct metrics {
+	struct metrics_data cur;
+
+	struct metrics_page *page;
+	char *shm_name;
+
+	int sock_fd;
+	char *sock_path;
+
+	uint64_t last_publish_us;
+	uint64_t fps_start_us;
+	uint64_t fps_start_frames;
+
+	uint64_t first_decode_us;
+	uint64_t last_decode_us;
+
+	uint64_t last_present_us;
+	uint64_t last_msc;
+
+	/* every decode latency, for exact percentiles in the report */
+	int keep_samples;
+	uint32_t *samples;
+	size_t nsamples;
+	size_t samples_size;
+};
+
+struct instance;
+
+uint64_t metrics_now_us(void);
+
+/* Export through shm_open(shm_name) and/or a socket at sock_path */
+int metrics_init(struct metrics *m, const char *shm_name,
+		 const char *sock_path);
+void metrics_close(struct metrics *m);
+
+/* Fd to poll for scrape connections, -1 when the socket is disabled */
+int metrics_get_fd(struct metrics *m);
+int metrics_handle_client(struct instance *i);
+
+/* Refresh derived values and the shared page, rate limited */
+void metrics_update(struct instance *i, int force);
+
+int metrics_format(struct instance *i, char *buf, size_t size);
+
+void metrics_hist_add(struct metrics_hist *h, uint64_t us);
+
+/* A capture buffer with a frame, submitted is 0 if not known */
+void metrics_frame_decoded(struct metrics *m, uint64_t submitted);
+
+/* A frame reached the screen at present_us, decoded is 0 if not known,
+ * refresh_ns and msc as given by the compositor */
+void metrics_frame_presented(struct metrics *m, uint64_t decoded,
+			     uint64_t present_us, uint32_t refresh_ns,
+			     uint64_t msc);
+
+/* Print the summary at exit */
+void metrics_report(struct instance *i);
+
+/* One line of mean and percentiles, nothing if h is empty */
+void metrics_report_hist(const char *name, const struct metrics_hist *h);
+
+/* Snapshot a (possibly foreign) page, returns -1 if it is not valid */
+int metrics_page_read(const struct metrics_page *page,
+		      struct metrics_data *data);
+
+#define metrics_inc(m, field, n) \
+	__atomic_fetch_add(&(m)->cur.field, n, __ATOMIC_RELAXED)
+
+#endif /* INCLUDE_METRICS_H */
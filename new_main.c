@@ -1,594 +1,334 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <fcntl.h>
 #include <unistd.h>
-#include <sys/time.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <sys/mman.h>
 #include <sys/signalfd.h>
+#include <sys/eventfd.h>
 #include <signal.h>
 #include <poll.h>
-#include <linux/ion.h>
-#include <linux/msm_ion.h>
 
 #define DBG_TAG "  main"
 
 #include "common.h"
-#include "video.h"
-#include "defs.h"
-#include "ts.h"
-#include "packet.h"
+#include "args.h"
+#include "stream.h"
+#include "verify.h"
+#include "v4l2dec.h"
 
 
-#define INPUT_FILE "fcamera2.hevc"
-#define VIDEO_DEVICE "/dev/video32"
-#define ION_DEVICE "/dev/ion"
-#define ROTATOR_DEVICE "/dev/video2"
-#define WIDTH 1928
-#define HEIGHT 1208
-#define STREAM_BUFFER_SIZE (1024 * 1024)
-#define OUTPUT_BUFFER_COUNT 4
-#define CAPTURE_BUFFER_COUNT 4
-
-#define EXTRADATA_IDX(__num_planes) ((__num_planes) ? (__num_planes) - 1 : 0)
-#define TIMESTAMP_NONE	((uint64_t)-1)
+/* Several urls are decoded at once, a thread each */
+static int n_sessions = 1;
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t session_lock = PTHREAD_MUTEX_INITIALIZER;
 
+struct session {
+	struct instance inst;
+	pthread_t thread;
+	int ret;
+	int done_fd;		/* eventfd of main(), signalled at the end */
 
-#define av_err(errnum, fmt, ...) \
-	err(fmt ": %s", ##__VA_ARGS__, av_err2str(errnum))
+	/* main() ends the session, under session_lock */
+	struct v4l2dec *dec;
+	int stopped;
+};
 
+static void session_set(struct session *s, struct v4l2dec *d)
+{
+	pthread_mutex_lock(&session_lock);
+	s->dec = d;
+	if (d && s->stopped)
+		v4l2dec_stop(d);
+	pthread_mutex_unlock(&session_lock);
+}
 
-int stream_open(struct instance *i) {
-	const AVBitStreamFilter *filter;
-	AVCodecParameters *codecpar;
-	AVRational framerate;
-	int codec;
+/* Everything of one stream, from opening it to the report */
+static int session_run(struct instance *inst, struct session *s)
+{
+	struct v4l2dec *d;
 	int ret;
 
-	av_register_all();
-	avformat_network_init();
+	inst->sigfd = -1;
 
-	ret = avformat_open_input(&i->avctx, i->url, NULL, NULL);
-	if (ret < 0) {
-		av_err(ret, "failed to open %s", i->url);
-		goto fail;
-	}
+	/* with several sessions, main() waits for the signals */
+	if (!s) {
+		sigset_t sigmask;
+		int fd;
 
-	ret = avformat_find_stream_info(i->avctx, NULL);
-	if (ret < 0) {
-		av_err(ret, "failed to get streams info");
-		goto fail;
-	}
+		sigemptyset(&sigmask);
+		sigaddset(&sigmask, SIGINT);
+		sigaddset(&sigmask, SIGTERM);
 
-	av_dump_format(i->avctx, -1, i->url, 0);
+		fd = signalfd(-1, &sigmask, SFD_CLOEXEC);
+		if (fd < 0) {
+			perror("signalfd");
+			return EXIT_FAILURE;
+		}
 
-	ret = av_find_best_stream(i->avctx, AVMEDIA_TYPE_VIDEO, -1, -1,
-				  NULL, 0);
-	if (ret < 0) {
-		av_err(ret, "stream does not seem to contain video");
-		goto fail;
+		sigprocmask(SIG_BLOCK, &sigmask, NULL);
+		inst->sigfd = fd;
 	}
 
-	i->stream = i->avctx->streams[ret];
-	codecpar = i->stream->codecpar;
-
-	i->width = codecpar->width ?: 1928;
-	i->height = codecpar->height ?: 1208;
-	i->need_header = 1;
-
-	framerate = av_stream_get_r_frame_rate(i->stream);
-	i->fps_n = framerate.num;
-	i->fps_d = framerate.den;
-    filter = av_bsf_get_by_name("hevc_mp4toannexb");
-
-	i->fourcc = V4L2_PIX_FMT_HEVC;
+	d = v4l2dec_open_instance(inst);
+	if (!d)
+		return EXIT_FAILURE;
 
-    ret = av_bsf_alloc(filter, &i->bsf);
-    if (ret < 0) {
-        av_err(ret, "cannot allocate bistream filter");
-        goto fail;
-    }
+	if (s)
+		session_set(s, d);
 
-    avcodec_parameters_copy(i->bsf->par_in, codecpar);
-    i->bsf->time_base_in = i->stream->time_base;
+	ret = v4l2dec_run(d);
 
-    ret = av_bsf_init(i->bsf);
-    if (ret < 0) {
-        av_err(ret, "failed to initialize bitstream filter");
-        goto fail;
-    }
-	
+	pthread_mutex_lock(&report_lock);
+	if (n_sessions > 1)
+		info("%s:", inst->url);
+	v4l2dec_report(d);
+	pthread_mutex_unlock(&report_lock);
 
-	return 0;
+	if (v4l2dec_instance(d)->verify_failed)
+		ret = -1;
 
-fail:
-	stream_close(i);
-	return -1;
-}
+	if (s)
+		session_set(s, NULL);
+	v4l2dec_close(d);
+	if (inst->sigfd != -1)
+		close(inst->sigfd);
 
-void stream_close(struct instance *i) {
-	i->stream = NULL;
-	if (i->bsf)
-		av_bsf_free(&i->bsf);
-	if (i->avctx)
-		avformat_close_input(&i->avctx);
+	return ret ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
-int handle_video_event(struct instance *i) {
-	struct v4l2_event event;
-
-	if (video_dequeue_event(i, &event))
-		return -1;
-
-	switch (event.type) {
-	case V4L2_EVENT_MSM_VIDC_PORT_SETTINGS_CHANGED_INSUFFICIENT: {
-		unsigned int *ptr = (unsigned int *)event.u.data;
-		unsigned int height = ptr[0];
-		unsigned int width = ptr[1];
-		// ptr[0] = event_notify->height;
-		// ptr[1] = event_notify->width;
-		// ptr[2] = event_notify->bit_depth;
-		// ptr[3] = event_notify->pic_struct;
-		// ptr[4] = event_notify->colour_space;
-		// ptr[5] = event_notify->crop_data.top;
-		// ptr[6] = event_notify->crop_data.left;
-		// ptr[7] = event_notify->crop_data.height;
-		// ptr[8] = event_notify->crop_data.width;
-		// ptr[9] = msm_comm_get_v4l2_profile(
-		// 	inst->fmts[OUTPUT_PORT].fourcc,
-		// 	event_notify->profile);
-		// ptr[10] = msm_comm_get_v4l2_level( // returns -22
-		// 	inst->fmts[OUTPUT_PORT].fourcc, 
-		// 	event_notify->level); 
-		// ptr[11] = event_notify->max_dpb_count;
-		// ptr[12] = event_notify->max_ref_count;
-		// ptr[13] = event_notify->max_dec_buffering;
-
-		info("Port Reconfig received insufficient, new size %ux%u",
-		     width, height);
-
-		i->depth = ptr[2];
-
-		if (ptr[3] == MSM_VIDC_PIC_STRUCT_MAYBE_INTERLACED) {
-			i->interlaced = 1;
-		} else {
-			i->interlaced = 0;
-		}
-
-		unsigned int cspace = ptr[4];
+static void *session_thread(void *data)
+{
+	struct session *s = data;
 
-		i->width = width;
-		i->height = height;
-		i->reconfigure_pending = 1;
-		info("See dmesg msm_vidc for more info");
-		/* flush capture queue, we will reconfigure it when flush
-		 * done event is received */
-		video_flush(i, V4L2_QCOM_CMD_FLUSH_CAPTURE);
-		break;
-	}
-	case V4L2_EVENT_MSM_VIDC_PORT_SETTINGS_CHANGED_SUFFICIENT:
-		dbg("Setting changed sufficient");
-		break;
-	case V4L2_EVENT_MSM_VIDC_FLUSH_DONE: {
-		unsigned int *ptr = (unsigned int *)event.u.data;
-		unsigned int flags = ptr[0];
-
-		if (flags & V4L2_QCOM_CMD_FLUSH_CAPTURE)
-			dbg("Flush Done received on CAPTURE queue");
-		if (flags & V4L2_QCOM_CMD_FLUSH_OUTPUT)
-			dbg("Flush Done received on OUTPUT queue");
-
-		if (i->reconfigure_pending) {
-			dbg("Reconfiguring output");
-			restart_capture(i);
-			i->reconfigure_pending = 0;
-		}
-		break;
-	}
-	case V4L2_EVENT_MSM_VIDC_SYS_ERROR:
-		dbg("SYS Error received");
-		break;
-	case V4L2_EVENT_MSM_VIDC_HW_OVERLOAD:
-		dbg("HW Overload received");
-		break;
-	case V4L2_EVENT_MSM_VIDC_HW_UNSUPPORTED:
-		dbg("HW Unsupported received");
-		break;
-	case V4L2_EVENT_MSM_VIDC_RELEASE_BUFFER_REFERENCE:
-		dbg("Release buffer reference");
-		break;
-	case V4L2_EVENT_MSM_VIDC_RELEASE_UNQUEUED_BUFFER:
-		dbg("Release unqueued buffer");
-		break;
-	default:
-		err("unknown event type occurred %x", event.type);
-		break;
-	}
+	s->ret = session_run(&s->inst, s);
+	eventfd_write(s->done_fd, 1);
 
-	return 0;
+	return NULL;
 }
 
-int handle_video_capture(struct instance *i) {
-	struct video *vid = &i->video;
-	struct timeval tv;
-	uint32_t flags;
-	uint64_t pts;
-	unsigned int bytesused;
-	struct msm_vidc_extradata_header *extradata;
-	bool busy;
-	int ret, n;
-
-	/* capture buffer is ready */
-
-	ret = video_dequeue_capture(i, &n, &bytesused, &flags, &tv, &extradata);
-	if (ret < 0) {
-		err("dequeue capture buffer fail");
-		return ret;
-	}
-
-	if (flags & V4L2_QCOM_BUF_TIMESTAMP_INVALID)
-		pts = TIMESTAMP_NONE;
-	else
-		pts = ((uint64_t)tv.tv_sec) * 1000000 + tv.tv_usec;
-
-	busy = false;
-
-	if (bytesused > 0) {
-		struct ts_entry *l, *min = NULL;
-		int pending = 0;
-
-		vid->total_captured++;
-
-		//pthread_mutex_lock(&i->lock);
-
-		/* PTS are expected to be monotonically increasing,
-		 * so when unknown use the lowest pending DTS */
-		list_for_each_entry(l, &vid->pending_ts_list, link) {
-			if (l->dts == TIMESTAMP_NONE)
-				continue;
-			if (min == NULL || min->dts > l->dts)
-				min = l;
-			pending++;
-		}
-
-		if (min) {
-			dbg("pending %d min pts %" PRIi64
-			    " dts %" PRIi64
-			    " duration %" PRIi64, pending,
-			    min->pts, min->dts, min->duration);
-		}
-
-		if (pts == TIMESTAMP_NONE) {
-			dbg("no pts on frame");
-			if (min && vid->pts_dts_delta != TIMESTAMP_NONE) {
-				dbg("reuse dts %" PRIu64
-				    " delta %" PRIu64,
-				    min->dts, vid->pts_dts_delta);
-				pts = min->dts + vid->pts_dts_delta;
-			}
-		}
-
-		if (pts == TIMESTAMP_NONE) {
-			if (min && vid->cap_last_pts != TIMESTAMP_NONE)
-				pts = vid->cap_last_pts + min->duration;
-			else
-				pts = 0;
-
-			dbg("guessing pts %" PRIu64, pts);
-		}
-
-		vid->cap_last_pts = pts;
-
-		if (min != NULL) {
-			pts -= min->base;
-			ts_remove(min);
-		}
-
-		if (bytesused > 0 && vid->cap_buf_addr[n]) {
-			info("Saving Frame %d, size %d", n, bytesused);
-			// Convert UBWC to linear NV12 using SDE rotator  
-			unsigned char *linear_data = NULL;  
-			size_t linear_size = 0;
-			unsigned long ion_fd = (unsigned long)vid->cap_buf_fd[n];
-
-			int ret = convert_ubwc_to_linear(ion_fd, i->width, i->height, &linear_data, &linear_size);
-		}
-
-		//pthread_mutex_unlock(&i->lock);
-
-		i->prerolled = 1;
-
-	}
+/* name-<n>, so that every session exports its own metrics */
+static char *session_name(const char *name, int n)
+{
+	size_t size;
+	char *s;
 
-	if (!busy && !i->reconfigure_pending)
-		video_queue_buf_cap(i, n);
+	if (!name)
+		return NULL;
 
-	if (flags & V4L2_QCOM_BUF_FLAG_EOS) {
-		info("End of stream");
-		//finish(i);
-	}
+	size = strlen(name) + 12;
+	s = malloc(size);
+	if (s)
+		snprintf(s, size, "%s-%d", name, n);
 
-	return 0;
+	return s;
 }
 
-int handle_video_output(struct instance *i) {
-	struct video *vid = &i->video;
-	int ret, n;
+/* Sinks whose first argument is a file or a socket of their own */
+static const char *const path_sinks[] = { "file", "dump", "shm", "verify" };
 
-	ret = video_dequeue_output(i, &n);
-	if (ret < 0) {
-		err("dequeue output buffer fail");
-		return ret;
+static bool path_sink(const char *spec, size_t len)
+{
+	for (size_t k = 0; k < ARRAY_LENGTH(path_sinks); k++) {
+		if (strlen(path_sinks[k]) == len &&
+		    !strncmp(path_sinks[k], spec, len))
+			return true;
 	}
 
-	pthread_mutex_lock(&i->lock);
-	vid->out_buf_flag[n] = 0;
-	pthread_cond_signal(&i->cond);
-	pthread_mutex_unlock(&i->lock);
-
-	return 0;
+	return false;
 }
 
-int restart_capture(struct instance *i) {
-	struct video *vid = &i->video;
-	struct fb *fb, *next;
-	int n;
-
-	/*
-	 * Destroy window buffers that are not in use by the
-	 * wayland compositor; buffers in use will be destroyed
-	 * when the release callback is called
-	 */
-	/* Stop capture and release buffers */
-	if (vid->cap_buf_cnt > 0 && video_stop_capture(i))
-		return -1;
-
-	/* Setup capture queue with new parameters */
-	if (video_setup_capture(i, 4, i->width, i->height))
-		return -1;
-
-	/* Start streaming */
-	if (video_stream(i, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE,
-			 VIDIOC_STREAMON))
-		return -1;
-
-	/* Queue all capture buffers */
-	for (n = 0; n < vid->cap_buf_cnt; n++) {
-		if (video_queue_buf_cap(i, n))
-			return -1;
+/* The sink list with -<n> after every path, as session_name() */
+static char *session_sinks(const char *list, int n)
+{
+	char *copy, *spec, *save, *s;
+	size_t size, len = 0;
+
+	if (!list)
+		return NULL;
+
+	/* at most one suffix per sink */
+	size = strlen(list) + 12;
+	for (const char *c = list; *c; c++)
+		size += *c == ',' ? 12 : 0;
+
+	copy = strdup(list);
+	s = malloc(size);
+	if (!copy || !s) {
+		free(copy);
+		free(s);
+		return NULL;
 	}
 
-	return 0;
-}
+	s[0] = 0;
 
-int parse_frame(struct instance *i, AVPacket *pkt)
-{
-	int ret;
+	for (spec = strtok_r(copy, ",", &save); spec;
+	     spec = strtok_r(NULL, ",", &save)) {
+		char *arg = strchr(spec, ':');
+		char *rest;
 
-	if (!i->bsf_data_pending) {
-		ret = av_read_frame(i->avctx, pkt);
-		if (ret < 0)
-			return ret;
+		if (len)
+			s[len++] = ',';
 
-		if (pkt->stream_index != i->stream->index) {
-			av_packet_unref(pkt);
-			return AVERROR(EAGAIN);
+		if (!arg || !path_sink(spec, arg - spec)) {
+			len += snprintf(s + len, size - len, "%s", spec);
+			continue;
 		}
 
-		if (i->bsf) {
-			ret = av_bsf_send_packet(i->bsf, pkt);
-			if (ret < 0)
-				return ret;
+		/* dump:<path>:direct, the options follow the path */
+		rest = strchr(arg + 1, ':');
+		if (rest)
+			*rest++ = 0;
 
-			i->bsf_data_pending = 1;
-		}
+		len += snprintf(s + len, size - len, "%s-%d%s%s", spec, n,
+				rest ? ":" : "", rest ? rest : "");
 	}
 
-	if (i->bsf) {
-		ret = av_bsf_receive_packet(i->bsf, pkt);
-		if (ret == AVERROR(EAGAIN))
-			i->bsf_data_pending = 0;
+	free(copy);
 
-		if (ret < 0)
-			return ret;
-	}
-	// for (int i = 0; i < pkt->size && i < 16; ++i)
-    // 	print(2,"%02X ", pkt->data[i]);
-	// print(2,"\n");
-	return 0;
+	return s;
 }
 
-int get_buffer_unlocked(struct instance *i) {
-	struct video *vid = &i->video;
-
-	for (int n = 0; n < vid->out_buf_cnt; n++) {
-		if (!vid->out_buf_flag[n])
-			return n;
+/*
+ * One thread per url, each with an instance of its own.  The signals
+ * are blocked before, main() gets them and ends every session.
+ */
+static int run_sessions(struct instance *inst)
+{
+	struct session *sessions;
+	struct pollfd pfd[2];
+	sigset_t sigmask;
+	int fd, done_fd, ret = EXIT_SUCCESS, started = 0, left;
+
+	sessions = calloc(inst->n_urls, sizeof (*sessions));
+	done_fd = eventfd(0, EFD_CLOEXEC);
+	if (!sessions || done_fd < 0) {
+		free(sessions);
+		if (done_fd >= 0)
+			close(done_fd);
+		return EXIT_FAILURE;
 	}
 
-	return -1;
-}
-
-void main_loop(struct instance *i) {
-	struct video *vid = &i->video;
-	struct wl_display *wl_display = NULL;
-	struct pollfd pfd[EV_COUNT];
-	int ev[EV_COUNT];
-	short revents;
-	int nfds = 0;
-	int ret;
+	sigemptyset(&sigmask);
+	sigaddset(&sigmask, SIGINT);
+	sigaddset(&sigmask, SIGTERM);
 
-	dbg("main thread started");
+	fd = signalfd(-1, &sigmask, SFD_CLOEXEC);
+	if (fd < 0) {
+		perror("signalfd");
+		close(done_fd);
+		free(sessions);
+		return EXIT_FAILURE;
+	}
 
-	for (int i = 0; i < EV_COUNT; i++)
-		ev[i] = -1;
+	sigprocmask(SIG_BLOCK, &sigmask, NULL);
 
-	memset(pfd, 0, sizeof (pfd));
+	for (int n = 0; n < inst->n_urls; n++) {
+		struct session *s = &sessions[n];
+
+		s->inst = *inst;
+		s->inst.url = inst->urls[n];
+		s->inst.metrics_shm = session_name(inst->metrics_shm, n);
+		s->inst.metrics_sock = session_name(inst->metrics_sock, n);
+		s->inst.sink_list = session_sinks(inst->sink_list, n);
+		s->inst.verify_path = session_name(inst->verify_path, n);
+		s->done_fd = done_fd;
+
+		if (pthread_create(&s->thread, NULL, session_thread, s)) {
+			err("failed to start the session of %s", s->inst.url);
+			free(s->inst.metrics_shm);
+			free(s->inst.metrics_sock);
+			free(s->inst.sink_list);
+			free(s->inst.verify_path);
+			ret = EXIT_FAILURE;
+			break;
+		}
+		started++;
+	}
 
-	pfd[nfds].fd = vid->fd;
-	pfd[nfds].events = POLLOUT | POLLWRNORM | POLLPRI;
-	ev[EV_VIDEO] = nfds++;
+	pfd[0].fd = fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = done_fd;
+	pfd[1].events = POLLIN;
 
-	if (i->sigfd != -1) {
-		pfd[nfds].fd = i->sigfd;
-		pfd[nfds].events = POLLIN;
-		ev[EV_SIGNAL] = nfds++;
-	}
+	/* a session ending on its own leaves the others running */
+	for (left = started; left > 0; ) {
+		eventfd_t n;
 
-	AVPacket pkt;
-	int buf = -1;
-	int parse_ret;
-	bool waiting_for_buf = false;
-	av_init_packet(&pkt);
-	
-	while (!i->finish) {
-		pfd[ev[EV_VIDEO]].events |= POLLIN | POLLRDNORM;
-
-		ret = poll(pfd, nfds, 10);
-		if (ret <= 0) {
-			buf = get_buffer_unlocked(i);
-			if (buf < 0) {
-				err("No output buffer available");
-				continue;
-			}
-			
-			parse_ret = parse_frame(i, &pkt);
-			if (parse_ret < 0) {
-				if (parse_ret == AVERROR(EAGAIN)) {
-					continue;
-				} else if (parse_ret == AVERROR_EOF)
-					dbg("Queue end of stream");
-				else
-					av_err(parse_ret, "Parsing failed");
-				info("Sending EOS for buffer %d", buf);
-				send_eos(i, buf);
-				break;
-			}
-			if (send_pkt(i, buf, &pkt) < 0)
-				break;
-			av_packet_unref(&pkt);
+		if (poll(pfd, 2, -1) < 0)
 			continue;
-		}
 
-		for (int idx = 0; idx < nfds; idx++) {
-			revents = pfd[idx].revents;
-			if (!revents)
-				continue;
-
-			if (idx == ev[EV_VIDEO]) {
-				if (revents & (POLLIN | POLLRDNORM))
-					handle_video_capture(i);
-				if (revents & (POLLOUT | POLLWRNORM))
-					handle_video_output(i);
-				if (revents & POLLPRI)
-					handle_video_event(i);
-
-			} else if (idx == ev[EV_DISPLAY]) {
-				if (revents & POLLOUT)
-					pfd[ev[EV_DISPLAY]].events &= ~POLLOUT;
-
-			} else if (idx == ev[EV_SIGNAL]) {
-				handle_signal(i);
-				break;
+		if (pfd[0].revents) {
+			struct signalfd_siginfo siginfo;
+
+			if (read(fd, &siginfo, sizeof (siginfo)) < 0)
+				perror("signalfd/read");
+			pthread_mutex_lock(&session_lock);
+			for (int k = 0; k < started; k++) {
+				sessions[k].stopped = 1;
+				if (sessions[k].dec)
+					v4l2dec_stop(sessions[k].dec);
 			}
+			pthread_mutex_unlock(&session_lock);
+			break;
 		}
+
+		if (pfd[1].revents && !eventfd_read(done_fd, &n))
+			left -= n;
 	}
 
-	dbg("main thread finished");
-}
+	for (int n = 0; n < started; n++) {
+		pthread_join(sessions[n].thread, NULL);
+		if (sessions[n].ret != EXIT_SUCCESS)
+			ret = EXIT_FAILURE;
+		free(sessions[n].inst.metrics_shm);
+		free(sessions[n].inst.metrics_sock);
+		free(sessions[n].inst.sink_list);
+		free(sessions[n].inst.verify_path);
+	}
 
+	close(fd);
+	close(done_fd);
+	free(sessions);
+
+	return ret;
+}
 
 int main(int argc, char **argv) {
     struct instance inst = {0};
 	memset(&inst, 0, sizeof(inst));
     int ret;
 	ret = parse_args(&inst, argc, argv);
-	inst.sigfd = -1;
-	INIT_LIST_HEAD(&inst.video.pending_ts_list);
-	INIT_LIST_HEAD(&inst.fb_list);
-	inst.video.pts_dts_delta = TIMESTAMP_NONE;
-	inst.video.cap_last_pts = TIMESTAMP_NONE;
-	inst.video.extradata_index = -1;
-	inst.video.extradata_size = 0;
-	inst.video.extradata_ion_fd = -1;
     
     if (ret < 0) {
-        err("Usage: %s [-c] [-d] [-f] [-p] [-q] [-i] [-s] [-v] [-m device] url\n", argv[0]);
-        return EXIT_FAILURE;
-    }
-
-    if (stream_open(&inst)) {
-        err("Failed to open stream\n");
+        err("Usage: %s [-c] [-d] [-f] [-p] [-q] [-i] [-s] [-v] [-m device] url...\n", argv[0]);
         return EXIT_FAILURE;
     }
 
-    inst.video.fd = open(VIDEO_DEVICE, O_RDWR, 0);
-	if (inst.video.fd < 0) {
-		err("Failed to open video decoder: %s", inst.video.name);
+	if (log_init())
 		return EXIT_FAILURE;
-	}
-	struct v4l2_capability cap;
-	memzero(cap);
-	if (ioctl(inst.video.fd, VIDIOC_QUERYCAP, &cap) < 0) {
-		err("Failed to verify capabilities: %m");
-		return -1;
-	}
 
-	const int n_events = sizeof(event_type) / sizeof(event_type[0]);
-	for (int i = 0; i < n_events; i++) {
-		if (video_subscribe_event(&inst, event_type[i])) {
-			err("Failed to subscribe to event %d\n", event_type[i]);
-			return EXIT_FAILURE;
+	if (inst.verify_reference) {
+		if (stream_open(&inst)) {
+			err("Failed to open stream");
+			ret = EXIT_FAILURE;
+			goto out;
 		}
+		ret = verify_reference(&inst, inst.verify_reference);
+		stream_close(&inst);
+		ret = ret ? EXIT_FAILURE : EXIT_SUCCESS;
+		goto out;
 	}
 
-	if (video_setup_output(&inst, inst.fourcc, STREAM_BUFFER_SIZE, OUTPUT_BUFFER_COUNT)) {
-		err("Failed to setup video output\n");
-		return EXIT_FAILURE;
-	}
-
- 	if (video_set_control(&inst)) {
-		err("Failed to set video control\n");
-		return EXIT_FAILURE;
-	}
-	
-	if (video_stream(&inst, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE,VIDIOC_STREAMON)) {
-		err("Failed to start video output stream\n");
-		return EXIT_FAILURE;
-	}
-	
-	if (restart_capture(&inst)) {
-		err("Failed to restart capture\n");
-		return EXIT_FAILURE;
-	}
-
-	sigset_t sigmask;
-	int fd;
-
-	sigemptyset(&sigmask);
-	sigaddset(&sigmask, SIGINT);
-	sigaddset(&sigmask, SIGTERM);
-
-	fd = signalfd(-1, &sigmask, SFD_CLOEXEC);
-	if (fd < 0) {
-		perror("signalfd");
-		return EXIT_FAILURE;
-	}
-
-	sigprocmask(SIG_BLOCK, &sigmask, NULL);
-	inst.sigfd = fd;
-	
-	info("Video stream started successfully\n");
-	
-	main_loop(&inst);
-
-	return 0;
-
-
+	if (!inst.sink_list)
+		inst.sink_list = "null";
 
+	n_sessions = inst.n_urls;
+	if (n_sessions > 1)
+		ret = run_sessions(&inst);
+	else
+		ret = session_run(&inst, NULL);
 
+out:
+	log_shutdown();
 
+	return ret;
 }
-
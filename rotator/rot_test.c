@@ -1,159 +1,283 @@
 /*
- * rot_test.c – minimal Qualcomm SDM845 SDE-rotator demo (UBWC → linear)
+ * V4L2 Codec decoding example application
  *
- * Builds:
- *   arm64-linux-gnu-gcc -Wall -O2 -o rot_test rot_test.c
+ * Rotator throughput benchmark
  *
- * Typical run (root):
- *   ./rot_test /dev/video2 1920 1080
+ * Converts blank UBWC frames of a given size through the rotator API
+ * (hw_rot.h) as fast as the session allows and reports frames/s, without
+ * a decoder: the source buffers are ION buffers laid out like the ones of
+ * the decoder CAPTURE queue.  A program of its own on top of
+ * libv4l2dec.a, run rot_test -h.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
  *
- * Dependencies:
- *   • your kernel headers (for <media/msm_sde_rotator.h> and ION UAPI)
- *   • ion_helpers.c  – provides ion_alloc_contig_fd()
- *   • sys_heap_mask.h – defines SYS_HEAP_MASK  (contiguous heap bitmask)
  */
 
-#define _GNU_SOURCE
-#include <fcntl.h>
-#include <linux/videodev2.h>
-#include <media/msm_sde_rotator.h>
-#include <linux/ion.h>
-#include <stdint.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <errno.h>
-#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
+#include "../common.h"
+#include "../hw_rot.h"
 #include "../video.h"
-#include "rot_test.h"
 
-/* ─────────────── helpers ─────────────── */
-#define CHECK(x, msg)  do { if ((x) < 0) { perror(msg); exit(1);} } while (0)
-#define CLEAR(s)       memset(&(s), 0, sizeof(s))
+#define DBG_TAG "rot_test"
+
+/* Source frames, enough to keep every pool buffer busy */
+#define ROT_TEST_SRC		(2 * MAX_ROT_BUF)
+
+static struct {
+	int frames;		/* to convert */
+	int submitted;
+	int done;
+	uint64_t latency;	/* sum, us */
+	int failed;
+} bench;
+
+static void rot_test_consumed(struct instance *i, int dec_index)
+{
+	if (bench.failed || bench.submitted == bench.frames)
+		return;
+
+	if (rotator_submit(i, dec_index, bench.submitted)) {
+		bench.failed = 1;
+		return;
+	}
+
+	bench.submitted++;
+}
+
+static void rot_test_done(struct instance *i, int index, uint64_t pts)
+{
+	bench.latency += metrics_now_us() - i->rotator.job[index].submitted;
+	bench.done++;
+
+	dbg("frame %llu in pool buffer %d", (unsigned long long)pts, index);
+
+	rotator_release(i, index);
+}
+
+static const struct rotator_cb rot_test_cb = {
+	.consumed = rot_test_consumed,
+	.done = rot_test_done,
+};
+
+static void rot_test_free(struct video *vid)
+{
+	for (int n = 0; n < vid->cap_buf_cnt; n++) {
+		if (vid->cap_buf_addr[n])
+			munmap(vid->cap_buf_addr[n], vid->cap_buf_size);
+		if (vid->cap_buf_fd[n] >= 0)
+			close(vid->cap_buf_fd[n]);
+
+		vid->cap_buf_addr[n] = NULL;
+		vid->cap_buf_fd[n] = -1;
+	}
+
+	vid->cap_buf_cnt = 0;
+}
+
+/* Stand-in for the decoder CAPTURE buffers */
+static int rot_test_alloc(struct video *vid, int width, int height)
+{
+	struct ubwc_layout l;
+
+	ubwc_layout_nv12(&l, width, height);
+
+	vid->cap_w = width;
+	vid->cap_h = height;
+	vid->cap_plane_stride[0] = l.y_stride;
+	vid->cap_scanlines = l.y_scanlines;
+	vid->cap_crop.left = 0;
+	vid->cap_crop.top = 0;
+	vid->cap_crop.width = width;
+	vid->cap_crop.height = height;
+	vid->cap_buf_size = l.size;
+
+	for (int n = 0; n < ROT_TEST_SRC; n++)
+		vid->cap_buf_fd[n] = -1;
+
+	for (vid->cap_buf_cnt = 0; vid->cap_buf_cnt < ROT_TEST_SRC;
+	     vid->cap_buf_cnt++) {
+		int n = vid->cap_buf_cnt;
+		void *addr;
+
+		vid->cap_buf_fd[n] = alloc_ion_buffer(l.size, 0);
+		if (vid->cap_buf_fd[n] < 0)
+			goto fail;
 
-static int xioctl(int fd, int req, void *arg, const char *tag)
+		addr = mmap(NULL, l.size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			    vid->cap_buf_fd[n], 0);
+		if (addr == MAP_FAILED) {
+			err("rot_test: failed to map buffer: %m");
+			goto fail;
+		}
+
+		vid->cap_buf_addr[n] = addr;
+	}
+
+	return 0;
+
+fail:
+	vid->cap_buf_cnt++;
+	rot_test_free(vid);
+	return -1;
+}
+
+/* Run frames blank width x height UBWC frames through the rotator
+ * device (or "sw") and report frames/s */
+static int test_rot(struct instance *i, const char *device, int width,
+		    int height, int frames)
+{
+	struct rotator *rot = &i->rotator;
+	struct video *vid = &i->video;
+	uint64_t start, elapsed;
+	int n, ret = -1;
+
+	memset(&bench, 0, sizeof (bench));
+	bench.frames = frames;
+
+	if (rot_test_alloc(vid, width, height))
+		return -1;
+
+	if (rotator_open(i, device, i->rotator_depth, &rot_test_cb))
+		goto out;
+
+	start = metrics_now_us();
+
+	for (n = 0; n < vid->cap_buf_cnt && bench.submitted < frames; n++) {
+		if (rotator_submit(i, n, bench.submitted))
+			goto out;
+		bench.submitted++;
+	}
+
+	while (bench.done < bench.submitted && !bench.failed) {
+		struct pollfd pfd = {
+			.fd = rotator_get_fd(i),
+			.events = POLLIN | POLLRDNORM,
+		};
+
+		ret = poll(&pfd, 1, 2000);
+		if (ret <= 0) {
+			err("rot_test: %s after %d frames",
+			    ret ? "poll failed" : "timed out", bench.done);
+			ret = -1;
+			goto out;
+		}
+
+		if (rotator_dispatch(i)) {
+			ret = -1;
+			goto out;
+		}
+	}
+
+	elapsed = metrics_now_us() - start;
+
+	info("rot_test: %s %dx%d to %dx%d%s, %d frames in %llu ms, "
+	     "%.1f frames/s, mean latency %llu us, depth %d",
+	     rot->sw ? "cpu" : rot->mplane ? "mplane dmabuf" : "userptr",
+	     rot->width, rot->height, rot->dst_w, rot->dst_h,
+	     rot->post ? " (scaled on the CPU)" : "", bench.done,
+	     (unsigned long long)elapsed / 1000,
+	     elapsed ? bench.done * 1e6 / elapsed : 0.0,
+	     (unsigned long long)(bench.done ? bench.latency / bench.done : 0),
+	     rot->cap_buf_cnt);
+
+	ret = bench.failed ? -1 : 0;
+
+out:
+	rotator_close(i);
+	rot_test_free(vid);
+	return ret;
+}
+
+static void usage(const char *name)
 {
-    int r; do { r = ioctl(fd, req, arg); } while (r < 0 && errno == EINTR);
-    if (r < 0) fprintf(stderr, "%s: %s\n", tag, strerror(errno));
-    return r;
+	fprintf(stderr,
+		"usage: %s [-d <device|sw>] [-n <frames>] [-s <w>x<h>] "
+		"[-o <w>x<h>] [-g]\n"
+		"       [-q <depth>] [-v]\n"
+		"  -d  rotator device (%s), sw for the CPU\n"
+		"  -n  frames to convert (1000)\n"
+		"  -s  UBWC frame size (1920x1080)\n"
+		"  -o  converted frame size (the frame size)\n"
+		"  -g  luma only output\n"
+		"  -q  frames in flight (the rotator default)\n"
+		"  -v  more output\n", name, ROTATOR_DEVICE);
 }
 
-/* ─────────────── main ─────────────── */
-int test_rot(int argc, char **argv)
+int main(int argc, char *argv[])
 {
-    const char *node = (argc > 1) ? argv[1] : "/dev/video2";
-    unsigned     W   = (argc > 2) ? atoi(argv[2]) : 1920;
-    unsigned     H   = (argc > 3) ? atoi(argv[3]) : 1080;
-
-    int fd = open(node, O_RDWR | O_NONBLOCK);
-    CHECK(fd, "open rotator");
-
-    /* 1. OUTPUT queue – NV12_UBWC (4 planes) */
-    struct v4l2_format fmt_out; CLEAR(fmt_out);
-    fmt_out.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
-    fmt_out.fmt.pix_mp.width       = W;
-    fmt_out.fmt.pix_mp.height      = H;
-    fmt_out.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_NV12_UBWC;
-    fmt_out.fmt.pix_mp.num_planes  = 4;                 /* Y, Ymeta, UV, UVmeta */
-    CHECK(xioctl(fd, VIDIOC_S_FMT, &fmt_out, "S_FMT OUT"), "S_FMT OUT");
-
-    /* plane sizes returned by driver */
-    size_t y_sz      = fmt_out.fmt.pix_mp.plane_fmt[0].sizeimage;
-    size_t ymeta_sz  = fmt_out.fmt.pix_mp.plane_fmt[1].sizeimage;
-    size_t uv_sz     = fmt_out.fmt.pix_mp.plane_fmt[2].sizeimage;
-    size_t uvmeta_sz = fmt_out.fmt.pix_mp.plane_fmt[3].sizeimage;
-
-    /* 2. CAPTURE queue – linear NV12 (2 planes) */
-    struct v4l2_format fmt_cap; CLEAR(fmt_cap);
-    fmt_cap.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-    fmt_cap.fmt.pix_mp.width       = W;
-    fmt_cap.fmt.pix_mp.height      = H;
-    fmt_cap.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_NV12;
-    fmt_cap.fmt.pix_mp.num_planes  = 2;                 /* Y, UV */
-    CHECK(xioctl(fd, VIDIOC_S_FMT, &fmt_cap, "S_FMT CAP"), "S_FMT CAP");
-
-    size_t y_lin_sz  = fmt_cap.fmt.pix_mp.plane_fmt[0].sizeimage;
-    size_t uv_lin_sz = fmt_cap.fmt.pix_mp.plane_fmt[1].sizeimage;
-
-    /* 3. ROTATE control = 0° (optional) */
-    struct v4l2_control rot = { .id = V4L2_CID_ROTATE, .value = 0 };
-    CHECK(xioctl(fd, VIDIOC_S_CTRL, &rot, "CTRL ROT"), "CTRL ROT");
-
-    /* 4. REQBUFS (both DMABUF) */
-    struct v4l2_requestbuffers req = { .count = 1,
-        .type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, .memory = V4L2_MEMORY_DMABUF };
-    CHECK(xioctl(fd, VIDIOC_REQBUFS, &req, "REQBUFS OUT"), "REQBUFS OUT");
-
-    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-    CHECK(xioctl(fd, VIDIOC_REQBUFS, &req, "REQBUFS CAP"), "REQBUFS CAP");
-
-    /* 5. allocate ION planes */
-    int fd_y  = alloc_ion_buffer(y_sz,      0);
-    int fd_ym = alloc_ion_buffer(ymeta_sz,  0);
-    int fd_uv = alloc_ion_buffer(uv_sz,     0);
-    int fd_uvm= alloc_ion_buffer(uvmeta_sz, 0);
-
-    int fd_y_lin  = alloc_ion_buffer(y_lin_sz,  0);
-    int fd_uv_lin = alloc_ion_buffer(uv_lin_sz, 0);
-
-    /* 6. QBUF OUT (4 planes) */
-    struct v4l2_buffer  buf_out;  CLEAR(buf_out);
-    struct v4l2_plane   planes_o[4]; CLEAR(planes_o);
-    buf_out.type      = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
-    buf_out.memory    = V4L2_MEMORY_DMABUF;
-    buf_out.index     = 0;
-    buf_out.length    = 4;
-    buf_out.m.planes  = planes_o;
-
-    planes_o[0].m.fd = fd_y;   planes_o[0].length = y_sz;      planes_o[0].bytesused = y_sz;
-    planes_o[1].m.fd = fd_ym;  planes_o[1].length = ymeta_sz;  planes_o[1].bytesused = ymeta_sz;
-    planes_o[2].m.fd = fd_uv;  planes_o[2].length = uv_sz;     planes_o[2].bytesused = uv_sz;
-    planes_o[3].m.fd = fd_uvm; planes_o[3].length = uvmeta_sz; planes_o[3].bytesused = uvmeta_sz;
-
-    CHECK(xioctl(fd, VIDIOC_QBUF, &buf_out, "QBUF OUT"), "QBUF OUT");
-
-    /* 7. QBUF CAP (2 planes) */
-    struct v4l2_buffer buf_cap; CLEAR(buf_cap);
-    struct v4l2_plane  planes_c[2]; CLEAR(planes_c);
-    buf_cap.type      = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-    buf_cap.memory    = V4L2_MEMORY_DMABUF;
-    buf_cap.index     = 0;
-    buf_cap.length    = 2;
-    buf_cap.m.planes  = planes_c;
-
-    planes_c[0].m.fd = fd_y_lin;  planes_c[0].length = y_lin_sz;
-    planes_c[1].m.fd = fd_uv_lin; planes_c[1].length = uv_lin_sz;
-
-    CHECK(xioctl(fd, VIDIOC_QBUF, &buf_cap, "QBUF CAP"), "QBUF CAP");
-
-    /* 8. STREAMON both queues */
-    enum v4l2_buf_type t = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
-    CHECK(xioctl(fd, VIDIOC_STREAMON, &t, "STREAMON OUT"), "STREAMON OUT");
-    t = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-    CHECK(xioctl(fd, VIDIOC_STREAMON, &t, "STREAMON CAP"), "STREAMON CAP");
-
-    /* 9. Wait for completion (DQBUF CAP) */
-    fd_set set; FD_ZERO(&set); FD_SET(fd, &set);
-    select(fd+1, &set, NULL, NULL, NULL);
-
-    CLEAR(buf_cap);
-    buf_cap.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-    buf_cap.memory = V4L2_MEMORY_DMABUF;
-    if (xioctl(fd, VIDIOC_DQBUF, &buf_cap, "DQBUF CAP") == 0)
-        printf("Success! Y bytes=%u  UV bytes=%u\n",
-               buf_cap.m.planes[0].bytesused, buf_cap.m.planes[1].bytesused);
-
-    /* 10. STREAMOFF + cleanup */
-    t = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
-    ioctl(fd, VIDIOC_STREAMOFF, &t);
-    t = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-    ioctl(fd, VIDIOC_STREAMOFF, &t);
-
-    close(fd_y); close(fd_ym); close(fd_uv); close(fd_uvm);
-    close(fd_y_lin); close(fd_uv_lin);
-    close(fd);
-    return 0;
-}
\ No newline at end of file
+	static struct instance inst;
+	const char *device = ROTATOR_DEVICE;
+	int width = 1920, height = 1080, frames = 1000;
+	int opt, ret;
+
+	debug_level = 2;
+
+	while ((opt = getopt(argc, argv, "d:n:s:o:gq:vh")) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 'n':
+			frames = atoi(optarg);
+			break;
+		case 's':
+			if (sscanf(optarg, "%dx%d", &width, &height) != 2) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'o':
+			if (sscanf(optarg, "%dx%d", &inst.rotator_width,
+				   &inst.rotator_height) != 2) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'g':
+			inst.rotator_fourcc = V4L2_PIX_FMT_GREY;
+			break;
+		case 'q':
+			inst.rotator_depth = atoi(optarg);
+			break;
+		case 'v':
+			debug_level++;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc || frames <= 0 || width <= 0 || height <= 0 ||
+	    inst.rotator_width < 0 || inst.rotator_height < 0 ||
+	    inst.rotator_depth < 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	inst.rotator.fd = -1;
+	if (metrics_init(&inst.metrics, NULL, NULL))
+		return 1;
+
+	ret = test_rot(&inst, device, width, height, frames);
+
+	metrics_close(&inst.metrics);
+
+	return ret ? 1 : 0;
+}
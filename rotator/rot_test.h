@@ -1 +0,0 @@
-int test_rot(int argc, char *argv[]);
\ No newline at end of file
@@ -0,0 +1,147 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * CPU image scaling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "scale.h"
+
+struct scaler {
+	int src_w, src_h;
+	int dst_w, dst_h;
+	int bpp;
+
+	/* first source sample of every destination sample, plus the end */
+	int *xb;
+	int *yb;
+
+	/* column sums of one destination line */
+	uint32_t *sum;
+};
+
+static void scale_bounds(int *b, int src, int dst)
+{
+	for (int n = 0; n < dst; n++)
+		b[n] = (int)((int64_t)n * src / dst);
+	b[dst] = src;
+
+	/* upscaling, every destination sample covers at least one */
+	for (int n = 0; n < dst; n++)
+		b[n] = MIN(b[n], src - 1);
+}
+
+struct scaler *scale_new(int src_w, int src_h, int dst_w, int dst_h,
+			 int bpp)
+{
+	struct scaler *s;
+
+	if (src_w <= 0 || src_h <= 0 || dst_w <= 0 || dst_h <= 0)
+		return NULL;
+
+	s = calloc(1, sizeof (*s));
+	if (!s)
+		return NULL;
+
+	s->src_w = src_w;
+	s->src_h = src_h;
+	s->dst_w = dst_w;
+	s->dst_h = dst_h;
+	s->bpp = bpp;
+
+	s->xb = malloc((dst_w + 1) * sizeof (*s->xb));
+	s->yb = malloc((dst_h + 1) * sizeof (*s->yb));
+	s->sum = malloc((size_t)bpp * dst_w * sizeof (*s->sum));
+	if (!s->xb || !s->yb || !s->sum) {
+		scale_free(s);
+		return NULL;
+	}
+
+	scale_bounds(s->xb, src_w, dst_w);
+	scale_bounds(s->yb, src_h, dst_h);
+
+	return s;
+}
+
+void scale_free(struct scaler *s)
+{
+	if (!s)
+		return;
+
+	free(s->xb);
+	free(s->yb);
+	free(s->sum);
+	free(s);
+}
+
+/* Add one source line to the column sums, bpp is a constant once
+ * inlined so the inner loops get unrolled */
+static inline __attribute__((always_inline)) void
+scale_sum_line(uint32_t *sum, const uint8_t *s, const int *xb, int dst_w,
+	       int bpp)
+{
+	for (int x = 0; x < dst_w; x++) {
+		int x1 = MAX(xb[x + 1], xb[x] + 1);
+
+		for (int sx = xb[x]; sx < x1; sx++)
+			for (int c = 0; c < bpp; c++)
+				sum[x * bpp + c] += s[sx * bpp + c];
+	}
+}
+
+void scale_box(struct scaler *s, const uint8_t *src, int src_stride,
+	       uint8_t *dst, int dst_stride)
+{
+	const int *xb = s->xb, *yb = s->yb;
+	uint32_t *sum = s->sum;
+	int dst_w = s->dst_w, bpp = s->bpp;
+
+	if (s->src_w == dst_w && s->src_h == s->dst_h) {
+		for (int y = 0; y < s->dst_h; y++)
+			memcpy(dst + (size_t)y * dst_stride,
+			       src + (size_t)y * src_stride, dst_w * bpp);
+		return;
+	}
+
+	for (int y = 0; y < s->dst_h; y++) {
+		int y1 = MAX(yb[y + 1], yb[y] + 1);
+		uint8_t *d = dst + (size_t)y * dst_stride;
+
+		memset(sum, 0, (size_t)bpp * dst_w * sizeof (*sum));
+
+		/* sum the source lines first, then the columns */
+		for (int sy = yb[y]; sy < y1; sy++) {
+			const uint8_t *l = src + (size_t)sy * src_stride;
+
+			if (bpp == 1)
+				scale_sum_line(sum, l, xb, dst_w, 1);
+			else
+				scale_sum_line(sum, l, xb, dst_w, 2);
+		}
+
+		for (int x = 0; x < dst_w; x++) {
+			int x1 = MAX(xb[x + 1], xb[x] + 1);
+			uint32_t area = (uint32_t)(x1 - xb[x]) * (y1 - yb[y]);
+
+			for (int c = 0; c < bpp; c++)
+				d[x * bpp + c] = (sum[x * bpp + c] + area / 2) /
+					area;
+		}
+	}
+}
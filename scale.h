@@ -0,0 +1,40 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * CPU image scaling header file
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef INCLUDE_SCALE_H
+#define INCLUDE_SCALE_H
+
+#include <stdint.h>
+
+struct scaler;
+
+/* Resize planes of src_w x src_h samples made of bpp interleaved bytes
+ * (1 for Y, 2 for the CbCr plane of NV12) to dst_w x dst_h.  Each
+ * destination sample is the average of the source samples it covers,
+ * which makes a good enough downscaler and a nearest neighbour
+ * upscaler.  Everything the geometry needs is allocated here, once. */
+struct scaler *scale_new(int src_w, int src_h, int dst_w, int dst_h,
+			 int bpp);
+void scale_free(struct scaler *s);
+
+/* Only one plane at a time per scaler */
+void scale_box(struct scaler *s, const uint8_t *src, int src_stride,
+	       uint8_t *dst, int dst_stride);
+
+#endif /* INCLUDE_SCALE_H */
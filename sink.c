@@ -0,0 +1,397 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Frame sinks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "sink.h"
+
+#define DBG_TAG "  sink"
+
+static int null_consume(struct sink *s, struct sink_frame *f)
+{
+	return 0;
+}
+
+/* decode only, the frames need no conversion */
+static int null_accepts(struct sink *s, uint32_t fourcc)
+{
+	return 1;
+}
+
+static const struct sink_ops sink_null_ops = {
+	.name = "null",
+	.consume = null_consume,
+	.accepts = null_accepts,
+};
+
+static const struct sink_ops *const sink_types[] = {
+	&sink_null_ops,
+	&sink_file_ops,
+	&sink_dump_ops,
+	&sink_shm_ops,
+	&sink_wayland_ops,
+	&sink_verify_ops,
+};
+
+static const struct sink_ops *sink_find(const char *name, size_t len)
+{
+	for (size_t n = 0; n < ARRAY_LENGTH(sink_types); n++) {
+		if (strlen(sink_types[n]->name) == len &&
+		    !strncmp(sink_types[n]->name, name, len))
+			return sink_types[n];
+	}
+
+	return NULL;
+}
+
+struct sink *sink_attach(struct instance *i, const struct sink_ops *ops,
+			 const char *name, const char *arg)
+{
+	struct sink *s;
+
+	if (i->n_sinks == SINK_MAX) {
+		err("too many sinks");
+		return NULL;
+	}
+
+	s = calloc(1, sizeof (*s));
+	if (!s)
+		return NULL;
+
+	s->ops = ops;
+	s->i = i;
+	s->id = i->n_sinks;
+	s->name = strdup(name);
+
+	if (ops->open && ops->open(s, arg)) {
+		err("failed to open sink %s", name);
+		free(s->name);
+		free(s);
+		return NULL;
+	}
+
+	i->sinks[i->n_sinks++] = s;
+
+	dbg("sink %s opened, keeps up to %d frames", s->name, s->max_held);
+
+	return s;
+}
+
+static int sink_open(struct instance *i, const char *spec)
+{
+	const struct sink_ops *ops;
+	const char *arg = strchr(spec, ':');
+
+	ops = sink_find(spec, arg ? (size_t)(arg - spec) : strlen(spec));
+	if (!ops) {
+		err("unknown sink %s", spec);
+		return -1;
+	}
+
+	return sink_attach(i, ops, spec, arg ? arg + 1 : NULL) ? 0 : -1;
+}
+
+int sinks_open(struct instance *i, const char *list)
+{
+	char *copy, *spec, *save;
+	int ret = 0;
+
+	copy = strdup(list);
+	if (!copy)
+		return -1;
+
+	for (spec = strtok_r(copy, ",", &save); spec && !ret;
+	     spec = strtok_r(NULL, ",", &save))
+		ret = sink_open(i, spec);
+
+	free(copy);
+
+	if (ret)
+		sinks_close(i);
+
+	return ret;
+}
+
+void sinks_close(struct instance *i)
+{
+	for (int n = 0; n < i->n_sinks; n++) {
+		struct sink *s = i->sinks[n];
+
+		/* frames still kept are released by the producer itself */
+		if (s->ops->close)
+			s->ops->close(s);
+
+		free(s->name);
+		free(s);
+		i->sinks[n] = NULL;
+	}
+
+	i->n_sinks = 0;
+}
+
+void sink_frame_unref(struct instance *i, struct sink_frame *f)
+{
+	if (--f->refs == 0 && f->release)
+		f->release(i, f);
+}
+
+void sinks_deliver(struct instance *i, struct sink_frame *f)
+{
+	uint64_t size = sink_frame_size(f);
+
+	f->refs = 1;
+
+	for (int n = 0; n < i->n_sinks; n++) {
+		struct sink *s = i->sinks[n];
+		struct sink_stats *st = &s->stats;
+		uint64_t start;
+		int ret;
+
+		if (s->max_held && st->held >= s->max_held) {
+			st->dropped++;
+			continue;
+		}
+
+		start = metrics_now_us();
+
+		/* the sink may put it back from consume() already */
+		f->refs++;
+		f->kept_us[s->id] = start;
+		st->held++;
+
+		ret = s->ops->consume(s, f);
+
+		metrics_hist_add(&st->consume, metrics_now_us() - start);
+
+		if (ret < 0) {
+			st->dropped++;
+		} else {
+			if (!st->frames)
+				st->first_us = start;
+			st->last_us = start;
+			st->frames++;
+			st->bytes += size;
+		}
+
+		if (ret <= 0) {
+			st->held--;
+			sink_frame_unref(i, f);
+		} else {
+			st->held_max = MAX(st->held_max, st->held);
+		}
+	}
+
+	sink_frame_unref(i, f);
+}
+
+void sink_put(struct sink *s, struct sink_frame *f)
+{
+	s->stats.held--;
+	metrics_hist_add(&s->stats.hold, metrics_now_us() - f->kept_us[s->id]);
+
+	sink_frame_unref(s->i, f);
+}
+
+size_t sink_frame_size(const struct sink_frame *f)
+{
+	size_t size = 0;
+
+	for (int p = 0; p < f->n_planes; p++)
+		size += (size_t)f->plane[p].width * f->plane[p].height;
+
+	return size;
+}
+
+void sink_frame_copy(const struct sink_frame *f, void *dst)
+{
+	uint8_t *d = dst;
+
+	for (int p = 0; p < f->n_planes; p++) {
+		const struct sink_plane *pl = &f->plane[p];
+		const uint8_t *src = pl->addr;
+
+		if (pl->stride == pl->width) {
+			memcpy(d, src, (size_t)pl->width * pl->height);
+			d += (size_t)pl->width * pl->height;
+			continue;
+		}
+
+		for (int y = 0; y < pl->height; y++) {
+			memcpy(d, src + (size_t)y * pl->stride, pl->width);
+			d += pl->width;
+		}
+	}
+}
+
+void sinks_pool(struct instance *i, const struct sink_frame *f, int n)
+{
+	for (int k = 0; k < i->n_sinks; k++) {
+		struct sink *s = i->sinks[k];
+
+		/* frames still come, the sink sets up what it needs then */
+		if (s->ops->pool && s->ops->pool(s, f, n))
+			err("sink %s: failed to set up %d buffers", s->name, n);
+	}
+}
+
+int sinks_accept(struct instance *i, uint32_t fourcc)
+{
+	if (!i->n_sinks)
+		return 0;
+
+	for (int n = 0; n < i->n_sinks; n++) {
+		struct sink *s = i->sinks[n];
+
+		if (!s->ops->accepts || !s->ops->accepts(s, fourcc))
+			return 0;
+	}
+
+	return 1;
+}
+
+int sinks_null(struct instance *i)
+{
+	for (int n = 0; n < i->n_sinks; n++) {
+		if (i->sinks[n]->ops != &sink_null_ops)
+			return 0;
+	}
+
+	return 1;
+}
+
+int sinks_prepare(struct instance *i)
+{
+	for (int n = 0; n < i->n_sinks; n++) {
+		struct sink *s = i->sinks[n];
+
+		if (s->ops->prepare && s->ops->prepare(s))
+			return -1;
+	}
+
+	return 0;
+}
+
+int sinks_get_fds(struct instance *i, struct pollfd *pfd)
+{
+	int nfds = 0;
+
+	for (int n = 0; n < i->n_sinks; n++) {
+		struct sink *s = i->sinks[n];
+
+		if (!s->ops->get_fd)
+			continue;
+
+		pfd[nfds].fd = s->ops->get_fd(s);
+		pfd[nfds].events = POLLIN;
+		pfd[nfds].revents = 0;
+		nfds++;
+	}
+
+	return nfds;
+}
+
+/* pfd is what sinks_get_fds() filled, in the same order */
+int sinks_dispatch(struct instance *i, const struct pollfd *pfd, int n)
+{
+	int k = 0;
+
+	for (int s = 0; s < i->n_sinks && k < n; s++) {
+		struct sink *sink = i->sinks[s];
+
+		if (!sink->ops->get_fd)
+			continue;
+
+		if (pfd[k].revents && sink->ops->dispatch(sink, pfd[k].revents))
+			return -1;
+		k++;
+	}
+
+	return 0;
+}
+
+static double sink_fps(const struct sink_stats *st)
+{
+	if (st->frames < 2 || st->last_us == st->first_us)
+		return 0;
+
+	return (st->frames - 1) * 1e6 / (st->last_us - st->first_us);
+}
+
+int sinks_format(struct instance *i, char *buf, size_t size)
+{
+	size_t n = 0;
+
+	for (int k = 0; k < i->n_sinks && n < size; k++) {
+		const struct sink *s = i->sinks[k];
+		const struct sink_stats *st = &s->stats;
+
+		n += snprintf(buf + n, size - n,
+			      "v4l2dec_sink_frames{sink=\"%s\"} %llu\n"
+			      "v4l2dec_sink_bytes{sink=\"%s\"} %llu\n"
+			      "v4l2dec_sink_dropped{sink=\"%s\"} %llu\n"
+			      "v4l2dec_sink_replaced{sink=\"%s\"} %llu\n"
+			      "v4l2dec_sink_held{sink=\"%s\"} %d\n"
+			      "v4l2dec_sink_consume_us_sum{sink=\"%s\"} %llu\n"
+			      "v4l2dec_sink_consume_us_max{sink=\"%s\"} %llu\n",
+			      s->name, (unsigned long long)st->frames,
+			      s->name, (unsigned long long)st->bytes,
+			      s->name, (unsigned long long)st->dropped,
+			      s->name, (unsigned long long)st->replaced,
+			      s->name, st->held,
+			      s->name, (unsigned long long)st->consume.sum_us,
+			      s->name, (unsigned long long)st->consume.max_us);
+	}
+
+	return MIN(n, size);
+}
+
+void sinks_report(struct instance *i)
+{
+	for (int k = 0; k < i->n_sinks; k++) {
+		const struct sink *s = i->sinks[k];
+		const struct sink_stats *st = &s->stats;
+		uint64_t elapsed = st->last_us - st->first_us;
+
+		info("sink %s: %llu frames, %.2f fps, %.2f MB/s, %llu dropped",
+		     s->name, (unsigned long long)st->frames, sink_fps(st),
+		     elapsed ? st->bytes / (double)elapsed : 0.0,
+		     (unsigned long long)st->dropped);
+
+		if (st->replaced)
+			info("sink %s: %llu frames replaced before they were "
+			     "shown", s->name,
+			     (unsigned long long)st->replaced);
+
+		if (!st->consume.count)
+			continue;
+
+		info("sink %s: consume mean %llu us max %llu us", s->name,
+		     (unsigned long long)(st->consume.sum_us /
+					  st->consume.count),
+		     (unsigned long long)st->consume.max_us);
+
+		if (st->held_max)
+			info("sink %s: kept up to %d frames for %llu us on "
+			     "average", s->name, st->held_max,
+			     (unsigned long long)(st->hold.count ?
+				st->hold.sum_us / st->hold.count : 0));
+	}
+}
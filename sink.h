@@ -0,0 +1,180 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Frame sinks header file
+ *
+ * Decoded frames (linear ones out of the rotator, or the decoder UBWC
+ * buffers when it is disabled) are handed to every sink selected with
+ * --sink.  A sink either is done with the frame when consume() returns,
+ * or keeps it and gives it back with sink_put() later; the producer gets
+ * its buffer back once the last sink has put it.
+ *
+ * A sink keeping max_held frames already is skipped for new frames,
+ * which are counted as dropped: a slow sink never stalls the decoder
+ * nor the other sinks.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef INCLUDE_SINK_H
+#define INCLUDE_SINK_H
+
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "metrics.h"
+
+/* Sinks selected at once */
+#define SINK_MAX		8
+
+/* NV12 has two, compressed formats are a single opaque plane whose
+ * width is the buffer size and height 1 */
+#define SINK_MAX_PLANES		2
+
+struct instance;
+struct sink;
+
+struct sink_plane {
+	void *addr;		/* CPU view */
+	int fd;			/* dmabuf, -1 for malloc'ed memory */
+	int offset;		/* of the plane in fd */
+	int stride;
+	int width;		/* bytes of a line */
+	int height;		/* lines */
+};
+
+struct sink_frame {
+	uint32_t fourcc;	/* V4L2_PIX_FMT_* */
+	int width;
+	int height;
+	int n_planes;
+	struct sink_plane plane[SINK_MAX_PLANES];
+
+	/* visible part, pixels */
+	struct {
+		int left, top, width, height;
+	} crop;
+
+	uint64_t pts;
+	uint64_t seq;		/* frame number */
+	uint64_t decoded;	/* metrics_now_us() when decoded */
+
+	/* producer buffer, the same (group, index) is the same memory */
+	int group;
+	int index;
+
+	/* references, the producer holds one while delivering */
+	int refs;
+	void (*release)(struct instance *i, struct sink_frame *f);
+
+	/* when each sink kept it, by sink id */
+	uint64_t kept_us[SINK_MAX];
+};
+
+struct sink_ops {
+	const char *name;
+
+	/* arg is what follows "name:" on the command line, or NULL */
+	int (*open)(struct sink *s, const char *arg);
+	void (*close)(struct sink *s);
+
+	/* 0 when done with the frame, 1 when kept until sink_put() */
+	int (*consume)(struct sink *s, struct sink_frame *f);
+
+	/* Optional: the n buffers of a new producer group, described as
+	 * frames without content, before any of them is consumed */
+	int (*pool)(struct sink *s, const struct sink_frame *f, int n);
+
+	/* Optional event source: work before polling, fd to poll and
+	 * what to do with its events, -1 ends the main loop */
+	int (*prepare)(struct sink *s);
+	int (*get_fd)(struct sink *s);
+	int (*dispatch)(struct sink *s, short revents);
+
+	/* Optional: frames of this V4L2 fourcc, as the decoder writes
+	 * them, are taken without the rotator converting them first */
+	int (*accepts)(struct sink *s, uint32_t fourcc);
+};
+
+struct sink_stats {
+	uint64_t frames;
+	uint64_t bytes;
+	uint64_t dropped;	/* skipped, max_held frames kept already */
+	uint64_t replaced;	/* kept, then put unused for a newer one */
+	int held;
+	int held_max;
+	uint64_t first_us;
+	uint64_t last_us;
+
+	struct metrics_hist consume;	/* time spent in consume() */
+	struct metrics_hist hold;	/* consume() to sink_put() */
+};
+
+struct sink {
+	const struct sink_ops *ops;
+	struct instance *i;
+	int id;
+	char *name;		/* as given on the command line */
+	int max_held;
+	void *priv;
+
+	struct sink_stats stats;
+};
+
+/* Built-in sinks */
+extern const struct sink_ops sink_file_ops;
+extern const struct sink_ops sink_dump_ops;
+extern const struct sink_ops sink_shm_ops;
+extern const struct sink_ops sink_wayland_ops;
+extern const struct sink_ops sink_verify_ops;
+
+/* Open the comma separated list of name[:arg] */
+int sinks_open(struct instance *i, const char *list);
+/* One more sink, not one of the built-in ones */
+struct sink *sink_attach(struct instance *i, const struct sink_ops *ops,
+			 const char *name, const char *arg);
+void sinks_close(struct instance *i);
+
+/* Hand f to every sink, f->release() runs when they are all done */
+void sinks_deliver(struct instance *i, struct sink_frame *f);
+
+/* The producer buffers changed, f[0..n-1] describe the new ones */
+void sinks_pool(struct instance *i, const struct sink_frame *f, int n);
+
+/* A sink is done with a frame it kept */
+void sink_put(struct sink *s, struct sink_frame *f);
+
+/* Drop a reference, f->release() on the last one */
+void sink_frame_unref(struct instance *i, struct sink_frame *f);
+
+/* Copy the visible lines of every plane one after the other */
+size_t sink_frame_size(const struct sink_frame *f);
+void sink_frame_copy(const struct sink_frame *f, void *dst);
+
+/* Every sink takes fourcc frames as they are, the rotator is not needed */
+int sinks_accept(struct instance *i, uint32_t fourcc);
+
+/* Only null sinks are open, the frames go nowhere */
+int sinks_null(struct instance *i);
+
+/* Main loop integration, pfd has room for SINK_MAX entries */
+int sinks_prepare(struct instance *i);
+int sinks_get_fds(struct instance *i, struct pollfd *pfd);
+int sinks_dispatch(struct instance *i, const struct pollfd *pfd, int n);
+
+int sinks_format(struct instance *i, char *buf, size_t size);
+void sinks_report(struct instance *i);
+
+#endif /* INCLUDE_SINK_H */
@@ -0,0 +1,650 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Dump sink, frames appended to one file through io_uring
+ *
+ * dump:<path>[:direct][:buffers=<n>][:resume] copies each frame into a
+ * free buffer of an aligned pool and queues its write, the decoding
+ * thread never waits for the disk: with every buffer still being written
+ * the frame is dropped.  Kernels without io_uring (ENOSYS) get a writer
+ * thread instead.  See dump.h for the file format.
+ *
+ * With resume an existing file is kept, up to its last complete frame
+ * when it was not closed, and the frames it already has are skipped:
+ * running the same command again after a crash completes it.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "dump.h"
+#include "sink.h"
+#include "uring.h"
+
+#define DBG_TAG "  dump"
+
+#define DUMP_BUFFERS		8
+#define DUMP_MAX_BUFFERS	32
+
+/* Offset of the index entry of a record whose write failed */
+#define DUMP_TORN		UINT64_MAX
+
+struct dump_buf {
+	uint8_t *data;		/* DUMP_BLOCK aligned */
+	size_t alloc;
+	struct iovec iov;	/* what is being written */
+	uint64_t offset;
+	size_t entry;		/* in the index */
+	int busy;
+	int res;		/* bytes written or -errno */
+};
+
+struct sink_dump {
+	char *path;
+	int fd;
+	int direct;
+
+	struct uring uring;
+	int use_uring;
+
+	/* writer thread without io_uring, buffer indices */
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int started;
+	int stop;
+	int queue[DUMP_MAX_BUFFERS];
+	int queue_head, queue_count;
+	int done[DUMP_MAX_BUFFERS];
+	int done_head, done_count;
+
+	struct dump_buf buf[DUMP_MAX_BUFFERS];
+	int n_bufs;
+	int in_flight;
+	int in_flight_max;
+
+	int resume;
+	uint64_t resume_seq;	/* first frame not in the file */
+	uint64_t skipped;
+
+	uint64_t offset;	/* end of the last frame */
+	struct dump_index_entry *index;
+	size_t n_index;
+	size_t index_alloc;
+
+	uint64_t pool_full;
+	int failed;
+};
+
+static ssize_t dump_pwrite(int fd, const void *data, size_t size,
+			   uint64_t offset)
+{
+	size_t done = 0;
+
+	while (done < size) {
+		ssize_t ret = pwrite(fd, (const uint8_t *)data + done,
+				     size - done, offset + done);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return ret < 0 ? -errno : (ssize_t)done;
+
+		done += ret;
+	}
+
+	return done;
+}
+
+static void *dump_thread(void *arg)
+{
+	struct sink_dump *d = arg;
+
+	pthread_mutex_lock(&d->lock);
+
+	while (!d->stop || d->queue_count) {
+		struct dump_buf *b;
+		int n;
+
+		if (!d->queue_count) {
+			pthread_cond_wait(&d->cond, &d->lock);
+			continue;
+		}
+
+		n = d->queue[d->queue_head];
+		d->queue_head = (d->queue_head + 1) % DUMP_MAX_BUFFERS;
+		d->queue_count--;
+		b = &d->buf[n];
+
+		pthread_mutex_unlock(&d->lock);
+
+		b->res = dump_pwrite(d->fd, b->iov.iov_base, b->iov.iov_len,
+				     b->offset);
+
+		pthread_mutex_lock(&d->lock);
+
+		d->done[(d->done_head + d->done_count) % DUMP_MAX_BUFFERS] = n;
+		d->done_count++;
+		pthread_cond_broadcast(&d->cond);
+	}
+
+	pthread_mutex_unlock(&d->lock);
+
+	return NULL;
+}
+
+static void dump_complete(struct sink_dump *d, int n, int res)
+{
+	struct dump_buf *b = &d->buf[n];
+
+	b->busy = 0;
+	d->in_flight--;
+
+	if (res == (int)b->iov.iov_len)
+		return;
+
+	/* the record is torn, dump_finish() leaves it out of the index */
+	d->index[b->entry].offset = DUMP_TORN;
+
+	/* most likely the disk is full, say it once */
+	if (!d->failed++)
+		err("failed to write to %s: %s", d->path,
+		    res < 0 ? strerror(-res) : "short write");
+}
+
+/* Give back the buffers written, wait for one when wait is set */
+static void dump_reap(struct sink_dump *d, int wait)
+{
+	struct uring_cqe *cqe;
+
+	if (d->use_uring) {
+		if (wait && d->in_flight && uring_submit(&d->uring, 1) < 0) {
+			err("io_uring wait failed: %m");
+			return;
+		}
+
+		while ((cqe = uring_peek_cqe(&d->uring))) {
+			dump_complete(d, cqe->user_data, cqe->res);
+			uring_cqe_seen(&d->uring);
+		}
+
+		return;
+	}
+
+	pthread_mutex_lock(&d->lock);
+
+	while (wait && d->in_flight && !d->done_count)
+		pthread_cond_wait(&d->cond, &d->lock);
+
+	while (d->done_count) {
+		int n = d->done[d->done_head];
+
+		d->done_head = (d->done_head + 1) % DUMP_MAX_BUFFERS;
+		d->done_count--;
+		dump_complete(d, n, d->buf[n].res);
+	}
+
+	pthread_mutex_unlock(&d->lock);
+}
+
+static int dump_submit(struct sink_dump *d, int n)
+{
+	struct dump_buf *b = &d->buf[n];
+
+	if (d->use_uring)
+		return uring_writev(&d->uring, d->fd, &b->iov, 1, b->offset, n);
+
+	pthread_mutex_lock(&d->lock);
+	d->queue[(d->queue_head + d->queue_count) % DUMP_MAX_BUFFERS] = n;
+	d->queue_count++;
+	pthread_cond_broadcast(&d->cond);
+	pthread_mutex_unlock(&d->lock);
+
+	return 0;
+}
+
+/* The file header, DUMP_BLOCK bytes for O_DIRECT, it only points to the
+ * index once it is written */
+static int dump_write_header(struct sink_dump *d, int closed)
+{
+	struct dump_file_header *hdr;
+	int ret;
+
+	if (posix_memalign((void **)&hdr, DUMP_BLOCK, DUMP_BLOCK))
+		return -1;
+
+	memset(hdr, 0, DUMP_BLOCK);
+	hdr->magic = DUMP_MAGIC;
+	hdr->version = DUMP_VERSION;
+	hdr->block_size = DUMP_BLOCK;
+	hdr->frames = d->n_index;
+
+	if (closed) {
+		hdr->index_offset = d->offset;
+		hdr->index_size = d->n_index * sizeof (*d->index);
+	}
+
+	ret = dump_pwrite(d->fd, hdr, DUMP_BLOCK, 0) == DUMP_BLOCK ? 0 : -1;
+
+	free(hdr);
+
+	return ret;
+}
+
+static int dump_parse(struct sink_dump *d, const char *arg)
+{
+	char *opt;
+
+	d->path = strdup(arg);
+	if (!d->path)
+		return -1;
+
+	/* options are taken off the end of the path */
+	while ((opt = strrchr(d->path, ':'))) {
+		if (!strcmp(opt, ":direct")) {
+			d->direct = 1;
+		} else if (!strcmp(opt, ":resume")) {
+			d->resume = 1;
+		} else if (!strncmp(opt, ":buffers=", 9)) {
+			d->n_bufs = atoi(opt + 9);
+			if (d->n_bufs < 2 || d->n_bufs > DUMP_MAX_BUFFERS) {
+				err("dump sink: 2 to %d buffers",
+				    DUMP_MAX_BUFFERS);
+				return -1;
+			}
+		} else {
+			break;
+		}
+
+		*opt = '\0';
+	}
+
+	return 0;
+}
+
+static int dump_index_add(struct sink_dump *d,
+			  const struct dump_frame_info *info, uint64_t offset)
+{
+	struct dump_index_entry *e;
+
+	if (d->n_index == d->index_alloc) {
+		size_t alloc = d->index_alloc ? 2 * d->index_alloc : 1024;
+
+		e = realloc(d->index, alloc * sizeof (*e));
+		if (!e)
+			return -1;
+
+		d->index = e;
+		d->index_alloc = alloc;
+	}
+
+	e = &d->index[d->n_index++];
+	e->offset = offset;
+	e->info = *info;
+
+	return 0;
+}
+
+/* Index of what the file holds already, up to the last frame intact */
+static int dump_recover(struct sink_dump *d)
+{
+	struct dump_file_header hdr;
+	struct dump_frame_header fh;
+	uint8_t *buf = NULL;
+	size_t buf_size = 0;
+	uint64_t off;
+	struct stat st;
+	int fd, ret = -1;
+
+	fd = open(d->path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return errno == ENOENT ? 0 : -1;
+
+	if (fstat(fd, &st) < 0)
+		goto out;
+
+	if (st.st_size < DUMP_BLOCK) {
+		ret = 0;
+		goto out;
+	}
+
+	if (pread(fd, &hdr, sizeof (hdr), 0) != sizeof (hdr) ||
+	    hdr.magic != DUMP_MAGIC || hdr.version != DUMP_VERSION ||
+	    hdr.block_size != DUMP_BLOCK) {
+		err("%s is not a frame archive of version %d", d->path,
+		    DUMP_VERSION);
+		goto out;
+	}
+
+	/* closed properly, the index is there */
+	if (hdr.index_offset &&
+	    hdr.index_offset + hdr.index_size <= (uint64_t)st.st_size &&
+	    hdr.index_size == hdr.frames * sizeof (*d->index)) {
+		d->index = malloc(hdr.index_size ?: 1);
+		if (!d->index ||
+		    pread(fd, d->index, hdr.index_size, hdr.index_offset) !=
+		    (ssize_t)hdr.index_size)
+			goto out;
+
+		d->n_index = d->index_alloc = hdr.frames;
+		d->offset = hdr.index_offset;
+		ret = 0;
+		goto out;
+	}
+
+	for (off = DUMP_BLOCK; off + DUMP_BLOCK <= (uint64_t)st.st_size;
+	     off += fh.record_size) {
+		if (pread(fd, &fh, sizeof (fh), off) != sizeof (fh) ||
+		    fh.magic != DUMP_FRAME_MAGIC ||
+		    fh.header_size != DUMP_BLOCK ||
+		    fh.record_size != DUMP_BLOCK + DUMP_ALIGN(fh.info.size) ||
+		    off + fh.record_size > (uint64_t)st.st_size)
+			break;
+
+		if (fh.info.size > buf_size) {
+			free(buf);
+			buf = malloc(fh.info.size);
+			buf_size = buf ? fh.info.size : 0;
+			if (!buf)
+				goto out;
+		}
+
+		if (pread(fd, buf, fh.info.size, off + DUMP_BLOCK) !=
+		    fh.info.size ||
+		    dump_check(buf, fh.info.size) != fh.info.check)
+			break;
+
+		if (dump_index_add(d, &fh.info, off))
+			goto out;
+	}
+
+	d->offset = off;
+	ret = 0;
+
+out:
+	if (!ret && d->n_index) {
+		d->resume_seq = d->index[d->n_index - 1].info.seq + 1;
+		info("%s: %zu frames kept, resuming after frame %llu",
+		     d->path, d->n_index,
+		     (unsigned long long)d->resume_seq - 1);
+	}
+
+	free(buf);
+	close(fd);
+	return ret;
+}
+
+static void dump_close(struct sink *s);
+
+static int dump_open(struct sink *s, const char *arg)
+{
+	struct sink_dump *d;
+	int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+	if (!arg || !*arg) {
+		err("dump sink needs a path, "
+		    "dump:<path>[:direct][:buffers=<n>][:resume]");
+		return -1;
+	}
+
+	d = calloc(1, sizeof (*d));
+	if (!d)
+		return -1;
+
+	d->fd = -1;
+	d->uring.fd = -1;
+	d->n_bufs = DUMP_BUFFERS;
+	pthread_mutex_init(&d->lock, NULL);
+	pthread_cond_init(&d->cond, NULL);
+	s->priv = d;
+
+	if (dump_parse(d, arg))
+		goto fail;
+
+	d->offset = DUMP_BLOCK;
+
+	if (d->resume) {
+		flags &= ~O_TRUNC;
+		if (dump_recover(d)) {
+			err("cannot resume %s", d->path);
+			goto fail;
+		}
+	}
+
+	d->fd = open(d->path, flags | (d->direct ? O_DIRECT : 0), 0644);
+	if (d->fd < 0 && d->direct && errno == EINVAL) {
+		/* e.g. tmpfs */
+		info("%s does not support O_DIRECT", d->path);
+		d->direct = 0;
+		d->fd = open(d->path, flags, 0644);
+	}
+
+	if (d->fd < 0) {
+		err("failed to create %s: %m", d->path);
+		goto fail;
+	}
+
+	/* the header stops pointing to an index about to be overwritten,
+	 * and whatever was partially written goes */
+	if (dump_write_header(d, 0) || ftruncate(d->fd, d->offset) < 0) {
+		err("failed to write to %s: %m", d->path);
+		goto fail;
+	}
+
+	if (!uring_init(&d->uring, d->n_bufs)) {
+		d->use_uring = 1;
+	} else if (errno == ENOSYS || errno == EPERM) {
+		dbg("no io_uring, writing from a thread");
+		if (pthread_create(&d->thread, NULL, dump_thread, d)) {
+			err("failed to start the dump writer");
+			goto fail;
+		}
+		d->started = 1;
+	} else {
+		err("failed to set up io_uring: %m");
+		goto fail;
+	}
+
+	info("dumping frames to %s through %s%s, %d buffers", d->path,
+	     d->use_uring ? "io_uring" : "a writer thread",
+	     d->direct ? " with O_DIRECT" : "", d->n_bufs);
+
+	return 0;
+
+fail:
+	dump_close(s);
+	return -1;
+}
+
+static int dump_consume(struct sink *s, struct sink_frame *f)
+{
+	struct sink_dump *d = s->priv;
+	size_t size = sink_frame_size(f);
+	size_t record = DUMP_BLOCK + DUMP_ALIGN(size);
+	struct dump_frame_header *hdr;
+	struct dump_buf *b = NULL;
+	uint32_t plane_offset = 0;
+	int n;
+
+	if (d->failed)
+		return -1;
+
+	if (f->seq < d->resume_seq) {
+		d->skipped++;
+		return 0;
+	}
+
+	dump_reap(d, 0);
+
+	for (n = 0; n < d->n_bufs && !b; n++) {
+		if (!d->buf[n].busy)
+			b = &d->buf[n];
+	}
+
+	if (!b) {
+		d->pool_full++;
+		return -1;
+	}
+
+	n = b - d->buf;
+
+	if (b->alloc < record) {
+		free(b->data);
+		b->alloc = 0;
+		if (posix_memalign((void **)&b->data, DUMP_BLOCK, record)) {
+			b->data = NULL;
+			return -1;
+		}
+		b->alloc = record;
+	}
+
+	hdr = (struct dump_frame_header *)b->data;
+	memset(hdr, 0, DUMP_BLOCK);
+	hdr->magic = DUMP_FRAME_MAGIC;
+	hdr->header_size = DUMP_BLOCK;
+	hdr->record_size = record;
+	hdr->info.seq = f->seq;
+	hdr->info.pts = f->pts;
+	hdr->info.fourcc = f->fourcc;
+	hdr->info.width = f->width;
+	hdr->info.height = f->height;
+	hdr->info.n_planes = f->n_planes;
+	for (int p = 0; p < f->n_planes; p++) {
+		hdr->info.plane_offset[p] = plane_offset;
+		hdr->info.plane_width[p] = f->plane[p].width;
+		hdr->info.plane_height[p] = f->plane[p].height;
+		plane_offset += f->plane[p].width * f->plane[p].height;
+	}
+	hdr->info.crop_left = f->crop.left;
+	hdr->info.crop_top = f->crop.top;
+	hdr->info.crop_width = f->crop.width;
+	hdr->info.crop_height = f->crop.height;
+	hdr->info.size = size;
+
+	sink_frame_copy(f, b->data + DUMP_BLOCK);
+	memset(b->data + DUMP_BLOCK + size, 0, record - DUMP_BLOCK - size);
+	hdr->info.check = dump_check(b->data + DUMP_BLOCK, size);
+
+	if (dump_index_add(d, &hdr->info, d->offset))
+		return -1;
+
+	b->iov.iov_base = b->data;
+	b->iov.iov_len = record;
+	b->offset = d->offset;
+	b->entry = d->n_index - 1;
+	b->busy = 1;
+
+	if (dump_submit(d, n)) {
+		err("failed to queue write to %s: %m", d->path);
+		b->busy = 0;
+		d->n_index--;
+		d->failed++;
+		return -1;
+	}
+
+	d->offset += record;
+	d->in_flight++;
+	d->in_flight_max = MAX(d->in_flight_max, d->in_flight);
+
+	return 0;
+}
+
+static int dump_prepare(struct sink *s)
+{
+	dump_reap(s->priv, 0);
+
+	return 0;
+}
+
+/* Buffered and unaligned from here on */
+static void dump_finish(struct sink_dump *d)
+{
+	size_t size, n = 0;
+	int flags;
+
+	for (size_t k = 0; k < d->n_index; k++) {
+		if (d->index[k].offset != DUMP_TORN)
+			d->index[n++] = d->index[k];
+	}
+
+	d->n_index = n;
+	size = d->n_index * sizeof (*d->index);
+
+	if (d->direct) {
+		flags = fcntl(d->fd, F_GETFL);
+		fcntl(d->fd, F_SETFL, flags & ~O_DIRECT);
+	}
+
+	if (dump_pwrite(d->fd, d->index, size, d->offset) != (ssize_t)size ||
+	    dump_write_header(d, 1)) {
+		err("failed to write the index of %s: %m", d->path);
+		return;
+	}
+
+	info("%s: %zu frames, %llu MB, up to %d writes in flight, "
+	     "%llu frames dropped with every buffer busy, %llu already there",
+	     d->path, d->n_index, (unsigned long long)(d->offset >> 20),
+	     d->in_flight_max, (unsigned long long)d->pool_full,
+	     (unsigned long long)d->skipped);
+}
+
+static void dump_close(struct sink *s)
+{
+	struct sink_dump *d = s->priv;
+
+	while (d->in_flight && (d->use_uring || d->started))
+		dump_reap(d, 1);
+
+	if (d->started) {
+		pthread_mutex_lock(&d->lock);
+		d->stop = 1;
+		pthread_cond_broadcast(&d->cond);
+		pthread_mutex_unlock(&d->lock);
+		pthread_join(d->thread, NULL);
+	}
+
+	if (d->use_uring)
+		uring_exit(&d->uring);
+
+	if (d->fd >= 0) {
+		if (d->use_uring || d->started)
+			dump_finish(d);
+		close(d->fd);
+	}
+
+	for (int n = 0; n < DUMP_MAX_BUFFERS; n++)
+		free(d->buf[n].data);
+
+	pthread_mutex_destroy(&d->lock);
+	pthread_cond_destroy(&d->cond);
+	free(d->index);
+	free(d->path);
+	free(d);
+}
+
+const struct sink_ops sink_dump_ops = {
+	.name = "dump",
+	.open = dump_open,
+	.close = dump_close,
+	.consume = dump_consume,
+	.prepare = dump_prepare,
+};
@@ -0,0 +1,127 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * File sink, raw frames appended to one file
+ *
+ * The visible lines of each plane are written one after the other, so
+ * NV12 output plays with e.g.
+ *
+ *	ffplay -f rawvideo -pixel_format nv12 -video_size <w>x<h> <file>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "sink.h"
+
+#define DBG_TAG "  file"
+
+struct sink_file {
+	int fd;
+	char *path;
+	uint8_t *buf;		/* frame with the stride padding removed */
+	size_t buf_size;
+	int failed;
+};
+
+static int file_open(struct sink *s, const char *arg)
+{
+	struct sink_file *f;
+
+	if (!arg || !*arg) {
+		err("file sink needs a path, file:<path>");
+		return -1;
+	}
+
+	f = calloc(1, sizeof (*f));
+	if (!f)
+		return -1;
+
+	f->fd = open(arg, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (f->fd < 0) {
+		err("failed to create %s: %m", arg);
+		free(f);
+		return -1;
+	}
+
+	f->path = strdup(arg);
+	s->priv = f;
+
+	return 0;
+}
+
+static void file_close(struct sink *s)
+{
+	struct sink_file *f = s->priv;
+
+	close(f->fd);
+	free(f->path);
+	free(f->buf);
+	free(f);
+}
+
+static int file_write(int fd, const uint8_t *data, size_t size)
+{
+	while (size) {
+		ssize_t ret = write(fd, data, size);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -1;
+
+		data += ret;
+		size -= ret;
+	}
+
+	return 0;
+}
+
+static int file_consume(struct sink *s, struct sink_frame *frame)
+{
+	struct sink_file *f = s->priv;
+	size_t size = sink_frame_size(frame);
+
+	if (size > f->buf_size) {
+		free(f->buf);
+		f->buf = malloc(size);
+		f->buf_size = f->buf ? size : 0;
+		if (!f->buf)
+			return -1;
+	}
+
+	sink_frame_copy(frame, f->buf);
+
+	if (file_write(f->fd, f->buf, size)) {
+		/* most likely the disk is full, say it once */
+		if (!f->failed++)
+			err("failed to write to %s: %m", f->path);
+		return -1;
+	}
+
+	return 0;
+}
+
+const struct sink_ops sink_file_ops = {
+	.name = "file",
+	.open = file_open,
+	.close = file_close,
+	.consume = file_consume,
+};
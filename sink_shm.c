@@ -0,0 +1,471 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Shared memory frame ring, see sink_shm.h for the layout
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <linux/memfd.h>
+
+#include "common.h"
+#include "sink.h"
+#include "sink_shm.h"
+
+#define DBG_TAG "   shm"
+
+#define SHM_ALIGN(x)	(((x) + 4095) & ~(size_t)4095)
+
+/* glibc before 2.27 has neither memfd_create() nor the seals */
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS	1033
+#define F_SEAL_SEAL	0x0001
+#define F_SEAL_SHRINK	0x0002
+#define F_SEAL_GROW	0x0004
+#endif
+
+struct shm_client {
+	int sock;		/* -1 when unused */
+	int event_fd;
+};
+
+struct sink_shm {
+	char *path;
+	int listen_fd;
+	int epoll_fd;
+	unsigned int slots;
+
+	/* current ring */
+	int fd;
+	struct sink_shm_header *hdr;
+	size_t size;
+
+	struct shm_client client[SINK_SHM_CLIENTS];
+	int n_clients;
+};
+
+static struct sink_shm_slot *shm_slot(struct sink_shm *shm, unsigned int n)
+{
+	return (struct sink_shm_slot *)((uint8_t *)shm->hdr +
+		shm->hdr->data_offset + (size_t)n * shm->hdr->slot_size);
+}
+
+static void shm_client_drop(struct sink_shm *shm, struct shm_client *c)
+{
+	epoll_ctl(shm->epoll_fd, EPOLL_CTL_DEL, c->sock, NULL);
+	close(c->sock);
+	close(c->event_fd);
+	c->sock = -1;
+	c->event_fd = -1;
+	shm->n_clients--;
+
+	dbg("%s: reader left, %d connected", shm->path, shm->n_clients);
+}
+
+/* The hello is small, it never blocks on a fresh or live connection */
+static int shm_client_hello(struct sink_shm *shm, struct shm_client *c)
+{
+	struct sink_shm_hello hello = {
+		.magic = SINK_SHM_MAGIC,
+		.version = SINK_SHM_VERSION,
+		.size = shm->size,
+	};
+	char control[CMSG_SPACE(2 * sizeof (int))];
+	struct iovec iov = {
+		.iov_base = &hello,
+		.iov_len = sizeof (hello),
+	};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control,
+		.msg_controllen = sizeof (control),
+	};
+	struct cmsghdr *cmsg;
+	int fds[2] = { shm->fd, c->event_fd };
+
+	memzero(control);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof (fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof (fds));
+
+	if (sendmsg(c->sock, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) !=
+	    sizeof (hello)) {
+		dbg("%s: failed to send ring to reader: %m", shm->path);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void shm_accept(struct sink_shm *shm)
+{
+	struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP };
+	struct shm_client *c = NULL;
+	int sock;
+
+	sock = accept4(shm->listen_fd, NULL, NULL,
+		       SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (sock < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			err("%s: accept failed: %m", shm->path);
+		return;
+	}
+
+	for (int n = 0; n < SINK_SHM_CLIENTS && !c; n++) {
+		if (shm->client[n].sock < 0)
+			c = &shm->client[n];
+	}
+
+	if (!c) {
+		err("%s: too many readers", shm->path);
+		close(sock);
+		return;
+	}
+
+	c->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (c->event_fd < 0) {
+		err("%s: failed to create eventfd: %m", shm->path);
+		close(sock);
+		return;
+	}
+
+	c->sock = sock;
+	ev.data.ptr = c;
+	shm->n_clients++;
+
+	if (epoll_ctl(shm->epoll_fd, EPOLL_CTL_ADD, sock, &ev) < 0) {
+		shm_client_drop(shm, c);
+		return;
+	}
+
+	/* before the first frame the ring follows with it */
+	if (shm->hdr && shm_client_hello(shm, c))
+		shm_client_drop(shm, c);
+	else
+		dbg("%s: reader joined, %d connected", shm->path,
+		    shm->n_clients);
+}
+
+static void shm_ring_close(struct sink_shm *shm)
+{
+	if (!shm->hdr)
+		return;
+
+	atomic_store_explicit(&shm->hdr->state, SINK_SHM_RETIRED,
+			      memory_order_release);
+	munmap(shm->hdr, shm->size);
+	close(shm->fd);
+	shm->hdr = NULL;
+	shm->fd = -1;
+}
+
+/* A new sealed memfd with slots of at least frame_size bytes of data */
+static int shm_ring_open(struct sink_shm *shm, size_t frame_size)
+{
+	struct sink_shm_header *hdr;
+	size_t slot_size, size;
+	int fd;
+
+	slot_size = SHM_ALIGN(sizeof (struct sink_shm_slot) + frame_size);
+	size = SHM_ALIGN(sizeof (*hdr)) + slot_size * shm->slots;
+
+	fd = syscall(SYS_memfd_create, "v4l2dec-frames",
+		     MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0) {
+		err("%s: failed to create memfd: %m", shm->path);
+		return -1;
+	}
+
+	/* readers can rely on the size, no SIGBUS under their feet */
+	if (ftruncate(fd, size) < 0 ||
+	    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+		  F_SEAL_SEAL) < 0) {
+		err("%s: failed to size ring to %zu bytes: %m", shm->path,
+		    size);
+		close(fd);
+		return -1;
+	}
+
+	hdr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (hdr == MAP_FAILED) {
+		err("%s: failed to map ring: %m", shm->path);
+		close(fd);
+		return -1;
+	}
+
+	/* a new memfd is zeroed, every slot sequence starts at 0 */
+	hdr->version = SINK_SHM_VERSION;
+	hdr->pid = getpid();
+	hdr->slots = shm->slots;
+	hdr->slot_size = slot_size;
+	hdr->data_offset = SHM_ALIGN(sizeof (*hdr));
+	atomic_store(&hdr->state, SINK_SHM_LIVE);
+	atomic_thread_fence(memory_order_release);
+	hdr->magic = SINK_SHM_MAGIC;
+
+	shm->fd = fd;
+	shm->hdr = hdr;
+	shm->size = size;
+
+	dbg("%s: %u slots of %zu bytes", shm->path, shm->slots, slot_size);
+
+	return 0;
+}
+
+/* Readers of the old ring find it retired and wait for the new one */
+static int shm_ring_replace(struct sink_shm *shm, size_t frame_size)
+{
+	shm_ring_close(shm);
+
+	if (shm_ring_open(shm, frame_size))
+		return -1;
+
+	for (int n = 0; n < SINK_SHM_CLIENTS; n++) {
+		struct shm_client *c = &shm->client[n];
+
+		if (c->sock >= 0 && shm_client_hello(shm, c))
+			shm_client_drop(shm, c);
+	}
+
+	return 0;
+}
+
+static int shm_listen(struct sink_shm *shm, const char *path)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+	struct sockaddr_un addr;
+
+	if (strlen(path) >= sizeof (addr.sun_path)) {
+		err("shm sink socket path too long");
+		return -1;
+	}
+
+	shm->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK |
+				SOCK_CLOEXEC, 0);
+	if (shm->listen_fd < 0) {
+		err("failed to create socket: %m");
+		return -1;
+	}
+
+	memzero(addr);
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	unlink(path);
+
+	if (bind(shm->listen_fd, (struct sockaddr *)&addr,
+		 sizeof (addr)) < 0 ||
+	    listen(shm->listen_fd, SINK_SHM_CLIENTS) < 0) {
+		err("failed to listen on %s: %m", path);
+		return -1;
+	}
+
+	shm->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (shm->epoll_fd < 0) {
+		err("failed to create epoll: %m");
+		return -1;
+	}
+
+	ev.data.ptr = NULL;
+	if (epoll_ctl(shm->epoll_fd, EPOLL_CTL_ADD, shm->listen_fd, &ev) < 0)
+		return -1;
+
+	return 0;
+}
+
+static void shm_sink_close(struct sink *s)
+{
+	struct sink_shm *shm = s->priv;
+
+	for (int n = 0; n < SINK_SHM_CLIENTS; n++) {
+		if (shm->client[n].sock >= 0)
+			shm_client_drop(shm, &shm->client[n]);
+	}
+
+	shm_ring_close(shm);
+
+	if (shm->epoll_fd >= 0)
+		close(shm->epoll_fd);
+
+	if (shm->listen_fd >= 0) {
+		close(shm->listen_fd);
+		unlink(shm->path);
+	}
+
+	free(shm->path);
+	free(shm);
+}
+
+static int shm_sink_open(struct sink *s, const char *arg)
+{
+	struct sink_shm *shm;
+	const char *colon;
+	char *end;
+
+	if (!arg || !arg[0]) {
+		err("shm sink needs a socket path, shm:<path>[:<slots>]");
+		return -1;
+	}
+
+	shm = calloc(1, sizeof (*shm));
+	if (!shm)
+		return -1;
+
+	shm->fd = -1;
+	shm->listen_fd = -1;
+	shm->epoll_fd = -1;
+	shm->slots = SINK_SHM_SLOTS;
+	for (int n = 0; n < SINK_SHM_CLIENTS; n++) {
+		shm->client[n].sock = -1;
+		shm->client[n].event_fd = -1;
+	}
+
+	s->priv = shm;
+
+	colon = strrchr(arg, ':');
+	if (colon && colon[1]) {
+		unsigned long slots = strtoul(colon + 1, &end, 10);
+
+		if (!*end) {
+			if (slots < 2 || slots > SINK_SHM_MAX_SLOTS) {
+				err("shm sink: 2 to %d slots",
+				    SINK_SHM_MAX_SLOTS);
+				goto fail;
+			}
+
+			shm->slots = slots;
+			shm->path = strndup(arg, colon - arg);
+		}
+	}
+
+	if (!shm->path)
+		shm->path = strdup(arg);
+
+	if (!shm->path || shm_listen(shm, shm->path))
+		goto fail;
+
+	info("frames published on %s, %u slots", shm->path, shm->slots);
+
+	return 0;
+
+fail:
+	shm_sink_close(s);
+	return -1;
+}
+
+static int shm_sink_consume(struct sink *s, struct sink_frame *f)
+{
+	struct sink_shm *shm = s->priv;
+	size_t size = sink_frame_size(f);
+	struct sink_shm_slot *slot;
+	unsigned long long head;
+	unsigned int seq;
+
+	if ((!shm->hdr || sizeof (*slot) + size > shm->hdr->slot_size) &&
+	    shm_ring_replace(shm, size))
+		return -1;
+
+	head = atomic_load_explicit(&shm->hdr->head, memory_order_relaxed);
+	slot = shm_slot(shm, head % shm->slots);
+
+	seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+	atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	slot->frame.seq = f->seq;
+	slot->frame.pts = f->pts;
+	slot->frame.fourcc = f->fourcc;
+	slot->frame.width = f->width;
+	slot->frame.height = f->height;
+	slot->frame.n_planes = f->n_planes;
+	for (int p = 0; p < f->n_planes; p++) {
+		slot->frame.plane_width[p] = f->plane[p].width;
+		slot->frame.plane_height[p] = f->plane[p].height;
+	}
+	slot->frame.size = size;
+
+	sink_frame_copy(f, slot + 1);
+
+	slot->frame.published_us = metrics_now_us();
+	atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+	atomic_store_explicit(&shm->hdr->head, head + 1, memory_order_release);
+
+	/* a reader that does not read its eventfd only saturates it */
+	for (int n = 0; n < SINK_SHM_CLIENTS && shm->n_clients; n++) {
+		uint64_t one = 1;
+
+		if (shm->client[n].event_fd >= 0 &&
+		    write(shm->client[n].event_fd, &one, sizeof (one)) < 0 &&
+		    errno != EAGAIN)
+			shm_client_drop(shm, &shm->client[n]);
+	}
+
+	return 0;
+}
+
+static int shm_sink_get_fd(struct sink *s)
+{
+	struct sink_shm *shm = s->priv;
+
+	return shm->epoll_fd;
+}
+
+/* New readers, or readers gone */
+static int shm_sink_dispatch(struct sink *s, short revents)
+{
+	struct sink_shm *shm = s->priv;
+	struct epoll_event ev[SINK_SHM_CLIENTS + 1];
+	int n;
+
+	n = epoll_wait(shm->epoll_fd, ev, ARRAY_LENGTH(ev), 0);
+
+	for (int k = 0; k < n; k++) {
+		struct shm_client *c = ev[k].data.ptr;
+
+		if (!c) {
+			shm_accept(shm);
+			continue;
+		}
+
+		/* readers never write, anything is a hangup */
+		if (c->sock >= 0)
+			shm_client_drop(shm, c);
+	}
+
+	return 0;
+}
+
+const struct sink_ops sink_shm_ops = {
+	.name = "shm",
+	.open = shm_sink_open,
+	.close = shm_sink_close,
+	.consume = shm_sink_consume,
+	.get_fd = shm_sink_get_fd,
+	.dispatch = shm_sink_dispatch,
+};
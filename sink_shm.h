@@ -0,0 +1,105 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Shared memory frame ring header file
+ *
+ * shm:<path>[:<slots>] publishes the last <slots> (default
+ * SINK_SHM_SLOTS) frames in a sealed memfd, handed to the readers that
+ * connect to the Unix socket <path>.  Every connection gets a struct
+ * sink_shm_hello with two file descriptors (SCM_RIGHTS): the memfd and
+ * an eventfd signalled once per published frame.
+ *
+ * The memfd holds a header followed by the slots, each one a struct
+ * sink_shm_slot and the frame, planes packed one after the other.  The
+ * writer never waits for readers, it overwrites the oldest slot; readers
+ * use the slot sequence lock to detect frames overwritten while they
+ * were reading them:
+ *
+ *	do {
+ *		seq = load_acquire(&slot->seq);
+ *		read slot->frame and the data;
+ *		fence_acquire();
+ *	} while ((seq & 1) || seq != load(&slot->seq));
+ *
+ * Frame n (counting from 0) is in slot n % slots, head is the number of
+ * frames published.  A reader further than slots frames behind lost the
+ * frames in between.
+ *
+ * When the frames get larger than the slots the ring is replaced: state
+ * of the old one becomes SINK_SHM_RETIRED and every reader gets a new
+ * hello on its connection.  client/frame_ring.h does all of that.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef INCLUDE_SINK_SHM_H
+#define INCLUDE_SINK_SHM_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define SINK_SHM_MAGIC		0x4d52464c	/* "LFRM" */
+#define SINK_SHM_VERSION	2
+
+#define SINK_SHM_SLOTS		8
+#define SINK_SHM_MAX_SLOTS	64
+
+/* Readers connected at once */
+#define SINK_SHM_CLIENTS	16
+
+enum sink_shm_state {
+	SINK_SHM_LIVE,
+	SINK_SHM_RETIRED,	/* a new ring follows on the socket */
+};
+
+/* Sent on the socket with the memfd and the eventfd */
+struct sink_shm_hello {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t size;			/* of the memfd */
+};
+
+struct sink_shm_frame {
+	uint64_t seq;			/* frame number */
+	uint64_t pts;
+	uint64_t published_us;		/* CLOCK_MONOTONIC */
+	uint32_t fourcc;
+	uint32_t width;
+	uint32_t height;
+	uint32_t n_planes;
+	uint32_t plane_width[2];	/* bytes of a line */
+	uint32_t plane_height[2];
+	uint32_t size;
+	uint32_t reserved;
+};
+
+struct sink_shm_slot {
+	atomic_uint seq;		/* odd while being written */
+	uint32_t reserved;
+	struct sink_shm_frame frame;
+};
+
+struct sink_shm_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t pid;
+	uint32_t slots;
+	uint32_t slot_size;		/* struct sink_shm_slot and data */
+	uint32_t data_offset;		/* of the first slot */
+	atomic_uint state;		/* enum sink_shm_state */
+	uint32_t reserved;
+	atomic_ullong head;		/* frames published */
+};
+
+#endif /* INCLUDE_SINK_SHM_H */
@@ -0,0 +1,195 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Frame sink checking the frames against a reference list (verify.h)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "sink.h"
+#include "verify.h"
+
+#define DBG_TAG "verify"
+
+struct sink_verify {
+	struct verify_list ref;
+	char *path;
+
+	uint64_t checked;
+	uint64_t differ;
+	uint64_t unknown;	/* not in the reference */
+	uint64_t unchecked;	/* not linear, e.g. UBWC without rotator */
+	uint64_t first_bad;
+};
+
+static int verify_open(struct sink *s, const char *arg)
+{
+	struct sink_verify *v;
+
+	if (!arg || !*arg) {
+		err("verify sink needs a reference list, verify:<path>");
+		return -1;
+	}
+
+	v = calloc(1, sizeof (*v));
+	if (!v)
+		return -1;
+
+	if (verify_list_load(&v->ref, arg)) {
+		free(v);
+		return -1;
+	}
+
+	v->path = strdup(arg);
+	s->priv = v;
+
+	info("verifying frames against %s, %zu frames", arg, v->ref.n);
+
+	return 0;
+}
+
+static void verify_close(struct sink *s)
+{
+	struct sink_verify *v = s->priv;
+	uint64_t missing = v->ref.n > v->checked ? v->ref.n - v->checked : 0;
+
+	if (v->differ)
+		err("%s: %" PRIu64 " of %" PRIu64 " frames differ, first "
+		    "frame %" PRIu64, v->path, v->differ, v->checked,
+		    v->first_bad);
+	else
+		info("%s: %" PRIu64 " frames match", v->path, v->checked);
+
+	if (v->unchecked)
+		err("%s: %" PRIu64 " frames not linear, not checked", v->path,
+		    v->unchecked);
+
+	if (missing || v->unknown)
+		err("%s: %" PRIu64 " reference frames not decoded, %" PRIu64
+		    " frames not in the reference", v->path, missing,
+		    v->unknown);
+
+	if (v->differ || missing || v->unknown || v->unchecked)
+		s->i->verify_failed = 1;
+
+	verify_list_free(&v->ref);
+	free(v->path);
+	free(v);
+}
+
+static const struct verify_frame *verify_find(struct sink_verify *v,
+					      uint64_t seq)
+{
+	size_t lo = 0, hi = v->ref.n;
+
+	/* lists are written in frame order, usually a direct hit */
+	if (seq < v->ref.n && v->ref.frames[seq].seq == seq)
+		return &v->ref.frames[seq];
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (v->ref.frames[mid].seq < seq)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo < v->ref.n && v->ref.frames[lo].seq == seq ?
+		&v->ref.frames[lo] : NULL;
+}
+
+static int verify_consume(struct sink *s, struct sink_frame *f)
+{
+	struct sink_verify *v = s->priv;
+	const struct verify_frame *ref;
+	struct verify_frame got;
+	const uint8_t *y, *uv;
+	int left, top;
+
+	ref = verify_find(v, f->seq);
+	if (!ref) {
+		v->unknown++;
+		return 0;
+	}
+
+	/* UBWC frames are not detiled, see ubwc.h */
+	if (f->fourcc != V4L2_PIX_FMT_NV12 &&
+	    f->fourcc != V4L2_PIX_FMT_GREY) {
+		if (!v->unchecked++)
+			err("cannot verify %.4s frames", (char *)&f->fourcc);
+		return -1;
+	}
+
+	left = f->crop.left & ~1;
+	top = f->crop.top & ~1;
+
+	got.seq = f->seq;
+	got.width = f->crop.width;
+	got.height = f->crop.height;
+
+	y = (const uint8_t *)f->plane[0].addr +
+		(size_t)top * f->plane[0].stride + left;
+	got.plane[0] = verify_plane_hash(y, f->plane[0].stride,
+					 got.width, got.height);
+
+	got.plane[1] = 0;
+	if (f->n_planes > 1) {
+		uv = (const uint8_t *)f->plane[1].addr +
+			(size_t)top / 2 * f->plane[1].stride + left;
+		got.plane[1] = verify_plane_hash(uv, f->plane[1].stride,
+						 (got.width + 1) & ~1,
+						 (got.height + 1) / 2);
+	}
+
+	v->checked++;
+
+	if (got.width == ref->width && got.height == ref->height &&
+	    got.plane[0] == ref->plane[0] &&
+	    (f->fourcc == V4L2_PIX_FMT_GREY || got.plane[1] == ref->plane[1]))
+		return 0;
+
+	if (!v->differ++) {
+		v->first_bad = f->seq;
+
+		if (got.width != ref->width || got.height != ref->height)
+			err("frame %" PRIu64 ": %dx%d, reference %dx%d",
+			    f->seq, got.width, got.height,
+			    ref->width, ref->height);
+		else
+			err("frame %" PRIu64 ": %s differs, %016" PRIx64
+			    " instead of %016" PRIx64, f->seq,
+			    got.plane[0] != ref->plane[0] ? "Y" : "UV",
+			    got.plane[0] != ref->plane[0] ?
+			    got.plane[0] : got.plane[1],
+			    got.plane[0] != ref->plane[0] ?
+			    ref->plane[0] : ref->plane[1]);
+	} else {
+		dbg("frame %" PRIu64 " differs", f->seq);
+	}
+
+	return 0;
+}
+
+const struct sink_ops sink_verify_ops = {
+	.name = "verify",
+	.open = verify_open,
+	.close = verify_close,
+	.consume = verify_consume,
+};
@@ -0,0 +1,812 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Wayland sink, frames shown in a window through linux-dmabuf
+ *
+ * The wl_buffer of a producer buffer is created when the producer
+ * announces its buffers or the first time it is shown.  They are kept
+ * by group, in an array by buffer index; the group of older buffers
+ * goes once the compositor released the last of them.  Frames are kept
+ * until the compositor releases their buffer.
+ *
+ * wayland:mailbox commits a frame only once the compositor drew the
+ * previous one.  Until then the newest frame waits, the one it replaces
+ * is given back at once, so the producer never waits for the compositor.
+ *
+ * wayland:mosaic shows the sinks of every session of the process in one
+ * window, each in a pane of its own (see display.h): the display is
+ * shared and read by a thread of its own, each sink dispatches the
+ * events of its pane on its session thread.  Options are separated by
+ * colons, wayland:mosaic:mailbox.
+ *
+ * The UBWC buffers of the decoder are shown as they are, as NV12 with
+ * the Qualcomm compressed modifier, when the compositor advertises it:
+ * the rotator is then only opened for sinks needing linear frames.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/input.h>
+
+#include "common.h"
+#include "display.h"
+#include "sink.h"
+#include "ubwc.h"
+
+#define DBG_TAG "    wl"
+
+/* Buffers the compositor may hold: on screen, pending and the new one */
+#define WAYLAND_MAX_HELD		3
+
+#define WAYLAND_FOURCC(a, b, c, d)	((uint32_t)(a) | ((uint32_t)(b) << 8) | \
+				 ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+#define WAYLAND_NV12			WAYLAND_FOURCC('N', 'V', '1', '2')
+
+/* One producer buffer and the frame it holds while shown */
+struct wayland_slot {
+	struct sink *sink;
+	struct wayland_group *group;
+	struct fb *fb;
+	struct sink_frame *frame;
+	uint64_t decoded;	/* of the frame last shown */
+	size_t bytes;		/* of the dmabuf the wl_buffer keeps */
+};
+
+/* The slots of one group of producer buffers, by buffer index */
+struct wayland_group {
+	int group;
+	struct wayland_slot *slot[MAX_CAP_BUF];
+	int n_slots;
+	size_t bytes;
+	struct list_head link;
+};
+
+struct sink_wayland {
+	struct display *display;
+	struct window *window;
+	struct wayland_group *cur;
+	struct list_head stale;		/* older groups, until released */
+	int n_stale;
+	size_t stale_bytes;
+	size_t stale_peak;
+	struct wayland_slot *shown;		/* last one given to the window */
+	struct wayland_slot *pending;		/* mailbox, next to commit */
+	int mailbox;
+	int mosaic;
+	int warned;
+	struct window_stats reported;	/* what metrics have already */
+};
+
+static void wayland_frame(struct window *window);
+
+/* The window the wayland:mosaic sinks are panes of */
+static struct {
+	pthread_mutex_t lock;
+	int refs;
+	struct display *display;
+	struct window *window;
+} wayland_mosaic = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void wayland_key(struct window *window, uint32_t time, uint32_t key,
+		   enum wl_keyboard_key_state state)
+{
+	struct sink *s = window_get_user_data(window);
+	struct instance *i = s->i;
+
+	if (state != WL_KEYBOARD_KEY_STATE_PRESSED)
+		return;
+
+	switch (key) {
+	case KEY_ESC:
+		i->finish = 1;
+		break;
+	case KEY_F:
+		window_toggle_fullscreen(window);
+		break;
+	}
+}
+
+/* Keys go to the window, not its panes: the sessions end together */
+static void wayland_mosaic_key(struct window *window, uint32_t time,
+			       uint32_t key, enum wl_keyboard_key_state state)
+{
+	if (state != WL_KEYBOARD_KEY_STATE_PRESSED)
+		return;
+
+	switch (key) {
+	case KEY_ESC:
+		display_exit(wayland_mosaic.display);
+		break;
+	case KEY_F:
+		window_toggle_fullscreen(window);
+		break;
+	}
+}
+
+static struct window *wayland_mosaic_get(struct instance *i)
+{
+	struct window *window = NULL;
+
+	pthread_mutex_lock(&wayland_mosaic.lock);
+
+	if (wayland_mosaic.refs) {
+		wayland_mosaic.refs++;
+		window = wayland_mosaic.window;
+		goto out;
+	}
+
+	wayland_mosaic.display = display_create();
+	if (!wayland_mosaic.display)
+		goto out;
+
+	wayland_mosaic.window = display_create_window(wayland_mosaic.display);
+	if (!wayland_mosaic.window)
+		goto fail;
+
+	window_set_key_callback(wayland_mosaic.window, wayland_mosaic_key);
+	if (i->fullscreen)
+		window_toggle_fullscreen(wayland_mosaic.window);
+
+	if (display_start_thread(wayland_mosaic.display)) {
+		window_destroy(wayland_mosaic.window);
+		goto fail;
+	}
+
+	wayland_mosaic.refs = 1;
+	window = wayland_mosaic.window;
+	goto out;
+
+fail:
+	display_destroy(wayland_mosaic.display);
+	wayland_mosaic.display = NULL;
+out:
+	pthread_mutex_unlock(&wayland_mosaic.lock);
+
+	return window;
+}
+
+static void wayland_mosaic_put(void)
+{
+	pthread_mutex_lock(&wayland_mosaic.lock);
+
+	if (!--wayland_mosaic.refs) {
+		window_destroy(wayland_mosaic.window);
+		display_destroy(wayland_mosaic.display);
+		wayland_mosaic.window = NULL;
+		wayland_mosaic.display = NULL;
+	}
+
+	pthread_mutex_unlock(&wayland_mosaic.lock);
+}
+
+static int wayland_parse(struct sink_wayland *wl, const char *arg)
+{
+	char *copy, *opt, *save;
+	int ret = 0;
+
+	if (!arg)
+		return 0;
+
+	copy = strdup(arg);
+	if (!copy)
+		return -1;
+
+	for (opt = strtok_r(copy, ":", &save); opt && !ret;
+	     opt = strtok_r(NULL, ":", &save)) {
+		if (!strcmp(opt, "mailbox")) {
+			wl->mailbox = 1;
+		} else if (!strcmp(opt, "mosaic")) {
+			wl->mosaic = 1;
+		} else {
+			err("invalid wayland sink option %s, mailbox or mosaic",
+			    opt);
+			ret = -1;
+		}
+	}
+
+	free(copy);
+
+	return ret;
+}
+
+/* The frame may have been put already, the slot is there until its fb
+ * goes, which drops the feedback */
+static void wayland_presented(struct window *window, struct fb *fb,
+			      const struct fb_presentation *p)
+{
+	struct sink *s = window_get_user_data(window);
+	struct instance *i = s->i;
+	struct wayland_slot *slot = fb->cb_data;
+
+	if (!p->presented) {
+		metrics_inc(&i->metrics, frames_discarded, 1);
+		return;
+	}
+
+	metrics_frame_presented(&i->metrics, slot ? slot->decoded : 0,
+				p->time_us, p->refresh_ns, p->msc);
+}
+
+static int wayland_open(struct sink *s, const char *arg)
+{
+	struct instance *i = s->i;
+	struct sink_wayland *wl;
+
+	wl = calloc(1, sizeof (*wl));
+	if (!wl)
+		return -1;
+
+	if (wayland_parse(wl, arg)) {
+		free(wl);
+		return -1;
+	}
+
+	INIT_LIST_HEAD(&wl->stale);
+	s->priv = wl;
+	/* mailbox: a new frame comes in before it replaces the waiting one */
+	s->max_held = WAYLAND_MAX_HELD + wl->mailbox;
+
+	if (wl->mosaic) {
+		struct window *parent = wayland_mosaic_get(i);
+
+		if (!parent) {
+			free(wl);
+			return -1;
+		}
+
+		wl->display = wayland_mosaic.display;
+		wl->window = window_create_pane(parent);
+		if (!wl->window) {
+			wayland_mosaic_put();
+			free(wl);
+			return -1;
+		}
+	} else {
+		wl->display = display_create();
+		if (!wl->display)
+			goto fail;
+
+		wl->window = display_create_window(wl->display);
+		if (!wl->window)
+			goto fail;
+	}
+
+	window_set_user_data(wl->window, s);
+	window_set_key_callback(wl->window, wayland_key);
+	window_set_present_callback(wl->window, wayland_presented);
+	if (wl->mailbox)
+		window_set_frame_callback(wl->window, wayland_frame);
+
+	if (i->avctx && i->stream) {
+		AVRational ar = av_guess_sample_aspect_ratio(i->avctx,
+							     i->stream, NULL);
+
+		window_set_aspect_ratio(wl->window, ar.num, ar.den);
+	}
+
+	if (i->fullscreen && !wl->mosaic)
+		window_toggle_fullscreen(wl->window);
+
+	return 0;
+
+fail:
+	if (wl->display)
+		display_destroy(wl->display);
+	free(wl);
+	return -1;
+}
+
+static void wayland_group_free(struct sink_wayland *wl,
+			       struct wayland_group *g)
+{
+	if (g != wl->cur) {
+		list_del(&g->link);
+		wl->n_stale--;
+		dbg("buffers of group %d released, %d older groups left",
+		    g->group, wl->n_stale);
+	}
+
+	free(g);
+}
+
+/* An older group goes with its last slot */
+static void wayland_slot_free(struct sink_wayland *wl,
+			      struct wayland_slot *slot)
+{
+	struct wayland_group *g = slot->group;
+
+	g->slot[slot->fb->index] = NULL;
+	g->n_slots--;
+	g->bytes -= slot->bytes;
+	if (g != wl->cur)
+		wl->stale_bytes -= slot->bytes;
+
+	fb_destroy(slot->fb);
+	free(slot);
+
+	if (g != wl->cur && !g->n_slots)
+		wayland_group_free(wl, g);
+}
+
+static void wayland_close(struct sink *s)
+{
+	struct sink_wayland *wl = s->priv;
+	struct wayland_group *g, *next;
+
+	/* each older group goes with its last slot */
+	list_for_each_entry_safe(g, next, &wl->stale, link) {
+		for (int n = 0, left = g->n_slots; left; n++) {
+			if (g->slot[n]) {
+				left--;
+				wayland_slot_free(wl, g->slot[n]);
+			}
+		}
+	}
+
+	if (wl->cur) {
+		for (int n = 0; n < MAX_CAP_BUF; n++) {
+			if (wl->cur->slot[n])
+				wayland_slot_free(wl, wl->cur->slot[n]);
+		}
+		wayland_group_free(wl, wl->cur);
+	}
+
+	if (wl->stale_peak)
+		info("older buffer groups held up to %zu KiB",
+		     wl->stale_peak >> 10);
+
+	window_destroy(wl->window);
+	if (wl->mosaic)
+		wayland_mosaic_put();
+	else
+		display_destroy(wl->display);
+	free(wl);
+}
+
+static void wayland_released(struct fb *fb, void *data)
+{
+	struct wayland_slot *slot = data;
+	struct sink *s = slot->sink;
+	struct sink_wayland *wl = s->priv;
+	struct sink_frame *f = slot->frame;
+
+	slot->frame = NULL;
+
+	if (slot->group != wl->cur && slot != wl->shown &&
+	    slot != wl->pending)
+		wayland_slot_free(wl, slot);
+
+	if (f)
+		sink_put(s, f);
+}
+
+/* The producer buffers changed, drop the wl_buffers not on screen */
+static void wayland_sweep(struct sink *s)
+{
+	struct sink_wayland *wl = s->priv;
+	struct wayland_group *g, *next;
+
+	list_for_each_entry_safe(g, next, &wl->stale, link) {
+		/* g is gone with its last slot */
+		for (int n = 0, left = g->n_slots; left; n++) {
+			struct wayland_slot *slot = g->slot[n];
+
+			if (!slot)
+				continue;
+			left--;
+
+			if (slot->fb->busy || slot == wl->shown ||
+			    slot == wl->pending)
+				continue;
+
+			/* given to the window but never attached */
+			if (slot->frame)
+				sink_put(s, slot->frame);
+
+			wayland_slot_free(wl, slot);
+		}
+	}
+}
+
+/*
+ * The group of the frame: the current one, a newer one which then
+ * becomes current, or an older one still held by the compositor.
+ */
+static struct wayland_group *wayland_get_group(struct sink *s, int group)
+{
+	struct sink_wayland *wl = s->priv;
+	struct wayland_group *g, *old = wl->cur;
+
+	if (old && group == old->group)
+		return old;
+
+	if (old && group < old->group) {
+		list_for_each_entry(g, &wl->stale, link) {
+			if (g->group == group)
+				return g;
+		}
+		dbg("frame of released group %d", group);
+		return NULL;
+	}
+
+	g = calloc(1, sizeof (*g));
+	if (!g)
+		return NULL;
+
+	g->group = group;
+	INIT_LIST_HEAD(&g->link);
+	wl->cur = g;
+
+	if (!old)
+		return g;
+
+	if (!old->n_slots) {
+		free(old);
+		return g;
+	}
+
+	list_add_tail(&old->link, &wl->stale);
+	wl->n_stale++;
+	wl->stale_bytes += old->bytes;
+	wl->stale_peak = MAX(wl->stale_peak, wl->stale_bytes);
+
+	return g;
+}
+
+/* All planes have to be in one dmabuf */
+static int wayland_can_show(const struct sink_frame *f)
+{
+	for (int p = 0; p < f->n_planes; p++) {
+		if (f->plane[p].fd < 0 || f->plane[p].fd != f->plane[0].fd)
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * The opaque plane of a UBWC frame as the two planes of NV12: each one
+ * starts with its metadata, Y metadata and Y then UV metadata and UV,
+ * where the display driver looks for them
+ */
+static int wayland_ubwc_planes(struct sink *s, const struct sink_frame *f,
+			       int *offsets, int *strides)
+{
+	struct ubwc_layout l;
+
+	/* the frame has no scanlines, the decoder buffers of its group
+	 * are the current ones */
+	ubwc_layout_nv12(&l, f->width, f->height);
+	if (ubwc_layout_match(&l, f->plane[0].stride,
+			      s->i->video.cap_scanlines, f->plane[0].width))
+		return -1;
+
+	offsets[0] = f->plane[0].offset + l.y_meta_off;
+	strides[0] = l.y_stride;
+	offsets[1] = f->plane[0].offset + l.uv_meta_off;
+	strides[1] = l.uv_stride;
+
+	return 0;
+}
+
+/* The wl_buffer is asked for, not waited for */
+static struct wayland_slot *wayland_new_slot(struct sink *s,
+					     struct wayland_group *g,
+					     const struct sink_frame *f)
+{
+	struct sink_wayland *wl = s->priv;
+	struct wayland_slot *slot;
+	int offsets[SINK_MAX_PLANES], strides[SINK_MAX_PLANES];
+	uint32_t format = f->fourcc;
+	uint64_t modifier = DRM_FORMAT_MOD_LINEAR;
+	int n_planes = f->n_planes;
+
+	slot = calloc(1, sizeof (*slot));
+	if (!slot)
+		return NULL;
+
+	for (int p = 0; p < f->n_planes; p++) {
+		offsets[p] = f->plane[p].offset;
+		strides[p] = f->plane[p].stride;
+		slot->bytes = MAX(slot->bytes, f->plane[p].offset +
+				  (size_t)f->plane[p].stride *
+				  f->plane[p].height);
+	}
+
+	if (format == V4L2_PIX_FMT_GREY) {
+		format = WAYLAND_FOURCC('R', '8', ' ', ' ');
+	} else if (format == V4L2_PIX_FMT_NV12_UBWC) {
+		if (wayland_ubwc_planes(s, f, offsets, strides)) {
+			free(slot);
+			return NULL;
+		}
+
+		format = WAYLAND_NV12;
+		modifier = DRM_FORMAT_MOD_QCOM_COMPRESSED;
+		n_planes = 2;
+		slot->bytes = f->plane[0].offset + (size_t)f->plane[0].width;
+	}
+
+	slot->sink = s;
+	slot->group = g;
+
+	slot->fb = window_create_buffer(wl->window, f->group, f->index,
+					f->plane[0].fd, format, modifier,
+					f->width, f->height, n_planes,
+					offsets, strides);
+	if (!slot->fb) {
+		free(slot);
+		return NULL;
+	}
+
+	/* the decoder buffer is aligned, only the crop is shown */
+	if (modifier == DRM_FORMAT_MOD_QCOM_COMPRESSED && f->crop.width &&
+	    f->crop.height) {
+		slot->fb->crop_x = f->crop.left;
+		slot->fb->crop_y = f->crop.top;
+		slot->fb->crop_w = f->crop.width;
+		slot->fb->crop_h = f->crop.height;
+	}
+
+	g->slot[f->index] = slot;
+	g->n_slots++;
+	g->bytes += slot->bytes;
+	if (g != wl->cur)
+		wl->stale_bytes += slot->bytes;
+
+	return slot;
+}
+
+static struct wayland_slot *wayland_get_slot(struct sink *s,
+					     struct sink_frame *f)
+{
+	struct sink_wayland *wl = s->priv;
+	struct wayland_group *g;
+	struct wayland_slot *slot;
+
+	if (f->index < 0 || f->index >= MAX_CAP_BUF)
+		return NULL;
+
+	g = wayland_get_group(s, f->group);
+	if (!g)
+		return NULL;
+
+	slot = g->slot[f->index];
+	if (!slot)
+		slot = wayland_new_slot(s, g, f);
+	if (!slot)
+		return NULL;
+
+	/*
+	 * Only without create_immed and when the frame came before the
+	 * reply: one roundtrip gets every wl_buffer asked for so far.
+	 */
+	if (!slot->fb->buffer)
+		window_roundtrip(wl->window);
+
+	if (!slot->fb->buffer) {
+		wayland_slot_free(wl, slot);
+		return NULL;
+	}
+
+	return slot;
+}
+
+/* The wl_buffers of a new group are asked for at once, the replies are
+ * dispatched by the main loop before the first frame comes */
+static int wayland_pool(struct sink *s, const struct sink_frame *f, int n)
+{
+	struct sink_wayland *wl = s->priv;
+	struct wayland_group *g;
+	int ret = 0;
+
+	if (!n)
+		return 0;
+
+	g = wayland_get_group(s, f[0].group);
+	if (!g)
+		return -1;
+
+	for (int k = 0; k < n; k++) {
+		if (f[k].index < 0 || f[k].index >= MAX_CAP_BUF ||
+		    g->slot[f[k].index] || !wayland_can_show(&f[k]))
+			continue;
+
+		if (!wayland_new_slot(s, g, &f[k]))
+			ret = -1;
+	}
+
+	wayland_sweep(s);
+
+	if (wl->n_stale)
+		dbg("%d older groups hold %zu KiB until released",
+		    wl->n_stale, wl->stale_bytes >> 10);
+
+	if (wl_display_flush(display_get_wl_display(wl->display)) < 0 &&
+	    errno != EAGAIN)
+		ret = -1;
+
+	return ret;
+}
+
+static void wayland_show(struct sink *s, struct wayland_slot *slot)
+{
+	struct sink_wayland *wl = s->priv;
+	struct wayland_slot *prev = wl->shown;
+
+	struct window_stats st;
+
+	wl->shown = slot;
+	window_show_buffer(wl->window, slot->fb, wayland_released, slot);
+
+	window_get_stats(wl->window, &st);
+	metrics_inc(&s->i->metrics, display_commits,
+		    st.commits - wl->reported.commits);
+	metrics_inc(&s->i->metrics, display_requests,
+		    st.requests - wl->reported.requests);
+	wl->reported = st;
+
+	/* the window was not configured yet, the previous frame never
+	 * reached the compositor which will not release it */
+	if (prev && prev != slot && !prev->fb->busy && prev->frame) {
+		struct sink_frame *old = prev->frame;
+
+		prev->frame = NULL;
+		sink_put(s, old);
+	}
+
+	wayland_sweep(s);
+}
+
+/* Mailbox: the last commit was drawn, the waiting frame goes next */
+static void wayland_frame(struct window *window)
+{
+	struct sink *s = window_get_user_data(window);
+	struct sink_wayland *wl = s->priv;
+	struct wayland_slot *slot = wl->pending;
+
+	if (!slot)
+		return;
+
+	wl->pending = NULL;
+	wayland_show(s, slot);
+}
+
+static int wayland_consume(struct sink *s, struct sink_frame *f)
+{
+	struct sink_wayland *wl = s->priv;
+	struct wayland_slot *slot;
+
+	if (!wayland_can_show(f)) {
+		if (!wl->warned++)
+			err("wayland sink needs frames in one dmabuf");
+		return -1;
+	}
+
+	slot = wayland_get_slot(s, f);
+	if (!slot)
+		return -1;
+
+	/* the producer does not reuse a buffer before it is put */
+	if (slot->frame) {
+		err("wayland sink: buffer %d shown twice", f->index);
+		return -1;
+	}
+
+	slot->frame = f;
+	slot->decoded = f->decoded;
+
+	if (!wl->mailbox || !window_frame_pending(wl->window)) {
+		wayland_show(s, slot);
+		return 1;
+	}
+
+	/* never committed, its buffer goes back to the producer now */
+	if (wl->pending) {
+		struct sink_frame *old = wl->pending->frame;
+
+		wl->pending->frame = NULL;
+		s->stats.replaced++;
+		sink_put(s, old);
+	}
+
+	wl->pending = slot;
+	wayland_sweep(s);
+
+	return 1;
+}
+
+static int wayland_prepare(struct sink *s)
+{
+	struct sink_wayland *wl = s->priv;
+	struct wl_display *display = display_get_wl_display(wl->display);
+
+	if (!display_is_running(wl->display))
+		return -1;
+
+	/* a pane only dispatches its own queue, the display thread reads */
+	if (wl->mosaic) {
+		if (window_dispatch(wl->window) < 0) {
+			err("wayland connection failed: %m");
+			return -1;
+		}
+		return 0;
+	}
+
+	if (wl_display_dispatch_pending(display) < 0 ||
+	    (wl_display_flush(display) < 0 && errno != EAGAIN)) {
+		err("wayland connection failed: %m");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int wayland_get_fd(struct sink *s)
+{
+	struct sink_wayland *wl = s->priv;
+
+	if (wl->mosaic)
+		return window_get_fd(wl->window);
+
+	return wl_display_get_fd(display_get_wl_display(wl->display));
+}
+
+static int wayland_dispatch(struct sink *s, short revents)
+{
+	struct sink_wayland *wl = s->priv;
+
+	if (wl->mosaic ? window_dispatch(wl->window) < 0 :
+	    wl_display_dispatch(display_get_wl_display(wl->display)) < 0) {
+		err("wayland connection failed: %m");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Linear frames need the display format, UBWC ones the modifier */
+static int wayland_accepts(struct sink *s, uint32_t fourcc)
+{
+	struct sink_wayland *wl = s->priv;
+
+	switch (fourcc) {
+	case V4L2_PIX_FMT_NV12_UBWC:
+		return display_supports(wl->display, WAYLAND_NV12,
+					DRM_FORMAT_MOD_QCOM_COMPRESSED);
+	case V4L2_PIX_FMT_NV12:
+		return display_supports(wl->display, WAYLAND_NV12,
+					DRM_FORMAT_MOD_LINEAR);
+	default:
+		return 0;
+	}
+}
+
+const struct sink_ops sink_wayland_ops = {
+	.name = "wayland",
+	.open = wayland_open,
+	.close = wayland_close,
+	.consume = wayland_consume,
+	.pool = wayland_pool,
+	.prepare = wayland_prepare,
+	.get_fd = wayland_get_fd,
+	.dispatch = wayland_dispatch,
+	.accepts = wayland_accepts,
+};
@@ -0,0 +1,216 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Input stream
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <linux/videodev2.h>
+#include <media/msm_vidc.h>
+
+#include "common.h"
+#include "stream.h"
+
+#define DBG_TAG "stream"
+
+#define av_err(errnum, fmt, ...) \
+	err(fmt ": %s", ##__VA_ARGS__, av_err2str(errnum))
+
+void stream_close(struct instance *i)
+{
+	i->stream = NULL;
+	if (i->bsf)
+		av_bsf_free(&i->bsf);
+	if (i->avctx)
+		avformat_close_input(&i->avctx);
+}
+
+static int get_av_log_level(void)
+{
+	if (debug_level >= 5)
+		return AV_LOG_TRACE;
+	if (debug_level >= 4)
+		return AV_LOG_DEBUG;
+	if (debug_level >= 3)
+		return AV_LOG_VERBOSE;
+	if (debug_level >= 2)
+		return AV_LOG_INFO;
+	if (debug_level >= 1)
+		return AV_LOG_ERROR;
+	return AV_LOG_QUIET;
+}
+
+int stream_open(struct instance *i)
+{
+	const AVBitStreamFilter *filter;
+	AVCodecParameters *codecpar;
+	AVRational framerate;
+	int codec;
+	int ret;
+
+	av_log_set_level(get_av_log_level());
+
+	av_register_all();
+	avformat_network_init();
+
+	ret = avformat_open_input(&i->avctx, i->url, NULL, NULL);
+	if (ret < 0) {
+		av_err(ret, "failed to open %s", i->url);
+		goto fail;
+	}
+
+	ret = avformat_find_stream_info(i->avctx, NULL);
+	if (ret < 0) {
+		av_err(ret, "failed to get streams info");
+		goto fail;
+	}
+
+	av_dump_format(i->avctx, -1, i->url, 0);
+
+	ret = av_find_best_stream(i->avctx, AVMEDIA_TYPE_VIDEO, -1, -1,
+				  NULL, 0);
+	if (ret < 0) {
+		av_err(ret, "stream does not seem to contain video");
+		goto fail;
+	}
+
+	i->stream = i->avctx->streams[ret];
+	codecpar = i->stream->codecpar;
+
+	i->width = codecpar->width ?: 1928;
+	i->height = codecpar->height ?: 1208;
+	i->need_header = 1;
+
+	framerate = av_stream_get_r_frame_rate(i->stream);
+	i->fps_n = framerate.num;
+	i->fps_d = framerate.den;
+
+	filter = NULL;
+
+	switch (codecpar->codec_id) {
+	case AV_CODEC_ID_H263:
+		codec = V4L2_PIX_FMT_H263;
+		break;
+	case AV_CODEC_ID_H264:
+		codec = V4L2_PIX_FMT_H264;
+		filter = av_bsf_get_by_name("h264_mp4toannexb");
+		break;
+	case AV_CODEC_ID_HEVC:
+		codec = V4L2_PIX_FMT_HEVC;
+		filter = av_bsf_get_by_name("hevc_mp4toannexb");
+		break;
+	case AV_CODEC_ID_MPEG2VIDEO:
+		codec = V4L2_PIX_FMT_MPEG2;
+		break;
+	case AV_CODEC_ID_MPEG4:
+		codec = V4L2_PIX_FMT_MPEG4;
+		break;
+	case AV_CODEC_ID_MSMPEG4V3:
+		codec = V4L2_PIX_FMT_DIVX_311;
+		break;
+	case AV_CODEC_ID_WMV3:
+		codec = V4L2_PIX_FMT_VC1_ANNEX_G;
+		break;
+	case AV_CODEC_ID_VC1:
+		codec = V4L2_PIX_FMT_VC1_ANNEX_G;
+		break;
+	case AV_CODEC_ID_VP8:
+		codec = V4L2_PIX_FMT_VP8;
+		break;
+	case AV_CODEC_ID_VP9:
+		codec = V4L2_PIX_FMT_VP9;
+		break;
+	default:
+		err("cannot decode %s", avcodec_get_name(codecpar->codec_id));
+		goto fail;
+	}
+
+	i->fourcc = codec;
+
+	if (filter) {
+		ret = av_bsf_alloc(filter, &i->bsf);
+		if (ret < 0) {
+			av_err(ret, "cannot allocate bistream filter");
+			goto fail;
+		}
+
+		avcodec_parameters_copy(i->bsf->par_in, codecpar);
+		i->bsf->time_base_in = i->stream->time_base;
+
+		ret = av_bsf_init(i->bsf);
+		if (ret < 0) {
+			av_err(ret, "failed to initialize bitstream filter");
+			goto fail;
+		}
+	}
+
+	return 0;
+
+fail:
+	stream_close(i);
+	return -1;
+}
+
+static int read_packet(struct instance *i, AVPacket *pkt)
+{
+	int ret;
+
+	if (!i->bsf_data_pending) {
+		ret = av_read_frame(i->avctx, pkt);
+		if (ret < 0)
+			return ret;
+
+		if (pkt->stream_index != i->stream->index) {
+			av_packet_unref(pkt);
+			return AVERROR(EAGAIN);
+		}
+
+		if (i->bsf) {
+			ret = av_bsf_send_packet(i->bsf, pkt);
+			if (ret < 0)
+				return ret;
+
+			i->bsf_data_pending = 1;
+		}
+	}
+
+	if (i->bsf) {
+		ret = av_bsf_receive_packet(i->bsf, pkt);
+		if (ret == AVERROR(EAGAIN))
+			i->bsf_data_pending = 0;
+
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+int stream_read(struct instance *i, AVPacket *pkt)
+{
+	int ret;
+
+	/* access units left out by --decimate never reach the decoder */
+	for (;;) {
+		ret = read_packet(i, pkt);
+		if (ret < 0 ||
+		    decimate_keep(&i->decimate, i->stream->codecpar->codec_id,
+				  pkt->data, pkt->size))
+			return ret;
+
+		metrics_inc(&i->metrics, frames_skipped, 1);
+		av_packet_unref(pkt);
+	}
+}
@@ -0,0 +1,38 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Input stream header file
+ *
+ * The url is demuxed with libavformat; the best video stream is read,
+ * as Annex B for H.264 and HEVC, and its access units left out by
+ * --decimate are skipped.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef INCLUDE_STREAM_H
+#define INCLUDE_STREAM_H
+
+#include <libavcodec/avcodec.h>
+
+struct instance;
+
+/* Sets i->fourcc, the size and the frame rate from i->url */
+int stream_open(struct instance *i);
+void stream_close(struct instance *i);
+
+/* Next packet to decode, AVERROR(EAGAIN) for one of another stream */
+int stream_read(struct instance *i, AVPacket *pkt);
+
+#endif /* INCLUDE_STREAM_H */
@@ -13,13 +13,14 @@ struct ts_entry {
 	uint64_t dts;
 	uint64_t duration;
 	uint64_t base;
+	uint64_t submitted;	/* monotonic time the packet was queued, us */
 	struct list_head link;
 };
 
 
 #define TIMESTAMP_NONE	((uint64_t)-1)
 
-static struct ts_entry *
+static inline struct ts_entry *
 ts_insert(struct video *vid, uint64_t pts, uint64_t dts, uint64_t duration,
 	  uint64_t base)
 {
@@ -33,13 +34,14 @@ ts_insert(struct video *vid, uint64_t pts, uint64_t dts, uint64_t duration,
 	l->dts = dts;
 	l->duration = duration;
 	l->base = base;
+	l->submitted = metrics_now_us();
 
 	list_add_tail(&l->link, &vid->pending_ts_list);
 
 	return l;
 }
 
-static void
+static inline void
 ts_remove(struct ts_entry *l)
 {
 	list_del(&l->link);
@@ -0,0 +1,403 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * CPU UBWC to linear NV12 conversion
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define UBWC_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define UBWC_SSE2
+#endif
+
+#include "common.h"
+#include "ubwc.h"
+
+#define DBG_TAG "  ubwc"
+
+#define ALIGN(x, a)		(((x) + (a) - 1) / (a) * (a))
+#define DIV_ROUND_UP(x, d)	(((x) + (d) - 1) / (d))
+
+/* One frame being converted, split in macrotile rows: the Y rows come
+ * first, then the UV rows */
+struct ubwc_job {
+	const struct ubwc_layout *l;
+	const uint8_t *src;
+	int width;
+	int height;
+	uint8_t *dst;
+	int dst_stride;
+	int dst_scanlines;
+	int y_rows;
+	int rows;
+	atomic_int next;
+};
+
+struct ubwc {
+	int nthreads;
+	pthread_t thread[UBWC_MAX_THREADS];
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_cond_t done_cond;
+	unsigned int generation;
+	int busy;
+	int stop;
+
+	struct ubwc_job *job;
+};
+
+void ubwc_layout_nv12(struct ubwc_layout *l, int width, int height)
+{
+	memset(l, 0, sizeof (*l));
+
+	l->width = width;
+	l->height = height;
+
+	l->y_stride = ALIGN(width, 128);
+	l->y_scanlines = ALIGN(height, 32);
+	l->uv_stride = ALIGN(width, 128);
+	l->uv_scanlines = ALIGN((height + 1) >> 1, 32);
+
+	l->y_meta_stride = ALIGN(DIV_ROUND_UP(width, 32), 64);
+	l->y_meta_scanlines = ALIGN(DIV_ROUND_UP(height, 8), 16);
+	l->uv_meta_stride = ALIGN(DIV_ROUND_UP((width + 1) >> 1, 16), 64);
+	l->uv_meta_scanlines = ALIGN(DIV_ROUND_UP((height + 1) >> 1, 8), 16);
+
+	l->y_meta_off = 0;
+	l->y_off = l->y_meta_off +
+		ALIGN((size_t)l->y_meta_stride * l->y_meta_scanlines, 4096);
+	l->uv_meta_off = l->y_off +
+		ALIGN((size_t)l->y_stride * l->y_scanlines, 4096);
+	l->uv_off = l->uv_meta_off +
+		ALIGN((size_t)l->uv_meta_stride * l->uv_meta_scanlines, 4096);
+	l->size = l->uv_off +
+		ALIGN((size_t)l->uv_stride * l->uv_scanlines, 4096);
+}
+
+int ubwc_layout_match(const struct ubwc_layout *l, int y_stride,
+		      int y_scanlines, size_t size)
+{
+	if (y_stride == l->y_stride && y_scanlines == l->y_scanlines &&
+	    size >= l->size)
+		return 0;
+
+	err("ubwc: decoder Y plane %dx%d in %zu bytes, the %dx%d layout "
+	    "has %dx%d in %zu bytes", y_stride, y_scanlines, size, l->width,
+	    l->height, l->y_stride, l->y_scanlines, l->size);
+
+	return -1;
+}
+
+/* Copy one line of four tiles, src points to the line in the first tile */
+static inline void
+ubwc_copy_line(uint8_t *dst, const uint8_t *src)
+{
+#if defined(UBWC_NEON)
+	for (int t = 0; t < 4; t++) {
+		const uint8_t *s = src + t * UBWC_TILE_W * UBWC_TILE_H;
+
+		vst1q_u8(dst + t * UBWC_TILE_W, vld1q_u8(s));
+		vst1q_u8(dst + t * UBWC_TILE_W + 16, vld1q_u8(s + 16));
+	}
+#elif defined(UBWC_SSE2)
+	for (int t = 0; t < 4; t++) {
+		const __m128i *s = (const __m128i *)
+			(src + t * UBWC_TILE_W * UBWC_TILE_H);
+		__m128i *d = (__m128i *)(dst + t * UBWC_TILE_W);
+
+		_mm_storeu_si128(d, _mm_loadu_si128(s));
+		_mm_storeu_si128(d + 1, _mm_loadu_si128(s + 1));
+	}
+#else
+	for (int t = 0; t < 4; t++)
+		memcpy(dst + t * UBWC_TILE_W,
+		       src + t * UBWC_TILE_W * UBWC_TILE_H, UBWC_TILE_W);
+#endif
+}
+
+/* Same for the last macrotile of a line, which may be cut by the
+ * width of the destination */
+static void
+ubwc_copy_line_partial(uint8_t *dst, const uint8_t *src, int bytes)
+{
+	for (int t = 0; t < 4 && bytes > 0; t++) {
+		memcpy(dst, src, MIN(bytes, UBWC_TILE_W));
+		dst += UBWC_TILE_W;
+		src += UBWC_TILE_W * UBWC_TILE_H;
+		bytes -= UBWC_TILE_W;
+	}
+}
+
+/* Detile one row of macrotiles, that is 32 lines of a plane */
+static void
+ubwc_convert_row(const uint8_t *plane, int stride, int row,
+		 uint8_t *dst, int dst_stride, int width, int lines)
+{
+	const uint8_t *macro = plane + (size_t)row * UBWC_MACRO_H * stride;
+	int full = width / UBWC_MACRO_W;
+	int rest = width % UBWC_MACRO_W;
+
+	lines = MIN(lines - row * UBWC_MACRO_H, UBWC_MACRO_H);
+
+	for (int y = 0; y < lines; y++) {
+		/* tile row in the macrotile, then line in the tile */
+		const uint8_t *src = macro +
+			(y / UBWC_TILE_H) * 4 * UBWC_TILE_W * UBWC_TILE_H +
+			(y % UBWC_TILE_H) * UBWC_TILE_W;
+		uint8_t *d = dst + (size_t)(row * UBWC_MACRO_H + y) *
+			dst_stride;
+		int x;
+
+		for (x = 0; x < full; x++)
+			ubwc_copy_line(d + x * UBWC_MACRO_W,
+				       src + x * UBWC_MACRO_SIZE);
+
+		if (rest)
+			ubwc_copy_line_partial(d + x * UBWC_MACRO_W,
+					       src + x * UBWC_MACRO_SIZE, rest);
+	}
+}
+
+static void ubwc_run(struct ubwc_job *job)
+{
+	const struct ubwc_layout *l = job->l;
+	int row;
+
+	while ((row = atomic_fetch_add(&job->next, 1)) < job->rows) {
+		if (row < job->y_rows) {
+			ubwc_convert_row(job->src + l->y_off, l->y_stride, row,
+					 job->dst, job->dst_stride,
+					 job->width, job->height);
+		} else {
+			uint8_t *uv = job->dst +
+				(size_t)job->dst_stride * job->dst_scanlines;
+
+			ubwc_convert_row(job->src + l->uv_off, l->uv_stride,
+					 row - job->y_rows, uv,
+					 job->dst_stride,
+					 ((job->width + 1) >> 1) * 2,
+					 (job->height + 1) >> 1);
+		}
+	}
+}
+
+static void *ubwc_thread(void *arg)
+{
+	struct ubwc *u = arg;
+	unsigned int generation = 0;
+
+	pthread_mutex_lock(&u->lock);
+
+	for (;;) {
+		while (!u->stop && u->generation == generation)
+			pthread_cond_wait(&u->cond, &u->lock);
+
+		if (u->stop)
+			break;
+
+		generation = u->generation;
+		pthread_mutex_unlock(&u->lock);
+
+		ubwc_run(u->job);
+
+		pthread_mutex_lock(&u->lock);
+		if (--u->busy == 0)
+			pthread_cond_signal(&u->done_cond);
+	}
+
+	pthread_mutex_unlock(&u->lock);
+
+	return NULL;
+}
+
+struct ubwc *ubwc_new(int threads)
+{
+	struct ubwc *u;
+
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	u = calloc(1, sizeof (*u));
+	if (!u)
+		return NULL;
+
+	pthread_mutex_init(&u->lock, NULL);
+	pthread_cond_init(&u->cond, NULL);
+	pthread_cond_init(&u->done_cond, NULL);
+
+	/* the caller converts too, so one thread less */
+	threads = MAX(MIN(threads, UBWC_MAX_THREADS), 1);
+
+	for (u->nthreads = 0; u->nthreads < threads - 1; u->nthreads++) {
+		if (pthread_create(&u->thread[u->nthreads], NULL, ubwc_thread,
+				   u))
+			break;
+	}
+
+	dbg("%s kernel, %d threads", ubwc_kernel(), u->nthreads + 1);
+
+	return u;
+}
+
+void ubwc_free(struct ubwc *u)
+{
+	if (!u)
+		return;
+
+	pthread_mutex_lock(&u->lock);
+	u->stop = 1;
+	pthread_cond_broadcast(&u->cond);
+	pthread_mutex_unlock(&u->lock);
+
+	for (int n = 0; n < u->nthreads; n++)
+		pthread_join(u->thread[n], NULL);
+
+	pthread_mutex_destroy(&u->lock);
+	pthread_cond_destroy(&u->cond);
+	pthread_cond_destroy(&u->done_cond);
+	free(u);
+}
+
+const char *ubwc_kernel(void)
+{
+#if defined(UBWC_NEON)
+	return "neon";
+#elif defined(UBWC_SSE2)
+	return "sse2";
+#else
+	return "scalar";
+#endif
+}
+
+/* Every tile has a byte in the metadata plane, see ubwc.h for what is
+ * assumed of them */
+static size_t ubwc_meta_count(const uint8_t *meta, size_t size)
+{
+	size_t count = 0;
+
+	for (size_t n = 0; n < size; n++)
+		count += meta[n] != 0;
+
+	return count;
+}
+
+size_t ubwc_meta_tiles(const struct ubwc_layout *l, const void *src)
+{
+	const uint8_t *s = src;
+
+	return ubwc_meta_count(s + l->y_meta_off, (size_t)l->y_meta_stride *
+			       l->y_meta_scanlines) +
+		ubwc_meta_count(s + l->uv_meta_off, (size_t)l->uv_meta_stride *
+				l->uv_meta_scanlines);
+}
+
+int ubwc_to_nv12(struct ubwc *u, const struct ubwc_layout *l,
+		 const void *src, size_t src_size, int width, int height,
+		 uint8_t *dst, int dst_stride, int dst_scanlines)
+{
+	struct ubwc_job job;
+	size_t tiles;
+
+	if (src_size < l->size || width > l->width || height > l->height ||
+	    dst_stride < width || dst_scanlines < height) {
+		err("ubwc: %zu bytes for %dx%d of a %dx%d frame of %zu "
+		    "bytes, destination %dx%d", src_size, width, height,
+		    l->width, l->height, l->size, dst_stride, dst_scanlines);
+		return -1;
+	}
+
+	tiles = ubwc_meta_tiles(l, src);
+	if (tiles) {
+		dbg("ubwc: %zu tiles with metadata, cannot convert", tiles);
+		return -1;
+	}
+
+	job.l = l;
+	job.src = src;
+	job.width = width;
+	job.height = height;
+	job.dst = dst;
+	job.dst_stride = dst_stride;
+	job.dst_scanlines = dst_scanlines;
+	job.y_rows = DIV_ROUND_UP(height, UBWC_MACRO_H);
+	job.rows = job.y_rows +
+		DIV_ROUND_UP((height + 1) >> 1, UBWC_MACRO_H);
+	atomic_init(&job.next, 0);
+
+	pthread_mutex_lock(&u->lock);
+	u->job = &job;
+	u->busy = u->nthreads;
+	u->generation++;
+	pthread_cond_broadcast(&u->cond);
+	pthread_mutex_unlock(&u->lock);
+
+	ubwc_run(&job);
+
+	pthread_mutex_lock(&u->lock);
+	while (u->busy)
+		pthread_cond_wait(&u->done_cond, &u->lock);
+	u->job = NULL;
+	pthread_mutex_unlock(&u->lock);
+
+	return 0;
+}
+
+double ubwc_compare_nv12(const uint8_t *a, const uint8_t *a_uv,
+			 const uint8_t *b, const uint8_t *b_uv,
+			 int width, int height, int stride, int *row)
+{
+	int uv_lines = (height + 1) >> 1;
+	int uv_width = ((width + 1) >> 1) * 2;
+	uint64_t sse = 0, samples = 0;
+
+	*row = -1;
+
+	for (int y = 0; y < height + uv_lines; y++) {
+		const uint8_t *pa = y < height ? a + (size_t)y * stride :
+			a_uv + (size_t)(y - height) * stride;
+		const uint8_t *pb = y < height ? b + (size_t)y * stride :
+			b_uv + (size_t)(y - height) * stride;
+		int w = y < height ? width : uv_width;
+		uint64_t line = 0;
+
+		for (int x = 0; x < w; x++) {
+			int d = pa[x] - pb[x];
+
+			line += d * d;
+		}
+
+		if (line && *row < 0)
+			*row = y;
+
+		sse += line;
+		samples += w;
+	}
+
+	if (!sse)
+		return INFINITY;
+
+	return 10.0 * log10(255.0 * 255.0 * samples / sse);
+}
@@ -0,0 +1,106 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * CPU UBWC to linear NV12 conversion header file
+ *
+ * The decoder writes NV12_UBWC frames as four planes, each 4K aligned:
+ * Y metadata, Y, UV metadata, UV.  The data planes are made of 4K
+ * macrotiles of 128 bytes x 32 lines, each holding 4x4 tiles of 32 bytes
+ * x 8 lines stored one after the other.  For Y a tile is 32x8 pixels,
+ * for UV it is 16x8 interleaved CbCr pairs.  The metadata planes hold
+ * one byte per tile.
+ *
+ * Neither the metadata nor the compressed tile encoding is public.
+ * Tiles are only copied, and only frames whose metadata bytes are all
+ * zero are taken.  That those frames hold their pixels as they are is
+ * an assumption, checked by nothing but --ubwc-verify against the
+ * rotator.  Decoded frames normally have metadata set, so this is a
+ * verifier for frames without any and not a way to read decoded ones:
+ * without a rotator the decoder is asked for linear NV12 instead.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef INCLUDE_UBWC_H
+#define INCLUDE_UBWC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define UBWC_TILE_W		32	/* bytes */
+#define UBWC_TILE_H		8
+#define UBWC_MACRO_W		128	/* bytes, 4 tiles */
+#define UBWC_MACRO_H		32	/* lines, 4 tiles */
+#define UBWC_MACRO_SIZE		4096
+
+/* Most threads used for one frame */
+#define UBWC_MAX_THREADS	8
+
+/* Plane geometry, same formulas as msm_media_info.h */
+struct ubwc_layout {
+	int width;
+	int height;
+
+	int y_stride;
+	int y_scanlines;
+	int uv_stride;
+	int uv_scanlines;
+	int y_meta_stride;
+	int y_meta_scanlines;
+	int uv_meta_stride;
+	int uv_meta_scanlines;
+
+	size_t y_meta_off;
+	size_t y_off;
+	size_t uv_meta_off;
+	size_t uv_off;
+	size_t size;
+};
+
+struct ubwc;
+
+void ubwc_layout_nv12(struct ubwc_layout *l, int width, int height);
+
+/* 0 when the Y plane the decoder reports, y_stride x y_scanlines in a
+ * buffer of size bytes, is where the layout puts it.  The driver does
+ * not give the other planes, so a layout that does not match would
+ * misplace them */
+int ubwc_layout_match(const struct ubwc_layout *l, int y_stride,
+		      int y_scanlines, size_t size);
+
+/* Converter using threads workers, 0 picks one per CPU */
+struct ubwc *ubwc_new(int threads);
+void ubwc_free(struct ubwc *u);
+
+/* Name of the tile copy kernel in use, e.g. "neon" */
+const char *ubwc_kernel(void);
+
+/* Tiles of the frame in src with a nonzero metadata byte */
+size_t ubwc_meta_tiles(const struct ubwc_layout *l, const void *src);
+
+/* Convert the top left width x height part of the frame in src
+ * (l->size bytes) to NV12 with the UV plane at dst + dst_stride *
+ * dst_scanlines.  -1 when any tile has a nonzero metadata byte */
+int ubwc_to_nv12(struct ubwc *u, const struct ubwc_layout *l,
+		 const void *src, size_t src_size, int width, int height,
+		 uint8_t *dst, int dst_stride, int dst_scanlines);
+
+/* PSNR in dB of NV12 frame a against b, INFINITY if identical; the UV
+ * planes may live in buffers of their own.  *row is set to the first
+ * line that differs (UV lines follow the Y lines) */
+double ubwc_compare_nv12(const uint8_t *a, const uint8_t *a_uv,
+			 const uint8_t *b, const uint8_t *b_uv,
+			 int width, int height, int stride, int *row);
+
+#endif /* INCLUDE_UBWC_H */
@@ -0,0 +1,224 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Minimal io_uring
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+/* Same numbers on every architecture */
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup	425
+#define __NR_io_uring_enter	426
+#endif
+
+#define URING_OFF_SQ_RING	0ULL
+#define URING_OFF_CQ_RING	0x8000000ULL
+#define URING_OFF_SQES		0x10000000ULL
+
+#define URING_ENTER_GETEVENTS	(1U << 0)
+
+/* struct io_uring_params */
+struct uring_params {
+	uint32_t sq_entries;
+	uint32_t cq_entries;
+	uint32_t flags;
+	uint32_t sq_thread_cpu;
+	uint32_t sq_thread_idle;
+	uint32_t features;
+	uint32_t resv[4];
+	struct {
+		uint32_t head, tail, ring_mask, ring_entries;
+		uint32_t flags, dropped, array, resv1;
+		uint64_t resv2;
+	} sq_off;
+	struct {
+		uint32_t head, tail, ring_mask, ring_entries;
+		uint32_t overflow, cqes, flags, resv1;
+		uint64_t resv2;
+	} cq_off;
+};
+
+static void *uring_map(int fd, size_t size, uint64_t offset)
+{
+	void *addr;
+
+	addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, fd, offset);
+
+	return addr == MAP_FAILED ? NULL : addr;
+}
+
+int uring_init(struct uring *u, unsigned int entries)
+{
+	struct uring_params p;
+
+	memset(u, 0, sizeof (*u));
+	memset(&p, 0, sizeof (p));
+
+	u->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (u->fd < 0)
+		return -1;
+
+	u->entries = p.sq_entries;
+
+	u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof (unsigned int);
+	u->sq_ring = uring_map(u->fd, u->sq_ring_size, URING_OFF_SQ_RING);
+
+	u->cq_ring_size = p.cq_off.cqes +
+		p.cq_entries * sizeof (struct uring_cqe);
+	u->cq_ring = uring_map(u->fd, u->cq_ring_size, URING_OFF_CQ_RING);
+
+	u->sqes = uring_map(u->fd, p.sq_entries * sizeof (struct uring_sqe),
+			    URING_OFF_SQES);
+
+	if (!u->sq_ring || !u->cq_ring || !u->sqes) {
+		uring_exit(u);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	u->sq_head = (unsigned int *)((uint8_t *)u->sq_ring + p.sq_off.head);
+	u->sq_tail = (unsigned int *)((uint8_t *)u->sq_ring + p.sq_off.tail);
+	u->sq_mask = (unsigned int *)((uint8_t *)u->sq_ring +
+				      p.sq_off.ring_mask);
+	u->sq_array = (unsigned int *)((uint8_t *)u->sq_ring + p.sq_off.array);
+
+	u->cq_head = (unsigned int *)((uint8_t *)u->cq_ring + p.cq_off.head);
+	u->cq_tail = (unsigned int *)((uint8_t *)u->cq_ring + p.cq_off.tail);
+	u->cq_mask = (unsigned int *)((uint8_t *)u->cq_ring +
+				      p.cq_off.ring_mask);
+	u->cqes = (struct uring_cqe *)((uint8_t *)u->cq_ring +
+				       p.cq_off.cqes);
+
+	return 0;
+}
+
+void uring_exit(struct uring *u)
+{
+	if (u->sqes)
+		munmap(u->sqes, u->entries * sizeof (struct uring_sqe));
+	if (u->cq_ring)
+		munmap(u->cq_ring, u->cq_ring_size);
+	if (u->sq_ring)
+		munmap(u->sq_ring, u->sq_ring_size);
+	if (u->fd >= 0)
+		close(u->fd);
+
+	memset(u, 0, sizeof (*u));
+	u->fd = -1;
+}
+
+struct uring_sqe *uring_get_sqe(struct uring *u)
+{
+	unsigned int head, tail;
+	struct uring_sqe *sqe;
+
+	head = atomic_load_explicit((_Atomic unsigned int *)u->sq_head,
+				    memory_order_acquire);
+	tail = *u->sq_tail + u->sq_pending;
+
+	if (tail - head >= u->entries)
+		return NULL;
+
+	sqe = &u->sqes[tail & *u->sq_mask];
+	u->sq_array[tail & *u->sq_mask] = tail & *u->sq_mask;
+	u->sq_pending++;
+
+	memset(sqe, 0, sizeof (*sqe));
+
+	return sqe;
+}
+
+int uring_submit(struct uring *u, unsigned int wait_nr)
+{
+	unsigned int tail = *u->sq_tail;
+	unsigned int head, submit;
+	int ret, err;
+
+	/* the entries have to be visible before the new tail */
+	atomic_store_explicit((_Atomic unsigned int *)u->sq_tail,
+			      tail + u->sq_pending, memory_order_release);
+	u->sq_pending = 0;
+
+	/* what a short submit left behind goes in as well, the kernel only
+	 * takes entries in io_uring_enter() */
+	head = atomic_load_explicit((_Atomic unsigned int *)u->sq_head,
+				    memory_order_acquire);
+	submit = *u->sq_tail - head;
+
+	do {
+		ret = syscall(__NR_io_uring_enter, u->fd, submit, wait_nr,
+			      wait_nr ? URING_ENTER_GETEVENTS : 0, NULL, 0);
+	} while (ret < 0 && errno == EINTR);
+
+	/* nothing was taken: the new entries are withdrawn so they cannot
+	 * go in later behind the caller's back */
+	if (ret < 0) {
+		err = errno;
+		atomic_store_explicit((_Atomic unsigned int *)u->sq_tail,
+				      tail, memory_order_release);
+		errno = err;
+	}
+
+	return ret;
+}
+
+struct uring_cqe *uring_peek_cqe(struct uring *u)
+{
+	unsigned int head = *u->cq_head;
+	unsigned int tail;
+
+	tail = atomic_load_explicit((_Atomic unsigned int *)u->cq_tail,
+				    memory_order_acquire);
+	if (head == tail)
+		return NULL;
+
+	return &u->cqes[head & *u->cq_mask];
+}
+
+void uring_cqe_seen(struct uring *u)
+{
+	atomic_store_explicit((_Atomic unsigned int *)u->cq_head,
+			      *u->cq_head + 1, memory_order_release);
+}
+
+int uring_writev(struct uring *u, int fd, const struct iovec *iov,
+		 int iovcnt, uint64_t offset, uint64_t user_data)
+{
+	struct uring_sqe *sqe = uring_get_sqe(u);
+
+	if (!sqe) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	sqe->opcode = URING_OP_WRITEV;
+	sqe->fd = fd;
+	sqe->off = offset;
+	sqe->addr = (uintptr_t)iov;
+	sqe->len = iovcnt;
+	sqe->user_data = user_data;
+
+	return uring_submit(u, 0) < 0 ? -1 : 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Minimal io_uring header file
+ *
+ * Raw system calls and just the ABI needed to queue writes: the kernel
+ * headers the application is built with predate io_uring (5.1) and
+ * liburing is not available on the target.  uring_init() fails with
+ * ENOSYS on older kernels, callers fall back to something else.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef INCLUDE_URING_H
+#define INCLUDE_URING_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+/* struct io_uring_sqe */
+struct uring_sqe {
+	uint8_t opcode;
+	uint8_t flags;
+	uint16_t ioprio;
+	int32_t fd;
+	uint64_t off;
+	uint64_t addr;
+	uint32_t len;
+	uint32_t rw_flags;
+	uint64_t user_data;
+	uint64_t pad[3];
+};
+
+/* struct io_uring_cqe */
+struct uring_cqe {
+	uint64_t user_data;
+	int32_t res;
+	uint32_t flags;
+};
+
+#define URING_OP_WRITEV		2	/* IORING_OP_WRITEV */
+
+struct uring {
+	int fd;
+	unsigned int entries;
+
+	/* submission queue, shared with the kernel */
+	void *sq_ring;
+	size_t sq_ring_size;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	struct uring_sqe *sqes;
+	unsigned int sq_pending;	/* taken, not submitted yet */
+
+	/* completion queue */
+	void *cq_ring;
+	size_t cq_ring_size;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct uring_cqe *cqes;
+};
+
+int uring_init(struct uring *u, unsigned int entries);
+void uring_exit(struct uring *u);
+
+/* A zeroed submission entry, NULL when the queue is full */
+struct uring_sqe *uring_get_sqe(struct uring *u);
+
+/* Hand the pending entries, and any a short submit left, to the kernel
+ * and wait for wait_nr completions; the number submitted, or -1 and
+ * the pending entries are dropped, the kernel never saw them */
+int uring_submit(struct uring *u, unsigned int wait_nr);
+
+/* The oldest completion, NULL when there is none */
+struct uring_cqe *uring_peek_cqe(struct uring *u);
+void uring_cqe_seen(struct uring *u);
+
+/* Queue a pwritev() of iov, which has to stay valid until completion;
+ * on -1 it was not queued */
+int uring_writev(struct uring *u, int fd, const struct iovec *iov,
+		 int iovcnt, uint64_t offset, uint64_t user_data);
+
+#endif /* INCLUDE_URING_H */
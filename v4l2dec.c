@@ -0,0 +1,1192 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Decoder library, see v4l2dec.h
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+
+#include "common.h"
+#include "hw_rot.h"
+#include "packet.h"
+#include "stream.h"
+#include "ts.h"
+#include "v4l2dec.h"
+#include "video.h"
+
+#define DBG_TAG "v4l2dec"
+
+#define VIDEO_DEVICE		"/dev/video32"
+#define WIDTH			1928
+#define HEIGHT			1208
+#define STREAM_BUFFER_SIZE	(1024 * 1024)
+#define OUTPUT_BUFFER_COUNT	4
+#define CAPTURE_BUFFER_COUNT	4
+
+/* Frames the caller holds at once by default, see v4l2dec_config */
+#define APP_FRAMES		2
+
+static const int event_type[] = {
+	V4L2_EVENT_MSM_VIDC_FLUSH_DONE,
+	V4L2_EVENT_MSM_VIDC_PORT_SETTINGS_CHANGED_SUFFICIENT,
+	V4L2_EVENT_MSM_VIDC_PORT_SETTINGS_CHANGED_INSUFFICIENT,
+	V4L2_EVENT_MSM_VIDC_SYS_ERROR,
+	V4L2_EVENT_MSM_VIDC_HW_OVERLOAD,
+	V4L2_EVENT_MSM_VIDC_HW_UNSUPPORTED,
+	V4L2_EVENT_MSM_VIDC_RELEASE_BUFFER_REFERENCE,
+	V4L2_EVENT_MSM_VIDC_RELEASE_UNQUEUED_BUFFER,
+};
+
+enum {
+	EV_VIDEO,
+	EV_SIGNAL,
+	EV_METRICS,
+	EV_ROTATOR,
+	EV_COUNT
+};
+
+struct v4l2dec {
+	struct instance i;
+	char *sink_list;	/* with --verify, ours */
+	bool video_open;
+	bool eos;		/* sent */
+
+	/* frames for v4l2dec_receive_frame() */
+	struct sink *app;
+	uint64_t received;
+
+	/* the sink fds follow the EV_COUNT ones */
+	struct pollfd pfd[EV_COUNT + SINK_MAX];
+	int ev[EV_COUNT];
+	int nfds;
+
+	AVPacket pkt;
+};
+
+/* A frame the sink keeps for the caller */
+struct app_frame {
+	struct v4l2dec_frame frame;	/* first, what the caller gets */
+	struct sink_frame *f;
+	struct list_head link;
+};
+
+struct sink_app {
+	struct list_head queue;		/* not received yet */
+};
+
+static int restart_capture(struct instance *i);
+
+static const char *colorspace_to_string(int cspace)
+{
+	switch (cspace) {
+	case MSM_VIDC_BT709_5:
+		return "bt709";
+	case MSM_VIDC_UNSPECIFIED:
+		return "unspecified";
+	case MSM_VIDC_BT470_6_M:
+		return "bt470m";
+	case MSM_VIDC_BT601_6_625:
+		return "bt601/625";
+	case MSM_VIDC_BT601_6_525:
+		return "bt601/525";
+	case MSM_VIDC_SMPTE_240M:
+		return "smpte240m";
+	case MSM_VIDC_GENERIC_FILM:
+		return "generic";
+	case MSM_VIDC_BT2020:
+		return "bt2020";
+	case MSM_VIDC_RESERVED_1:
+		return "reserved1";
+	case MSM_VIDC_RESERVED_2:
+		return "reserved2";
+	}
+	return "unknown";
+}
+
+static const char *depth_to_string(int depth)
+{
+	switch (depth) {
+	case MSM_VIDC_BIT_DEPTH_8:
+		return "8bits";
+	case MSM_VIDC_BIT_DEPTH_10:
+		return "10bits";
+	case MSM_VIDC_BIT_DEPTH_UNSUPPORTED:
+		return "unsupported";
+	}
+	return "unknown";
+}
+
+static const char *pic_struct_to_string(int pic)
+{
+	switch (pic) {
+	case MSM_VIDC_PIC_STRUCT_PROGRESSIVE:
+		return "progressive";
+	case MSM_VIDC_PIC_STRUCT_MAYBE_INTERLACED:
+		return "interlaced";
+	}
+	return "unknown";
+}
+
+static int handle_video_event(struct instance *i)
+{
+	struct v4l2_event event;
+
+	if (video_dequeue_event(i, &event))
+		return -1;
+
+	switch (event.type) {
+	case V4L2_EVENT_MSM_VIDC_PORT_SETTINGS_CHANGED_INSUFFICIENT: {
+		unsigned int *ptr = (unsigned int *)event.u.data;
+		unsigned int height = ptr[0];
+		unsigned int width = ptr[1];
+		// ptr[0] = event_notify->height;
+		// ptr[1] = event_notify->width;
+		// ptr[2] = event_notify->bit_depth;
+		// ptr[3] = event_notify->pic_struct;
+		// ptr[4] = event_notify->colour_space;
+		// ptr[5] = event_notify->crop_data.top;
+		// ptr[6] = event_notify->crop_data.left;
+		// ptr[7] = event_notify->crop_data.height;
+		// ptr[8] = event_notify->crop_data.width;
+		// ptr[9] = msm_comm_get_v4l2_profile(
+		// 	inst->fmts[OUTPUT_PORT].fourcc,
+		// 	event_notify->profile);
+		// ptr[10] = msm_comm_get_v4l2_level( // returns -22
+		// 	inst->fmts[OUTPUT_PORT].fourcc, 
+		// 	event_notify->level); 
+		// ptr[11] = event_notify->max_dpb_count;
+		// ptr[12] = event_notify->max_ref_count;
+		// ptr[13] = event_notify->max_dec_buffering;
+
+		info("Port Reconfig received insufficient, new size %ux%u",
+		     width, height);
+
+		if (i->depth != ptr[2]) {
+			i->depth = ptr[2];
+			info("  bit depth changed to %s",
+			     depth_to_string(i->depth));
+		}
+
+		info("  interlacing changed to %s",
+		     pic_struct_to_string(ptr[3]));
+		i->interlaced = ptr[3] == MSM_VIDC_PIC_STRUCT_MAYBE_INTERLACED;
+
+		info("  colorspace changed to %s",
+		     colorspace_to_string(ptr[4]));
+
+		i->width = width;
+		i->height = height;
+		i->reconfigure_pending = 1;
+		metrics_inc(&i->metrics, reconfigures, 1);
+		info("See dmesg msm_vidc for more info");
+		/* flush capture queue, we will reconfigure it when flush
+		 * done event is received */
+		video_flush(i, V4L2_QCOM_CMD_FLUSH_CAPTURE);
+		break;
+	}
+	case V4L2_EVENT_MSM_VIDC_PORT_SETTINGS_CHANGED_SUFFICIENT:
+		dbg("Setting changed sufficient");
+		break;
+	case V4L2_EVENT_MSM_VIDC_FLUSH_DONE: {
+		unsigned int *ptr = (unsigned int *)event.u.data;
+		unsigned int flags = ptr[0];
+
+		if (flags & V4L2_QCOM_CMD_FLUSH_CAPTURE)
+			dbg("Flush Done received on CAPTURE queue");
+		if (flags & V4L2_QCOM_CMD_FLUSH_OUTPUT)
+			dbg("Flush Done received on OUTPUT queue");
+
+		if (i->reconfigure_pending) {
+			dbg("Reconfiguring output");
+			restart_capture(i);
+			i->reconfigure_pending = 0;
+		}
+		break;
+	}
+	case V4L2_EVENT_MSM_VIDC_SYS_ERROR:
+		dbg("SYS Error received");
+		break;
+	case V4L2_EVENT_MSM_VIDC_HW_OVERLOAD:
+		dbg("HW Overload received");
+		metrics_inc(&i->metrics, hw_overloads, 1);
+		break;
+	case V4L2_EVENT_MSM_VIDC_HW_UNSUPPORTED:
+		dbg("HW Unsupported received");
+		break;
+	case V4L2_EVENT_MSM_VIDC_RELEASE_BUFFER_REFERENCE:
+		dbg("Release buffer reference");
+		break;
+	case V4L2_EVENT_MSM_VIDC_RELEASE_UNQUEUED_BUFFER:
+		dbg("Release unqueued buffer");
+		break;
+	default:
+		err("unknown event type occurred %x", event.type);
+		break;
+	}
+
+	return 0;
+}
+
+static void release_decoded(struct instance *i, struct sink_frame *f)
+{
+	/* the buffers were reallocated in the meantime */
+	if (f->group == i->group && !i->reconfigure_pending)
+		video_queue_buf_cap(i, f->index);
+
+	free(f);
+}
+
+/* Without the rotator the sinks get the UBWC buffer as one opaque plane,
+ * or the planes of a linear NV12 one */
+static void decoded_frame(struct instance *i, int n, struct sink_frame *f)
+{
+	struct video *vid = &i->video;
+
+	f->fourcc = vid->cap_buf_format;
+	f->width = vid->cap_w;
+	f->height = vid->cap_h;
+	f->n_planes = 1;
+	f->plane[0].addr = vid->cap_buf_addr[n];
+	f->plane[0].fd = vid->cap_buf_fd[n];
+	f->plane[0].offset = vid->cap_plane_off[0];
+	f->plane[0].stride = vid->cap_plane_stride[0];
+	f->plane[0].width = vid->cap_buf_size;
+	f->plane[0].height = 1;
+
+	if (vid->cap_buf_format == V4L2_PIX_FMT_NV12) {
+		struct sink_plane *uv = &f->plane[f->n_planes++];
+
+		f->plane[0].width = vid->cap_w;
+		f->plane[0].height = vid->cap_h;
+
+		*uv = f->plane[0];
+		uv->offset = vid->cap_plane_off[1];
+		uv->stride = vid->cap_plane_stride[1];
+		uv->height = (vid->cap_h + 1) / 2;
+		if (uv->addr)
+			uv->addr = (uint8_t *)uv->addr + uv->offset;
+	}
+	f->crop.left = vid->cap_crop.left;
+	f->crop.top = vid->cap_crop.top;
+	f->crop.width = vid->cap_crop.width;
+	f->crop.height = vid->cap_crop.height;
+
+	f->group = i->group;
+	f->index = n;
+}
+
+/* 0 when the buffer is queued again once the sinks are done with it */
+static int deliver_decoded(struct instance *i, int n, uint64_t pts)
+{
+	struct sink_frame *f;
+
+	f = calloc(1, sizeof (*f));
+	if (!f)
+		return -1;
+
+	decoded_frame(i, n, f);
+
+	f->pts = pts;
+	f->seq = i->frame_seq++;
+	f->decoded = metrics_now_us();
+	f->release = release_decoded;
+
+	sinks_deliver(i, f);
+
+	return 0;
+}
+
+static int handle_video_capture(struct instance *i)
+{
+	struct video *vid = &i->video;
+	struct timeval tv;
+	uint32_t flags;
+	uint64_t pts;
+	unsigned int bytesused;
+	struct msm_vidc_extradata_header *extradata;
+	bool busy;
+	int ret, n;
+
+	/* capture buffer is ready */
+
+	ret = video_dequeue_capture(i, &n, &bytesused, &flags, &tv, &extradata);
+	if (ret < 0) {
+		err("dequeue capture buffer fail");
+		return ret;
+	}
+
+	if (flags & V4L2_QCOM_BUF_TIMESTAMP_INVALID)
+		pts = TIMESTAMP_NONE;
+	else
+		pts = ((uint64_t)tv.tv_sec) * 1000000 + tv.tv_usec;
+
+	busy = false;
+
+	if ((bytesused == 0 && !(flags & V4L2_QCOM_BUF_FLAG_EOS)) ||
+	    (flags & (V4L2_QCOM_BUF_DROP_FRAME |
+		      V4L2_QCOM_BUF_DATA_CORRUPT)))
+		metrics_inc(&i->metrics, frames_dropped, 1);
+
+	if (bytesused > 0) {
+		struct ts_entry *l, *min = NULL;
+		int pending = 0;
+
+		vid->total_captured++;
+
+		/* PTS are expected to be monotonically increasing,
+		 * so when unknown use the lowest pending DTS */
+		list_for_each_entry(l, &vid->pending_ts_list, link) {
+			if (l->dts == TIMESTAMP_NONE)
+				continue;
+			if (min == NULL || min->dts > l->dts)
+				min = l;
+			pending++;
+		}
+
+		if (min) {
+			dbg("pending %d min pts %" PRIi64
+			    " dts %" PRIi64
+			    " duration %" PRIi64, pending,
+			    min->pts, min->dts, min->duration);
+		}
+
+		if (pts == TIMESTAMP_NONE) {
+			dbg("no pts on frame");
+			if (min && vid->pts_dts_delta != TIMESTAMP_NONE) {
+				dbg("reuse dts %" PRIu64
+				    " delta %" PRIu64,
+				    min->dts, vid->pts_dts_delta);
+				pts = min->dts + vid->pts_dts_delta;
+			}
+		}
+
+		if (pts == TIMESTAMP_NONE) {
+			if (min && vid->cap_last_pts != TIMESTAMP_NONE)
+				pts = vid->cap_last_pts + min->duration;
+			else
+				pts = 0;
+
+			dbg("guessing pts %" PRIu64, pts);
+		}
+
+		vid->cap_last_pts = pts;
+
+		metrics_frame_decoded(&i->metrics, min ? min->submitted : 0);
+
+		if (min != NULL) {
+			pts -= min->base;
+			ts_remove(min);
+		}
+
+		if (extradata && video_update_crop(i, extradata))
+			rotator_update_crop(i);
+
+		if (i->rotator_bench && !rotator_busy(i)) {
+			rotator_bench(i, vid->cap_buf_fd[n], i->rotator_bench);
+			i->rotator_bench = 0;
+		}
+
+		/*
+		 * UBWC to linear NV12 using the SDE rotator, the buffer is
+		 * queued again once the rotator has read it. Without the
+		 * rotator the sinks get the UBWC buffer itself.
+		 */
+		if (i->rotator.active) {
+			if (!rotator_submit(i, n, pts))
+				busy = true;
+		} else if (!deliver_decoded(i, n, pts)) {
+			busy = true;
+		}
+
+		i->prerolled = 1;
+
+	}
+
+	if (!busy && !i->reconfigure_pending)
+		video_queue_buf_cap(i, n);
+
+	/* everything submitted is out, frames kept can still be received */
+	if (flags & V4L2_QCOM_BUF_FLAG_EOS) {
+		info("End of stream");
+		i->finish = 1;
+	}
+
+	return 0;
+}
+
+static int handle_video_output(struct instance *i)
+{
+	struct video *vid = &i->video;
+	int ret, n;
+
+	ret = video_dequeue_output(i, &n);
+	if (ret < 0) {
+		err("dequeue output buffer fail");
+		return ret;
+	}
+
+	pthread_mutex_lock(&i->lock);
+	vid->out_buf_flag[n] = 0;
+	pthread_cond_signal(&i->cond);
+	pthread_mutex_unlock(&i->lock);
+
+	return 0;
+}
+
+static void release_converted(struct instance *i, struct sink_frame *f)
+{
+	if (f->group == i->group)
+		rotator_release(i, f->index);
+
+	free(f);
+}
+
+static void handle_rotator_consumed(struct instance *i, int dec_index)
+{
+	if (!i->reconfigure_pending)
+		video_queue_buf_cap(i, dec_index);
+}
+
+static void converted_frame(struct instance *i, int index,
+			    struct sink_frame *f)
+{
+	struct rotator *rot = &i->rotator;
+	int fd = -1;
+
+	/* post-processed frames are in malloc'ed memory */
+	if (!rot->post)
+		fd = rot->cap_buf_fd[index];
+
+	f->fourcc = rot->dst_fourcc;
+	f->width = rot->dst_w;
+	f->height = rot->dst_h;
+	f->n_planes = 1;
+	f->plane[0].addr = rot->dst_addr[index];
+	f->plane[0].fd = fd;
+	f->plane[0].stride = rot->dst_stride;
+	f->plane[0].width = rot->dst_w;
+	f->plane[0].height = rot->dst_h;
+	f->crop.width = rot->dst_w;
+	f->crop.height = rot->dst_h;
+
+	if (rot->dst_fourcc == V4L2_PIX_FMT_NV12) {
+		struct sink_plane *uv = &f->plane[f->n_planes++];
+
+		uv->addr = rot->dst_uv_addr[index];
+		uv->stride = rot->dst_stride;
+		uv->width = rot->dst_w;
+		uv->height = (rot->dst_h + 1) / 2;
+
+		if (fd >= 0 && rot->cap_planes > 1) {
+			uv->fd = rot->cap_uv_fd[index];
+		} else {
+			uv->fd = fd;
+			uv->offset = rot->dst_stride * rot->dst_scanlines;
+		}
+	}
+
+	f->group = i->group;
+	f->index = index;
+}
+
+static void handle_rotator_done(struct instance *i, int index, uint64_t pts)
+{
+	struct sink_frame *f;
+
+	log_info("Converted frame pts %lu into rotator buffer %d",
+		 (unsigned long)pts, index);
+
+	f = calloc(1, sizeof (*f));
+	if (!f) {
+		rotator_release(i, index);
+		return;
+	}
+
+	converted_frame(i, index, f);
+
+	f->pts = pts;
+	f->seq = i->frame_seq++;
+	f->decoded = i->rotator.job[index].submitted;
+	f->release = release_converted;
+
+	sinks_deliver(i, f);
+}
+
+/*
+ * Sinks set up what they need for every buffer (e.g. the wl_buffers)
+ * when the buffers change, not on the first frame of each one.
+ */
+static void announce_buffers(struct instance *i, int converted)
+{
+	struct sink_frame f[MAX(MAX_CAP_BUF, MAX_ROT_BUF)];
+	int count = converted ? i->rotator.cap_buf_cnt : i->video.cap_buf_cnt;
+
+	memset(f, 0, sizeof (f));
+
+	for (int n = 0; n < count; n++) {
+		if (converted)
+			converted_frame(i, n, &f[n]);
+		else
+			decoded_frame(i, n, &f[n]);
+	}
+
+	sinks_pool(i, f, count);
+}
+
+/* New rotator buffers, at start or when the crop changed */
+static void handle_rotator_pool(struct instance *i)
+{
+	i->group++;
+	announce_buffers(i, 1);
+}
+
+static bool rotator_disabled(struct instance *i)
+{
+	return i->rotator_name && !strcmp(i->rotator_name, "none");
+}
+
+/*
+ * The rotator is a fallback: unless one is asked for, it is not opened
+ * when every sink takes the decoder buffers as they are, like a
+ * compositor scanning out UBWC, saving a full frame pass in memory.
+ */
+static bool rotator_needed(struct instance *i)
+{
+	if (rotator_disabled(i))
+		return false;
+
+	if (i->rotator_name)
+		return true;
+
+	if (sinks_accept(i, i->video.cap_buf_format)) {
+		info("sinks take the decoder frames as they are, no rotator");
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Only the rotator can read the UBWC frames of the decoder: without one,
+ * unless every sink takes them as they are, the decoder is asked for
+ * linear NV12.  --rotator=none keeps UBWC, --rotator=sw gets linear
+ * frames to crop and scale.
+ */
+static bool capture_linear(struct instance *i)
+{
+	if (rotator_disabled(i) || i->depth == 10)
+		return false;
+
+	if (!i->rotator_name && sinks_accept(i, V4L2_PIX_FMT_NV12_UBWC))
+		return false;
+
+	return !rotator_present(i->rotator_name ? i->rotator_name :
+				ROTATOR_DEVICE);
+}
+
+static const struct rotator_cb rotator_cb = {
+	.consumed = handle_rotator_consumed,
+	.done = handle_rotator_done,
+	.pool = handle_rotator_pool,
+};
+
+static int restart_capture(struct instance *i)
+{
+	struct video *vid = &i->video;
+	int n;
+
+	/* The rotator session depends on the capture format */
+	rotator_close(i);
+
+	/* frames still kept by the sinks are from the old buffers */
+	i->group++;
+
+	/* Stop capture and release buffers */
+	if (vid->cap_buf_cnt > 0 && video_stop_capture(i))
+		return -1;
+
+	i->capture_linear = capture_linear(i);
+
+	/* Setup capture queue with new parameters */
+	if (video_setup_capture(i, 4, i->width, i->height))
+		return -1;
+
+	/* Start streaming */
+	if (video_stream(i, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE,
+			 VIDIOC_STREAMON))
+		return -1;
+
+	/* Queue all capture buffers */
+	for (n = 0; n < vid->cap_buf_cnt; n++) {
+		if (video_queue_buf_cap(i, n))
+			return -1;
+	}
+
+	if (!rotator_needed(i)) {
+		announce_buffers(i, 0);
+		return 0;
+	}
+
+	/* frames are still decoded without it, just not converted */
+	if (rotator_open(i, i->rotator_name ? i->rotator_name : ROTATOR_DEVICE,
+			 i->rotator_depth, &rotator_cb))
+		err("continuing without rotator");
+
+	return 0;
+}
+
+static int get_buffer_unlocked(struct instance *i)
+{
+	struct video *vid = &i->video;
+
+	for (int n = 0; n < vid->out_buf_cnt; n++) {
+		if (!vid->out_buf_flag[n])
+			return n;
+	}
+
+	return -1;
+}
+
+static int handle_signal(struct instance *i)
+{
+	struct signalfd_siginfo siginfo;
+	sigset_t sigmask;
+
+	if (read(i->sigfd, &siginfo, sizeof (siginfo)) < 0) {
+		perror("signalfd/read");
+		return -1;
+	}
+
+	sigemptyset(&sigmask);
+	sigaddset(&sigmask, siginfo.ssi_signo);
+	sigprocmask(SIG_UNBLOCK, &sigmask, NULL);
+
+	i->finish = 1;
+
+	return 0;
+}
+
+/*
+ * The caller's sink: frames wait in a queue for v4l2dec_receive_frame(),
+ * max_held of them at most, and go back with v4l2dec_release_frame()
+ */
+static int app_open(struct sink *s, const char *arg)
+{
+	struct sink_app *app;
+
+	app = calloc(1, sizeof (*app));
+	if (!app)
+		return -1;
+
+	INIT_LIST_HEAD(&app->queue);
+	s->priv = app;
+
+	return 0;
+}
+
+static void app_close(struct sink *s)
+{
+	struct sink_app *app = s->priv;
+	struct app_frame *af, *next;
+
+	/* frames the caller did not release are theirs to leak */
+	list_for_each_entry_safe(af, next, &app->queue, link) {
+		list_del(&af->link);
+		free(af);
+	}
+
+	free(app);
+}
+
+static int app_consume(struct sink *s, struct sink_frame *f)
+{
+	struct sink_app *app = s->priv;
+	struct v4l2dec_frame *fr;
+	struct app_frame *af;
+
+	af = calloc(1, sizeof (*af));
+	if (!af)
+		return -1;
+
+	fr = &af->frame;
+	fr->fourcc = f->fourcc;
+	fr->width = f->width;
+	fr->height = f->height;
+	fr->n_planes = MIN(f->n_planes, (int)ARRAY_LENGTH(fr->plane));
+	for (int p = 0; p < fr->n_planes; p++) {
+		fr->plane[p].addr = f->plane[p].addr;
+		fr->plane[p].fd = f->plane[p].fd;
+		fr->plane[p].offset = f->plane[p].offset;
+		fr->plane[p].stride = f->plane[p].stride;
+		fr->plane[p].width = f->plane[p].width;
+		fr->plane[p].height = f->plane[p].height;
+	}
+	fr->crop.left = f->crop.left;
+	fr->crop.top = f->crop.top;
+	fr->crop.width = f->crop.width;
+	fr->crop.height = f->crop.height;
+	fr->pts = f->pts;
+	fr->seq = f->seq;
+
+	af->f = f;
+	list_add_tail(&af->link, &app->queue);
+
+	return 1;
+}
+
+static const struct sink_ops sink_app_ops = {
+	.name = "app",
+	.open = app_open,
+	.close = app_close,
+	.consume = app_consume,
+};
+
+/* Everything session_run() did before the decoder is opened */
+static struct v4l2dec *v4l2dec_create(const struct instance *inst)
+{
+	struct v4l2dec *d;
+	struct instance *i;
+
+	d = calloc(1, sizeof (*d));
+	if (!d)
+		return NULL;
+
+	i = &d->i;
+	*i = *inst;
+
+	i->n_sinks = 0;
+	i->finish = 0;
+	pthread_mutex_init(&i->lock, NULL);
+	pthread_cond_init(&i->cond, NULL);
+	INIT_LIST_HEAD(&i->video.pending_ts_list);
+	INIT_LIST_HEAD(&i->fb_list);
+	i->video.pts_dts_delta = TIMESTAMP_NONE;
+	i->video.cap_last_pts = TIMESTAMP_NONE;
+	i->video.extradata_index = -1;
+	i->video.extradata_size = 0;
+	i->video.extradata_ion_fd = -1;
+	i->rotator.fd = -1;
+
+	av_init_packet(&d->pkt);
+
+	if (metrics_init(&i->metrics, i->metrics_shm, i->metrics_sock)) {
+		free(d);
+		return NULL;
+	}
+
+	if (i->url && stream_open(i)) {
+		err("Failed to open stream");
+		goto fail;
+	}
+
+	/* --verify is one more sink, of linear frames from the rotator or,
+	 * without one, from the decoder */
+	if (i->verify_path && rotator_disabled(i)) {
+		err("--verify needs linear frames, not --rotator=none");
+		goto fail;
+	}
+
+	if (i->verify_path) {
+		const char *sinks = i->sink_list ? i->sink_list : "null";
+		size_t size = strlen(sinks) + strlen(i->verify_path) + 9;
+
+		d->sink_list = malloc(size);
+		if (!d->sink_list)
+			goto fail;
+		snprintf(d->sink_list, size, "%s,verify:%s", sinks,
+			 i->verify_path);
+		i->sink_list = d->sink_list;
+	}
+
+	if (i->sink_list && sinks_open(i, i->sink_list))
+		goto fail;
+
+	return d;
+
+fail:
+	v4l2dec_close(d);
+	return NULL;
+}
+
+/* Streaming the OUTPUT queue and the poll set of v4l2dec_process() */
+static int v4l2dec_start(struct v4l2dec *d)
+{
+	struct instance *i = &d->i;
+	struct video *vid = &i->video;
+	struct pollfd *pfd = d->pfd;
+	int nfds = 0;
+
+	/* decode only, every latency sample for exact percentiles */
+	i->metrics.keep_samples = sinks_null(i);
+
+	if (video_open(i, vid->name))
+		return -1;
+	d->video_open = true;
+
+	for (size_t n = 0; n < ARRAY_LENGTH(event_type); n++) {
+		if (video_subscribe_event(i, event_type[n])) {
+			err("Failed to subscribe to event %d", event_type[n]);
+			return -1;
+		}
+	}
+
+	if (video_setup_output(i, i->fourcc, STREAM_BUFFER_SIZE,
+			       OUTPUT_BUFFER_COUNT)) {
+		err("Failed to setup video output");
+		return -1;
+	}
+
+	if (video_set_control(i)) {
+		err("Failed to set video control");
+		return -1;
+	}
+
+	if (video_stream(i, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE,
+			 VIDIOC_STREAMON)) {
+		err("Failed to start video output stream");
+		return -1;
+	}
+
+	if (restart_capture(i)) {
+		err("Failed to restart capture");
+		return -1;
+	}
+
+	for (int n = 0; n < EV_COUNT; n++)
+		d->ev[n] = -1;
+
+	pfd[nfds].fd = vid->fd;
+	pfd[nfds].events = POLLOUT | POLLWRNORM | POLLPRI;
+	d->ev[EV_VIDEO] = nfds++;
+
+	if (i->sigfd != -1) {
+		pfd[nfds].fd = i->sigfd;
+		pfd[nfds].events = POLLIN;
+		d->ev[EV_SIGNAL] = nfds++;
+	}
+
+	if (metrics_get_fd(&i->metrics) >= 0) {
+		pfd[nfds].fd = metrics_get_fd(&i->metrics);
+		pfd[nfds].events = POLLIN;
+		d->ev[EV_METRICS] = nfds++;
+	}
+
+	/* fd filled in while frames are in flight */
+	pfd[nfds].fd = -1;
+	pfd[nfds].events = POLLIN;
+	d->ev[EV_ROTATOR] = nfds++;
+
+	d->nfds = nfds;
+
+	info("Video stream started successfully");
+
+	return 0;
+}
+
+struct v4l2dec *v4l2dec_open_instance(const struct instance *inst)
+{
+	struct v4l2dec *d;
+
+	d = v4l2dec_create(inst);
+	if (!d)
+		return NULL;
+
+	if (v4l2dec_start(d)) {
+		v4l2dec_close(d);
+		return NULL;
+	}
+
+	return d;
+}
+
+struct v4l2dec *v4l2dec_open(const struct v4l2dec_config *cfg)
+{
+	struct instance inst;
+	struct v4l2dec *d;
+
+	memset(&inst, 0, sizeof (inst));
+
+	inst.url = (char *)cfg->url;
+	inst.fourcc = cfg->codec;
+	inst.width = cfg->width ? cfg->width : WIDTH;
+	inst.height = cfg->height ? cfg->height : HEIGHT;
+	inst.video.name = (char *)(cfg->device ? cfg->device : VIDEO_DEVICE);
+	inst.rotator_name = (char *)cfg->rotator;
+	inst.sink_list = (char *)cfg->sinks;
+	inst.sigfd = -1;
+
+	d = v4l2dec_create(&inst);
+	if (!d)
+		return NULL;
+
+	/* before the decoder starts, the first frames are the caller's too */
+	if (cfg->frames > 0) {
+		d->app = sink_attach(&d->i, &sink_app_ops, "app", NULL);
+		if (!d->app)
+			goto fail;
+		d->app->max_held = cfg->frames;
+	}
+
+	if (v4l2dec_start(d))
+		goto fail;
+
+	return d;
+
+fail:
+	v4l2dec_close(d);
+	return NULL;
+}
+
+void v4l2dec_close(struct v4l2dec *d)
+{
+	struct instance *i = &d->i;
+	struct ts_entry *l, *next;
+
+	rotator_close(i);
+	sinks_close(i);
+
+	if (d->video_open) {
+		video_stop_output(i);
+		video_stop_capture(i);
+		video_close(i);
+	}
+
+	stream_close(i);
+
+	list_for_each_entry_safe(l, next, &i->video.pending_ts_list, link)
+		ts_remove(l);
+
+	av_packet_unref(&d->pkt);
+	metrics_close(&i->metrics);
+
+	pthread_cond_destroy(&i->cond);
+	pthread_mutex_destroy(&i->lock);
+
+	free(i->pkt_dump);
+	free(d->sink_list);
+	free(d);
+}
+
+struct instance *v4l2dec_instance(struct v4l2dec *d)
+{
+	return &d->i;
+}
+
+int v4l2dec_submit(struct v4l2dec *d, const void *data, size_t size,
+		   uint64_t pts)
+{
+	struct instance *i = &d->i;
+	int buf;
+
+	/* the url feeds the decoder itself */
+	if (i->avctx || d->eos)
+		return -EINVAL;
+
+	buf = get_buffer_unlocked(i);
+	if (buf < 0)
+		return -EAGAIN;
+
+	if (!size) {
+		info("Sending EOS for buffer %d", buf);
+		d->eos = true;
+		return send_eos(i, buf);
+	}
+
+	return send_data(i, buf, data, size, pts);
+}
+
+/* Packets of the url into every free OUTPUT buffer, so the decoder
+ * never waits for the loop to go idle */
+static int feed_packets(struct v4l2dec *d)
+{
+	struct instance *i = &d->i;
+	int buf, ret;
+
+	if (!i->avctx)
+		return 0;
+
+	while (!d->eos) {
+		buf = get_buffer_unlocked(i);
+		if (buf < 0)
+			return 0;
+
+		ret = stream_read(i, &d->pkt);
+		if (ret == AVERROR(EAGAIN))
+			return 0;
+
+		if (ret < 0) {
+			if (ret == AVERROR_EOF)
+				dbg("Queue end of stream");
+			else
+				err("Parsing failed: %s", av_err2str(ret));
+			info("Sending EOS for buffer %d", buf);
+			d->eos = true;
+			return send_eos(i, buf);
+		}
+
+		ret = send_pkt(i, buf, &d->pkt);
+		av_packet_unref(&d->pkt);
+		if (ret < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+int v4l2dec_process(struct v4l2dec *d, int timeout_ms)
+{
+	struct instance *i = &d->i;
+	struct pollfd *pfd = d->pfd;
+	int *ev = d->ev;
+	int nfds = d->nfds;
+	int sink_fds, ret;
+	short revents;
+
+	if (i->finish)
+		return 1;
+
+	pfd[ev[EV_VIDEO]].events |= POLLIN | POLLRDNORM;
+
+	metrics_update(i, 0);
+
+	/* the session is recreated on reconfigure */
+	pfd[ev[EV_ROTATOR]].fd = rotator_busy(i) ? rotator_get_fd(i) : -1;
+
+	if (sinks_prepare(i))
+		return -1;
+
+	sink_fds = sinks_get_fds(i, &pfd[nfds]);
+
+	if (feed_packets(d))
+		return -1;
+
+	ret = poll(pfd, nfds + sink_fds, timeout_ms);
+	if (ret <= 0)
+		return i->finish;
+
+	for (int idx = 0; idx < nfds; idx++) {
+		revents = pfd[idx].revents;
+		if (!revents)
+			continue;
+
+		if (idx == ev[EV_VIDEO]) {
+			if (revents & (POLLIN | POLLRDNORM))
+				handle_video_capture(i);
+			if ((revents & (POLLOUT | POLLWRNORM)) &&
+			    !handle_video_output(i) && feed_packets(d))
+				return -1;
+			if (revents & POLLPRI)
+				handle_video_event(i);
+
+		} else if (idx == ev[EV_SIGNAL]) {
+			handle_signal(i);
+			return 1;
+
+		} else if (idx == ev[EV_METRICS]) {
+			metrics_handle_client(i);
+
+		} else if (idx == ev[EV_ROTATOR]) {
+			rotator_dispatch(i);
+		}
+	}
+
+	if (sinks_dispatch(i, &pfd[nfds], sink_fds))
+		return -1;
+
+	return i->finish;
+}
+
+int v4l2dec_run(struct v4l2dec *d)
+{
+	int ret;
+
+	dbg("main loop started");
+
+	while (!(ret = v4l2dec_process(d, 10)))
+		;
+
+	dbg("main loop finished");
+
+	return ret < 0 ? -1 : 0;
+}
+
+void v4l2dec_stop(struct v4l2dec *d)
+{
+	d->i.finish = 1;
+}
+
+int v4l2dec_receive_frame(struct v4l2dec *d, struct v4l2dec_frame **frame)
+{
+	struct sink_app *app;
+	struct app_frame *af;
+
+	if (!d->app)
+		return -EAGAIN;
+
+	app = d->app->priv;
+	if (list_empty(&app->queue))
+		return -EAGAIN;
+
+	af = list_first_entry(&app->queue, struct app_frame, link);
+	list_del(&af->link);
+	d->received++;
+
+	*frame = &af->frame;
+
+	return 0;
+}
+
+void v4l2dec_release_frame(struct v4l2dec *d, struct v4l2dec_frame *frame)
+{
+	struct app_frame *af = container_of(frame, struct app_frame, frame);
+
+	sink_put(d->app, af->f);
+	free(af);
+}
+
+void v4l2dec_get_stats(struct v4l2dec *d, struct v4l2dec_stats *st)
+{
+	const struct metrics_data *m = &d->i.metrics.cur;
+
+	st->frames_submitted = m->frames_submitted;
+	st->bytes_submitted = m->bytes_submitted;
+	st->frames_skipped = m->frames_skipped;
+	st->frames_decoded = m->frames_decoded;
+	st->frames_dropped = m->frames_dropped;
+	st->frames_rotated = m->frames_rotated;
+	st->frames_rot_dropped = m->frames_rot_dropped;
+	st->frames_received = d->received;
+	st->reconfigures = m->reconfigures;
+	st->fps_milli = m->fps_milli;
+	st->decode_latency_us = m->decode_latency.count ?
+		m->decode_latency.sum_us / m->decode_latency.count : 0;
+	st->decode_latency_max_us = m->decode_latency.max_us;
+}
+
+void v4l2dec_report(struct v4l2dec *d)
+{
+	metrics_update(&d->i, 1);
+	metrics_report(&d->i);
+	sinks_report(&d->i);
+}
@@ -0,0 +1,158 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Decoder library header file
+ *
+ * libv4l2dec is what v4l2_decode runs, for any program to embed: a
+ * session decodes one stream with the MSM V4L2 decoder, has the frames
+ * converted by the rotator when something needs them linear, and hands
+ * them to the caller and to the sinks it asked for (see sink.h).
+ *
+ * The packets come from a url the session demuxes itself, or are
+ * submitted by the caller one access unit at a time.  Nothing runs in
+ * the background: the thread owning the session calls v4l2dec_process()
+ * in a loop, which waits for and handles the decoder, rotator and sink
+ * events, and with a url feeds the decoder.
+ *
+ *	cfg.codec = V4L2_PIX_FMT_HEVC;
+ *	cfg.frames = 2;
+ *	d = v4l2dec_open(&cfg);
+ *
+ *	while (v4l2dec_process(d, 10) == 0) {
+ *		if (have_packet && !v4l2dec_submit(d, data, size, pts))
+ *			have_packet = 0;
+ *
+ *		while (!v4l2dec_receive_frame(d, &frame)) {
+ *			use(frame);
+ *			v4l2dec_release_frame(d, frame);
+ *		}
+ *	}
+ *
+ *	v4l2dec_close(d);
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef INCLUDE_V4L2DEC_H
+#define INCLUDE_V4L2DEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define V4L2DEC_TS_NONE		((uint64_t)-1)
+
+struct v4l2dec;
+struct instance;
+
+struct v4l2dec_config {
+	const char *url;	/* demuxed by the session, NULL to submit */
+	uint32_t codec;		/* V4L2_PIX_FMT_*, of submitted packets */
+	int width;		/* first guess for submitted packets, the */
+	int height;		/* decoder tells the real size */
+	const char *device;	/* decoder, NULL for /dev/video32 */
+	const char *rotator;	/* as --rotator, NULL for the default */
+	const char *sinks;	/* as --sink, NULL for none */
+
+	/* Frames the caller may hold at once, counting the ones not
+	 * received yet; more are dropped.  0 for none, the sinks get
+	 * them all */
+	int frames;
+};
+
+struct v4l2dec_plane {
+	void *addr;		/* CPU view */
+	int fd;			/* dmabuf, -1 for malloc'ed memory */
+	int offset;		/* of the plane in fd */
+	int stride;
+	int width;		/* bytes of a line */
+	int height;		/* lines */
+};
+
+/*
+ * Linear NV12 (or GREY, --rotator-format) out of the rotator, or the
+ * decoder buffer itself without one: NV12_UBWC, a single opaque plane
+ * whose width is the buffer size.
+ */
+struct v4l2dec_frame {
+	uint32_t fourcc;	/* V4L2_PIX_FMT_* */
+	int width;
+	int height;
+	int n_planes;
+	struct v4l2dec_plane plane[2];
+
+	/* visible part, pixels */
+	struct {
+		int left, top, width, height;
+	} crop;
+
+	uint64_t pts;		/* us, as submitted */
+	uint64_t seq;		/* frame number */
+};
+
+struct v4l2dec_stats {
+	uint64_t frames_submitted;
+	uint64_t bytes_submitted;
+	uint64_t frames_skipped;	/* --decimate */
+	uint64_t frames_decoded;
+	uint64_t frames_dropped;	/* empty or corrupted */
+	uint64_t frames_rotated;
+	uint64_t frames_rot_dropped;	/* not converted */
+	uint64_t frames_received;	/* by v4l2dec_receive_frame() */
+	uint64_t reconfigures;
+	uint32_t fps_milli;		/* decoded fps * 1000, last second */
+	uint64_t decode_latency_us;	/* submit to decoded, mean */
+	uint64_t decode_latency_max_us;
+};
+
+/* The decoder is streaming once it returns, NULL on error */
+struct v4l2dec *v4l2dec_open(const struct v4l2dec_config *cfg);
+void v4l2dec_close(struct v4l2dec *d);
+
+/*
+ * One access unit, copied at once; -EAGAIN while the decoder has no free
+ * input buffer, v4l2dec_process() gets them back.  A size of 0 ends the
+ * stream.  pts orders the pending packets, V4L2DEC_TS_NONE only when
+ * the decoder has timestamps of its own.
+ */
+int v4l2dec_submit(struct v4l2dec *d, const void *data, size_t size,
+		   uint64_t pts);
+
+/* Waits up to timeout_ms for events and handles them: 0, 1 once the
+ * session is over, -1 on error */
+int v4l2dec_process(struct v4l2dec *d, int timeout_ms);
+
+/* v4l2dec_process() until the session is over */
+int v4l2dec_run(struct v4l2dec *d);
+
+/* Ends the session, from any thread */
+void v4l2dec_stop(struct v4l2dec *d);
+
+/* The oldest frame decoded, -EAGAIN when there is none; it is the
+ * caller's until released */
+int v4l2dec_receive_frame(struct v4l2dec *d, struct v4l2dec_frame **frame);
+void v4l2dec_release_frame(struct v4l2dec *d, struct v4l2dec_frame *frame);
+
+void v4l2dec_get_stats(struct v4l2dec *d, struct v4l2dec_stats *st);
+
+/* Metrics and sinks reports, as v4l2_decode prints them */
+void v4l2dec_report(struct v4l2dec *d);
+
+/*
+ * For the tools of this tree: a session set up from a struct instance
+ * filled by parse_args() (see common.h), with every option it has.
+ */
+struct v4l2dec *v4l2dec_open_instance(const struct instance *inst);
+struct instance *v4l2dec_instance(struct v4l2dec *d);
+
+#endif /* INCLUDE_V4L2DEC_H */
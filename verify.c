@@ -0,0 +1,421 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Decoded frame verification
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/pixdesc.h>
+
+#include "common.h"
+#include "verify.h"
+
+#define DBG_TAG "verify"
+
+#define XXH_P1	0x9e3779b185ebca87ULL
+#define XXH_P2	0xc2b2ae3d27d4eb4fULL
+#define XXH_P3	0x165667b19e3779f9ULL
+#define XXH_P4	0x85ebca77c2b2ae63ULL
+#define XXH_P5	0x27d4eb2f165667c5ULL
+
+static inline uint64_t xxh_rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh_read64(const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static inline uint32_t xxh_read32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t in)
+{
+	acc += in * XXH_P2;
+	acc = xxh_rotl(acc, 31);
+	return acc * XXH_P1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t v)
+{
+	acc ^= xxh_round(0, v);
+	return acc * XXH_P1 + XXH_P4;
+}
+
+void verify_xxh64_init(struct verify_xxh64 *h)
+{
+	memset(h, 0, sizeof (*h));
+
+	h->v[0] = XXH_P1 + XXH_P2;
+	h->v[1] = XXH_P2;
+	h->v[2] = 0;
+	h->v[3] = -XXH_P1;
+}
+
+/* The four lanes are independent, the multiplies of a stripe overlap */
+static const uint8_t *xxh_stripes(uint64_t *v, const uint8_t *p,
+				  const uint8_t *end)
+{
+	uint64_t v0 = v[0], v1 = v[1], v2 = v[2], v3 = v[3];
+
+	while (p + 32 <= end) {
+		v0 = xxh_round(v0, xxh_read64(p));
+		v1 = xxh_round(v1, xxh_read64(p + 8));
+		v2 = xxh_round(v2, xxh_read64(p + 16));
+		v3 = xxh_round(v3, xxh_read64(p + 24));
+		p += 32;
+	}
+
+	v[0] = v0;
+	v[1] = v1;
+	v[2] = v2;
+	v[3] = v3;
+
+	return p;
+}
+
+void verify_xxh64_update(struct verify_xxh64 *h, const void *data,
+			 size_t size)
+{
+	const uint8_t *p = data, *end = p + size;
+
+	h->total += size;
+
+	if (h->mem_size + size < 32) {
+		memcpy(h->mem + h->mem_size, p, size);
+		h->mem_size += size;
+		return;
+	}
+
+	if (h->mem_size) {
+		unsigned int fill = 32 - h->mem_size;
+
+		memcpy(h->mem + h->mem_size, p, fill);
+		xxh_stripes(h->v, h->mem, h->mem + 32);
+		p += fill;
+		h->mem_size = 0;
+	}
+
+	p = xxh_stripes(h->v, p, end);
+
+	h->mem_size = end - p;
+	memcpy(h->mem, p, h->mem_size);
+}
+
+uint64_t verify_xxh64_digest(const struct verify_xxh64 *h)
+{
+	const uint8_t *p = h->mem, *end = p + h->mem_size;
+	uint64_t acc;
+
+	if (h->total >= 32) {
+		acc = xxh_rotl(h->v[0], 1) + xxh_rotl(h->v[1], 7) +
+			xxh_rotl(h->v[2], 12) + xxh_rotl(h->v[3], 18);
+		for (int n = 0; n < 4; n++)
+			acc = xxh_merge(acc, h->v[n]);
+	} else {
+		acc = XXH_P5;
+	}
+
+	acc += h->total;
+
+	for (; p + 8 <= end; p += 8) {
+		acc ^= xxh_round(0, xxh_read64(p));
+		acc = xxh_rotl(acc, 27) * XXH_P1 + XXH_P4;
+	}
+
+	if (p + 4 <= end) {
+		acc ^= (uint64_t)xxh_read32(p) * XXH_P1;
+		acc = xxh_rotl(acc, 23) * XXH_P2 + XXH_P3;
+		p += 4;
+	}
+
+	for (; p < end; p++) {
+		acc ^= *p * XXH_P5;
+		acc = xxh_rotl(acc, 11) * XXH_P1;
+	}
+
+	acc ^= acc >> 33;
+	acc *= XXH_P2;
+	acc ^= acc >> 29;
+	acc *= XXH_P3;
+	acc ^= acc >> 32;
+
+	return acc;
+}
+
+uint64_t verify_plane_hash(const uint8_t *data, int stride, int width,
+			   int height)
+{
+	struct verify_xxh64 h;
+
+	verify_xxh64_init(&h);
+
+	if (stride == width) {
+		verify_xxh64_update(&h, data, (size_t)width * height);
+	} else {
+		for (int y = 0; y < height; y++)
+			verify_xxh64_update(&h, data + (size_t)y * stride,
+					    width);
+	}
+
+	return verify_xxh64_digest(&h);
+}
+
+int verify_list_add(struct verify_list *l, const struct verify_frame *f)
+{
+	if (l->n == l->alloc) {
+		struct verify_frame *frames;
+		size_t alloc = l->alloc ? 2 * l->alloc : 1024;
+
+		frames = realloc(l->frames, alloc * sizeof (*frames));
+		if (!frames)
+			return -1;
+
+		l->frames = frames;
+		l->alloc = alloc;
+	}
+
+	l->frames[l->n++] = *f;
+
+	return 0;
+}
+
+int verify_list_load(struct verify_list *l, const char *path)
+{
+	char line[256];
+	int lineno = 0;
+	FILE *fp;
+
+	memset(l, 0, sizeof (*l));
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		err("failed to open %s: %m", path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof (line), fp)) {
+		struct verify_frame f;
+
+		lineno++;
+
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		if (sscanf(line, "%" SCNu64 " %dx%d %" SCNx64 " %" SCNx64,
+			   &f.seq, &f.width, &f.height,
+			   &f.plane[0], &f.plane[1]) != 5) {
+			err("%s:%d: bad line", path, lineno);
+			goto fail;
+		}
+
+		if (verify_list_add(l, &f))
+			goto fail;
+	}
+
+	fclose(fp);
+
+	return 0;
+
+fail:
+	fclose(fp);
+	verify_list_free(l);
+	return -1;
+}
+
+void verify_list_free(struct verify_list *l)
+{
+	free(l->frames);
+	memset(l, 0, sizeof (*l));
+}
+
+/* Hash a software decoded frame the way the verify sink hashes NV12 */
+static int reference_hash(AVFrame *frame, uint8_t **line,
+			  struct verify_frame *f)
+{
+	int cw = (frame->width + 1) / 2;
+	int ch = (frame->height + 1) / 2;
+	struct verify_xxh64 h;
+
+	f->width = frame->width;
+	f->height = frame->height;
+	f->plane[0] = verify_plane_hash(frame->data[0], frame->linesize[0],
+					frame->width, frame->height);
+
+	switch (frame->format) {
+	case AV_PIX_FMT_NV12:
+		f->plane[1] = verify_plane_hash(frame->data[1],
+						frame->linesize[1],
+						2 * cw, ch);
+		return 0;
+	case AV_PIX_FMT_YUV420P:
+	case AV_PIX_FMT_YUVJ420P:
+		break;
+	default:
+		err("cannot verify %s frames",
+		    av_get_pix_fmt_name(frame->format));
+		return -1;
+	}
+
+	if (!*line) {
+		*line = malloc(2 * cw);
+		if (!*line)
+			return -1;
+	}
+
+	verify_xxh64_init(&h);
+
+	for (int y = 0; y < ch; y++) {
+		const uint8_t *u = frame->data[1] + y * frame->linesize[1];
+		const uint8_t *v = frame->data[2] + y * frame->linesize[2];
+		uint8_t *d = *line;
+
+		for (int x = 0; x < cw; x++) {
+			d[2 * x] = u[x];
+			d[2 * x + 1] = v[x];
+		}
+
+		verify_xxh64_update(&h, d, 2 * cw);
+	}
+
+	f->plane[1] = verify_xxh64_digest(&h);
+
+	return 0;
+}
+
+static int reference_receive(AVCodecContext *ctx, AVFrame *frame,
+			     uint8_t **line, FILE *fp, uint64_t *seq)
+{
+	struct verify_frame f;
+	int ret;
+
+	for (;;) {
+		ret = avcodec_receive_frame(ctx, frame);
+		if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+			return 0;
+		if (ret < 0) {
+			err("software decoding failed: %s", av_err2str(ret));
+			return -1;
+		}
+
+		f.seq = (*seq)++;
+		ret = reference_hash(frame, line, &f);
+		av_frame_unref(frame);
+		if (ret)
+			return -1;
+
+		fprintf(fp, "%" PRIu64 " %dx%d %016" PRIx64 " %016" PRIx64 "\n",
+			f.seq, f.width, f.height, f.plane[0], f.plane[1]);
+	}
+}
+
+int verify_reference(struct instance *i, const char *path)
+{
+	AVCodecContext *ctx = NULL;
+	AVFrame *frame = NULL;
+	AVPacket *pkt = NULL;
+	const AVCodec *codec;
+	uint8_t *line = NULL;
+	uint64_t seq = 0, start;
+	int ret = -1, eof = 0;
+	FILE *fp;
+
+	codec = avcodec_find_decoder(i->stream->codecpar->codec_id);
+	if (!codec) {
+		err("no software decoder for %s",
+		    avcodec_get_name(i->stream->codecpar->codec_id));
+		return -1;
+	}
+
+	fp = fopen(path, "w");
+	if (!fp) {
+		err("failed to create %s: %m", path);
+		return -1;
+	}
+
+	ctx = avcodec_alloc_context3(codec);
+	frame = av_frame_alloc();
+	pkt = av_packet_alloc();
+	if (!ctx || !frame || !pkt)
+		goto out;
+
+	avcodec_parameters_to_context(ctx, i->stream->codecpar);
+	ctx->thread_count = 0;	/* one per CPU */
+
+	if (avcodec_open2(ctx, codec, NULL) < 0) {
+		err("failed to open the %s software decoder", codec->name);
+		goto out;
+	}
+
+	fprintf(fp, "# v4l2_decode --verify reference of %s\n", i->url);
+	fprintf(fp, "# frame size y uv\n");
+
+	start = metrics_now_us();
+
+	while (!eof) {
+		if (av_read_frame(i->avctx, pkt) < 0) {
+			eof = 1;
+			avcodec_send_packet(ctx, NULL);
+		} else if (pkt->stream_index != i->stream->index ||
+			   !decimate_keep(&i->decimate,
+					  i->stream->codecpar->codec_id,
+					  pkt->data, pkt->size)) {
+			/* the same access units as the hardware decoder */
+			av_packet_unref(pkt);
+			continue;
+		} else {
+			avcodec_send_packet(ctx, pkt);
+			av_packet_unref(pkt);
+		}
+
+		if (reference_receive(ctx, frame, &line, fp, &seq))
+			goto out;
+	}
+
+	if (fflush(fp)) {
+		err("failed to write %s: %m", path);
+		goto out;
+	}
+
+	info("%s: %" PRIu64 " frames decoded in %.1f s", path, seq,
+	     (metrics_now_us() - start) / 1e6);
+
+	ret = 0;
+
+out:
+	fclose(fp);
+	free(line);
+	av_packet_free(&pkt);
+	av_frame_free(&frame);
+	avcodec_free_context(&ctx);
+
+	return ret;
+}
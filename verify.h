@@ -0,0 +1,78 @@
+/*
+ * V4L2 Codec decoding example application
+ *
+ * Decoded frame verification header file
+ *
+ * --verify-reference=<list> decodes the stream with libavcodec in
+ * software and writes one line per frame with a hash of each plane:
+ *
+ *	<frame> <width>x<height> <Y hash> <UV hash>
+ *
+ * --verify=<list> hashes the frames of the hardware decoder the same way
+ * (the verify sink) and reports the first one that differs.  A plane is
+ * hashed over its visible part line by line, the UV plane as NV12
+ * whatever the software decoder output, so the lists do not depend on
+ * strides or alignment.  The hash is XXH64, hashing runs at memory
+ * speed.  Both take --decimate into account, a reference is made from
+ * the access units the hardware decoder gets.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef INCLUDE_VERIFY_H
+#define INCLUDE_VERIFY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct instance;
+
+/* Streaming XXH64 */
+struct verify_xxh64 {
+	uint64_t total;
+	uint64_t v[4];
+	uint8_t mem[32];
+	unsigned int mem_size;
+};
+
+void verify_xxh64_init(struct verify_xxh64 *h);
+void verify_xxh64_update(struct verify_xxh64 *h, const void *data,
+			 size_t size);
+uint64_t verify_xxh64_digest(const struct verify_xxh64 *h);
+
+/* Hash of height lines of width bytes */
+uint64_t verify_plane_hash(const uint8_t *data, int stride, int width,
+			   int height);
+
+struct verify_frame {
+	uint64_t seq;
+	int width;
+	int height;
+	uint64_t plane[2];	/* 0 for a missing plane */
+};
+
+struct verify_list {
+	struct verify_frame *frames;
+	size_t n;
+	size_t alloc;
+};
+
+int verify_list_load(struct verify_list *l, const char *path);
+int verify_list_add(struct verify_list *l, const struct verify_frame *f);
+void verify_list_free(struct verify_list *l);
+
+/* Software decode of the opened stream into the list at path */
+int verify_reference(struct instance *i, const char *path);
+
+#endif /* INCLUDE_VERIFY_H */
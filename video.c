@@ -218,63 +218,19 @@ static const char *extradata_interlace_color_format_to_string(unsigned int forma
 
 #undef CASE
 
-static void list_formats(struct instance *i, enum v4l2_buf_type type)
-{
-	struct v4l2_fmtdesc fdesc;
-	struct v4l2_frmsizeenum frmsize;
-
-	dbg("%s formats:", buf_type_to_string(type));
-
-	memzero(fdesc);
-	fdesc.type = type;
-
-	while (!ioctl(i->video.fd, VIDIOC_ENUM_FMT, &fdesc)) {
-		dbg("  %s", fdesc.description);
-
-		memzero(frmsize);
-		frmsize.pixel_format = fdesc.pixelformat;
-
-		while (!ioctl(i->video.fd, VIDIOC_ENUM_FRAMESIZES, &frmsize)) {
-			switch (frmsize.type) {
-			case V4L2_FRMSIZE_TYPE_DISCRETE:
-				dbg("    %dx%d",
-				    frmsize.discrete.width,
-				    frmsize.discrete.height);
-				break;
-			case V4L2_FRMSIZE_TYPE_STEPWISE:
-			case V4L2_FRMSIZE_TYPE_CONTINUOUS:
-				dbg("    %dx%d to %dx%d, step %+d%+d",
-				    frmsize.stepwise.min_width,
-				    frmsize.stepwise.min_height,
-				    frmsize.stepwise.max_width,
-				    frmsize.stepwise.max_height,
-				    frmsize.stepwise.step_width,
-				    frmsize.stepwise.step_height);
-				break;
-			}
-
-			if (frmsize.type != V4L2_FRMSIZE_TYPE_DISCRETE)
-				break;
-
-			frmsize.index++;
-		}
-
-		fdesc.index++;
-	}
-}
-
 int video_open(struct instance *i, char *name)
 {
+	struct video *vid = &i->video;
 	struct v4l2_capability cap;
 
-	i->video.fd = open(name, O_RDWR, 0);
-	if (i->video.fd < 0) {
+	vid->fd = open(name, O_RDWR, 0);
+	if (vid->fd < 0) {
 		err("Failed to open video decoder: %s", name);
 		return -1;
 	}
 
 	memzero(cap);
-	if (ioctl(i->video.fd, VIDIOC_QUERYCAP, &cap) < 0) {
+	if (ioctl(vid->fd, VIDIOC_QUERYCAP, &cap) < 0) {
 		err("Failed to verify capabilities: %m");
 		return -1;
 	}
@@ -342,15 +298,34 @@ int video_open(struct instance *i, char *name)
 		return -1;
 	}
 
-	list_formats(i, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE);
-	list_formats(i, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
+	if (!i->caps_path)
+		vid->caps_path = caps_default_path(&cap);
+	else if (strcmp(i->caps_path, "none"))
+		vid->caps_path = strdup(i->caps_path);
 
-        return 0;
+	if (vid->caps_path &&
+	    !caps_load(&vid->caps, vid->caps_path, &cap)) {
+		dbg("using cached capabilities from %s", vid->caps_path);
+	} else {
+		if (caps_probe(&vid->caps, vid->fd, &cap)) {
+			err("no formats reported by %s", name);
+			return -1;
+		}
+
+		if (vid->caps_path)
+			caps_save(&vid->caps, vid->caps_path);
+	}
+
+	caps_dump(&vid->caps);
+
+	return 0;
 }
 
 void video_close(struct instance *i)
 {
 	close(i->video.fd);
+	free(i->video.caps_path);
+	i->video.caps_path = NULL;
 }
 
 int video_set_secure(struct instance *i)
@@ -368,91 +343,139 @@ int video_set_secure(struct instance *i)
 	return 0;
 }
 
-int video_set_control(struct instance *i)
+static int video_set_ext_controls(struct instance *i,
+				  struct v4l2_ext_control *control, int count,
+				  uint32_t *error_idx)
 {
-	struct v4l2_control control = {0};
+	struct v4l2_ext_controls controls = {0};
+	int ret;
 
-	if (i->decode_order) {
-		control.id = V4L2_CID_MPEG_VIDC_VIDEO_OUTPUT_ORDER;
-		control.value = V4L2_MPEG_VIDC_VIDEO_OUTPUT_ORDER_DECODE;
+	controls.count = count;
+	controls.ctrl_class = V4L2_CTRL_CLASS_MPEG;
+	controls.controls = control;
 
-		if (ioctl(i->video.fd, VIDIOC_S_CTRL, &control) < 0) {
-			err("failed to set output order: %m");
-			return -1;
+	ret = ioctl(i->video.fd, VIDIOC_S_EXT_CTRLS, &controls);
+	*error_idx = controls.error_idx;
+
+	return ret;
+}
+
+static int video_set_controls(struct instance *i,
+			      struct v4l2_ext_control *control,
+			      const char **what, int count)
+{
+	struct video_caps *caps = &i->video.caps;
+	struct v4l2_control ctrl = {0};
+	uint32_t error_idx;
+	int error;
+
+	/* one ioctl for everything, unless the driver is known not to
+	 * support it */
+	if (caps->ext_ctrls != 0) {
+		if (!video_set_ext_controls(i, control, count, &error_idx)) {
+			if (caps->ext_ctrls < 0) {
+				caps->ext_ctrls = 1;
+				caps->dirty = 1;
+			}
+			return 0;
+		}
+
+		error = errno;
+		dbg("S_EXT_CTRLS failed (%m), falling back to S_CTRL");
+
+		/* only a missing ioctl, or a class the driver does not
+		 * take (error_idx == count), is cached; a control it
+		 * rejects or EBUSY is this call's problem */
+		if (error == ENOTTY ||
+		    (error == EINVAL && error_idx == (uint32_t)count)) {
+			caps->ext_ctrls = 0;
+			caps->dirty = 1;
 		}
 	}
 
-	if (i->skip_frames) {
-		control.id = V4L2_CID_MPEG_VIDC_VIDEO_PICTYPE_DEC_MODE;
-		control.value = V4L2_MPEG_VIDC_VIDEO_PICTYPE_DECODE_ON;
+	for (int n = 0; n < count; n++) {
+		ctrl.id = control[n].id;
+		ctrl.value = control[n].value;
 
-		if (ioctl(i->video.fd, VIDIOC_S_CTRL, &control) < 0) {
-			err("failed to set skip mode: %m");
+		if (ioctl(i->video.fd, VIDIOC_S_CTRL, &ctrl) < 0) {
+			err("failed to set %s: %m", what[n]);
 			return -1;
 		}
 	}
 
+	return 0;
+}
 
-	control.id = V4L2_CID_MPEG_VIDC_VIDEO_OPERATING_RATE;
-	control.value = INT_MAX;
+int video_set_control(struct instance *i)
+{
+	struct video *vid = &i->video;
+	struct v4l2_ext_control control[8];
+	const char *what[8];
+	struct v4l2_control ctrl = {0};
+	int count = 0;
+	int ret;
 
-	if (ioctl(i->video.fd, VIDIOC_S_CTRL, &control) < 0) {
-		err("failed to set perf level: %m");
-		return -1;
-	}
+	static const struct {
+		int value;
+		const char *what;
+	} extradata[] = {
+		{ V4L2_MPEG_VIDC_EXTRADATA_INTERLACE_VIDEO, "interlace" },
+		{ V4L2_MPEG_VIDC_EXTRADATA_OUTPUT_CROP, "output crop" },
+		{ V4L2_MPEG_VIDC_EXTRADATA_ASPECT_RATIO, "aspect ratio" },
+		{ V4L2_MPEG_VIDC_EXTRADATA_FRAME_RATE, "framerate" },
+#if 0
+		/* FIXME : Use this when QCOM has fixed the bug */
+		{ V4L2_MPEG_VIDC_EXTRADATA_DISPLAY_COLOUR_SEI,
+		  "display colour sei" },
+#endif
+	};
 
-	control.id = V4L2_CID_MPEG_VIDC_VIDEO_CONCEAL_COLOR_8BIT;
-	control.value = 0x000000ff;
+	memset(control, 0, sizeof (control));
 
-	if (ioctl(i->video.fd, VIDIOC_S_CTRL, &control) < 0) {
-		err("failed to set conceal color: %m");
-		return -1;
+	if (i->decode_order) {
+		control[count].id = V4L2_CID_MPEG_VIDC_VIDEO_OUTPUT_ORDER;
+		control[count].value = V4L2_MPEG_VIDC_VIDEO_OUTPUT_ORDER_DECODE;
+		what[count++] = "output order";
 	}
 
-	control.id = V4L2_CID_MPEG_VIDC_VIDEO_EXTRADATA;
-	control.value = V4L2_MPEG_VIDC_EXTRADATA_INTERLACE_VIDEO;
-
-	if (ioctl(i->video.fd, VIDIOC_S_CTRL, &control) < 0) {
-		err("failed to enable interlace extradata: %m");
-		return -1;
+	/* only key frames come, the decoder can skip its DPB logic too */
+	if (i->skip_frames || i->decimate.mode == DECIMATE_KEY) {
+		control[count].id = V4L2_CID_MPEG_VIDC_VIDEO_PICTYPE_DEC_MODE;
+		control[count].value = V4L2_MPEG_VIDC_VIDEO_PICTYPE_DECODE_ON;
+		what[count++] = "skip mode";
 	}
 
-	control.id = V4L2_CID_MPEG_VIDC_VIDEO_EXTRADATA;
-	control.value = V4L2_MPEG_VIDC_EXTRADATA_OUTPUT_CROP;
+	vid->operating_rate = INT_MAX;
 
-	if (ioctl(i->video.fd, VIDIOC_S_CTRL, &control) < 0) {
-		err("failed to enable output crop extradata: %m");
-		return -1;
-	}
+	control[count].id = V4L2_CID_MPEG_VIDC_VIDEO_OPERATING_RATE;
+	control[count].value = vid->operating_rate;
+	what[count++] = "perf level";
 
-	control.id = V4L2_CID_MPEG_VIDC_VIDEO_EXTRADATA;
-	control.value = V4L2_MPEG_VIDC_EXTRADATA_ASPECT_RATIO;
+	control[count].id = V4L2_CID_MPEG_VIDC_VIDEO_CONCEAL_COLOR_8BIT;
+	control[count].value = 0x000000ff;
+	what[count++] = "conceal color";
 
-	if (ioctl(i->video.fd, VIDIOC_S_CTRL, &control) < 0) {
-		err("failed to enable aspect ratio extradata: %m");
-		return -1;
-	}
+	ret = video_set_controls(i, control, what, count);
 
-	control.id = V4L2_CID_MPEG_VIDC_VIDEO_EXTRADATA;
-	control.value = V4L2_MPEG_VIDC_EXTRADATA_FRAME_RATE;
+	/*
+	 * Every extradata type is a value of the same control, so they
+	 * cannot share one S_EXT_CTRLS call.
+	 */
+	for (unsigned int n = 0; !ret && n < ARRAY_LENGTH(extradata); n++) {
+		ctrl.id = V4L2_CID_MPEG_VIDC_VIDEO_EXTRADATA;
+		ctrl.value = extradata[n].value;
 
-	if (ioctl(i->video.fd, VIDIOC_S_CTRL, &control) < 0) {
-		err("failed to enable framerate extradata: %m");
-		return -1;
+		if (ioctl(vid->fd, VIDIOC_S_CTRL, &ctrl) < 0) {
+			err("failed to enable %s extradata: %m",
+			    extradata[n].what);
+			ret = -1;
+		}
 	}
 
-#if 0
-	/* FIXME : Use this when QCOM has fixed the bug */
-	control.id = V4L2_CID_MPEG_VIDC_VIDEO_EXTRADATA;
-	control.value = V4L2_MPEG_VIDC_EXTRADATA_DISPLAY_COLOUR_SEI;
+	if (vid->caps_path)
+		caps_save(&vid->caps, vid->caps_path);
 
-	if (ioctl(i->video.fd, VIDIOC_S_CTRL, &control) < 0) {
-		err("failed to enable display colour sei extradata: %m");
-		return -1;
-	}
-#endif
-
-	return 0;
+	return ret;
 }
 
 int video_set_dpb(struct instance *i,
@@ -659,6 +682,30 @@ extradata_header_find(const struct msm_vidc_extradata_header *hdr, int type)
 	return NULL;
 }
 
+int video_update_crop(struct instance *i,
+		      const struct msm_vidc_extradata_header *hdr)
+{
+	struct video *vid = &i->video;
+	struct msm_vidc_output_crop_payload *crop;
+	struct v4l2_rect c;
+
+	crop = extradata_header_find(hdr, MSM_VIDC_EXTRADATA_OUTPUT_CROP);
+	if (!crop || !crop->display_width || !crop->display_height)
+		return 0;
+
+	c.left = crop->left;
+	c.top = crop->top;
+	c.width = crop->display_width;
+	c.height = crop->display_height;
+
+	if (!memcmp(&c, &vid->cap_crop, sizeof (c)))
+		return 0;
+
+	vid->cap_crop = c;
+
+	return 1;
+}
+
 static int video_count_capture_queued_bufs(struct video *vid)
 {
 	int cap_queued = 0;
@@ -690,6 +737,7 @@ int video_queue_buf_out(struct instance *i, int n, int length,
 	enum v4l2_buf_type type;
 	struct v4l2_buffer buf;
 	struct v4l2_plane planes[1];
+	unsigned long count;
 
 	type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
 
@@ -729,10 +777,20 @@ int video_queue_buf_out(struct instance *i, int n, int length,
 	    buf.m.planes[0].bytesused,
 	    buf.timestamp.tv_sec, buf.timestamp.tv_usec,
 	    video_count_output_queued_bufs(vid), vid->out_buf_cnt);
-	
-	static int frame_cnt = 0;
-	info("put %d compressed frames into the output queue (Contains compressed frame)", frame_cnt);
-	frame_cnt++;
+
+	count = atomic_fetch_add_explicit(&vid->out_queued_total, 1,
+					  memory_order_relaxed);
+	log_info("put %lu compressed frames into the output queue "
+		 "(Contains compressed frame)", count);
+
+	if (count == 0) {
+		struct metrics_data *m = &i->metrics.cur;
+
+		m->startup_us = metrics_now_us() - m->start_us;
+		info("time to first QBUF: %llu.%03llu ms",
+		     (unsigned long long)m->startup_us / 1000,
+		     (unsigned long long)m->startup_us % 1000);
+	}
 
 	return 0;
 }
@@ -743,6 +801,7 @@ int video_queue_buf_cap(struct instance *i, int n)
 	enum v4l2_buf_type type;
 	struct v4l2_buffer buf;
 	struct v4l2_plane planes[2];
+	unsigned long count;
 
 	type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
 
@@ -788,9 +847,11 @@ int video_queue_buf_cap(struct instance *i, int n)
 
 	dbg("%s: queued buffer %d, %d/%d queued", buf_type_to_string(buf.type),
 	    buf.index, video_count_capture_queued_bufs(vid), vid->cap_buf_cnt);
-		static int frame_cnt = 0;
-	info("put %d empty frames into the capture queue (Contains blank frames for writing)", frame_cnt);
-	frame_cnt++;
+
+	count = atomic_fetch_add_explicit(&vid->cap_queued_total, 1,
+					  memory_order_relaxed);
+	log_info("put %lu empty frames into the capture queue "
+		 "(Contains blank frames for writing)", count);
 
 	return 0;
 }
@@ -833,6 +894,7 @@ int video_dequeue_output(struct instance *i, int *n)
 
 	struct v4l2_buffer buf;
 	struct v4l2_plane planes[OUT_PLANES];
+	unsigned long count;
 	int ret;
 
 	memzero(buf);
@@ -846,9 +908,11 @@ int video_dequeue_output(struct instance *i, int *n)
 		return ret;
 
 	*n = buf.index;
-	static int frame_cnt = 0;
-	info("Dequeued %d output frames (Contains compressed frame)", frame_cnt);
-	frame_cnt++;
+
+	count = atomic_fetch_add_explicit(&i->video.out_dequeued_total, 1,
+					  memory_order_relaxed);
+	log_info("Dequeued %lu output frames (Contains compressed frame)",
+		 count);
 
 	return 0;
 }
@@ -862,6 +926,7 @@ int video_dequeue_capture(struct instance *i, int *n, unsigned int *bytesused,
 	struct v4l2_plane planes[CAP_PLANES];
 	void *extradata_addr;
 	bool extradata_valid;
+	unsigned long count;
 
 	memzero(buf);
 	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
@@ -892,9 +957,10 @@ int video_dequeue_capture(struct instance *i, int *n, unsigned int *bytesused,
 	if (extradata)
 		*extradata = extradata_valid ? extradata_addr : NULL;
 
-	static int frame_cnt = 0;
-	info("Dequeued %d Capture frames (Contains the decompressed frame)", frame_cnt);
-	frame_cnt++;
+	count = atomic_fetch_add_explicit(&vid->cap_dequeued_total, 1,
+					  memory_order_relaxed);
+	log_info("Dequeued %lu Capture frames (Contains the decompressed frame)",
+		 count);
 
 	return 0;
 }
@@ -1028,6 +1094,7 @@ int video_setup_capture(struct instance *i, int num_buffers, int w, int h)
 	enum v4l2_buf_type type;
 	struct v4l2_format fmt;
 	struct v4l2_pix_format_mplane *pix;
+	struct v4l2_crop crop;
 	struct v4l2_requestbuffers reqbuf;
 	int ion_fd;
 	uint32_t ion_flags;
@@ -1046,9 +1113,10 @@ int video_setup_capture(struct instance *i, int num_buffers, int w, int h)
 	pix->height = h;
 	pix->width = w;
 
+	/* linear when nothing could read the UBWC frames */
 	if (i->depth == 10)
 		pix->pixelformat = V4L2_PIX_FMT_NV12_TP10_UBWC;
-	else if (!i->interlaced)
+	else if (!i->interlaced && !i->capture_linear)
 		pix->pixelformat = V4L2_PIX_FMT_NV12_UBWC;
 	else
 		pix->pixelformat = V4L2_PIX_FMT_NV12;
@@ -1094,6 +1162,24 @@ int video_setup_capture(struct instance *i, int num_buffers, int w, int h)
 	vid->cap_buf_format = pix->pixelformat;
 	vid->cap_w = pix->width;
 	vid->cap_h = pix->height;
+	vid->cap_scanlines = pix->plane_fmt[0].reserved[0];
+
+	/* the visible part of the frame, the rest is alignment padding */
+	memzero(crop);
+	crop.type = type;
+
+	if (ioctl(vid->fd, VIDIOC_G_CROP, &crop) < 0 ||
+	    !crop.c.width || !crop.c.height) {
+		crop.c.left = 0;
+		crop.c.top = 0;
+		crop.c.width = vid->cap_w;
+		crop.c.height = vid->cap_h;
+	}
+
+	vid->cap_crop = crop.c;
+
+	dbg("  crop %ux%u at %d,%d", crop.c.width, crop.c.height,
+	    crop.c.left, crop.c.top);
 
 	/* MSM V4L2 driver stores video data in the first plane and extra
 	 * metadata in the second plane. */
@@ -1106,7 +1192,7 @@ int video_setup_capture(struct instance *i, int num_buffers, int w, int h)
 		vid->cap_plane_off[0] = 0;
 		vid->cap_plane_stride[0] = pix->plane_fmt[0].bytesperline;
 		/* UV plane */
-		vid->cap_plane_off[1] = pix->plane_fmt[0].reserved[0] *
+		vid->cap_plane_off[1] = vid->cap_scanlines *
 			pix->plane_fmt[0].bytesperline;
 		vid->cap_plane_stride[1] = pix->plane_fmt[0].bytesperline;
 		break;
@@ -1210,6 +1296,7 @@ int video_setup_output(struct instance *i, unsigned long codec,
 	struct v4l2_format fmt;
 	struct v4l2_pix_format_mplane *pix;
 	struct v4l2_requestbuffers reqbuf;
+	const struct video_fmt_caps *caps;
 	int ion_fd;
 	int ion_size;
 	void *buf_addr;
@@ -1217,6 +1304,24 @@ int video_setup_output(struct instance *i, unsigned long codec,
 
 	type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
 
+	caps = caps_find(&vid->caps, type, codec);
+	if (!caps) {
+		err("codec %.4s not supported by %s", (char *)&codec,
+		    vid->name);
+		return -1;
+	}
+
+	if (caps->frmsize_type && i->width && i->height &&
+	    (i->width < (int)caps->min_width ||
+	     i->width > (int)caps->max_width ||
+	     i->height < (int)caps->min_height ||
+	     i->height > (int)caps->max_height)) {
+		err("%dx%d is outside of the supported %ux%u to %ux%u",
+		    i->width, i->height, caps->min_width, caps->min_height,
+		    caps->max_width, caps->max_height);
+		return -1;
+	}
+
 	memzero(fmt);
 	fmt.type = type;
 	pix = &fmt.fmt.pix_mp;
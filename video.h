@@ -93,5 +93,10 @@ bool extradata_header_is_valid(const struct msm_vidc_extradata_header *hdr,
 void *extradata_header_find(const struct msm_vidc_extradata_header *hdr,
 			    int type);
 
+/* Take the visible rectangle from the OUTPUT_CROP extradata, returns 1
+ * if it changed */
+int video_update_crop(struct instance *i,
+		      const struct msm_vidc_extradata_header *hdr);
+
 #endif /* INCLUDE_VIDEO_H */
 